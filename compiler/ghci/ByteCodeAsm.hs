@@ -430,6 +430,13 @@ assembleI dflags i = case i of
   SWIZZLE   stkoff n       -> emit bci_SWIZZLE [SmallOp stkoff, SmallOp n]
   JMP       l              -> emit bci_JMP [LabelOp l]
   ENTER                    -> emit bci_ENTER []
+  ENTER_IC                 -> do ic <- int 0  -- the call site's cache
+                                 emit bci_ENTER_IC [Op ic]
+  PUSH_L_ENTER o1 by       -> emit bci_PUSH_L_ENTER [SmallOp o1, SmallOp by]
+  PUSH_LL_PACK o1 o2 dcon sz
+                           -> do itbl_no <- lit [BCONPtrItbl (getName dcon)]
+                                 emit bci_PUSH_LL_PACK [SmallOp o1, SmallOp o2,
+                                                        Op itbl_no, SmallOp sz]
   RETURN                   -> emit bci_RETURN []
   RETURN_UBX rep           -> emit (return_ubx rep) []
   CCALL off m_addr i       -> do np <- addr m_addr
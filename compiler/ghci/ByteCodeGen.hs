@@ -281,16 +281,16 @@ mkProtoBCO dflags nm instrs_ordlist origin arity bitmap_size bitmap is_ret ffis
         -- (hopefully rare) cases when the (overestimated) stack use
         -- exceeds iNTERP_STACK_CHECK_THRESH.
         maybe_with_stack_check
-           | is_ret && stack_usage < fromIntegral (aP_STACK_SPLIM dflags) = peep_d
+           | is_ret && stack_usage < fromIntegral (aP_STACK_SPLIM dflags) = fused_d
                 -- don't do stack checks at return points,
                 -- everything is aggregated up to the top BCO
                 -- (which must be a function).
                 -- That is, unless the stack usage is >= AP_STACK_SPLIM,
                 -- see bug #1466.
            | stack_usage >= fromIntegral iNTERP_STACK_CHECK_THRESH
-           = STKCHECK stack_usage : peep_d
+           = STKCHECK stack_usage : fused_d
            | otherwise
-           = peep_d     -- the supposedly common case
+           = fused_d    -- the supposedly common case
 
         -- We assume that this sum doesn't wrap
         stack_usage = sum (map bciStackUse peep_d)
@@ -307,6 +307,22 @@ mkProtoBCO dflags nm instrs_ordlist origin arity bitmap_size bitmap is_ret ffis
         peep []
            = []
 
+        -- Make superinstructions of the commonest sequences, see
+        -- Note [Bytecode superinstructions] in rts/Interpreter.c
+        fused_d = fuse peep_d
+
+        fuse (PUSH_L off : SLIDE 1 by : ENTER : rest)
+           = PUSH_L_ENTER off by : fuse rest
+        fuse (PUSH_L off : ENTER : rest)
+           = PUSH_L_ENTER off 0 : fuse rest
+        fuse (PUSH_LL off1 off2 : PACK dcon sz : rest)
+           | sz >= 2
+           = PUSH_LL_PACK off1 off2 dcon sz : fuse rest
+        fuse (i:rest)
+           = i : fuse rest
+        fuse []
+           = []
+
 argBits :: DynFlags -> [ArgRep] -> [Bool]
 argBits _      [] = []
 argBits dflags (rep : args)
@@ -846,7 +862,7 @@ doTailCall init_d s p fn args = do_pushes init_d args (map atomRep args)
         dflags <- getDynFlags
         ASSERT( sz == wordSize dflags ) return ()
         let slide = mkSlideB dflags (d - init_d + wordSize dflags) (init_d - s)
-        return (push_fn `appOL` (slide `appOL` unitOL ENTER))
+        return (push_fn `appOL` (slide `appOL` unitOL enter))
   do_pushes !d args reps = do
       let (push_apply, n, rest_of_reps) = findPushSeq reps
           (these_args, rest_of_args) = splitAt n args
@@ -856,6 +872,11 @@ doTailCall init_d s p fn args = do_pushes init_d args (map atomRep args)
       --                          ^^^ for the PUSH_APPLY_ instruction
       return (push_code `appOL` (push_apply `consOL` instrs))
 
+  -- A call with arguments gets an inline cache, see
+  -- Note [Interpreter inline caches] in rts/Interpreter.c
+  enter | null args = ENTER
+        | otherwise = ENTER_IC
+
   push_seq d [] = return (d, nilOL)
   push_seq d (arg:args) = do
     (push_code, sz) <- pushAtom d p arg
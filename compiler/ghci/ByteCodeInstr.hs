@@ -169,9 +169,16 @@ data BCInstr
 
    -- To Infinity And Beyond
    | ENTER
+   | ENTER_IC           -- ENTER at a call site, with an inline cache
    | RETURN             -- return a lifted value
    | RETURN_UBX ArgRep -- return an unlifted value, here's its rep
 
+   -- Superinstructions, made by the peephole pass in mkProtoBCO.
+   -- See Note [Bytecode superinstructions] in rts/Interpreter.c
+   | PUSH_L_ENTER     !Word16 !Word16 -- PUSH_L o; SLIDE 1 by; ENTER
+   | PUSH_LL_PACK     !Word16 !Word16 DataCon !Word16
+                                      -- PUSH_LL o1 o2; PACK dcon sz
+
    -- Breakpoints
    | BRK_FUN          Word16 Unique (RemotePtr CostCentre)
 
@@ -285,8 +292,13 @@ instance Outputable BCInstr where
    ppr (SWIZZLE stkoff n)    = text "SWIZZLE " <+> text "stkoff" <+> ppr stkoff
                                                <+> text "by" <+> ppr n
    ppr ENTER                 = text "ENTER"
+   ppr ENTER_IC              = text "ENTER_IC"
    ppr RETURN                = text "RETURN"
    ppr (RETURN_UBX pk)       = text "RETURN_UBX  " <+> ppr pk
+   ppr (PUSH_L_ENTER o by)   = text "PUSH_L_ENTER" <+> ppr o <+> ppr by
+   ppr (PUSH_LL_PACK o1 o2 dcon sz)
+                             = text "PUSH_LL_PACK" <+> ppr o1 <+> ppr o2
+                                               <+> ppr dcon <+> ppr sz
    ppr (BRK_FUN index uniq _cc) = text "BRK_FUN" <+> ppr index <+> ppr uniq <+> text "<cc>"
 
 -- -----------------------------------------------------------------------------
@@ -354,11 +366,14 @@ bciStackUse TESTEQ_P{}            = 0
 bciStackUse CASEFAIL{}            = 0
 bciStackUse JMP{}                 = 0
 bciStackUse ENTER{}               = 0
+bciStackUse ENTER_IC{}            = 0
 bciStackUse RETURN{}              = 0
 bciStackUse RETURN_UBX{}          = 1
 bciStackUse CCALL{}               = 0
 bciStackUse SWIZZLE{}             = 0
 bciStackUse BRK_FUN{}             = 0
+bciStackUse PUSH_L_ENTER{}        = 1 -- as PUSH_L; SLIDE; ENTER
+bciStackUse PUSH_LL_PACK{}        = 3 -- as PUSH_LL; PACK
 
 -- These insns actually reduce stack use, but we need the high-tide level,
 -- so can't use this info.  Not that it matters much.
@@ -151,6 +151,31 @@ typedef struct GCDetails_ {
   Time cpu_ns;
     // The time elapsed during GC itself
   Time elapsed_ns;
+    // Total amount of to-space scanned by all GC threads
+  uint64_t scanned_bytes;
+
+  // -----------------------------------
+  // Elapsed time spent in each phase of the GC, by the thread that
+  // initiated it.  Only collected when GC statistics are enabled.
+
+    // Scavenging the mutable lists of older generations
+  Time mut_lists_elapsed_ns;
+    // Marking roots: CAFs, capabilities, the scheduler and weak pointers
+  Time roots_elapsed_ns;
+    // Marking and updating the StablePtr and StableName tables
+  Time stable_tables_elapsed_ns;
+    // The copy loop
+  Time scavenge_elapsed_ns;
+    // Traversing the weak pointer list
+  Time weak_elapsed_ns;
+    // Pruning spark pools
+  Time sparks_elapsed_ns;
+    // Compacting or sweeping the oldest generation
+  Time mark_compact_elapsed_ns;
+    // Freeing from-space and dead large objects
+  Time tidy_elapsed_ns;
+    // In parallel GC, the max time spent in the copy loop by any one thread
+  Time par_max_scavenge_elapsed_ns;
 } GCDetails;
 
 //
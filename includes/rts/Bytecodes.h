@@ -91,6 +91,15 @@
 #define bci_BRK_FUN			66
 #define bci_TESTLT_W   			67
 #define bci_TESTEQ_W  			68
+
+/* Superinstructions: fused forms of common sequences, see
+   Note [Bytecode superinstructions] in rts/Interpreter.c */
+#define bci_PUSH_L_ENTER		69
+#define bci_PUSH_LL_PACK		70
+
+/* ENTER at a call site, with an inline cache; see
+   Note [Interpreter inline caches] in rts/Interpreter.c */
+#define bci_ENTER_IC			71
 /* If you need to go past 255 then you will run into the flags */
 
 /* If you need to go below 0x0100 then you will run into the instructions */
@@ -181,12 +181,26 @@
 
 #define EVENT_USER_BINARY_MSG              181
 
+#define EVENT_STACK_SAMPLE                 182 /* (thread, depth,
+                                                   return_addr*) */
+#define EVENT_GC_PHASES                    183 /* (heap_capset, generation,
+                                                   phase_ns*) */
+#define EVENT_GC_THREAD_WORK               184 /* (gc_thread, copied_bytes,
+                                                   scanned_bytes, any_work,
+                                                   no_work, scav_find_work,
+                                                   scavenge_ns) */
+#define EVENT_ALLOC_SAMPLE                 185 /* (thread, weight_bytes,
+                                                   return_addr, info_ptr) */
+#define EVENT_FINALIZER_BACKLOG            186 /* (c_finalizers,
+                                                   haskell_finalizers,
+                                                   haskell_threads) */
+
 /*
  * The highest event code +1 that ghc itself emits. Note that some event
  * ranges higher than this are reserved but not currently emitted by ghc.
  * This must match the size of the EventDesc[] array in EventLog.c
  */
-#define NUM_GHC_EVENT_TAGS        182
+#define NUM_GHC_EVENT_TAGS        187
 
 #if 0  /* DEPRECATED EVENTS: */
 /* we don't actually need to record the thread, it's implicit */
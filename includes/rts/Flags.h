@@ -144,6 +144,7 @@ typedef struct _PROFILING_FLAGS {
     bool		showCCSOnException;
 
     uint32_t    maxRetainerSetSize;
+    uint32_t    maxRetainerSets;    /* 0 == unlimited */
 
     uint32_t    ccsLength;
 
@@ -170,8 +171,16 @@ typedef struct _TRACE_FLAGS {
     bool sparks_sampled; /* trace spark events by a sampled method */
     bool sparks_full;    /* trace spark events 100% accurately */
     bool user;           /* trace user events (emitted from Haskell code) */
+    bool stack_samples;  /* sample the stacks of running threads */
+    uint32_t stackSampleDepth; /* frames recorded per stack sample */
+    bool alloc_samples;  /* sample allocation sites */
+    StgWord64 allocSampleInterval; /* bytes allocated between samples */
 } TRACE_FLAGS;
 
+/* An upper bound on stackSampleDepth, keeps a sample well within
+ * EVENT_PAYLOAD_SIZE_MAX */
+#define STACK_SAMPLE_MAX_DEPTH 1024
+
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _CONCURRENT_FLAGS {
     Time ctxtSwitchTime;         /* units: TIME_RESOLUTION */
@@ -198,6 +207,20 @@ typedef struct _MISC_FLAGS {
     bool internalCounters;       /* See Note [Internal Counter Stats] */
     StgWord linkerMemBase;       /* address to ask the OS for memory
                                   * for the linker, NULL ==> off */
+    bool linkerLazy;             /* resolve objects and sections on demand */
+    bool linkerStats;            /* report time spent in the linker */
+    uint32_t linkerThreads;      /* OS threads to link with, 0 ==> one
+                                  * per processor */
+    uint32_t compactThreads;     /* OS threads to copy into compact
+                                  * regions with, 0 ==> one per processor */
+    bool compactForwarding;      /* preserve sharing in compact regions
+                                  * with forwarding pointers */
+    uint32_t finalizerThreads;   /* OS threads to run C finalizers on,
+                                  * 0 ==> on idle capabilities */
+    const char* linkerIndexDir;  /* where to keep archive symbol indices,
+                                  * NULL ==> off */
+    bool tickless;               /* stop the ticker when no capability
+                                  * needs to context switch */
 } MISC_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -207,6 +207,16 @@ void             freeExec (AdjustorExecutable p);
 // Used by GC checks in external .cmm code:
 extern W_ large_alloc_lim;
 
+/* Compact regions in files (see Note [Compact files] in rts/sm/CNF.c).
+   compactWriteFile returns -1 and sets errno on failure.  compactMapFile
+   returns the first block of a compact to pass to compactFixupPointers#,
+   or NULL with errno set (to 0 if the file is not a compact written by this
+   program).  It needs no capability, so it may be called from a safe
+   foreign call. */
+int compactWriteFile (StgCompactNFDataBlock *first, StgClosure *root,
+                      const char *path);
+StgCompactNFDataBlock *compactMapFile (const char *path, StgClosure **root);
+
 /* -----------------------------------------------------------------------------
    Performing Garbage Collection
    -------------------------------------------------------------------------- */
@@ -19,6 +19,7 @@ extern void * getMBlock(void);
 extern void * getMBlocks(uint32_t n);
 extern void * getMBlockOnNode(uint32_t node);
 extern void * getMBlocksOnNode(uint32_t node, uint32_t n);
+extern void * claimMBlocksAt(void *addr, uint32_t n);
 extern void freeMBlocks(void *addr, uint32_t n);
 extern void releaseFreeMemory(void);
 extern void freeAllMBlocks(void);
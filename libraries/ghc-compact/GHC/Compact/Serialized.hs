@@ -24,6 +24,8 @@ module GHC.Compact.Serialized(
   withSerializedCompact,
   importCompact,
   importCompactByteStrings,
+  writeCompactFile,
+  mapCompactFile,
 ) where
 
 import GHC.Prim
@@ -36,8 +38,15 @@ import Control.Concurrent
 import qualified Data.ByteString as ByteString
 import Data.ByteString.Internal(toForeignPtr)
 import Data.IORef(newIORef, readIORef, writeIORef)
+import Foreign.C.Error(eOK, getErrno, throwErrnoPath,
+                       throwErrnoPathIfMinus1_)
+import Foreign.C.String(CString)
+import Foreign.C.Types(CInt(..))
 import Foreign.ForeignPtr(withForeignPtr)
+import Foreign.Marshal.Alloc(alloca)
 import Foreign.Marshal.Utils(copyBytes)
+import Foreign.Storable(peek)
+import System.Posix.Internals(withFilePath)
 
 import GHC.Compact
 
@@ -208,3 +217,45 @@ importCompactByteStrings serialized stringList =
             copyBytes to (from `plusPtr` off) (fromIntegral size)
           writeIORef state rest
     importCompact serialized filler
+
+foreign import ccall safe "compactWriteFile"
+  c_compactWriteFile :: Ptr a -> Ptr a -> CString -> IO CInt
+
+-- A safe call: if the file cannot be mapped, it is read into memory,
+-- which should not hold up the other threads or the GC.
+foreign import ccall safe "compactMapFile"
+  c_compactMapFile :: CString -> Ptr (Ptr a) -> IO (Ptr a)
+
+-- | Write a 'Compact' to a file, in a form that 'mapCompactFile' can map
+-- straight back into memory. The file can only be read by the same
+-- program binary that wrote it.
+writeCompactFile :: Compact a -> FilePath -> IO ()
+writeCompactFile c path =
+  withSerializedCompact c $ \(SerializedCompact blocks root) ->
+  withFilePath path $ \cpath ->
+    case blocks of
+      [] -> return ()  -- a compact always has a block
+      ((first, _):_) ->
+        throwErrnoPathIfMinus1_ "writeCompactFile" path
+          (c_compactWriteFile first root cpath)
+
+-- | Map a compact region written by 'writeCompactFile' into memory. When
+-- it can, the runtime maps the file where its pointers expect it to be,
+-- so that no pointers need adjusting and pages are only read from the
+-- file when they are used; otherwise the file is read into memory as
+-- 'importCompact' would. Returns 'Nothing' if the file is not a compact
+-- region written by this program, and throws an 'IOError' if it cannot be
+-- read.
+mapCompactFile :: FilePath -> IO (Maybe (Compact a))
+mapCompactFile path =
+  withFilePath path $ \cpath ->
+  alloca $ \rootp -> do
+    Ptr first <- c_compactMapFile cpath rootp
+    if addrIsNull first
+      then do
+        errno <- getErrno
+        if errno == eOK then return Nothing
+          else throwErrnoPath "mapCompactFile" path
+      else do
+        Ptr root <- peek rootp
+        IO (fixupPointers first root)
@@ -0,0 +1,59 @@
+module Main where
+
+import Control.Exception
+import System.Directory
+import System.Mem
+import qualified Data.Array.Unboxed as U
+
+import GHC.Compact
+import GHC.Compact.Serialized
+
+assertFail :: String -> IO ()
+assertFail msg = throwIO $ AssertionFailed msg
+
+assertEquals :: (Eq a, Show a) => a -> a -> IO ()
+assertEquals expected actual =
+  if expected == actual then return ()
+  else assertFail $ "expected " ++ (show expected)
+       ++ ", got " ++ (show actual)
+
+main :: IO ()
+main = do
+  let val = ("hello", [1..20000], 42, Just 42) ::
+        (String, [Int], Integer, Maybe Int)
+      file = "compact_file.cnf"
+
+  -- small blocks, so that the file packs several into each megablock
+  cnf <- compactSized 4096 True val
+  writeCompactFile cnf file
+  performMajorGC
+
+  -- map it twice: the second copy can't go where the first one is
+  Just a <- mapCompactFile file
+  Just b <- mapCompactFile file
+  performMajorGC
+  assertEquals val (getCompact a)
+  assertEquals val (getCompact b)
+
+  -- the mapped compacts can be added to
+  c <- compactAdd a (Just "more")
+  assertEquals (Just "more") (getCompact c)
+  performMajorGC
+
+  -- an array bigger than a megablock needs a group of several
+  let arr = U.listArray (1, 500000) [1..] :: U.UArray Int Int
+  big <- compact arr
+  writeCompactFile big file
+  Just d <- mapCompactFile file
+  Just e <- mapCompactFile file
+  performMajorGC
+  assertEquals (sum (U.elems arr)) (sum (U.elems (getCompact d)))
+  assertEquals arr (getCompact e)
+
+  writeFile file "not a compact"
+  r <- mapCompactFile file :: IO (Maybe (Compact Int))
+  case r of
+    Nothing -> return ()
+    Just _ -> assertFail "mapped a text file"
+  removeFile file
+  putStrLn "ok"
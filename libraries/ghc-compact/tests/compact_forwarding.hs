@@ -0,0 +1,18 @@
+import Control.Exception
+import GHC.Compact
+import qualified Data.Map as Map
+
+main = do
+  let m = Map.fromList [(x,show x) | x <- [1..(10000::Integer)]]
+      xs = cycle "abc"
+  -- fully evaluated, so sharing is preserved by forwarding
+  _ <- evaluate (length (show m))
+  _ <- evaluate (length (take 4 xs))
+  c <- compactWithSharing (m,m)
+  print (getCompact c == (m,m))
+  s1 <- compactSize c
+  c <- compact (m,m)
+  s2 <- compactSize c
+  print (s1 < s2)
+  c <- compactWithSharing xs
+  print (take 10 (getCompact c))
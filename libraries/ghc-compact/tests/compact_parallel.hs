@@ -0,0 +1,18 @@
+import Control.Exception
+import GHC.Compact
+import qualified Data.Map as Map
+
+main = do
+  let m1 = Map.fromList [(x,show x) | x <- [1..(100000::Integer)]]
+      m2 = Map.fromList [(x,y) | x <- [1..(100000::Integer)],
+                                 Just y <- [Map.lookup x m1]]
+  -- fully evaluated, so copied in parallel
+  _ <- evaluate (length (show (m1,m2)))
+  c <- compact (m1,m2)
+  print (getCompact c == (m1,m2))
+  c <- compactWithSharing (m1,m2)
+  print (getCompact c == (m1,m2))
+  -- contains a thunk, so copied by the sequential code
+  let m3 = Map.insert 0 (show (0::Int)) m1
+  c <- compact m3
+  print (Map.size (getCompact c))
@@ -214,6 +214,8 @@ newReturningTask (Capability *cap, Task *task)
     cap->returning_tasks_tl = task;
     cap->n_returning_tasks++;
     ASSERT_RETURNING_TASKS(cap,task);
+    // the thread running on cap must be preempted to let the task in
+    tickerWanted();
 }
 
 STATIC_INLINE Task *
@@ -266,6 +268,8 @@ initCapability (Capability *cap, uint32_t i)
     cap->returning_tasks_tl = NULL;
     cap->n_returning_tasks  = 0;
     cap->inbox              = (Message*)END_TSO_QUEUE;
+    cap->outbox             = (Message*)END_TSO_QUEUE;
+    cap->n_outbox           = 0;
     cap->putMVars           = NULL;
     cap->sparks             = allocSparkPool();
     cap->spark_stats.created    = 0;
@@ -274,11 +278,24 @@ initCapability (Capability *cap, uint32_t i)
     cap->spark_stats.converted  = 0;
     cap->spark_stats.gcd        = 0;
     cap->spark_stats.fizzled    = 0;
+    cap->n_free_stable_ptrs     = 0;
+    cap->writing_stable_ptrs    = 0;
+    for (g = 0; g < EXEC_SLAB_CLASSES; g++) {
+        cap->free_execs[g]      = NULL;
+        cap->n_free_execs[g]    = 0;
+    }
 #if !defined(mingw32_HOST_OS)
     cap->io_manager_control_wr_fd = -1;
 #endif
 #endif
     cap->total_allocated        = 0;
+    cap->alloc_sample_at        = ~(W_)0;
+#if defined(TRACING)
+    if (RtsFlags.TraceFlags.alloc_samples) {
+        cap->alloc_sample_at =
+            RtsFlags.TraceFlags.allocSampleInterval / sizeof(W_);
+    }
+#endif
 
     cap->f.stgEagerBlackholeInfo = (W_)&__stg_EAGER_BLACKHOLE_info;
     cap->f.stgGCEnter1     = (StgFunPtr)__stg_gc_enter_1;
@@ -302,6 +319,9 @@ initCapability (Capability *cap, uint32_t i)
     cap->free_trec_headers = NO_TREC;
     cap->transaction_tokens = 0;
     cap->context_switch = 0;
+    cap->stack_sample = 0;
+    cap->ticks_to_ctxt_switch = RtsFlags.ConcFlags.ctxtSwitchTicks;
+    cap->n_free_stable_names = 0;
     cap->pinned_object_block = NULL;
     cap->pinned_object_blocks = NULL;
 
@@ -1172,6 +1192,7 @@ markCapability (evac_fn evac, void *user, Capability *cap,
     evac(user, (StgClosure **)(void *)&cap->run_queue_tl);
 #if defined(THREADED_RTS)
     evac(user, (StgClosure **)(void *)&cap->inbox);
+    evac(user, (StgClosure **)(void *)&cap->outbox);
 #endif
     for (incall = cap->suspended_ccalls; incall != NULL;
          incall=incall->next) {
@@ -26,6 +26,15 @@
 
 #include "BeginPrivate.h"
 
+// Number of free stable name table entries a Capability reserves at a time
+#define STABLE_NAME_BATCH 32
+
+// Number of free stable pointer table entries a Capability may cache
+#define STABLE_PTR_CACHE_SIZE 64
+
+// Number of size classes of adjustor stubs, see sm/ExecSlab.c
+#define EXEC_SLAB_CLASSES 3
+
 struct Capability_ {
     // State required by the STG virtual machine when running Haskell
     // code.  During STG execution, the BaseReg register always points
@@ -108,10 +117,33 @@ struct Capability_ {
     // reset after we have executed the context switch.
     int interrupt;
 
+    // Stack sample flag.  Set by the timer when stack sampling is on
+    // (+RTS -lc), together with stopping the Capability; the scheduler
+    // records a sample of the running thread's stack when it returns.
+    // See Note [Stack sampling] in Trace.c.
+    int stack_sample;
+
+    // Ticks left before this Capability's next pre-emptive context
+    // switch, counted down only while it has other threads waiting to
+    // run (+RTS --tickless).  See Note [Tickless mode] in Timer.c.
+    int ticks_to_ctxt_switch;
+
     // Total words allocated by this cap since rts start
     // See Note [allocation accounting] in Storage.c
     W_ total_allocated;
 
+    // When total_allocated reaches this many words, the thread stops at
+    // its next nursery block boundary and we take an allocation sample.
+    // ~0 if allocation sampling (+RTS -lm) is off.  See Note
+    // [Allocation sampling] in Trace.c.
+    W_ alloc_sample_at;
+
+    // Free stable name table entries reserved for this Capability, so
+    // that making a new StableName does not need stable_name_mutex.  See
+    // Note [Concurrent stable names] in StableName.c.
+    uint32_t n_free_stable_names;
+    StgWord free_stable_names[STABLE_NAME_BATCH];
+
 #if defined(THREADED_RTS)
     // Worker Tasks waiting in the wings.  Singly-linked.
     Task *spare_workers;
@@ -138,12 +170,30 @@ struct Capability_ {
     // Locks required: cap->lock
     Message *inbox;
 
+    // MSG_THROWTO messages for other Capabilities waiting to be sent
+    // as a batch, or END_TSO_QUEUE.  Only the running task touches
+    // these; see Note [Batched throwTo] in RaiseAsync.c.
+    Message *outbox;
+    uint32_t n_outbox;
+
     // putMVars are really messages, but they're allocated with malloc() so they
     // can't go on the inbox queue: the GC would get confused.
     struct PutMVar_ *putMVars;
 
     SparkPool *sparks;
 
+    // Free stable pointer table entries cached by this Capability, and a
+    // flag that is set while it writes to the table without the lock.
+    // See Note [Per-capability stable pointers] in StablePtr.c.
+    uint32_t n_free_stable_ptrs;
+    StgWord free_stable_ptrs[STABLE_PTR_CACHE_SIZE];
+    volatile StgWord writing_stable_ptrs;
+
+    // Free adjustor stubs cached by this Capability, one list per size
+    // class.  See Note [Adjustor slabs] in sm/ExecSlab.c.
+    void *free_execs[EXEC_SLAB_CLASSES];
+    uint32_t n_free_execs[EXEC_SLAB_CLASSES];
+
     // Stats on spark creation/conversion
     SparkCounters spark_stats;
 #if !defined(mingw32_HOST_OS)
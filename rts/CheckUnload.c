@@ -12,7 +12,6 @@
 #include "Rts.h"
 
 #include "RtsUtils.h"
-#include "Hash.h"
 #include "LinkerInternals.h"
 #include "CheckUnload.h"
 #include "sm/Storage.h"
@@ -31,49 +30,145 @@
 // traversal: we look at the header of every object, but not its
 // contents.
 //
-// On the assumption that there aren't many different info pointers in
-// a typical heap, we insert addresses into a hash table.  The
-// first time we see an address, we check it against the pending
-// unloadable objects and if it lies within any of them, we mark that
-// object as referenced so that it won't get unloaded in this round.
+// The sections of the objects waiting to be unloaded are kept in an
+// array sorted by address (the "unload index"), which is updated as
+// objects are unloaded by unloadObj() and freed here, rather than
+// rebuilt for every check.  Looking up an address is a binary search,
+// and most addresses are rejected by checking that they are outside the
+// span of the whole index.  The first time an address falls inside an
+// object, we mark the object as referenced so that it won't get
+// unloaded in this round.  Once every object is marked we know the
+// answer, so we stop traversing the heap.
 //
 
-static void checkAddress (HashTable *addrs, const void *addr)
-{
+typedef struct {
+    W_ start;
+    W_ end;
     ObjectCode *oc;
+} SectionRange;
+
+// The unload index; only touched with linker_unloaded_mutex held
+static SectionRange *ranges = NULL;
+static uint32_t n_ranges = 0;
+static uint32_t max_ranges = 0;
+static bool ranges_sorted = true;
+static W_ ranges_start, ranges_end;
+
+// Unloaded objects not yet known to be referenced, in this check
+static uint32_t n_unreferenced;
+
+//
+// Add the sections of an object that has just been put on
+// unloaded_objects to the unload index.  Called with
+// linker_unloaded_mutex held.
+//
+void indexUnloadedObject (ObjectCode *oc)
+{
     int i;
 
-    if (!lookupHashTable(addrs, (W_)addr)) {
-        insertHashTable(addrs, (W_)addr, addr);
-
-        for (oc = unloaded_objects; oc; oc = oc->next) {
-            for (i = 0; i < oc->n_sections; i++) {
-                if (oc->sections[i].kind != SECTIONKIND_OTHER) {
-                    if ((W_)addr >= (W_)oc->sections[i].start &&
-                        (W_)addr <  (W_)oc->sections[i].start
-                                    + oc->sections[i].size) {
-                        oc->referenced = 1;
-                        return;
-                    }
-                }
-            }
+    for (i = 0; i < oc->n_sections; i++) {
+        Section *s = &oc->sections[i];
+        if (s->kind == SECTIONKIND_OTHER || s->size == 0) {
+            continue;
         }
+        if (n_ranges == max_ranges) {
+            max_ranges = max_ranges ? max_ranges * 2 : 64;
+            ranges = stgReallocBytes(ranges, max_ranges * sizeof(SectionRange),
+                                     "indexUnloadedObject");
+        }
+        ranges[n_ranges].start = (W_)s->start;
+        ranges[n_ranges].end   = (W_)s->start + s->size;
+        ranges[n_ranges].oc    = oc;
+        n_ranges++;
+        ranges_sorted = false;
     }
 }
 
-static void searchStackChunk (HashTable *addrs, StgPtr sp, StgPtr stack_end)
+static int compareSectionRanges (const void *a, const void *b)
+{
+    W_ x = ((const SectionRange *)a)->start;
+    W_ y = ((const SectionRange *)b)->start;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void sortUnloadIndex (void)
+{
+    uint32_t i;
+
+    if (!ranges_sorted) {
+        qsort(ranges, n_ranges, sizeof(SectionRange), compareSectionRanges);
+        ranges_sorted = true;
+    }
+    ranges_start = n_ranges > 0 ? ranges[0].start : 0;
+    ranges_end = 0;
+    for (i = 0; i < n_ranges; i++) {
+        ranges_end = stg_max(ranges_end, ranges[i].end);
+    }
+}
+
+// Drop the sections of the objects that are about to be freed
+static void pruneUnloadIndex (void)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < n_ranges; i++) {
+        if (ranges[i].oc->referenced) {
+            ranges[n++] = ranges[i];
+        }
+    }
+    n_ranges = n;
+    if (n_ranges == 0) {
+        stgFree(ranges);
+        ranges = NULL;
+        max_ranges = 0;
+    }
+}
+
+static void checkAddress (const void *addr)
+{
+    W_ a = (W_)addr;
+    uint32_t lo, hi, mid;
+    ObjectCode *oc;
+
+    if (a < ranges_start || a >= ranges_end) {
+        return;
+    }
+
+    // find the last section starting at or below addr; sections don't
+    // overlap, so it is the only one that can contain it
+    lo = 0;
+    hi = n_ranges;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (ranges[mid].start <= a) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (a < ranges[lo].end) {
+        oc = ranges[lo].oc;
+        if (!oc->referenced) {
+            oc->referenced = 1;
+            n_unreferenced--;
+        }
+    }
+}
+
+static void searchStackChunk (StgPtr sp, StgPtr stack_end)
 {
     StgPtr p;
     const StgRetInfoTable *info;
 
     p = sp;
-    while (p < stack_end) {
+    while (p < stack_end && n_unreferenced > 0) {
         info = get_ret_itbl((StgClosure *)p);
 
         switch (info->i.type) {
         case RET_SMALL:
         case RET_BIG:
-            checkAddress(addrs, (const void*)info);
+            checkAddress((const void*)info);
             break;
 
         default:
@@ -85,14 +180,14 @@ static void searchStackChunk (HashTable *addrs, StgPtr sp, StgPtr stack_end)
 }
 
 
-static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
+static void searchHeapBlocks (bdescr *bd)
 {
     StgPtr p;
     const StgInfoTable *info;
     uint32_t size;
     bool prim;
 
-    for (; bd != NULL; bd = bd->link) {
+    for (; bd != NULL && n_unreferenced > 0; bd = bd->link) {
 
         if (bd->flags & BF_PINNED) {
             // Assume that objects in PINNED blocks cannot refer to
@@ -188,7 +283,7 @@ static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
                 StgAP_STACK *ap = (StgAP_STACK *)p;
                 prim = true;
                 size = ap_stack_sizeW(ap);
-                searchStackChunk(addrs, (StgPtr)ap->payload,
+                searchStackChunk((StgPtr)ap->payload,
                                  (StgPtr)ap->payload + ap->size);
                 break;
             }
@@ -222,7 +317,7 @@ static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
             case STACK: {
                 StgStack *stack = (StgStack*)p;
                 prim = true;
-                searchStackChunk(addrs, stack->sp,
+                searchStackChunk(stack->sp,
                                  stack->stack + stack->stack_size);
                 size = stack_sizeW(stack);
                 break;
@@ -238,7 +333,7 @@ static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
             }
 
             if (!prim) {
-                checkAddress(addrs,info);
+                checkAddress(info);
             }
 
             p += size;
@@ -251,15 +346,15 @@ static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
 // Do not unload the object if the CCS tree refers to a CCS or CC which
 // originates in the object.
 //
-static void searchCostCentres (HashTable *addrs, CostCentreStack *ccs)
+static void searchCostCentres (CostCentreStack *ccs)
 {
     IndexTable *i;
 
-    checkAddress(addrs, ccs);
-    checkAddress(addrs, ccs->cc);
+    checkAddress(ccs);
+    checkAddress(ccs->cc);
     for (i = ccs->indexTable; i != NULL; i = i->next) {
         if (!i->back_edge) {
-            searchCostCentres(addrs, i->ccs);
+            searchCostCentres(i->ccs);
         }
     }
 }
@@ -273,11 +368,11 @@ static void searchCostCentres (HashTable *addrs, CostCentreStack *ccs)
 // The check involves a complete heap traversal, but you only pay for
 // this (a) when you have called unloadObj(), and (b) at a major GC,
 // which is much more expensive than the traversal we're doing here.
+// The traversal stops as soon as every object is known to be referenced.
 //
 void checkUnload (StgClosure *static_objects)
 {
   uint32_t g, n;
-  HashTable *addrs;
   StgClosure* p;
   const StgInfoTable *info;
   ObjectCode *oc, *prev, *next;
@@ -289,52 +384,63 @@ void checkUnload (StgClosure *static_objects)
   ACQUIRE_LOCK(&linker_unloaded_mutex);
 
   // Mark every unloadable object as unreferenced initially
+  n_unreferenced = 0;
   for (oc = unloaded_objects; oc; oc = oc->next) {
       IF_DEBUG(linker, debugBelch("Checking whether to unload %" PATH_FMT "\n",
                                   oc->fileName));
       oc->referenced = false;
+      n_unreferenced++;
   }
 
-  addrs = allocHashTable();
+  sortUnloadIndex();
+
+  // An object with no sections in the index can't be referenced, so if
+  // there are none we needn't look at the heap at all.
+  if (n_ranges == 0) goto done;
 
-  for (p = static_objects; p != END_OF_STATIC_OBJECT_LIST; p = link) {
+  for (p = static_objects;
+       p != END_OF_STATIC_OBJECT_LIST && n_unreferenced > 0;
+       p = link) {
       p = UNTAG_STATIC_LIST_PTR(p);
-      checkAddress(addrs, p);
+      checkAddress(p);
       info = get_itbl(p);
       link = *STATIC_LINK(info, p);
   }
 
   // CAFs on revertible_caf_list are not on static_objects
   for (p = (StgClosure*)revertible_caf_list;
-       p != END_OF_CAF_LIST;
+       p != END_OF_CAF_LIST && n_unreferenced > 0;
        p = ((StgIndStatic *)p)->static_link) {
       p = UNTAG_STATIC_LIST_PTR(p);
-      checkAddress(addrs, p);
+      checkAddress(p);
   }
 
   for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
-      searchHeapBlocks (addrs, generations[g].blocks);
-      searchHeapBlocks (addrs, generations[g].large_objects);
+      searchHeapBlocks (generations[g].blocks);
+      searchHeapBlocks (generations[g].large_objects);
 
       for (n = 0; n < n_capabilities; n++) {
           ws = &gc_threads[n]->gens[g];
-          searchHeapBlocks(addrs, ws->todo_bd);
-          searchHeapBlocks(addrs, ws->part_list);
-          searchHeapBlocks(addrs, ws->scavd_list);
+          searchHeapBlocks(ws->todo_bd);
+          searchHeapBlocks(ws->part_list);
+          searchHeapBlocks(ws->scavd_list);
       }
   }
 
 #if defined(PROFILING)
   /* Traverse the cost centre tree, calling checkAddress on each CCS/CC */
-  searchCostCentres(addrs, CCS_MAIN);
+  searchCostCentres(CCS_MAIN);
 
   /* Also check each cost centre in the CC_LIST */
   CostCentre *cc;
   for (cc = CC_LIST; cc != NULL; cc = cc->link) {
-      checkAddress(addrs, cc);
+      checkAddress(cc);
   }
 #endif /* PROFILING */
 
+done:
+  pruneUnloadIndex();
+
   // Look through the unloadable objects, and any object that is still
   // marked as unreferenced can be physically unloaded, because we
   // have no references to it.
@@ -357,7 +463,5 @@ void checkUnload (StgClosure *static_objects)
       }
   }
 
-  freeHashTable(addrs, NULL);
-
   RELEASE_LOCK(&linker_unloaded_mutex);
 }
@@ -10,8 +10,11 @@
 
 #pragma once
 
+#include "LinkerInternals.h"
+
 #include "BeginPrivate.h"
 
 void checkUnload (StgClosure *static_objects);
+void indexUnloadedObject (ObjectCode *oc);
 
 #include "EndPrivate.h"
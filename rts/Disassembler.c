@@ -243,6 +243,12 @@ disInstr ( StgBCO *bco, int pc )
          printPtr( (StgPtr)literals[instrs[pc]] );
          debugBelch("\n");
          pc += 2; break;
+      case bci_PUSH_LL_PACK:
+         debugBelch("PUSH_LL_PACK %d %d, %d words with itbl ",
+                    instrs[pc], instrs[pc+1], instrs[pc+3] );
+         printPtr( (StgPtr)literals[instrs[pc+2]] );
+         debugBelch("\n");
+         pc += 4; break;
 
       case bci_TESTLT_I: {
           unsigned int discr  = BCO_NEXT;
@@ -291,6 +297,15 @@ disInstr ( StgBCO *bco, int pc )
       case bci_ENTER:
          debugBelch("ENTER\n");
          break;
+      case bci_ENTER_IC: {
+         StgWord ic = BCO_GET_LARGE_ARG;
+         debugBelch("ENTER_IC  cache %" FMT_Word " = %" FMT_Word "\n",
+                    ic, literals[ic]);
+         break;
+      }
+      case bci_PUSH_L_ENTER:
+         debugBelch("PUSH_L_ENTER %d, slide by %d\n", instrs[pc], instrs[pc+1] );
+         pc += 2; break;
 
       case bci_RETURN:
          debugBelch("RETURN\n" );
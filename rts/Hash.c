@@ -3,9 +3,7 @@
  * (c) The AQUA Project, Glasgow University, 1995-1998
  * (c) The GHC Team, 1999
  *
- * Dynamically expanding linear hash tables, as described in
- * Per-\AAke Larson, ``Dynamic Hash Tables,'' CACM 31(4), April 1988,
- * pp. 446 -- 457.
+ * Open-addressing hash tables.  See Note [Hash table layout].
  * -------------------------------------------------------------------------- */
 
 #include "PosixSource.h"
@@ -17,84 +15,106 @@
 
 #include <string.h>
 
-#define HSEGSIZE    1024    /* Size of a single hash table segment */
-                            /* Also the minimum size of a hash table */
-#define HDIRSIZE    1024    /* Size of the segment directory */
-                            /* Maximum hash table size is HSEGSIZE * HDIRSIZE */
-#define HLOAD       5       /* Maximum average load of a single hash bucket */
-
-#define HCHUNK      (1024 * sizeof(W_) / sizeof(HashList))
-                            /* Number of HashList cells to allocate in one go */
-
-
-/* Linked list of (key, data) pairs for separate chaining */
-typedef struct hashlist {
+/* Note [Hash table layout]
+   ~~~~~~~~~~~~~~~~~~~~~~~~
+The table is an array of slots holding the keys and values inline, plus a
+parallel array with one control byte per slot, in the style of Google's
+SwissTable.  A control byte is either
+
+  * HASH_EMPTY:   the slot has never been used,
+  * HASH_DELETED: the slot held an entry that has been removed, or
+  * the low HASH_H2_BITS bits of the hash of the key in the slot.
+
+The rest of the hash (h1) picks the slot where a probe starts.  A probe
+examines a whole group of HASH_GROUP_WIDTH control bytes at once, as one
+64-bit word: the bytes that match the control byte of the key we are
+looking for give the only slots whose keys need comparing, and a lookup
+stops at the first group containing an empty slot.  Successive groups are
+visited by triangular probing, which visits every group of a power-of-2
+sized table.  The first HASH_GROUP_WIDTH control bytes are mirrored after
+the end of the array, so that a group starting near the end can be loaded
+with one unaligned read.
+
+Each slot also caches the full hash of its key.  Comparing the cached
+hashes first means that a string comparison is only done for a real
+match, and growing the table never rehashes a key; both matter for string
+keys, which cost a strlen() and an XXH64 to hash.
+
+A removed entry leaves a tombstone (HASH_DELETED), which lookups probe
+past and inserts may reuse, unless no probe can have gone past its slot
+(see removeSlot()).  When an insertion finds no free slot left,
+the table is rebuilt without tombstones, at double the size if more than
+half of it is in use.
+
+Several entries with the same key may be inserted; lookupHashTable()
+returns one of them, and removeHashTable() can pick out one by its value.
+*/
+
+#define HASH_GROUP_WIDTH    8       /* control bytes probed at once */
+#define HASH_MIN_CAPACITY   32      /* must be a power of 2, >= group width */
+
+#define HASH_EMPTY          ((uint8_t)0x80)
+#define HASH_DELETED        ((uint8_t)0xfe)
+#define HASH_H2_BITS        7
+
+#define H1(h)   ((h) >> HASH_H2_BITS)
+#define H2(h)   ((uint8_t)((h) & ((1 << HASH_H2_BITS) - 1)))
+
+#define IS_FULL(ctrl)       ((ctrl) < 0x80)
+
+typedef struct {
     StgWord key;
     const void *data;
-    struct hashlist *next;  /* Next cell in bucket chain (same hash value) */
-} HashList;
-
-typedef struct chunklist {
-  HashList *chunk;
-  struct chunklist *next;
-} HashListChunk;
+    StgWord hash;           /* cached hash of key */
+} HashEntry;
 
 struct hashtable {
-    int split;              /* Next bucket to split when expanding */
-    int max;                /* Max bucket of smaller table */
-    int mask1;              /* Mask for doing the mod of h_1 (smaller table) */
-    int mask2;              /* Mask for doing the mod of h_2 (larger table) */
+    uint8_t *ctrl;          /* capacity + HASH_GROUP_WIDTH control bytes */
+    HashEntry *slots;       /* capacity slots */
+    StgWord mask;           /* capacity - 1 */
     int kcount;             /* Number of keys */
-    int bcount;             /* Number of buckets */
-    HashList **dir[HDIRSIZE];   /* Directory of segments */
-    HashList *freeList;         /* free list of HashLists */
-    HashListChunk *chunks;
+    int growth_left;        /* Number of empty slots we may still fill */
     HashFunction *hash;         /* hash function */
     CompareFunction *compare;   /* key comparison function */
 };
 
 /* -----------------------------------------------------------------------------
- * Hash first using the smaller table.  If the bucket is less than the
- * next bucket to be split, re-hash using the larger table.
+ * Hash functions
+ *
+ * These return the full hash of a key; the table takes the bits it needs.
  * -------------------------------------------------------------------------- */
 
-int
-hashWord(const HashTable *table, StgWord key)
+StgWord
+hashWord(const HashTable *table STG_UNUSED, StgWord key)
 {
-    int bucket;
+    StgWord h;
 
     /* Strip the boring zero bits */
     key /= sizeof(StgWord);
 
-    /* Mod the size of the hash table (a power of 2) */
-    bucket = key & table->mask1;
-
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = key & table->mask2;
-    }
-    return bucket;
+    /* Keys are usually addresses at a regular stride.  With open
+     * addressing, using the key itself as the slot (as the old chained
+     * table did) makes such keys pile up into long probe sequences, so mix
+     * the high bits of a multiplicative hash back into the low ones. */
+#if SIZEOF_VOID_P == 8
+    h = key * UINT64_C(0x9e3779b97f4a7c15);
+    h ^= h >> 32;
+#else
+    h = key * 0x9e3779b9;
+    h ^= h >> 16;
+#endif
+    return h;
 }
 
-int
-hashStr(const HashTable *table, StgWord w)
+StgWord
+hashStr(const HashTable *table STG_UNUSED, StgWord w)
 {
     const char *key = (char*) w;
 #ifdef x86_64_HOST_ARCH
-    StgWord h = XXH64 (key, strlen(key), 1048583);
+    return XXH64 (key, strlen(key), 1048583);
 #else
-    StgWord h = XXH32 (key, strlen(key), 1048583);
+    return XXH32 (key, strlen(key), 1048583);
 #endif
-
-    /* Mod the size of the hash table (a power of 2) */
-    int bucket = h & table->mask1;
-
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = h & table->mask2;
-    }
-
-    return bucket;
 }
 
 static int
@@ -109,101 +129,185 @@ compareStr(StgWord key1, StgWord key2)
     return (strcmp((char *)key1, (char *)key2) == 0);
 }
 
+/* -----------------------------------------------------------------------------
+ * Groups of control bytes
+ *
+ * A group is loaded into a word with the control byte of the first slot in
+ * its least significant byte.  The match functions return a word with the
+ * top bit of each selected byte set.
+ * -------------------------------------------------------------------------- */
+
+#define GROUP_LSBS  UINT64_C(0x0101010101010101)
+#define GROUP_MSBS  UINT64_C(0x8080808080808080)
+
+STATIC_INLINE StgWord64
+loadGroup(const uint8_t *ctrl)
+{
+    StgWord64 g;
+    memcpy(&g, ctrl, sizeof(g));
+#if defined(WORDS_BIGENDIAN)
+    g = __builtin_bswap64(g);
+#endif
+    return g;
+}
+
+// Bytes equal to h2.  This may also report a byte following a real match
+// (when the borrow of the subtraction spills over), which is harmless: the
+// caller compares the hashes anyway.
+STATIC_INLINE StgWord64
+matchH2(StgWord64 g, uint8_t h2)
+{
+    StgWord64 x = g ^ (GROUP_LSBS * h2);
+    return (x - GROUP_LSBS) & ~x & GROUP_MSBS;
+}
+
+// Bytes that are HASH_EMPTY: the only control bytes with the top bit set and
+// bit 1 clear.
+STATIC_INLINE StgWord64
+matchEmpty(StgWord64 g)
+{
+    return g & (~g << 6) & GROUP_MSBS;
+}
+
+// Bytes that are HASH_EMPTY or HASH_DELETED
+STATIC_INLINE StgWord64
+matchFree(StgWord64 g)
+{
+    return g & GROUP_MSBS;
+}
+
+// Index within the group of the lowest selected byte
+STATIC_INLINE uint32_t
+lowestMatch(StgWord64 m)
+{
+    return __builtin_ctzll(m) / 8;
+}
+
+STATIC_INLINE void
+setCtrl(HashTable *table, StgWord i, uint8_t c)
+{
+    table->ctrl[i] = c;
+    // Keep the mirrored bytes after the end of the array up to date
+    if (i < HASH_GROUP_WIDTH) {
+        table->ctrl[table->mask + 1 + i] = c;
+    }
+}
+
+// Usable slots in a table of the given capacity: a load factor of 7/8
+STATIC_INLINE int
+capacityToGrowth(StgWord capacity)
+{
+    return capacity - capacity / 8;
+}
 
 /* -----------------------------------------------------------------------------
- * Allocate a new segment of the dynamically growing hash table.
+ * Find the slot holding key (with hash h), or -1
  * -------------------------------------------------------------------------- */
 
-static void
-allocSegment(HashTable *table, int segment)
+STATIC_INLINE long
+findSlot(const HashTable *table, StgWord key, StgWord h)
+{
+    const uint8_t h2 = H2(h);
+    StgWord pos = H1(h) & table->mask;
+    StgWord stride = 0;
+    StgWord64 g, m;
+    StgWord i;
+
+    for (;;) {
+        g = loadGroup(table->ctrl + pos);
+        for (m = matchH2(g, h2); m != 0; m &= m - 1) {
+            i = (pos + lowestMatch(m)) & table->mask;
+            if (table->slots[i].hash == h &&
+                table->compare(table->slots[i].key, key)) {
+                return i;
+            }
+        }
+        if (matchEmpty(g) != 0) {
+            return -1;
+        }
+        stride += HASH_GROUP_WIDTH;
+        pos = (pos + stride) & table->mask;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Find the first empty or deleted slot on the probe sequence for hash h.
+ * There is always one, since the table is never completely full.
+ * -------------------------------------------------------------------------- */
+
+STATIC_INLINE StgWord
+findFreeSlot(const HashTable *table, StgWord h)
 {
-    table->dir[segment] = stgMallocBytes(HSEGSIZE * sizeof(HashList *),
-                                         "allocSegment");
+    StgWord pos = H1(h) & table->mask;
+    StgWord stride = 0;
+    StgWord64 m;
+
+    for (;;) {
+        m = matchFree(loadGroup(table->ctrl + pos));
+        if (m != 0) {
+            return (pos + lowestMatch(m)) & table->mask;
+        }
+        stride += HASH_GROUP_WIDTH;
+        pos = (pos + stride) & table->mask;
+    }
 }
 
+/* -----------------------------------------------------------------------------
+ * Allocate the slot arrays of an empty table with the given capacity
+ * -------------------------------------------------------------------------- */
+
+static void
+allocSlots(HashTable *table, StgWord capacity)
+{
+    table->ctrl = stgMallocBytes(capacity + HASH_GROUP_WIDTH, "allocSlots");
+    table->slots = stgMallocBytes(capacity * sizeof(HashEntry), "allocSlots");
+    memset(table->ctrl, HASH_EMPTY, capacity + HASH_GROUP_WIDTH);
+    table->mask = capacity - 1;
+    table->growth_left = capacityToGrowth(capacity) - table->kcount;
+}
 
 /* -----------------------------------------------------------------------------
- * Expand the larger hash table by one bucket, and split one bucket
- * from the smaller table into two parts.  Only the bucket referenced
- * by @table->split@ is affected by the expansion.
+ * Rebuild the table without tombstones, doubling its size if more than half
+ * of it is in use.  The cached hashes mean we never have to rehash a key.
  * -------------------------------------------------------------------------- */
 
 static void
-expand(HashTable *table)
+resize(HashTable *table)
 {
-    int oldsegment;
-    int oldindex;
-    int newbucket;
-    int newsegment;
-    int newindex;
-    HashList *hl;
-    HashList *next;
-    HashList *old, *new;
-
-    if (table->split + table->max >= HDIRSIZE * HSEGSIZE)
-        /* Wow!  That's big.  Too big, so don't expand. */
-        return;
-
-    /* Calculate indices of bucket to split */
-    oldsegment = table->split / HSEGSIZE;
-    oldindex = table->split % HSEGSIZE;
-
-    newbucket = table->max + table->split;
-
-    /* And the indices of the new bucket */
-    newsegment = newbucket / HSEGSIZE;
-    newindex = newbucket % HSEGSIZE;
-
-    if (newindex == 0)
-        allocSegment(table, newsegment);
-
-    if (++table->split == table->max) {
-        table->split = 0;
-        table->max *= 2;
-        table->mask1 = table->mask2;
-        table->mask2 = table->mask2 << 1 | 1;
+    uint8_t *old_ctrl = table->ctrl;
+    HashEntry *old_slots = table->slots;
+    StgWord old_capacity = table->mask + 1;
+    StgWord capacity = old_capacity;
+    StgWord i, j;
+
+    if ((StgWord)table->kcount >= old_capacity / 2) {
+        capacity *= 2;
     }
-    table->bcount++;
-
-    /* Split the bucket, paying no attention to the original order */
-
-    old = new = NULL;
-    for (hl = table->dir[oldsegment][oldindex]; hl != NULL; hl = next) {
-        next = hl->next;
-        if (table->hash(table, hl->key) == newbucket) {
-            hl->next = new;
-            new = hl;
-        } else {
-            hl->next = old;
-            old = hl;
+
+    allocSlots(table, capacity);
+
+    for (i = 0; i < old_capacity; i++) {
+        if (IS_FULL(old_ctrl[i])) {
+            j = findFreeSlot(table, old_slots[i].hash);
+            setCtrl(table, j, H2(old_slots[i].hash));
+            table->slots[j] = old_slots[i];
         }
     }
-    table->dir[oldsegment][oldindex] = old;
-    table->dir[newsegment][newindex] = new;
 
-    return;
+    stgFree(old_ctrl);
+    stgFree(old_slots);
 }
 
 void *
 lookupHashTable(const HashTable *table, StgWord key)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    CompareFunction *cmp = table->compare;
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (cmp(hl->key, key))
-            return (void *) hl->data;
-    }
+    long i = findSlot(table, key, table->hash(table, key));
 
-    /* It's not there */
-    return NULL;
+    if (i < 0) {
+        /* It's not there */
+        return NULL;
+    }
+    return (void *) table->slots[i].data;
 }
 
 // Puts up to szKeys keys of the hash table into the given array. Returns the
@@ -212,120 +316,97 @@ lookupHashTable(const HashTable *table, StgWord key)
 // If the table is modified concurrently, the function behavior is undefined.
 //
 int keysHashTable(HashTable *table, StgWord keys[], int szKeys) {
-    int segment, index;
+    StgWord i;
     int k = 0;
-    HashList *hl;
-
 
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0 && k < szKeys) {
-        while (index >= 0 && k < szKeys) {
-            hl = table->dir[segment][index];
-            while (hl && k < szKeys) {
-                keys[k] = hl->key;
-                k += 1;
-                hl = hl->next;
-            }
-            index--;
+    for (i = 0; i <= table->mask && k < szKeys; i++) {
+        if (IS_FULL(table->ctrl[i])) {
+            keys[k] = table->slots[i].key;
+            k += 1;
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
     return k;
 }
 
-/* -----------------------------------------------------------------------------
- * We allocate the hashlist cells in large chunks to cut down on malloc
- * overhead.  Although we keep a free list of hashlist cells, we make
- * no effort to actually return the space to the malloc arena.
- * -------------------------------------------------------------------------- */
-
-static HashList *
-allocHashList (HashTable *table)
-{
-    HashList *hl, *p;
-    HashListChunk *cl;
-
-    if ((hl = table->freeList) != NULL) {
-        table->freeList = hl->next;
-    } else {
-        hl = stgMallocBytes(HCHUNK * sizeof(HashList), "allocHashList");
-        cl = stgMallocBytes(sizeof (*cl), "allocHashList: chunkList");
-        cl->chunk = hl;
-        cl->next = table->chunks;
-        table->chunks = cl;
-
-        table->freeList = hl + 1;
-        for (p = table->freeList; p < hl + HCHUNK - 1; p++)
-            p->next = p + 1;
-        p->next = NULL;
-    }
-    return hl;
-}
-
-static void
-freeHashList (HashTable *table, HashList *hl)
-{
-    hl->next = table->freeList;
-    table->freeList = hl;
-}
-
 void
 insertHashTable(HashTable *table, StgWord key, const void *data)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
+    StgWord h, i;
 
     // Disable this assert; sometimes it's useful to be able to
     // overwrite entries in the hash table.
     // ASSERT(lookupHashTable(table, key) == NULL);
 
-    /* When the average load gets too high, we expand the table */
-    if (++table->kcount >= HLOAD * table->bcount)
-        expand(table);
+    h = table->hash(table, key);
+    i = findFreeSlot(table, h);
 
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
+    // Reusing a tombstone costs nothing, but filling an empty slot uses up
+    // some of the room we leave for probes to terminate.
+    if (table->ctrl[i] == HASH_EMPTY) {
+        if (table->growth_left == 0) {
+            resize(table);
+            i = findFreeSlot(table, h);
+        }
+        table->growth_left--;
+    }
 
-    hl = allocHashList(table);
+    setCtrl(table, i, H2(h));
+    table->slots[i].key = key;
+    table->slots[i].data = data;
+    table->slots[i].hash = h;
+    table->kcount++;
+}
 
-    hl->key = key;
-    hl->data = data;
-    hl->next = table->dir[segment][index];
-    table->dir[segment][index] = hl;
+/* -----------------------------------------------------------------------------
+ * Empty slot i.  It only needs a tombstone if a probe may have gone past it,
+ * which can only happen if it is in a run of HASH_GROUP_WIDTH or more
+ * slots none of which is empty.
+ * -------------------------------------------------------------------------- */
 
+STATIC_INLINE void
+removeSlot(HashTable *table, StgWord i)
+{
+    StgWord before = (i - HASH_GROUP_WIDTH) & table->mask;
+    StgWord64 empty_before = matchEmpty(loadGroup(table->ctrl + before));
+    StgWord64 empty_after = matchEmpty(loadGroup(table->ctrl + i));
+
+    if (empty_before != 0 && empty_after != 0 &&
+        __builtin_clzll(empty_before) / 8 +
+        __builtin_ctzll(empty_after) / 8 < HASH_GROUP_WIDTH) {
+        setCtrl(table, i, HASH_EMPTY);
+        table->growth_left++;
+    } else {
+        setCtrl(table, i, HASH_DELETED);
+    }
 }
 
 void *
 removeHashTable(HashTable *table, StgWord key, const void *data)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-    HashList *prev = NULL;
-
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (table->compare(hl->key,key) && (data == NULL || hl->data == data)) {
-            if (prev == NULL)
-                table->dir[segment][index] = hl->next;
-            else
-                prev->next = hl->next;
-            freeHashList(table,hl);
-            table->kcount--;
-            return (void *) hl->data;
+    const StgWord h = table->hash(table, key);
+    const uint8_t h2 = H2(h);
+    StgWord pos = H1(h) & table->mask;
+    StgWord stride = 0;
+    StgWord64 g, m;
+    StgWord i;
+
+    for (;;) {
+        g = loadGroup(table->ctrl + pos);
+        for (m = matchH2(g, h2); m != 0; m &= m - 1) {
+            i = (pos + lowestMatch(m)) & table->mask;
+            if (table->slots[i].hash == h &&
+                table->compare(table->slots[i].key, key) &&
+                (data == NULL || table->slots[i].data == data)) {
+                removeSlot(table, i);
+                table->kcount--;
+                return (void *) table->slots[i].data;
+            }
+        }
+        if (matchEmpty(g) != 0) {
+            break;
         }
-        prev = hl;
+        stride += HASH_GROUP_WIDTH;
+        pos = (pos + stride) & table->mask;
     }
 
     /* It's not there */
@@ -342,34 +423,17 @@ removeHashTable(HashTable *table, StgWord key, const void *data)
 void
 freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 {
-    long segment;
-    long index;
-    HashList *hl;
-    HashList *next;
-    HashListChunk *cl, *cl_next;
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (hl = table->dir[segment][index]; hl != NULL; hl = next) {
-                next = hl->next;
-                if (freeDataFun != NULL)
-                    (*freeDataFun)((void *) hl->data);
+    StgWord i;
+
+    if (freeDataFun != NULL) {
+        for (i = 0; i <= table->mask; i++) {
+            if (IS_FULL(table->ctrl[i])) {
+                (*freeDataFun)((void *) table->slots[i].data);
             }
-            index--;
         }
-        stgFree(table->dir[segment]);
-        segment--;
-        index = HSEGSIZE - 1;
-    }
-    for (cl = table->chunks; cl != NULL; cl = cl_next) {
-        cl_next = cl->next;
-        stgFree(cl->chunk);
-        stgFree(cl);
     }
+    stgFree(table->ctrl);
+    stgFree(table->slots);
     stgFree(table);
 }
 
@@ -380,54 +444,26 @@ freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 void
 mapHashTable(HashTable *table, void *data, MapHashFn fn)
 {
-    long segment;
-    long index;
-    HashList *hl;
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-                fn(data, hl->key, hl->data);
-            }
-            index--;
+    StgWord i;
+
+    for (i = 0; i <= table->mask; i++) {
+        if (IS_FULL(table->ctrl[i])) {
+            fn(data, table->slots[i].key, table->slots[i].data);
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
 }
 
-/* -----------------------------------------------------------------------------
- * When we initialize a hash table, we set up the first segment as well,
- * initializing all of the first segment's hash buckets to NULL.
- * -------------------------------------------------------------------------- */
-
 HashTable *
 allocHashTable_(HashFunction *hash, CompareFunction *compare)
 {
     HashTable *table;
-    HashList **hb;
 
     table = stgMallocBytes(sizeof(HashTable),"allocHashTable");
 
-    allocSegment(table, 0);
-
-    for (hb = table->dir[0]; hb < table->dir[0] + HSEGSIZE; hb++)
-        *hb = NULL;
-
-    table->split = 0;
-    table->max = HSEGSIZE;
-    table->mask1 = HSEGSIZE - 1;
-    table->mask2 = 2 * HSEGSIZE - 1;
     table->kcount = 0;
-    table->bcount = HSEGSIZE;
-    table->freeList = NULL;
-    table->chunks = NULL;
     table->hash = hash;
     table->compare = compare;
+    allocSlots(table, HASH_MIN_CAPACITY);
 
     return table;
 }
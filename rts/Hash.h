@@ -51,12 +51,16 @@ HashTable * allocStrHashTable ( void );
 #define removeStrHashTable(table, key, data) \
    (removeHashTable(table, (StgWord)key, data))
 
-/* Hash tables for arbitrary keys */
-typedef int HashFunction(const HashTable *table, StgWord key);
+/* Hash tables for arbitrary keys.  A HashFunction returns the full hash of
+ * a key, and must spread it over all the bits of the result: the table uses
+ * both the low and the high bits.  hashWord and hashStr may be used to build
+ * one.
+ */
+typedef StgWord HashFunction(const HashTable *table, StgWord key);
 typedef int CompareFunction(StgWord key1, StgWord key2);
 HashTable * allocHashTable_(HashFunction *hash, CompareFunction *compare);
-int hashWord(const HashTable *table, StgWord key);
-int hashStr(const HashTable *table, StgWord key);
+StgWord hashWord(const HashTable *table, StgWord key);
+StgWord hashStr(const HashTable *table, StgWord key);
 
 /* Freeing hash tables
  */
@@ -49,6 +49,77 @@
 
 /* #define INTERP_STATS */
 
+/*
+   Note [Interpreter dispatch]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   With a C compiler that supports labels as values (GCC and clang) the
+   interpreter dispatches each instruction with a computed goto through
+   a table of labels, one per opcode, rather than through the switch.
+   Every instruction ends with its own copy of the dispatch (NEXT_INSN),
+   so the indirect branch predictor sees one branch per opcode, keyed on
+   the previous instruction, instead of a single shared branch that it
+   mostly mispredicts.  The switch is still there: it supplies the case
+   labels for the portable build, which is selected on other compilers
+   or by defining INTERP_SWITCH_DISPATCH, and debugging and statistics
+   builds route every instruction through nextInsn so that they can
+   trace and count them.
+
+   To compare the two strategies, build the RTS with and without
+   -DINTERP_SWITCH_DISPATCH and time bytecode-heavy programs such as
+   testsuite/tests/ghci/should_run/ghcirun005 under GHCi.
+*/
+
+/*
+   Note [Bytecode superinstructions]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   The bytecode generator's peephole pass (mkProtoBCO in ByteCodeGen)
+   fuses the commonest instruction sequences into single instructions,
+   saving a dispatch each and, more importantly, the stack traffic
+   between them:
+
+     PUSH_L_ENTER o by    PUSH_L o; SLIDE 1 by; ENTER (by may be 0)
+                          a tail call of a local: the closure is read
+                          straight off the stack rather than pushed,
+                          slid down and popped again.
+
+     PUSH_LL_PACK o1 o2 itbl n
+                          PUSH_LL o1 o2; PACK itbl n, for n >= 2:
+                          the two locals are stored straight into the
+                          new constructor.
+
+   Each must leave the stack exactly as the sequence it replaces would,
+   including when PUSH_L_ENTER yields to the scheduler, and their stack
+   use (bciStackUse) is that of the sequence.  Opcode pair counts from
+   an INTERP_STATS build are the place to look for further candidates.
+*/
+
+#if defined(__GNUC__) && !defined(INTERP_SWITCH_DISPATCH)
+#define INTERP_COMPUTED_GOTO 1
+#endif
+
+#if defined(INTERP_COMPUTED_GOTO)
+#define INSN(op) case op: lbl_##op
+#define DISPATCH()                                              \
+    do {                                                        \
+        const void *target = dispatch_table[bci & 0xFF];        \
+        if (target == NULL) goto unknown_opcode;                \
+        goto *target;                                           \
+    } while (0)
+#else
+#define INSN(op) case op
+#endif
+
+// Whether each instruction dispatches the next itself
+#if defined(INTERP_COMPUTED_GOTO) && !defined(DEBUG) && !defined(INTERP_STATS)
+#define INTERP_THREADED_DISPATCH 1
+#endif
+
+#if defined(INTERP_THREADED_DISPATCH)
+#define NEXT_INSN do { bci = BCO_NEXT; DISPATCH(); } while (0)
+#else
+#define NEXT_INSN goto nextInsn
+#endif
+
 
 /* Sp points to the lowest live word on the stack. */
 
@@ -173,6 +244,9 @@ int it_ofreq[27];
 int it_oofreq[27][27];
 int it_lastopc;
 
+int it_ic_hits;
+int it_ic_misses;
+
 
 #define INTERP_TICK(n) (n)++
 
@@ -184,6 +258,7 @@ void interp_startup ( void )
    for (i = 0; i < N_CLOSURE_TYPES; i++)
       it_unknown_entries[i] = 0;
    it_slides = it_insns = it_BCO_entries = 0;
+   it_ic_hits = it_ic_misses = 0;
    for (i = 0; i < 27; i++) it_ofreq[i] = 0;
    for (i = 0; i < 27; i++)
      for (j = 0; j < 27; j++)
@@ -208,6 +283,10 @@ void interp_shutdown ( void )
    }
    debugBelch("%d insns, %d slides, %d BCO_entries\n",
                    it_insns, it_slides, it_BCO_entries);
+   debugBelch("%d inline cache hits, %d misses (%4.1f%% hits)\n",
+                   it_ic_hits, it_ic_misses,
+                   100.0 * ((double)it_ic_hits) /
+                           ((double)(it_ic_hits + it_ic_misses + 1)));
    for (i = 0; i < 27; i++)
       debugBelch("opcode %2d got %d\n", i, it_ofreq[i] );
 
@@ -288,6 +367,64 @@ static StgWord app_ptrs_itbl[] = {
     (W_)&stg_ap_pppppp_info,
 };
 
+// The application frames we can apply a function to ourselves: the
+// number of arguments each passes (n), and the words they take (m).
+static const struct {
+    StgWord info;
+    uint32_t n, m;
+} ap_frames[] = {
+    { (W_)&stg_ap_v_info,      1, 0 },
+    { (W_)&stg_ap_f_info,      1, 1 },
+    { (W_)&stg_ap_d_info,      1, sizeofW(StgDouble) },
+    { (W_)&stg_ap_l_info,      1, sizeofW(StgInt64) },
+    { (W_)&stg_ap_n_info,      1, 1 },
+    { (W_)&stg_ap_p_info,      1, 1 },
+    { (W_)&stg_ap_pp_info,     2, 2 },
+    { (W_)&stg_ap_ppp_info,    3, 3 },
+    { (W_)&stg_ap_pppp_info,   4, 4 },
+    { (W_)&stg_ap_ppppp_info,  5, 5 },
+    { (W_)&stg_ap_pppppp_info, 6, 6 },
+};
+
+#define N_AP_FRAMES (sizeof(ap_frames) / sizeof(ap_frames[0]))
+
+/*
+   Note [Interpreter inline caches]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   A call of an unknown function with arguments compiles to: push the
+   arguments and an stg_ap_* frame, push the function, ENTER.  Entering
+   the function then goes the long way round: eval finds that it is a
+   function, do_return works out from the frame's info pointer how many
+   arguments are being passed, and do_apply compares that with the
+   function's arity.  Yet almost every call site calls the same kind of
+   function with the same number of arguments each time.
+
+   So the bytecode generator ends such calls with ENTER_IC, which names
+   a word of the BCO's literals, zero to begin with, as the call site's
+   inline cache.  When a call is saturated, do_apply stores in it which
+   of ap_frames[] was applied and whether the function was a BCO or a
+   PAP of a BCO (IC_ENTRY).  ENTER_IC checks the next call against the
+   cache: if the frame is the same and the function is again of the
+   cached kind and has exactly that arity, it goes straight to the
+   function's code.  Anything else misses and takes the generic path,
+   which refills the cache.
+
+   The cache only says which checks to make, and a hit makes them all
+   against the real frame and function, so it is harmless for a cache
+   to be stale, or for two Capabilities running the same BCO to race
+   on it: it is a single word.  The interpreter keeps the address of
+   the cache it missed in (ic) only until the call reaches do_apply or
+   another BCO starts running; no GC can happen in between.
+
+   Build with INTERP_STATS to count hits and misses.
+*/
+
+#define IC_BCO 1
+#define IC_PAP 2
+#define IC_ENTRY(frame,kind) ((((W_)(frame) + 1) << 2) | (kind))
+#define IC_FRAME(entry) (((entry) >> 2) - 1)
+#define IC_KIND(entry) ((entry) & 3)
+
 HsStablePtr rts_breakpoint_io_action; // points to the IO action which is executed on a breakpoint
                                       // it is set in main/GHC.hs:runStmt
 
@@ -300,6 +437,8 @@ interpretBCO (Capability* cap)
     register void *SpLim;  // local state -- stack lim pointer
     register StgClosure *tagged_obj = 0, *obj = NULL;
     uint32_t n, m;
+    uint32_t frame = 0;     // index into ap_frames[] of the frame applied
+    StgWord *ic = NULL;     // the inline cache that missed, if any
 
     LOAD_THREAD_STATE();
 
@@ -566,38 +705,12 @@ do_return:
             goto do_return;
         }
 
-        if (info == (StgInfoTable *)&stg_ap_v_info) {
-            n = 1; m = 0; goto do_apply;
-        }
-        if (info == (StgInfoTable *)&stg_ap_f_info) {
-            n = 1; m = 1; goto do_apply;
-        }
-        if (info == (StgInfoTable *)&stg_ap_d_info) {
-            n = 1; m = sizeofW(StgDouble); goto do_apply;
-        }
-        if (info == (StgInfoTable *)&stg_ap_l_info) {
-            n = 1; m = sizeofW(StgInt64); goto do_apply;
-        }
-        if (info == (StgInfoTable *)&stg_ap_n_info) {
-            n = 1; m = 1; goto do_apply;
-        }
-        if (info == (StgInfoTable *)&stg_ap_p_info) {
-            n = 1; m = 1; goto do_apply;
-        }
-        if (info == (StgInfoTable *)&stg_ap_pp_info) {
-            n = 2; m = 2; goto do_apply;
-        }
-        if (info == (StgInfoTable *)&stg_ap_ppp_info) {
-            n = 3; m = 3; goto do_apply;
-        }
-        if (info == (StgInfoTable *)&stg_ap_pppp_info) {
-            n = 4; m = 4; goto do_apply;
-        }
-        if (info == (StgInfoTable *)&stg_ap_ppppp_info) {
-            n = 5; m = 5; goto do_apply;
-        }
-        if (info == (StgInfoTable *)&stg_ap_pppppp_info) {
-            n = 6; m = 6; goto do_apply;
+        for (frame = 0; frame < N_AP_FRAMES; frame++) {
+            if ((W_)info == ap_frames[frame].info) {
+                n = ap_frames[frame].n;
+                m = ap_frames[frame].m;
+                goto do_apply;
+            }
         }
         goto do_return_unrecognised;
     }
@@ -733,6 +846,10 @@ do_apply:
     // words on the stack.  The info table (stg_ap_pp_info or whatever)
     // is on top of the arguments on the stack.
     {
+        // the inline cache of the call site we came from, if it missed
+        StgWord *call_ic = ic;
+        ic = NULL;
+
         switch (get_itbl(obj)->type) {
 
         case PAP: {
@@ -785,6 +902,9 @@ do_apply:
                 goto run_BCO_fun;
             }
             else if (arity == n) {
+                if (call_ic != NULL) {
+                    *call_ic = IC_ENTRY(frame, IC_PAP);
+                }
                 Sp_subW(pap->n_args);
                 for (i = 0; i < pap->n_args; i++) {
                     SpW(i) = (W_)pap->payload[i];
@@ -837,6 +957,9 @@ do_apply:
                 goto run_BCO_fun;
             }
             else if (arity == n) {
+                if (call_ic != NULL) {
+                    *call_ic = IC_ENTRY(frame, IC_BCO);
+                }
                 goto run_BCO_fun;
             }
             else /* arity > n */ {
@@ -964,6 +1087,7 @@ run_BCO_fun:
     // scheduler again until the stack is in an orderly state).
 run_BCO:
     INTERP_TICK(it_BCO_entries);
+    ic = NULL;
     {
         register int       bciPtr = 0; /* instruction pointer */
         register StgWord16 bci;
@@ -980,8 +1104,85 @@ run_BCO:
 #if defined(INTERP_STATS)
         it_lastopc = 0; /* no opcode */
 #endif
+#if defined(INTERP_COMPUTED_GOTO)
+        // See Note [Interpreter dispatch]; missing opcodes are NULL.
+        static const void *const dispatch_table[256] = {
+            [bci_STKCHECK]          = &&lbl_bci_STKCHECK,
+            [bci_PUSH_L]            = &&lbl_bci_PUSH_L,
+            [bci_PUSH_LL]           = &&lbl_bci_PUSH_LL,
+            [bci_PUSH_LLL]          = &&lbl_bci_PUSH_LLL,
+            [bci_PUSH8]             = &&lbl_bci_PUSH8,
+            [bci_PUSH16]            = &&lbl_bci_PUSH16,
+            [bci_PUSH32]            = &&lbl_bci_PUSH32,
+            [bci_PUSH8_W]           = &&lbl_bci_PUSH8_W,
+            [bci_PUSH16_W]          = &&lbl_bci_PUSH16_W,
+            [bci_PUSH32_W]          = &&lbl_bci_PUSH32_W,
+            [bci_PUSH_G]            = &&lbl_bci_PUSH_G,
+            [bci_PUSH_ALTS]         = &&lbl_bci_PUSH_ALTS,
+            [bci_PUSH_ALTS_P]       = &&lbl_bci_PUSH_ALTS_P,
+            [bci_PUSH_ALTS_N]       = &&lbl_bci_PUSH_ALTS_N,
+            [bci_PUSH_ALTS_F]       = &&lbl_bci_PUSH_ALTS_F,
+            [bci_PUSH_ALTS_D]       = &&lbl_bci_PUSH_ALTS_D,
+            [bci_PUSH_ALTS_L]       = &&lbl_bci_PUSH_ALTS_L,
+            [bci_PUSH_ALTS_V]       = &&lbl_bci_PUSH_ALTS_V,
+            [bci_PUSH_PAD8]         = &&lbl_bci_PUSH_PAD8,
+            [bci_PUSH_PAD16]        = &&lbl_bci_PUSH_PAD16,
+            [bci_PUSH_PAD32]        = &&lbl_bci_PUSH_PAD32,
+            [bci_PUSH_UBX8]         = &&lbl_bci_PUSH_UBX8,
+            [bci_PUSH_UBX16]        = &&lbl_bci_PUSH_UBX16,
+            [bci_PUSH_UBX32]        = &&lbl_bci_PUSH_UBX32,
+            [bci_PUSH_UBX]          = &&lbl_bci_PUSH_UBX,
+            [bci_PUSH_APPLY_N]      = &&lbl_bci_PUSH_APPLY_N,
+            [bci_PUSH_APPLY_F]      = &&lbl_bci_PUSH_APPLY_F,
+            [bci_PUSH_APPLY_D]      = &&lbl_bci_PUSH_APPLY_D,
+            [bci_PUSH_APPLY_L]      = &&lbl_bci_PUSH_APPLY_L,
+            [bci_PUSH_APPLY_V]      = &&lbl_bci_PUSH_APPLY_V,
+            [bci_PUSH_APPLY_P]      = &&lbl_bci_PUSH_APPLY_P,
+            [bci_PUSH_APPLY_PP]     = &&lbl_bci_PUSH_APPLY_PP,
+            [bci_PUSH_APPLY_PPP]    = &&lbl_bci_PUSH_APPLY_PPP,
+            [bci_PUSH_APPLY_PPPP]   = &&lbl_bci_PUSH_APPLY_PPPP,
+            [bci_PUSH_APPLY_PPPPP]  = &&lbl_bci_PUSH_APPLY_PPPPP,
+            [bci_PUSH_APPLY_PPPPPP] = &&lbl_bci_PUSH_APPLY_PPPPPP,
+            [bci_SLIDE]             = &&lbl_bci_SLIDE,
+            [bci_ALLOC_AP]          = &&lbl_bci_ALLOC_AP,
+            [bci_ALLOC_AP_NOUPD]    = &&lbl_bci_ALLOC_AP_NOUPD,
+            [bci_ALLOC_PAP]         = &&lbl_bci_ALLOC_PAP,
+            [bci_MKAP]              = &&lbl_bci_MKAP,
+            [bci_MKPAP]             = &&lbl_bci_MKPAP,
+            [bci_UNPACK]            = &&lbl_bci_UNPACK,
+            [bci_PACK]              = &&lbl_bci_PACK,
+            [bci_TESTLT_I]          = &&lbl_bci_TESTLT_I,
+            [bci_TESTEQ_I]          = &&lbl_bci_TESTEQ_I,
+            [bci_TESTLT_F]          = &&lbl_bci_TESTLT_F,
+            [bci_TESTEQ_F]          = &&lbl_bci_TESTEQ_F,
+            [bci_TESTLT_D]          = &&lbl_bci_TESTLT_D,
+            [bci_TESTEQ_D]          = &&lbl_bci_TESTEQ_D,
+            [bci_TESTLT_P]          = &&lbl_bci_TESTLT_P,
+            [bci_TESTEQ_P]          = &&lbl_bci_TESTEQ_P,
+            [bci_CASEFAIL]          = &&lbl_bci_CASEFAIL,
+            [bci_JMP]               = &&lbl_bci_JMP,
+            [bci_CCALL]             = &&lbl_bci_CCALL,
+            [bci_SWIZZLE]           = &&lbl_bci_SWIZZLE,
+            [bci_ENTER]             = &&lbl_bci_ENTER,
+            [bci_RETURN]            = &&lbl_bci_RETURN,
+            [bci_RETURN_P]          = &&lbl_bci_RETURN_P,
+            [bci_RETURN_N]          = &&lbl_bci_RETURN_N,
+            [bci_RETURN_F]          = &&lbl_bci_RETURN_F,
+            [bci_RETURN_D]          = &&lbl_bci_RETURN_D,
+            [bci_RETURN_L]          = &&lbl_bci_RETURN_L,
+            [bci_RETURN_V]          = &&lbl_bci_RETURN_V,
+            [bci_BRK_FUN]           = &&lbl_bci_BRK_FUN,
+            [bci_TESTLT_W]          = &&lbl_bci_TESTLT_W,
+            [bci_TESTEQ_W]          = &&lbl_bci_TESTEQ_W,
+            [bci_PUSH_L_ENTER]      = &&lbl_bci_PUSH_L_ENTER,
+            [bci_PUSH_LL_PACK]      = &&lbl_bci_PUSH_LL_PACK,
+            [bci_ENTER_IC]          = &&lbl_bci_ENTER_IC,
+        };
+#endif
 
+#if !defined(INTERP_THREADED_DISPATCH)
     nextInsn:
+#endif
         ASSERT(bciPtr < bcoSize);
         IF_DEBUG(interpreter,
                  //if (do_print_stack) {
@@ -1016,10 +1217,14 @@ run_BCO:
      * currently allocated */
     ASSERT((bci & 0xFF00) == (bci & 0x8000));
 
+#if defined(INTERP_COMPUTED_GOTO)
+    DISPATCH();
+#endif
+
     switch (bci & 0xFF) {
 
         /* check for a breakpoint on the beginning of a let binding */
-        case bci_BRK_FUN:
+        INSN(bci_BRK_FUN):
         {
             int arg1_brk_array, arg2_array_index, arg3_module_uniq;
 #if defined(PROFILING)
@@ -1136,10 +1341,10 @@ run_BCO:
             cap->r.rCurrentTSO->flags &= ~TSO_STOPPED_ON_BREAKPOINT;
 
             // continue normal execution of the byte code instructions
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_STKCHECK: {
+        INSN(bci_STKCHECK): {
             // Explicit stack check at the beginning of a function
             // *only* (stack checks in case alternatives are
             // propagated to the enclosing function).
@@ -1150,27 +1355,27 @@ run_BCO:
                 SpW(0) = (W_)&stg_apply_interp_info;
                 RETURN_TO_SCHEDULER(ThreadInterpret, StackOverflow);
             } else {
-                goto nextInsn;
+                NEXT_INSN;
             }
         }
 
-        case bci_PUSH_L: {
+        INSN(bci_PUSH_L): {
             int o1 = BCO_NEXT;
             SpW(-1) = SpW(o1);
             Sp_subW(1);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_LL: {
+        INSN(bci_PUSH_LL): {
             int o1 = BCO_NEXT;
             int o2 = BCO_NEXT;
             SpW(-1) = SpW(o1);
             SpW(-2) = SpW(o2);
             Sp_subW(2);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_LLL: {
+        INSN(bci_PUSH_LLL): {
             int o1 = BCO_NEXT;
             int o2 = BCO_NEXT;
             int o3 = BCO_NEXT;
@@ -1178,59 +1383,59 @@ run_BCO:
             SpW(-2) = SpW(o2);
             SpW(-3) = SpW(o3);
             Sp_subW(3);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH8: {
+        INSN(bci_PUSH8): {
             int off = BCO_NEXT;
             Sp_subB(1);
             *(StgWord8*)Sp = *(StgWord8*)(Sp_plusB(off+1));
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH16: {
+        INSN(bci_PUSH16): {
             int off = BCO_NEXT;
             Sp_subB(2);
             *(StgWord16*)Sp = *(StgWord16*)(Sp_plusB(off+2));
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH32: {
+        INSN(bci_PUSH32): {
             int off = BCO_NEXT;
             Sp_subB(4);
             *(StgWord32*)Sp = *(StgWord32*)(Sp_plusB(off+4));
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH8_W: {
+        INSN(bci_PUSH8_W): {
             int off = BCO_NEXT;
             *(StgWord*)(Sp_minusW(1)) = *(StgWord8*)(Sp_plusB(off));
             Sp_subW(1);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH16_W: {
+        INSN(bci_PUSH16_W): {
             int off = BCO_NEXT;
             *(StgWord*)(Sp_minusW(1)) = *(StgWord16*)(Sp_plusB(off));
             Sp_subW(1);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH32_W: {
+        INSN(bci_PUSH32_W): {
             int off = BCO_NEXT;
             *(StgWord*)(Sp_minusW(1)) = *(StgWord32*)(Sp_plusB(off));
             Sp_subW(1);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_G: {
+        INSN(bci_PUSH_G): {
             int o1 = BCO_GET_LARGE_ARG;
             SpW(-1) = BCO_PTR(o1);
             Sp_subW(1);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS: {
+        INSN(bci_PUSH_ALTS): {
             int o_bco  = BCO_GET_LARGE_ARG;
             Sp_subW(2);
             SpW(1) = BCO_PTR(o_bco);
@@ -1240,10 +1445,10 @@ run_BCO:
             SpW(1) = (W_)cap->r.rCCCS;
             SpW(0) = (W_)&stg_restore_cccs_info;
 #endif
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_P: {
+        INSN(bci_PUSH_ALTS_P): {
             int o_bco  = BCO_GET_LARGE_ARG;
             SpW(-2) = (W_)&stg_ctoi_R1unpt_info;
             SpW(-1) = BCO_PTR(o_bco);
@@ -1253,10 +1458,10 @@ run_BCO:
             SpW(1) = (W_)cap->r.rCCCS;
             SpW(0) = (W_)&stg_restore_cccs_info;
 #endif
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_N: {
+        INSN(bci_PUSH_ALTS_N): {
             int o_bco  = BCO_GET_LARGE_ARG;
             SpW(-2) = (W_)&stg_ctoi_R1n_info;
             SpW(-1) = BCO_PTR(o_bco);
@@ -1266,10 +1471,10 @@ run_BCO:
             SpW(1) = (W_)cap->r.rCCCS;
             SpW(0) = (W_)&stg_restore_cccs_info;
 #endif
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_F: {
+        INSN(bci_PUSH_ALTS_F): {
             int o_bco  = BCO_GET_LARGE_ARG;
             SpW(-2) = (W_)&stg_ctoi_F1_info;
             SpW(-1) = BCO_PTR(o_bco);
@@ -1279,10 +1484,10 @@ run_BCO:
             SpW(1) = (W_)cap->r.rCCCS;
             SpW(0) = (W_)&stg_restore_cccs_info;
 #endif
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_D: {
+        INSN(bci_PUSH_ALTS_D): {
             int o_bco  = BCO_GET_LARGE_ARG;
             SpW(-2) = (W_)&stg_ctoi_D1_info;
             SpW(-1) = BCO_PTR(o_bco);
@@ -1292,10 +1497,10 @@ run_BCO:
             SpW(1) = (W_)cap->r.rCCCS;
             SpW(0) = (W_)&stg_restore_cccs_info;
 #endif
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_L: {
+        INSN(bci_PUSH_ALTS_L): {
             int o_bco  = BCO_GET_LARGE_ARG;
             SpW(-2) = (W_)&stg_ctoi_L1_info;
             SpW(-1) = BCO_PTR(o_bco);
@@ -1305,10 +1510,10 @@ run_BCO:
             SpW(1) = (W_)cap->r.rCCCS;
             SpW(0) = (W_)&stg_restore_cccs_info;
 #endif
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_V: {
+        INSN(bci_PUSH_ALTS_V): {
             int o_bco  = BCO_GET_LARGE_ARG;
             SpW(-2) = (W_)&stg_ctoi_V_info;
             SpW(-1) = BCO_PTR(o_bco);
@@ -1318,83 +1523,83 @@ run_BCO:
             SpW(1) = (W_)cap->r.rCCCS;
             SpW(0) = (W_)&stg_restore_cccs_info;
 #endif
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_APPLY_N:
+        INSN(bci_PUSH_APPLY_N):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_n_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_V:
+            NEXT_INSN;
+        INSN(bci_PUSH_APPLY_V):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_v_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_F:
+            NEXT_INSN;
+        INSN(bci_PUSH_APPLY_F):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_f_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_D:
+            NEXT_INSN;
+        INSN(bci_PUSH_APPLY_D):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_d_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_L:
+            NEXT_INSN;
+        INSN(bci_PUSH_APPLY_L):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_l_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_P:
+            NEXT_INSN;
+        INSN(bci_PUSH_APPLY_P):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_p_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_PP:
+            NEXT_INSN;
+        INSN(bci_PUSH_APPLY_PP):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_pp_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_PPP:
+            NEXT_INSN;
+        INSN(bci_PUSH_APPLY_PPP):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_ppp_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_PPPP:
+            NEXT_INSN;
+        INSN(bci_PUSH_APPLY_PPPP):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_pppp_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_PPPPP:
+            NEXT_INSN;
+        INSN(bci_PUSH_APPLY_PPPPP):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_ppppp_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_PPPPPP:
+            NEXT_INSN;
+        INSN(bci_PUSH_APPLY_PPPPPP):
             Sp_subW(1); SpW(0) = (W_)&stg_ap_pppppp_info;
-            goto nextInsn;
+            NEXT_INSN;
 
-        case bci_PUSH_PAD8: {
+        INSN(bci_PUSH_PAD8): {
             Sp_subB(1);
             *(StgWord8*)Sp = 0;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_PAD16: {
+        INSN(bci_PUSH_PAD16): {
             Sp_subB(2);
             *(StgWord16*)Sp = 0;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_PAD32: {
+        INSN(bci_PUSH_PAD32): {
             Sp_subB(4);
             *(StgWord32*)Sp = 0;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_UBX8: {
+        INSN(bci_PUSH_UBX8): {
             int o_lit = BCO_GET_LARGE_ARG;
             Sp_subB(1);
             *(StgWord8*)Sp = *(StgWord8*)(literals+o_lit);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_UBX16: {
+        INSN(bci_PUSH_UBX16): {
             int o_lit = BCO_GET_LARGE_ARG;
             Sp_subB(2);
             *(StgWord16*)Sp = *(StgWord16*)(literals+o_lit);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_UBX32: {
+        INSN(bci_PUSH_UBX32): {
             int o_lit = BCO_GET_LARGE_ARG;
             Sp_subB(4);
             *(StgWord32*)Sp = *(StgWord32*)(literals+o_lit);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_UBX: {
+        INSN(bci_PUSH_UBX): {
             int i;
             int o_lits = BCO_GET_LARGE_ARG;
             int n_words = BCO_NEXT;
@@ -1402,10 +1607,10 @@ run_BCO:
             for (i = 0; i < n_words; i++) {
                 SpW(i) = (W_)BCO_LIT(o_lits+i);
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_SLIDE: {
+        INSN(bci_SLIDE): {
             int n  = BCO_NEXT;
             int by = BCO_NEXT;
             /* a_1, .. a_n, b_1, .. b_by, s => a_1, .. a_n, s */
@@ -1414,10 +1619,10 @@ run_BCO:
             }
             Sp_addW(by);
             INTERP_TICK(it_slides);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_ALLOC_AP: {
+        INSN(bci_ALLOC_AP): {
             StgAP* ap;
             int n_payload = BCO_NEXT;
             ap = (StgAP*)allocate(cap, AP_sizeW(n_payload));
@@ -1425,10 +1630,10 @@ run_BCO:
             ap->n_args = n_payload;
             SET_HDR(ap, &stg_AP_info, cap->r.rCCCS)
             Sp_subW(1);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_ALLOC_AP_NOUPD: {
+        INSN(bci_ALLOC_AP_NOUPD): {
             StgAP* ap;
             int n_payload = BCO_NEXT;
             ap = (StgAP*)allocate(cap, AP_sizeW(n_payload));
@@ -1436,10 +1641,10 @@ run_BCO:
             ap->n_args = n_payload;
             SET_HDR(ap, &stg_AP_NOUPD_info, cap->r.rCCCS)
             Sp_subW(1);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_ALLOC_PAP: {
+        INSN(bci_ALLOC_PAP): {
             StgPAP* pap;
             int arity = BCO_NEXT;
             int n_payload = BCO_NEXT;
@@ -1449,10 +1654,10 @@ run_BCO:
             pap->arity = arity;
             SET_HDR(pap, &stg_PAP_info, cap->r.rCCCS)
             Sp_subW(1);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_MKAP: {
+        INSN(bci_MKAP): {
             int i;
             int stkoff = BCO_NEXT;
             int n_payload = BCO_NEXT;
@@ -1472,10 +1677,10 @@ run_BCO:
                      debugBelch("\tBuilt ");
                      printObj((StgClosure*)ap);
                 );
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_MKPAP: {
+        INSN(bci_MKPAP): {
             int i;
             int stkoff = BCO_NEXT;
             int n_payload = BCO_NEXT;
@@ -1498,10 +1703,10 @@ run_BCO:
                      debugBelch("\tBuilt ");
                      printObj((StgClosure*)pap);
                 );
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_UNPACK: {
+        INSN(bci_UNPACK): {
             /* Unpack N ptr words from t.o.s constructor */
             int i;
             int n_words = BCO_NEXT;
@@ -1510,10 +1715,10 @@ run_BCO:
             for (i = 0; i < n_words; i++) {
                 SpW(i) = (W_)con->payload[i];
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PACK: {
+        INSN(bci_PACK): {
             int i;
             int o_itbl         = BCO_GET_LARGE_ARG;
             int n_words        = BCO_NEXT;
@@ -1533,40 +1738,68 @@ run_BCO:
                      debugBelch("\tBuilt ");
                      printObj((StgClosure*)con);
                 );
-            goto nextInsn;
+            NEXT_INSN;
+        }
+
+        INSN(bci_PUSH_LL_PACK): {
+            // PUSH_LL o1 o2; PACK itbl n_words, with n_words >= 2.
+            // See Note [Bytecode superinstructions].
+            int i;
+            int o1             = BCO_NEXT;
+            int o2             = BCO_NEXT;
+            int o_itbl         = BCO_GET_LARGE_ARG;
+            int n_words        = BCO_NEXT;
+            StgInfoTable* itbl = INFO_PTR_TO_STRUCT((StgInfoTable *)BCO_LIT(o_itbl));
+            int request        = CONSTR_sizeW( itbl->layout.payload.ptrs,
+                                               itbl->layout.payload.nptrs );
+            StgClosure* con = (StgClosure*)allocate_NONUPD(cap,request);
+            ASSERT(n_words >= 2);
+            SET_HDR(con, (StgInfoTable*)BCO_LIT(o_itbl), cap->r.rCCCS);
+            con->payload[0] = (StgClosure*)SpW(o2);
+            con->payload[1] = (StgClosure*)SpW(o1);
+            for (i = 2; i < n_words; i++) {
+                con->payload[i] = (StgClosure*)SpW(i-2);
+            }
+            Sp_addW(n_words - 3);
+            SpW(0) = (W_)con;
+            IF_DEBUG(interpreter,
+                     debugBelch("\tBuilt ");
+                     printObj((StgClosure*)con);
+                );
+            NEXT_INSN;
         }
 
-        case bci_TESTLT_P: {
+        INSN(bci_TESTLT_P): {
             unsigned int discr  = BCO_NEXT;
             int failto = BCO_GET_LARGE_ARG;
             StgClosure* con = (StgClosure*)SpW(0);
             if (GET_TAG(con) >= discr) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTEQ_P: {
+        INSN(bci_TESTEQ_P): {
             unsigned int discr  = BCO_NEXT;
             int failto = BCO_GET_LARGE_ARG;
             StgClosure* con = (StgClosure*)SpW(0);
             if (GET_TAG(con) != discr) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTLT_I: {
+        INSN(bci_TESTLT_I): {
             // There should be an Int at SpW(1), and an info table at SpW(0).
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
             I_ stackInt = (I_)SpW(1);
             if (stackInt >= (I_)BCO_LIT(discr))
                 bciPtr = failto;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTEQ_I: {
+        INSN(bci_TESTEQ_I): {
             // There should be an Int at SpW(1), and an info table at SpW(0).
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1574,20 +1807,20 @@ run_BCO:
             if (stackInt != (I_)BCO_LIT(discr)) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTLT_W: {
+        INSN(bci_TESTLT_W): {
             // There should be an Int at SpW(1), and an info table at SpW(0).
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
             W_ stackWord = (W_)SpW(1);
             if (stackWord >= (W_)BCO_LIT(discr))
                 bciPtr = failto;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTEQ_W: {
+        INSN(bci_TESTEQ_W): {
             // There should be an Int at SpW(1), and an info table at SpW(0).
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1595,10 +1828,10 @@ run_BCO:
             if (stackWord != (W_)BCO_LIT(discr)) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTLT_D: {
+        INSN(bci_TESTLT_D): {
             // There should be a Double at SpW(1), and an info table at SpW(0).
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1608,10 +1841,10 @@ run_BCO:
             if (stackDbl >= discrDbl) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTEQ_D: {
+        INSN(bci_TESTEQ_D): {
             // There should be a Double at SpW(1), and an info table at SpW(0).
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1621,10 +1854,10 @@ run_BCO:
             if (stackDbl != discrDbl) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTLT_F: {
+        INSN(bci_TESTLT_F): {
             // There should be a Float at SpW(1), and an info table at SpW(0).
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1634,10 +1867,10 @@ run_BCO:
             if (stackFlt >= discrFlt) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTEQ_F: {
+        INSN(bci_TESTEQ_F): {
             // There should be a Float at SpW(1), and an info table at SpW(0).
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1647,11 +1880,11 @@ run_BCO:
             if (stackFlt != discrFlt) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
         // Control-flow ish things
-        case bci_ENTER:
+        INSN(bci_ENTER):
             // Context-switch check.  We put it here to ensure that
             // the interpreter has done at least *some* work before
             // context switching: sometimes the scheduler can invoke
@@ -1663,44 +1896,110 @@ run_BCO:
             }
             goto eval;
 
-        case bci_RETURN:
+        INSN(bci_ENTER_IC): {
+            // ENTER at a call site: the function is on top of the
+            // stack, then an stg_ap_* frame and the arguments.
+            // See Note [Interpreter inline caches].
+            int o_ic      = BCO_GET_LARGE_ARG;
+            StgWord entry = BCO_LIT(o_ic);
+            if (cap->r.rHpLim == NULL) {
+                Sp_subW(1); SpW(0) = (W_)&stg_enter_info;
+                RETURN_TO_SCHEDULER(ThreadInterpret, ThreadYielding);
+            }
+            obj = UNTAG_CLOSURE((StgClosure *)SpW(0));
+            if (entry != 0 && SpW(1) == ap_frames[IC_FRAME(entry)].info
+#if defined(PROFILING)
+                // eval would wrap the function in a PAP for its CCS
+                && cap->r.rCCCS == obj->header.prof.ccs
+#endif
+                ) {
+                n = ap_frames[IC_FRAME(entry)].n;
+                if (IC_KIND(entry) == IC_BCO
+                    && get_itbl(obj)->type == BCO
+                    && ((StgBCO *)obj)->arity == n) {
+                    INTERP_TICK(it_ic_hits);
+                    Sp_addW(2);
+                    goto run_BCO_fun;
+                }
+                if (IC_KIND(entry) == IC_PAP
+                    && get_itbl(obj)->type == PAP) {
+                    StgPAP *pap = (StgPAP *)obj;
+                    uint32_t i;
+                    if (pap->arity == n
+                        && get_itbl(UNTAG_CLOSURE(pap->fun))->type == BCO
+                        && Sp_minusW(pap->n_args) >= SpLim) {
+                        INTERP_TICK(it_ic_hits);
+                        Sp_addW(2);
+                        Sp_subW(pap->n_args);
+                        for (i = 0; i < pap->n_args; i++) {
+                            SpW(i) = (W_)pap->payload[i];
+                        }
+                        obj = UNTAG_CLOSURE(pap->fun);
+#if defined(PROFILING)
+                        enterFunCCS(&cap->r, pap->header.prof.ccs);
+#endif
+                        goto run_BCO_fun;
+                    }
+                }
+            }
+            INTERP_TICK(it_ic_misses);
+            ic = &BCO_LIT(o_ic);
+            goto eval;
+        }
+
+        INSN(bci_PUSH_L_ENTER): {
+            // PUSH_L o1; SLIDE 1 by; ENTER, or just PUSH_L o1; ENTER
+            // when by is 0.  See Note [Bytecode superinstructions].
+            int o1 = BCO_NEXT;
+            int by = BCO_NEXT;
+            W_ x   = SpW(o1);
+            Sp_addW(by);
+            if (cap->r.rHpLim == NULL) {
+                Sp_subW(2); SpW(1) = x; SpW(0) = (W_)&stg_enter_info;
+                RETURN_TO_SCHEDULER(ThreadInterpret, ThreadYielding);
+            }
+            tagged_obj = (StgClosure*)x;
+            goto eval_obj;
+        }
+
+        INSN(bci_RETURN):
             tagged_obj = (StgClosure *)SpW(0);
             Sp_addW(1);
             goto do_return;
 
-        case bci_RETURN_P:
+        INSN(bci_RETURN_P):
             Sp_subW(1);
             SpW(0) = (W_)&stg_ret_p_info;
             goto do_return_unboxed;
-        case bci_RETURN_N:
+        INSN(bci_RETURN_N):
             Sp_subW(1);
             SpW(0) = (W_)&stg_ret_n_info;
             goto do_return_unboxed;
-        case bci_RETURN_F:
+        INSN(bci_RETURN_F):
             Sp_subW(1);
             SpW(0) = (W_)&stg_ret_f_info;
             goto do_return_unboxed;
-        case bci_RETURN_D:
+        INSN(bci_RETURN_D):
             Sp_subW(1);
             SpW(0) = (W_)&stg_ret_d_info;
             goto do_return_unboxed;
-        case bci_RETURN_L:
+        INSN(bci_RETURN_L):
             Sp_subW(1);
             SpW(0) = (W_)&stg_ret_l_info;
             goto do_return_unboxed;
-        case bci_RETURN_V:
+        INSN(bci_RETURN_V):
             Sp_subW(1);
             SpW(0) = (W_)&stg_ret_v_info;
             goto do_return_unboxed;
 
-        case bci_SWIZZLE: {
+        INSN(bci_SWIZZLE): {
             int stkoff = BCO_NEXT;
             signed short n = (signed short)(BCO_NEXT);
             SpW(stkoff) += (W_)n;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_CCALL: {
+        INSN(bci_CCALL): {
             void *tok;
             int stk_offset            = BCO_NEXT;
             int o_itbl                = BCO_GET_LARGE_ARG;
@@ -1834,21 +2133,24 @@ run_BCO:
             // most 2 words large, and resides at arguments[0].
             memcpy(Sp, ret, sizeof(W_) * stg_min(stk_offset,ret_size));
 
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_JMP: {
+        INSN(bci_JMP): {
             /* BCO_NEXT modifies bciPtr, so be conservative. */
             int nextpc = BCO_GET_LARGE_ARG;
             bciPtr     = nextpc;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_CASEFAIL:
+        INSN(bci_CASEFAIL):
             barf("interpretBCO: hit a CASEFAIL");
 
             // Errors
         default:
+#if defined(INTERP_COMPUTED_GOTO)
+        unknown_opcode:
+#endif
             barf("interpretBCO: unknown or unimplemented opcode %d",
                  (int)(bci & 0xFF));
 
@@ -17,6 +17,7 @@
 #include "Stats.h"
 #include "Hash.h"
 #include "LinkerInternals.h"
+#include "CheckUnload.h"
 #include "RtsUtils.h"
 #include "Trace.h"
 #include "StgPrimFloat.h" // for __int_encodeFloat etc.
@@ -30,6 +31,7 @@
 #include "linker/M32Alloc.h"
 #include "linker/CacheFlush.h"
 #include "linker/SymbolExtras.h"
+#include "linker/Parallel.h"
 #include "PathUtils.h"
 
 #if !defined(mingw32_HOST_OS)
@@ -161,6 +163,55 @@
 
    2) The number of duplicate symbols, since now only symbols that are
       true duplicates will display the error.
+
+   Note [Lazy linking]
+   --------------------------------------
+   With +RTS --linker-lazy the linker goes further:
+
+   * Every ObjectCode starts out as `OBJECT_LOADED`, not just archive
+     members, so resolveObjs() does nothing and an object is only
+     initialised when one of its symbols is looked up.
+
+   * On ELF (except where sections need PLT stubs next to them), an object
+     is only partly relocated when it is initialised: just the sections its
+     initialisers need (see ocResolve_ELF).  When a symbol is looked up,
+     loadSymbol() relocates the section defining it, and any sections of
+     the same object that its relocations refer to, transitively.  The
+     contents of small sections are only copied out of the image when they
+     are relocated; big sections are mapped from the file, so the OS
+     already only reads them when they are touched.
+
+   Since a section is only entered through a symbol lookup or a
+   relocation from another relocated section, no unrelocated code is ever
+   run.  The price is that initialisers only run when an object is first
+   used, which is why this is not the default.
+
+   Note [Parallel linking]
+   --------------------------------------
+   With +RTS --linker-threads=<n> (threaded RTS only) the per-object work
+   of linking runs on up to n OS threads (see linker/Parallel.c):
+
+   * loadArchive() reads the members one after another, then initialises
+     them (parsing the headers and extracting the symbol tables) in
+     parallel.  Their symbols are still added to symhash one member at a
+     time, in archive order, so which definition wins a conflict does not
+     change.
+
+   * resolveObjs() relocates the `OBJECT_NEEDED` objects in waves.  Before
+     a wave, the duplicate symbol check of ocTryLoad() is done for each of
+     its objects in the order of the `objects` list; after that symhash is
+     only read while the wave is relocated in parallel.  A lookup that hits
+     an `OBJECT_LOADED` object during a wave just marks it `OBJECT_NEEDED`
+     (its symbols' addresses are already known) and it is relocated in the
+     next wave.  When there are none left, the initialisers are run one
+     object at a time, in list order.  (Not on Windows, where looking up a
+     symbol can load a DLL.)
+
+   So the objects that are loaded, and the definition each symbol resolves
+   to, don't depend on how the threads were scheduled.  With --linker-lazy
+   there is nothing to resolve up front, and with --linker-index a lookup
+   may have to read an archive member (see Note [Archive symbol index] in
+   linker/LoadArchive.c), so in those cases we resolve sequentially.
  */
 /*Str*/HashTable *symhash;
 
@@ -186,6 +237,13 @@ Mutex linker_unloaded_mutex;
 /* Generic wrapper function to try and Resolve and RunInit oc files */
 int ocTryLoad( ObjectCode* oc );
 
+#if defined(THREADED_RTS)
+/* Set while resolveObjs() relocates objects in parallel, see
+ * Note [Parallel linking] */
+static bool linker_parallel_wave = false;
+static Mutex linker_wave_mutex;
+#endif
+
 /* Link objects into the lower 2Gb on x86_64.  GHC assumes the
  * small memory model on this architecture (see gcc docs,
  * -mcmodel=small).
@@ -225,11 +283,29 @@ int ocTryLoad( ObjectCode* oc );
 static void *mmap_32bit_base = (void *)MMAP_32BIT_BASE_DEFAULT;
 #endif
 
+/* The symbols of the RTS itself are not in symhash, but in an index of
+   their own; see Note [RTS symbol index] in RtsSymbols.c */
+static RtsSymbolInfo *lookupSymbolInfo(HashTable *table, const SymbolName* key)
+{
+    RtsSymbolInfo *pinfo;
+    if (table == symhash && (pinfo = lookupRtsSymbolInfo(key)) != NULL) {
+        return pinfo;
+    }
+    return lookupStrHashTable(table, key);
+}
+
 static void ghciRemoveSymbolTable(HashTable *table, const SymbolName* key,
     ObjectCode *owner)
 {
-    RtsSymbolInfo *pinfo = lookupStrHashTable(table, key);
+    RtsSymbolInfo *pinfo = lookupSymbolInfo(table, key);
     if (!pinfo || owner != pinfo->owner) return;
+    if (isRtsSymbolInfo(pinfo)) {
+        /* the object overrode an RTS symbol; put it back */
+        if (isSymbolImport (owner, key))
+          stgFree(pinfo->value);
+        restoreRtsSymbolInfo(pinfo);
+        return;
+    }
     removeStrHashTable(table, key, NULL);
     if (isSymbolImport (owner, key))
       stgFree(pinfo->value);
@@ -266,7 +342,7 @@ int ghciInsertSymbolTable(
    HsBool weak,
    ObjectCode *owner)
 {
-   RtsSymbolInfo *pinfo = lookupStrHashTable(table, key);
+   RtsSymbolInfo *pinfo = lookupSymbolInfo(table, key);
    if (!pinfo) /* new entry */
    {
       pinfo = stgMallocBytes(sizeof (*pinfo), "ghciInsertToSymbolTable");
@@ -276,9 +352,20 @@ int ghciInsertSymbolTable(
       insertStrHashTable(table, key, pinfo);
       return 1;
    }
-   else if (weak && data && pinfo->weak && !pinfo->value)
+   else if (owner && owner->deferred && pinfo->owner == owner && data)
    {
-       /* The existing symbol is weak with a zero value; replace it with the new symbol. */
+       /* We now know where a symbol registered from an archive index is,
+          see Note [Archive symbol index] in linker/LoadArchive.c */
+       pinfo->value = data;
+       pinfo->weak = weak;
+       return 1;
+   }
+   else if (weak && data && pinfo->weak && !pinfo->value
+            && !(pinfo->owner && pinfo->owner->deferred))
+   {
+       /* The existing symbol is weak with a zero value; replace it with the new symbol.
+          An archive index entry is weak with no value too, but it is a
+          definition we just haven't loaded yet, so it keeps the symbol. */
        pinfo->value = data;
        pinfo->owner = owner;
        return 1;
@@ -374,7 +461,7 @@ int ghciInsertSymbolTable(
 HsBool ghciLookupSymbolInfo(HashTable *table,
     const SymbolName* key, RtsSymbolInfo **result)
 {
-    RtsSymbolInfo *pinfo = lookupStrHashTable(table, key);
+    RtsSymbolInfo *pinfo = lookupSymbolInfo(table, key);
     if (!pinfo) {
         *result = NULL;
         return HS_BOOL_FALSE;
@@ -415,7 +502,6 @@ void initLinker (void)
 void
 initLinker_ (int retain_cafs)
 {
-    RtsSymbolVal *sym;
 #if defined(OBJFORMAT_ELF) || defined(OBJFORMAT_MACHO)
     int compileResult;
 #endif
@@ -438,6 +524,7 @@ initLinker_ (int retain_cafs)
 #if defined(THREADED_RTS)
     initMutex(&linker_mutex);
     initMutex(&linker_unloaded_mutex);
+    initMutex(&linker_wave_mutex);
 #if defined(OBJFORMAT_ELF) || defined(OBJFORMAT_MACHO)
     initMutex(&dl_mutex);
 #endif
@@ -445,15 +532,8 @@ initLinker_ (int retain_cafs)
 
     symhash = allocStrHashTable();
 
-    /* populate the symbol table with stuff from the RTS */
-    for (sym = rtsSyms; sym->lbl != NULL; sym++) {
-        if (! ghciInsertSymbolTable(WSTR("(GHCi built-in symbols)"),
-                                    symhash, sym->lbl, sym->addr,
-                                    sym->weak, NULL)) {
-            barf("ghciInsertSymbolTable failed");
-        }
-        IF_DEBUG(linker, debugBelch("initLinker: inserting rts symbol %s, %p\n", sym->lbl, sym->addr));
-    }
+    /* index the symbols of the RTS, see Note [RTS symbol index] */
+    initRtsSymbolIndex();
 #   if defined(OBJFORMAT_MACHO) && defined(powerpc_HOST_ARCH)
     machoInitSymbolsWithoutUnderscore();
 #   endif
@@ -514,8 +594,81 @@ initLinker_ (int retain_cafs)
     return;
 }
 
+/* -----------------------------------------------------------------------------
+ * Note [Linker statistics]
+ *
+ * With +RTS --linker-stats we time the phases of the linker and report them
+ * on exit.  Time is charged to the innermost phase being run: loading an
+ * object on demand while relocating another one is charged to the phases of
+ * the new object, not to the relocation of the first one as well.
+ */
+
+static Time linker_phase_time[LINKER_PHASES];
+static LinkerPhase linker_phase = LINKER_PHASE_NONE;
+static Time linker_phase_start = 0;
+static StgWord linker_objects_loaded = 0;
+static StgWord linker_objects_resolved = 0;
+StgWord linker_lazy_sections_resolved = 0;
+StgWord linker_lazy_sections = 0;
+
+LinkerPhase switchLinkerPhase (LinkerPhase phase)
+{
+    LinkerPhase prev = linker_phase;
+    Time now;
+
+    if (RtsFlags.MiscFlags.linkerStats) {
+        now = getProcessElapsedTime();
+        linker_phase_time[prev] += now - linker_phase_start;
+        linker_phase_start = now;
+    }
+    linker_phase = phase;
+    return prev;
+}
+
+static void
+reportLinkerStats (void)
+{
+    static const char *names[LINKER_PHASES] = {
+        NULL, "reading", "verifying", "symbols", "jump islands",
+        "relocation", "initialisers"
+    };
+    Time total = 0;
+    uint32_t i;
+
+    for (i = LINKER_PHASE_PRELOAD; i < LINKER_PHASES; i++) {
+        total += linker_phase_time[i];
+    }
+    debugBelch("Linker: %.3fs in total\n", TimeToUS(total) / 1000000.0);
+    for (i = LINKER_PHASE_PRELOAD; i < LINKER_PHASES; i++) {
+        debugBelch("  %-14s %.3fs\n", names[i],
+                   TimeToUS(linker_phase_time[i]) / 1000000.0);
+    }
+    debugBelch("  %" FMT_Word " of %" FMT_Word " objects initialised\n",
+               linker_objects_resolved, linker_objects_loaded);
+    if (RtsFlags.MiscFlags.linkerLazy) {
+        debugBelch("  %" FMT_Word " of %" FMT_Word " sections relocated\n",
+                   linker_lazy_sections_resolved, linker_lazy_sections);
+    }
+    if (RTS_LINKER_USE_MMAP) {
+        static const char *arenas[M32_ARENAS] = { "text", "data", "rodata" };
+        M32Stats st;
+        for (i = 0; i < M32_ARENAS; i++) {
+            m32_stats(i, &st);
+            debugBelch("  m32 %-6s %" FMT_Word64 " pages, %" FMT_Word64
+                       " bytes in large objects, %" FMT_Word64
+                       " bytes allocated, %" FMT_Word64 " bytes padding, %"
+                       FMT_Word64 " bytes wasted\n", arenas[i],
+                       st.pages, st.large, st.allocated, st.padding,
+                       st.wasted);
+        }
+    }
+}
+
 void
 exitLinker( void ) {
+   if (RtsFlags.MiscFlags.linkerStats && linker_init_done == 1) {
+       reportLinkerStats();
+   }
 #if defined(OBJFORMAT_PEi386)
    exitLinker_PEi386();
 #endif
@@ -530,8 +683,10 @@ exitLinker( void ) {
 #endif
    if (linker_init_done == 1) {
        freeHashTable(symhash, free);
+       exitRtsSymbolIndex();
    }
 #if defined(THREADED_RTS)
+   closeMutex(&linker_wave_mutex);
    closeMutex(&linker_mutex);
 #endif
 }
@@ -882,9 +1037,26 @@ SymbolAddr* loadSymbol(SymbolName *lbl, RtsSymbolInfo *pinfo) {
                                 pinfo->value));
     ObjectCode* oc = pinfo->owner;
 
+#if defined(OBJFORMAT_ELF)
+    /* The object hasn't even been read yet, see Note [Archive symbol index]
+       in linker/LoadArchive.c */
+    if (oc && oc->deferred && !loadArchiveMember(oc)) {
+        return NULL;
+    }
+#endif
+
     /* Symbol can be found during linking, but hasn't been relocated. Do so now.
         See Note [runtime-linker-phases] */
     if (oc && lbl && oc->status == OBJECT_LOADED) {
+#if defined(THREADED_RTS)
+        if (linker_parallel_wave) {
+            /* relocated in the next wave, see Note [Parallel linking] */
+            ACQUIRE_LOCK(&linker_wave_mutex);
+            oc->status = OBJECT_NEEDED;
+            RELEASE_LOCK(&linker_wave_mutex);
+            return pinfo->value;
+        }
+#endif
         oc->status = OBJECT_NEEDED;
         IF_DEBUG(linker, debugBelch("lookupSymbol: on-demand "
                                     "loading symbol '%s'\n", lbl));
@@ -900,6 +1072,18 @@ SymbolAddr* loadSymbol(SymbolName *lbl, RtsSymbolInfo *pinfo) {
 #endif
     }
 
+#if defined(OBJFORMAT_ELF)
+    /* Relocate the section the symbol is in, see Note [Lazy linking] */
+    if (oc && oc->lazySections) {
+        LinkerPhase prev = switchLinkerPhase(LINKER_PHASE_RESOLVE);
+        int r = ocResolveSymbol_ELF(oc, pinfo->value);
+        switchLinkerPhase(prev);
+        if (!r) {
+            return NULL;
+        }
+    }
+#endif
+
     return pinfo->value;
 }
 
@@ -1099,7 +1283,7 @@ mmap_again:
  * Remove symbols from the symbol table, and free oc->symbols.
  * This operation is idempotent.
  */
-static void removeOcSymbols (ObjectCode *oc)
+void removeOcSymbols (ObjectCode *oc)
 {
     if (oc->symbols == NULL) return;
 
@@ -1167,6 +1351,11 @@ void freeObjectCode (ObjectCode *oc)
         oc->symbols = NULL;
     }
 
+    if (oc->indexNames != NULL) {
+        stgFree(oc->indexNames);
+        oc->indexNames = NULL;
+    }
+
     if (oc->extraInfos != NULL) {
         freeHashTable(oc->extraInfos, NULL);
         oc->extraInfos = NULL;
@@ -1235,7 +1424,8 @@ void freeObjectCode (ObjectCode *oc)
 * Sets the initial status of a fresh ObjectCode
 */
 static void setOcInitialStatus(ObjectCode* oc) {
-    if (oc->archiveMemberName == NULL) {
+    /* See Note [Lazy linking] */
+    if (oc->archiveMemberName == NULL && !RtsFlags.MiscFlags.linkerLazy) {
         oc->status = OBJECT_NEEDED;
     } else {
         oc->status = OBJECT_LOADED;
@@ -1289,6 +1479,10 @@ mkOc( pathchar *path, char *image, int imageSize,
 
    oc->misalignment      = misalignment;
    oc->extraInfos        = NULL;
+   oc->lazySections      = false;
+   oc->archiveOffset     = 0;
+   oc->deferred          = false;
+   oc->indexNames        = NULL;
 
    /* chain it onto the list of objects */
    oc->next              = NULL;
@@ -1471,12 +1665,14 @@ static HsInt loadObj_ (pathchar *path)
 HsInt loadObj (pathchar *path)
 {
    ACQUIRE_LOCK(&linker_mutex);
+   LinkerPhase prev = switchLinkerPhase(LINKER_PHASE_PRELOAD);
    HsInt r = loadObj_(path);
+   switchLinkerPhase(prev);
    RELEASE_LOCK(&linker_mutex);
    return r;
 }
 
-HsInt loadOc (ObjectCode* oc)
+static HsInt loadOc_ (ObjectCode* oc)
 {
    int r;
 
@@ -1511,6 +1707,7 @@ HsInt loadOc (ObjectCode* oc)
       library in the next few steps.  */
 
    /* build the symbol list for this image */
+   switchLinkerPhase(LINKER_PHASE_GETNAMES);
 #  if defined(OBJFORMAT_ELF)
    r = ocGetNames_ELF ( oc );
 #  elif defined(OBJFORMAT_PEi386)
@@ -1526,6 +1723,7 @@ HsInt loadOc (ObjectCode* oc)
    }
 
 #if defined(NEED_SYMBOL_EXTRAS)
+   switchLinkerPhase(LINKER_PHASE_EXTRAS);
 #  if defined(OBJFORMAT_MACHO)
    r = ocAllocateSymbolExtras_MachO ( oc );
    if (!r) {
@@ -1552,18 +1750,25 @@ HsInt loadOc (ObjectCode* oc)
    return 1;
 }
 
-/* -----------------------------------------------------------------------------
-* try to load and initialize an ObjectCode into memory
-*
-* Returns: 1 if ok, 0 on error.
-*/
-int ocTryLoad (ObjectCode* oc) {
-    int r;
-
-    if (oc->status != OBJECT_NEEDED) {
-        return 1;
-    }
+HsInt loadOc (ObjectCode* oc)
+{
+   LinkerPhase prev = switchLinkerPhase(LINKER_PHASE_VERIFY);
+   HsInt r = loadOc_(oc);
+   switchLinkerPhase(prev);
+   if (r) {
+       linker_objects_loaded++;
+   }
+   return r;
+}
 
+/* -----------------------------------------------------------------------------
+ * Check that none of the symbols of oc, which is about to be resolved, is
+ * also defined by an object that is, or is going to be, resolved.
+ *
+ * Returns: 1 if ok, 0 on error.
+ */
+static int ocCheckDuplicates (ObjectCode* oc)
+{
     /*  Check for duplicate symbols by looking into `symhash`.
         Duplicate symbols are any symbols which exist
         in different ObjectCodes that have both been loaded, or
@@ -1585,19 +1790,26 @@ int ocTryLoad (ObjectCode* oc) {
             return 0;
         }
     }
+    return 1;
+}
 
+static int ocResolve (ObjectCode* oc)
+{
 #   if defined(OBJFORMAT_ELF)
-    r = ocResolve_ELF ( oc );
+    return ocResolve_ELF ( oc );
 #   elif defined(OBJFORMAT_PEi386)
-    r = ocResolve_PEi386 ( oc );
+    return ocResolve_PEi386 ( oc );
 #   elif defined(OBJFORMAT_MACHO)
-    r = ocResolve_MachO ( oc );
+    return ocResolve_MachO ( oc );
 #   else
     barf("ocTryLoad: not implemented on this platform");
 #   endif
-    if (!r) { return r; }
+}
 
-    // run init/init_array/ctors/mod_init_func
+// run init/init_array/ctors/mod_init_func
+static int ocRunInit (ObjectCode* oc)
+{
+    int r;
 
     loading_obj = oc; // tells foreignExportStablePtr what to do
 #if defined(OBJFORMAT_ELF)
@@ -1610,14 +1822,109 @@ int ocTryLoad (ObjectCode* oc) {
     barf("ocTryLoad: initializers not implemented on this platform");
 #endif
     loading_obj = NULL;
+    return r;
+}
+
+/* -----------------------------------------------------------------------------
+* try to load and initialize an ObjectCode into memory
+*
+* Returns: 1 if ok, 0 on error.
+*/
+int ocTryLoad (ObjectCode* oc) {
+    int r;
+
+    if (oc->status != OBJECT_NEEDED) {
+        return 1;
+    }
+
+    if (!ocCheckDuplicates(oc)) {
+        return 0;
+    }
+
+    LinkerPhase prev = switchLinkerPhase(LINKER_PHASE_RESOLVE);
+    r = ocResolve(oc);
+    if (!r) {
+        switchLinkerPhase(prev);
+        return r;
+    }
+
+    switchLinkerPhase(LINKER_PHASE_INIT);
+    r = ocRunInit(oc);
+    switchLinkerPhase(prev);
 
     if (!r) { return r; }
 
     oc->status = OBJECT_RESOLVED;
+    linker_objects_resolved++;
 
     return 1;
 }
 
+#if defined(THREADED_RTS) && !defined(OBJFORMAT_PEi386)
+/* -----------------------------------------------------------------------------
+ * resolve the needed objects among ocs, which are in the order of the
+ * objects list, on several threads.  See Note [Parallel linking].
+ *
+ * Returns: 1 if ok, 0 on error.
+ */
+static HsInt resolveObjsParallel (ObjectCode **ocs, uint32_t n)
+{
+    ObjectCode **wave;
+    bool *relocated;
+    uint32_t i, n_wave;
+    HsInt r = 0;
+
+    wave = stgMallocBytes(n * sizeof(ObjectCode*), "resolveObjsParallel");
+    relocated = stgCallocBytes(n, sizeof(bool), "resolveObjsParallel");
+
+    LinkerPhase prev = switchLinkerPhase(LINKER_PHASE_RESOLVE);
+
+    while (1) {
+        n_wave = 0;
+        for (i = 0; i < n; i++) {
+            if (ocs[i]->status == OBJECT_NEEDED && !relocated[i]) {
+                if (!ocCheckDuplicates(ocs[i])) {
+                    goto fail;
+                }
+                relocated[i] = true;
+                wave[n_wave++] = ocs[i];
+            }
+        }
+        if (n_wave == 0) {
+            break;
+        }
+
+        IF_DEBUG(linker, debugBelch("resolveObjs: relocating %" FMT_Word32
+                                    " objects in parallel\n", n_wave));
+        linker_parallel_wave = true;
+        r = forEachObject(wave, n_wave, ocResolve);
+        linker_parallel_wave = false;
+        if (!r) {
+            goto fail;
+        }
+    }
+
+    r = 0;
+    switchLinkerPhase(LINKER_PHASE_INIT);
+    for (i = 0; i < n; i++) {
+        if (relocated[i]) {
+            if (!ocRunInit(ocs[i])) {
+                goto fail;
+            }
+            ocs[i]->status = OBJECT_RESOLVED;
+            linker_objects_resolved++;
+        }
+    }
+    r = 1;
+
+fail:
+    switchLinkerPhase(prev);
+    stgFree(relocated);
+    stgFree(wave);
+    return r;
+}
+#endif
+
 /* -----------------------------------------------------------------------------
  * resolve all the currently unlinked objects in memory
  *
@@ -1630,12 +1937,36 @@ static HsInt resolveObjs_ (void)
 
     IF_DEBUG(linker, debugBelch("resolveObjs: start\n"));
 
+#if defined(THREADED_RTS) && !defined(OBJFORMAT_PEi386)
+    uint32_t n = 0;
     for (oc = objects; oc; oc = oc->next) {
-        r = ocTryLoad(oc);
-        if (!r)
-        {
+        n++;
+    }
+
+    if (!RtsFlags.MiscFlags.linkerLazy
+        && RtsFlags.MiscFlags.linkerIndexDir == NULL
+        && linkerThreads(n) > 1) {
+        ObjectCode **ocs = stgMallocBytes(n * sizeof(ObjectCode*),
+                                          "resolveObjs");
+        n = 0;
+        for (oc = objects; oc; oc = oc->next) {
+            ocs[n++] = oc;
+        }
+        r = resolveObjsParallel(ocs, n);
+        stgFree(ocs);
+        if (!r) {
             return r;
         }
+    } else
+#endif
+    {
+        for (oc = objects; oc; oc = oc->next) {
+            r = ocTryLoad(oc);
+            if (!r)
+            {
+                return r;
+            }
+        }
     }
 
 #if defined(PROFILING)
@@ -1689,6 +2020,7 @@ static HsInt unloadObj_ (pathchar *path, bool just_purge)
                 oc->next = unloaded_objects;
                 unloaded_objects = oc;
                 oc->status = OBJECT_UNLOADED;
+                indexUnloadedObject(oc);
                 RELEASE_LOCK(&linker_unloaded_mutex);
                 // We do not own oc any more; it can be released at any time by
                 // the GC in checkUnload().
@@ -200,6 +200,18 @@ typedef struct _ObjectCode {
        require extra information.*/
     HashTable *extraInfos;
 
+    /* Sections are only relocated when something in them is needed, see
+       Note [Lazy linking] in Linker.c. */
+    bool lazySections;
+
+    /* Where this object is in its archive.  If it is `deferred`, its
+       symbols were registered from the archive's index and it hasn't been
+       read yet; indexNames holds the names of those symbols.  See
+       Note [Archive symbol index] in linker/LoadArchive.c. */
+    long archiveOffset;
+    bool deferred;
+    char *indexNames;
+
 } ObjectCode;
 
 #define OC_INFORMATIVE_FILENAME(OC)             \
@@ -239,7 +251,29 @@ typedef struct _RtsSymbolInfo {
 
 void exitLinker( void );
 
+/* The phases of the linker, for +RTS --linker-stats.  See Note [Linker
+   statistics] in Linker.c. */
+typedef enum {
+    LINKER_PHASE_NONE,          /* not in the linker */
+    LINKER_PHASE_PRELOAD,       /* reading object files and archives */
+    LINKER_PHASE_VERIFY,        /* checking object file headers */
+    LINKER_PHASE_GETNAMES,      /* allocating sections, adding symbols */
+    LINKER_PHASE_EXTRAS,        /* allocating jump islands */
+    LINKER_PHASE_RESOLVE,       /* relocating */
+    LINKER_PHASE_INIT,          /* running initialisers */
+    LINKER_PHASES
+} LinkerPhase;
+
+/* Charge the time from now on to the given phase; returns the phase that
+   was being charged before, which must be switched back to afterwards. */
+LinkerPhase switchLinkerPhase (LinkerPhase phase);
+
+/* Sections relocated, and sections that might have been, in lazy mode */
+extern StgWord linker_lazy_sections_resolved;
+extern StgWord linker_lazy_sections;
+
 void freeObjectCode (ObjectCode *oc);
+void removeOcSymbols (ObjectCode *oc);
 SymbolAddr* loadSymbol(SymbolName *lbl, RtsSymbolInfo *pinfo);
 
 void *mmapForLinker (size_t bytes, uint32_t flags, int fd, int offset);
@@ -295,6 +329,7 @@ resolveSymbolAddr (pathchar* buffer, int size,
 
 HsInt isAlreadyLoaded( pathchar *path );
 HsInt loadOc( ObjectCode* oc );
+HsInt loadArchiveMember( ObjectCode* oc );
 ObjectCode* mkOc( pathchar *path, char *image, int imageSize,
                   bool mapped, char *archiveMemberName,
                   int misalignment
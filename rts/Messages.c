@@ -23,11 +23,19 @@
 
 void sendMessage(Capability *from_cap, Capability *to_cap, Message *msg)
 {
-    ACQUIRE_LOCK(&to_cap->lock);
+    sendMessages(from_cap, to_cap, msg, msg);
+}
+
+// Send a chain of messages, linked from hd to tl, taking the lock and
+// waking up the target Capability only once.
+void sendMessages(Capability *from_cap, Capability *to_cap,
+                  Message *hd, Message *tl)
+{
+    Message *m;
 
+    for (m = hd; ; m = m->link) {
 #if defined(DEBUG)
-    {
-        const StgInfoTable *i = msg->header.info;
+        const StgInfoTable *i = m->header.info;
         if (i != &stg_MSG_THROWTO_info &&
             i != &stg_MSG_BLACKHOLE_info &&
             i != &stg_MSG_TRY_WAKEUP_info &&
@@ -35,13 +43,15 @@ void sendMessage(Capability *from_cap, Capability *to_cap, Message *msg)
             i != &stg_WHITEHOLE_info) {
             barf("sendMessage: %p", i);
         }
-    }
 #endif
+        recordClosureMutated(from_cap,(StgClosure*)m);
+        if (m == tl) break;
+    }
 
-    msg->link = to_cap->inbox;
-    to_cap->inbox = msg;
+    ACQUIRE_LOCK(&to_cap->lock);
 
-    recordClosureMutated(from_cap,(StgClosure*)msg);
+    tl->link = to_cap->inbox;
+    to_cap->inbox = hd;
 
     if (to_cap->running_task == NULL) {
         to_cap->running_task = myTask();
@@ -93,6 +93,18 @@ typedef struct {
 static Census *censuses = NULL;
 static uint32_t n_censuses = 0;
 
+// Work for a parallel heap census, see heapCensusParallel()
+typedef struct {
+    bdescr *bd;      // first block of the chunk
+    bdescr *end;     // first block after the chunk, or NULL
+} CensusChunk;
+
+static CensusChunk *census_chunks = NULL;
+static StgWord n_census_chunks = 0;
+static StgWord census_chunks_size = 0;
+static volatile StgWord next_census_chunk;
+static Census *census_partials = NULL;
+
 #if defined(PROFILING)
 static void aggregateCensusInfo( void );
 #endif
@@ -507,6 +519,7 @@ endHeapProfiling(void)
 #endif
 
     stgFree(censuses);
+    stgFree(census_chunks);
 
     seconds = mut_user_time();
     printSample(true, seconds);
@@ -970,15 +983,16 @@ heapCensusCompactList(Census *census, bdescr *bd)
 /* -----------------------------------------------------------------------------
  * Code to perform a heap census.
  * -------------------------------------------------------------------------- */
+// Take a census of the blocks from bd up to, but not including, end.
 static void
-heapCensusChain( Census *census, bdescr *bd )
+heapCensusBlocks( Census *census, bdescr *bd, bdescr *end )
 {
     StgPtr p;
     const StgInfoTable *info;
     size_t size;
     bool prim;
 
-    for (; bd != NULL; bd = bd->link) {
+    for (; bd != end; bd = bd->link) {
 
         // HACK: pretend a pinned block is just one big ARR_WORDS
         // owned by CCS_PINNED.  These blocks can be full of holes due
@@ -1159,6 +1173,143 @@ heapCensusChain( Census *census, bdescr *bd )
     }
 }
 
+static void
+heapCensusChain( Census *census, bdescr *bd )
+{
+    heapCensusBlocks(census, bd, NULL);
+}
+
+/* -----------------------------------------------------------------------------
+ * Parallel heap census
+ *
+ * After a parallel GC the other GC threads are idle until the mutator
+ * restarts, so we use them to take the census (see runOnGcThreads()).
+ * The block chains to be censused are cut into chunks of
+ * CENSUS_CHUNK_BLOCKS blocks, which the threads claim one at a time, so
+ * that a single large generation is spread across all of them.  Each
+ * thread counts into its own partial Census, and the partials are merged
+ * into the real one at the end; the result is the same as for a
+ * sequential census, apart from the order of the counters.
+ * -------------------------------------------------------------------------- */
+
+#define CENSUS_CHUNK_BLOCKS 64
+
+
+static void
+addCensusChunk( bdescr *bd, bdescr *end )
+{
+    if (n_census_chunks == census_chunks_size) {
+        census_chunks_size = census_chunks_size == 0 ? 1024
+                                                     : census_chunks_size * 2;
+        census_chunks = stgReallocBytes(census_chunks,
+                                        census_chunks_size * sizeof(CensusChunk),
+                                        "addCensusChunk");
+    }
+    census_chunks[n_census_chunks].bd  = bd;
+    census_chunks[n_census_chunks].end = end;
+    n_census_chunks++;
+}
+
+static void
+addCensusChain( bdescr *bd )
+{
+    bdescr *start;
+    uint32_t n;
+
+    while (bd != NULL) {
+        start = bd;
+        for (n = 0; bd != NULL && n < CENSUS_CHUNK_BLOCKS; n++) {
+            bd = bd->link;
+        }
+        addCensusChunk(start, bd);
+    }
+}
+
+static void
+heapCensusWorker( uint32_t thread_index, void *user STG_UNUSED )
+{
+    Census *census = &census_partials[thread_index];
+    StgWord i;
+
+    for (;;) {
+        i = atomic_inc(&next_census_chunk, 1) - 1;
+        if (i >= n_census_chunks) break;
+        heapCensusBlocks(census, census_chunks[i].bd, census_chunks[i].end);
+    }
+}
+
+// Add the counts in src to dst
+static void
+mergeCensus( Census *dst, Census *src )
+{
+    counter *c, *d;
+
+    dst->prim     += src->prim;
+    dst->not_used += src->not_used;
+    dst->used     += src->used;
+
+    for (c = src->ctrs; c != NULL; c = c->next) {
+        d = lookupHashTable(dst->hash, (StgWord)c->identity);
+        if (d == NULL) {
+            d = arenaAlloc(dst->arena, sizeof(counter));
+            *d = *c;
+            insertHashTable(dst->hash, (StgWord)d->identity, d);
+            d->next = dst->ctrs;
+            dst->ctrs = d;
+            continue;
+        }
+#if defined(PROFILING)
+        if (RtsFlags.ProfFlags.bioSelector != NULL) {
+            d->c.ldv.prim     += c->c.ldv.prim;
+            d->c.ldv.not_used += c->c.ldv.not_used;
+            d->c.ldv.used     += c->c.ldv.used;
+        } else
+#endif
+        {
+            d->c.resid += c->c.resid;
+        }
+    }
+}
+
+static void
+heapCensusParallel( Census *census )
+{
+    uint32_t g, n;
+    gen_workspace *ws;
+
+    n_census_chunks = 0;
+    next_census_chunk = 0;
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        addCensusChain(generations[g].blocks);
+        addCensusChain(generations[g].large_objects);
+        for (n = 0; n < n_capabilities; n++) {
+            ws = &gc_threads[n]->gens[g];
+            addCensusChain(ws->todo_bd);
+            addCensusChain(ws->part_list);
+            addCensusChain(ws->scavd_list);
+        }
+    }
+
+    census_partials = stgMallocBytes(n_capabilities * sizeof(Census),
+                                     "heapCensusParallel");
+    for (n = 0; n < n_capabilities; n++) {
+        initEra(&census_partials[n]);
+    }
+
+    runOnGcThreads(heapCensusWorker, NULL);
+
+    for (n = 0; n < n_capabilities; n++) {
+        mergeCensus(census, &census_partials[n]);
+        freeEra(&census_partials[n]);
+    }
+    stgFree(census_partials);
+    census_partials = NULL;
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        heapCensusCompactList(census, generations[g].compact_objects);
+    }
+}
+
 void heapCensus (Time t)
 {
   uint32_t g, n;
@@ -1180,18 +1331,22 @@ void heapCensus (Time t)
 #endif
 
   // Traverse the heap, collecting the census info
-  for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
-      heapCensusChain( census, generations[g].blocks );
-      // Are we interested in large objects?  might be
-      // confusing to include the stack in a heap profile.
-      heapCensusChain( census, generations[g].large_objects );
-      heapCensusCompactList ( census, generations[g].compact_objects );
-
-      for (n = 0; n < n_capabilities; n++) {
-          ws = &gc_threads[n]->gens[g];
-          heapCensusChain(census, ws->todo_bd);
-          heapCensusChain(census, ws->part_list);
-          heapCensusChain(census, ws->scavd_list);
+  if (n_gc_threads > 1) {
+      heapCensusParallel(census);
+  } else {
+      for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+          heapCensusChain( census, generations[g].blocks );
+          // Are we interested in large objects?  might be
+          // confusing to include the stack in a heap profile.
+          heapCensusChain( census, generations[g].large_objects );
+          heapCensusCompactList ( census, generations[g].compact_objects );
+
+          for (n = 0; n < n_capabilities; n++) {
+              ws = &gc_threads[n]->gens[g];
+              heapCensusChain(census, ws->todo_bd);
+              heapCensusChain(census, ws->part_list);
+              heapCensusChain(census, ws->scavd_list);
+          }
       }
   }
 
@@ -12,6 +12,7 @@
 #include "Profiling.h"
 #include "Proftimer.h"
 #include "Capability.h"
+#include "Trace.h"
 
 #if defined(PROFILING)
 static bool do_prof_ticks = false;       // enable profiling ticks
@@ -66,6 +67,22 @@ initProfTimer( void )
     startHeapProfTimer();
 }
 
+bool
+profTicksWanted(void)
+{
+#if defined(PROFILING)
+    if (do_prof_ticks) {
+        return true;
+    }
+#endif
+#if defined(TRACING)
+    if (TRACE_stack_samples) {
+        return true;
+    }
+#endif
+    return do_heap_prof_ticks;
+}
+
 uint32_t total_ticks = 0;
 
 void
@@ -81,6 +98,22 @@ handleProfTick(void)
     }
 #endif
 
+#if defined(TRACING)
+    if (RTS_UNLIKELY(TRACE_stack_samples)) {
+        // Ask every Capability running Haskell code to stop, so that
+        // the scheduler can sample its stack.  See Note [Stack
+        // sampling] in Trace.c.
+        uint32_t n;
+        for (n=0; n < n_capabilities; n++) {
+            Capability *cap = capabilities[n];
+            if (cap->in_haskell) {
+                cap->stack_sample = 1;
+                stopCapability(cap);
+            }
+        }
+    }
+#endif
+
     if (do_heap_prof_ticks) {
         ticks_to_heap_profile--;
         if (ticks_to_heap_profile <= 0) {
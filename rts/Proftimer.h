@@ -16,6 +16,9 @@ void handleProfTick     ( void );
 void stopHeapProfTimer  ( void );
 void startHeapProfTimer ( void );
 
+// Does handleProfTick() have anything to do?
+bool profTicksWanted    ( void );
+
 extern bool performHeapProfile;
 
 #include "EndPrivate.h"
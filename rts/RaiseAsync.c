@@ -195,6 +195,51 @@ throwToSelf (Capability *cap, StgTSO *tso, StgClosure *exception)
 
    -------------------------------------------------------------------------- */
 
+/*
+   Note [Batched throwTo]
+   ~~~~~~~~~~~~~~~~~~~~~~
+   When many threads time out at once (System.Timeout forks a thread to
+   throwTo each one), most of the throwTos target threads on other
+   Capabilities.  Sending each message on its own takes the target
+   Capability's lock and interrupts it, once per message.
+
+   So throwToSendMsg() doesn't send the message straight away, but puts
+   it on the sending Capability's outbox, and the scheduler sends them
+   with flushThrowTos(), which takes each target Capability's lock and
+   interrupts it only once per batch.  The thread that called throwTo is
+   blocked in BlockedOnMsgThrowTo anyway, so the scheduler only puts off
+   the flush while the thread it has just run blocked in a throwTo, it
+   has more threads to run, and fewer than THROWTO_BATCH messages are
+   waiting; any other reason for a thread to stop, including a context
+   switch, sends them.  While the flush is put off the next thread runs
+   with the messages still waiting, and it need not stop by itself
+   soon, so each tick also context switches every Capability that has
+   messages waiting (see handleThrowToTick() in Timer.c): no message
+   waits for much longer than a tick.  In --tickless mode a Capability
+   with messages waiting counts as wanting ticks (see
+   capabilityWantsTicks()), even if the thread it is running was the
+   last one in its run queue, so the ticker doesn't go quiet on them.
+   A Capability never goes idle, makes a safe
+   foreign call or takes part in a GC with messages waiting (see
+   scheduleDoGC() and suspendThread()), and the GC treats the outbox as
+   a root.
+
+   A message revoked while it waits (because the sender was killed) is
+   simply dropped.  The target may have moved by the time we send the
+   message, but the receiving Capability forwards it as usual.
+
+   Two more shortcuts avoid work for timeouts:
+
+   - throwTo() raises the exception without allocating a message at all
+     when the target is on our Capability, running and not masking
+     exceptions, and returns immediately when the target has finished.
+
+   - raiseAsync() doesn't build an AP_STACK for an update frame whose
+     thunk has already been updated by another thread: the computation
+     it would save is already done, so the thunk itself stands in for
+     it, and the stack chunk is just dropped.
+*/
+
 MessageThrowTo *
 throwTo (Capability *cap,       // the Capability we hold
          StgTSO *source,        // the TSO sending the exception (or NULL)
@@ -203,6 +248,18 @@ throwTo (Capability *cap,       // the Capability we hold
 {
     MessageThrowTo *msg;
 
+    // Fast paths that need no message; see Note [Batched throwTo]
+    if (target->what_next == ThreadComplete
+        || target->what_next == ThreadKilled) {
+        return NULL;
+    }
+    if (target->cap == cap
+        && target->why_blocked == NotBlocked
+        && (target->flags & TSO_BLOCKEX) == 0) {
+        raiseAsync(cap, target, exception, false, NULL);
+        return NULL;
+    }
+
     msg = (MessageThrowTo *) allocate(cap, sizeofW(MessageThrowTo));
     // the message starts locked; see below
     SET_HDR(msg, &stg_WHITEHOLE_info, CCS_SYSTEM);
@@ -492,18 +549,69 @@ check_target:
 }
 
 static void
-throwToSendMsg (Capability *cap STG_UNUSED,
+throwToSendMsg (Capability *cap USED_IF_THREADS,
                 Capability *target_cap USED_IF_THREADS,
                 MessageThrowTo *msg USED_IF_THREADS)
 
 {
 #if defined(THREADED_RTS)
-    debugTraceCap(DEBUG_sched, cap, "throwTo: sending a throwto message to cap %lu", (unsigned long)target_cap->no);
+    debugTraceCap(DEBUG_sched, cap, "throwTo: queueing a throwto message to cap %lu", (unsigned long)target_cap->no);
 
-    sendMessage(cap, target_cap, (Message*)msg);
+    // sent by flushThrowTos(); see Note [Batched throwTo]
+    msg->link = (MessageThrowTo*)cap->outbox;
+    cap->outbox = (Message*)msg;
+    cap->n_outbox++;
 #endif
 }
 
+#if defined(THREADED_RTS)
+// Send the messages on our outbox, one batch per target Capability.
+void
+flushThrowTos (Capability *cap)
+{
+    Message *m, *next, *hd, *tl, **prev;
+    Capability *to_cap;
+    uint32_t n STG_UNUSED;
+
+    while (cap->outbox != (Message*)END_TSO_QUEUE) {
+        // take the messages for the same Capability as the first one
+        to_cap = NULL;
+        hd = tl = NULL;
+        n = 0;
+        prev = &cap->outbox;
+        for (m = cap->outbox; m != (Message*)END_TSO_QUEUE; m = next) {
+            next = m->link;
+            if (m->header.info == &stg_MSG_NULL_info) {
+                // revoked while waiting
+                *prev = next;
+                continue;
+            }
+            if (to_cap == NULL) {
+                to_cap = ((MessageThrowTo*)m)->target->cap;
+            } else if (((MessageThrowTo*)m)->target->cap != to_cap) {
+                prev = &m->link;
+                continue;
+            }
+            *prev = next;
+            if (hd == NULL) {
+                hd = m;
+            } else {
+                tl->link = m;
+            }
+            tl = m;
+            n++;
+        }
+        if (hd != NULL) {
+            debugTraceCap(DEBUG_sched, cap,
+                          "throwTo: sending %u throwto messages to cap %lu",
+                          n, (unsigned long)to_cap->no);
+            sendMessages(cap, to_cap, hd, tl);
+        }
+    }
+    cap->n_outbox = 0;
+}
+#endif
+
 // Block a throwTo message on the target TSO's blocked_exceptions
 // queue.  The current Capability must own the target TSO in order to
 // modify the blocked_exceptions queue.
@@ -766,6 +874,28 @@ removeFromQueues(Capability *cap, StgTSO *tso)
  *
  * -------------------------------------------------------------------------- */
 
+// Has a thunk under evaluation by this thread been updated with its
+// value by some other thread?
+static bool
+alreadyUpdated (StgTSO *tso, StgClosure *thunk)
+{
+    const StgInfoTable *i;
+    StgClosure *v;
+
+    if (thunk->header.info != &stg_BLACKHOLE_info) {
+        return false;
+    }
+    v = UNTAG_CLOSURE(((StgInd*)thunk)->indirectee);
+    if ((StgTSO*)v == tso) {
+        return false;
+    }
+    i = v->header.info;
+    return i != &stg_TSO_info &&
+           i != &stg_BLOCKING_QUEUE_CLEAN_info &&
+           i != &stg_BLOCKING_QUEUE_DIRTY_info &&
+           i != &stg_WHITEHOLE_info;
+}
+
 StgTSO *
 raiseAsync(Capability *cap, StgTSO *tso, StgClosure *exception,
            bool stop_at_atomically, StgUpdateFrame *stop_here)
@@ -775,6 +905,7 @@ raiseAsync(Capability *cap, StgTSO *tso, StgClosure *exception,
     StgClosure *updatee;
     uint32_t i;
     StgStack *stack;
+    bool check_bqs = false;
 
     debugTraceCap(DEBUG_sched, cap,
                   "raising exception in thread %ld.", (long)tso->id);
@@ -855,6 +986,18 @@ raiseAsync(Capability *cap, StgTSO *tso, StgClosure *exception,
             StgAP_STACK * ap;
             uint32_t words;
 
+            if (((StgUpdateFrame *)frame)->updatee != updatee &&
+                alreadyUpdated(tso, ((StgUpdateFrame *)frame)->updatee)) {
+                // Another thread has finished this computation, so
+                // there's nothing to save: drop the chunk and continue
+                // with the thunk.  See Note [Batched throwTo].
+                sp = frame + sizeofW(StgUpdateFrame) - 1;
+                sp[0] = (W_)((StgUpdateFrame *)frame)->updatee;
+                frame = sp + 1;
+                check_bqs = true;
+                continue;
+            }
+
             // First build an AP_STACK consisting of the stack chunk above the
             // current update frame, with the top word on the stack as the
             // fun field.
@@ -890,8 +1033,6 @@ raiseAsync(Capability *cap, StgTSO *tso, StgClosure *exception,
                 ap = (StgAP_STACK*)updatee;
             } else {
                 // Perform the update
-                // TODO: this may waste some work, if the thunk has
-                // already been updated by another thread.
                 updateThunk(cap, tso,
                             ((StgUpdateFrame *)frame)->updatee, (StgClosure *)ap);
             }
@@ -1083,6 +1224,11 @@ raiseAsync(Capability *cap, StgTSO *tso, StgClosure *exception,
     }
 
 done:
+    // updateThunk() would have done this for the thunks we skipped
+    if (check_bqs) {
+        checkBlockingQueues(cap, tso);
+    }
+
     IF_DEBUG(sanity, checkTSO(tso));
 
     // wake it up
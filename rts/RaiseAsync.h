@@ -11,6 +11,10 @@
 #define THROWTO_SUCCESS   0
 #define THROWTO_BLOCKED   1
 
+// The most throwTo messages a Capability holds back before sending
+// them; see Note [Batched throwTo] in RaiseAsync.c
+#define THROWTO_BATCH     64
+
 #if !defined(CMINUSMINUS)
 
 #include "BeginPrivate.h"
@@ -46,6 +50,10 @@ MessageThrowTo *throwTo (Capability *cap,      // the Capability we hold
 uint32_t throwToMsg (Capability *cap,
                 MessageThrowTo *msg);
 
+#if defined(THREADED_RTS)
+void flushThrowTos (Capability *cap);
+#endif
+
 int  maybePerformBlockedException (Capability *cap, StgTSO *tso);
 void awakenBlockedExceptionQueue  (Capability *cap, StgTSO *tso);
 
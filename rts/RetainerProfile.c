@@ -33,6 +33,7 @@
 #include "StablePtr.h" /* markStablePtrTable */
 #include "StableName.h" /* rememberOldStableNameAddresses */
 #include "sm/Storage.h" // for END_OF_STATIC_LIST
+#include "sm/GCThread.h" // for n_gc_threads, runOnGcThreads
 
 /* Note [What is a retainer?]
    ~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -64,6 +65,7 @@ static uint32_t retainerGeneration;  // generation
 static uint32_t numObjectVisited;    // total number of objects visited
 static uint32_t timesAnyObjectVisited;  // number of times any objects are
                                         // visited
+                                        // (both summed over traverseStates)
 
 /*
   The rs field in the profile header of any object points to its retainer
@@ -76,11 +78,13 @@ static uint32_t timesAnyObjectVisited;  // number of times any objects are
 StgWord flip = 0;     // flip bit
                       // must be 0 if DEBUG_RETAINER is on (for static closures)
 
+// true while the GC threads are traversing the heap together, see
+// Note [Parallel retainer profiling]
+static bool parallel_traversal = false;
+
 #define setRetainerSetToNull(c)   \
   (c)->header.prof.hp.rs = (RetainerSet *)((StgWord)NULL | flip)
 
-static void retainStack(StgClosure *, retainer, StgPtr, StgPtr);
-static void retainClosure(StgClosure *, StgClosure *, retainer);
 #if defined(DEBUG_RETAINER)
 static void belongToHeap(StgPtr p);
 #endif
@@ -153,6 +157,9 @@ typedef struct {
 } stackElement;
 
 /*
+  The state of one traversal: each thread taking part in a parallel
+  traversal has its own (see Note [Parallel retainer profiling]).
+
   Invariants:
     firstStack points to the first block group.
     currentStack points to the block group currently being used.
@@ -168,18 +175,30 @@ typedef struct {
     When a current stack becomes empty, stackTop is set to point to
     the topmost element on the previous block group so as to satisfy
     the invariants described above.
- */
-static bdescr *firstStack = NULL;
-static bdescr *currentStack;
-static stackElement *stackBottom, *stackTop, *stackLimit;
 
-/*
   currentStackBoundary is used to mark the current stack chunk.
   If stackTop == currentStackBoundary, it means that the current stack chunk
   is empty. It is the responsibility of the user to keep currentStackBoundary
   valid all the time if it is to be employed.
  */
-static stackElement *currentStackBoundary;
+typedef struct {
+    bdescr *firstStack;
+    bdescr *currentStack;
+    stackElement *stackBottom, *stackTop, *stackLimit;
+    stackElement *currentStackBoundary;
+
+    uint32_t numObjectVisited;
+    uint32_t timesAnyObjectVisited;
+} traverseState;
+
+// One per GC thread; only the first is used by a sequential traversal.
+static traverseState *traverse_states = NULL;
+static uint32_t n_traverse_states = 0;
+
+static void retainStack(traverseState *, StgClosure *, retainer,
+                        StgPtr, StgPtr);
+static void retainClosure(traverseState *, StgClosure *, StgClosure *,
+                          retainer);
 
 /*
   stackSize records the current size of the stack.
@@ -206,13 +225,13 @@ static int stackSize, maxStackSize;
  *  currentStack->link == s.
  * -------------------------------------------------------------------------- */
 static INLINE void
-newStackBlock( bdescr *bd )
+newStackBlock( traverseState *ts, bdescr *bd )
 {
-    currentStack = bd;
-    stackTop     = (stackElement *)(bd->start + BLOCK_SIZE_W * bd->blocks);
-    stackBottom  = (stackElement *)bd->start;
-    stackLimit   = (stackElement *)stackTop;
-    bd->free     = (StgPtr)stackLimit;
+    ts->currentStack = bd;
+    ts->stackTop     = (stackElement *)(bd->start + BLOCK_SIZE_W * bd->blocks);
+    ts->stackBottom  = (stackElement *)bd->start;
+    ts->stackLimit   = (stackElement *)ts->stackTop;
+    bd->free         = (StgPtr)ts->stackLimit;
 }
 
 /* -----------------------------------------------------------------------------
@@ -221,30 +240,34 @@ newStackBlock( bdescr *bd )
  *   s->link == currentStack.
  * -------------------------------------------------------------------------- */
 static INLINE void
-returnToOldStack( bdescr *bd )
+returnToOldStack( traverseState *ts, bdescr *bd )
 {
-    currentStack = bd;
-    stackTop = (stackElement *)bd->free;
-    stackBottom = (stackElement *)bd->start;
-    stackLimit = (stackElement *)(bd->start + BLOCK_SIZE_W * bd->blocks);
-    bd->free = (StgPtr)stackLimit;
+    ts->currentStack = bd;
+    ts->stackTop = (stackElement *)bd->free;
+    ts->stackBottom = (stackElement *)bd->start;
+    ts->stackLimit = (stackElement *)(bd->start + BLOCK_SIZE_W * bd->blocks);
+    bd->free = (StgPtr)ts->stackLimit;
 }
 
 /* -----------------------------------------------------------------------------
  *  Initializes the traverse stack.
+ *  Note:
+ *    The traverse stacks of a parallel traversal are allocated by the GC
+ *    threads while the storage manager lock is not held, hence the _lock
+ *    variants of the block allocator functions.
  * -------------------------------------------------------------------------- */
 static void
-initializeTraverseStack( void )
+initializeTraverseStack( traverseState *ts )
 {
-    if (firstStack != NULL) {
-        freeChain(firstStack);
+    if (ts->firstStack != NULL) {
+        freeChain_lock(ts->firstStack);
     }
 
-    firstStack = allocGroup(BLOCKS_IN_STACK);
-    firstStack->link = NULL;
-    firstStack->u.back = NULL;
+    ts->firstStack = allocGroup_lock(BLOCKS_IN_STACK);
+    ts->firstStack->link = NULL;
+    ts->firstStack->u.back = NULL;
 
-    newStackBlock(firstStack);
+    newStackBlock(ts, ts->firstStack);
 }
 
 /* -----------------------------------------------------------------------------
@@ -253,19 +276,20 @@ initializeTraverseStack( void )
  *   firstStack != NULL
  * -------------------------------------------------------------------------- */
 static void
-closeTraverseStack( void )
+closeTraverseStack( traverseState *ts )
 {
-    freeChain(firstStack);
-    firstStack = NULL;
+    freeChain_lock(ts->firstStack);
+    ts->firstStack = NULL;
 }
 
 /* -----------------------------------------------------------------------------
  * Returns true if the whole stack is empty.
  * -------------------------------------------------------------------------- */
 static INLINE bool
-isEmptyRetainerStack( void )
+isEmptyRetainerStack( traverseState *ts )
 {
-    return (firstStack == currentStack) && stackTop == stackLimit;
+    return (ts->firstStack == ts->currentStack) &&
+        ts->stackTop == ts->stackLimit;
 }
 
 /* -----------------------------------------------------------------------------
@@ -276,9 +300,12 @@ retainerStackBlocks( void )
 {
     bdescr* bd;
     W_ res = 0;
+    uint32_t i;
 
-    for (bd = firstStack; bd != NULL; bd = bd->link)
-      res += bd->blocks;
+    for (i = 0; i < n_traverse_states; i++) {
+        for (bd = traverse_states[i].firstStack; bd != NULL; bd = bd->link)
+            res += bd->blocks;
+    }
 
     return res;
 }
@@ -288,11 +315,126 @@ retainerStackBlocks( void )
  * i.e., if the current stack chunk is empty.
  * -------------------------------------------------------------------------- */
 static INLINE bool
-isOnBoundary( void )
+isOnBoundary( traverseState *ts )
 {
-    return stackTop == currentStackBoundary;
+    return ts->stackTop == ts->currentStackBoundary;
 }
 
+/* Note [Parallel retainer profiling]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Retainer profiling is done as part of a heap census, right after a major GC.
+If that GC was parallel, the GC threads are still around (see
+runOnGcThreads()), and we use them to traverse the heap together:
+
+ * The roots are not traversed as they are found, but put in a shared work
+   pool.  Each GC thread has its own traverseState, takes an item from the
+   pool and traverses from it with its own stack, exactly as the sequential
+   traversal does.
+
+ * A thread that finds the pool empty counts itself as idle.  While some
+   thread is idle and the pool is empty, a busy thread gives away the
+   subtree under the next child it would descend into, as long as it has
+   other work of its own.  This balances the load even when most of the
+   heap hangs off a single root, e.g. the main thread.  The traversal is
+   over when every thread is idle and the pool is empty.
+
+ * The retainer set field of a closure may be updated by several threads at
+   once, so it is updated with a CAS (see associate()), and the update is
+   retried if another thread got in first.  Since a thread only goes on to
+   the children of a closure after it has successfully added its retainer
+   to the closure's retainer set, every retainer still reaches every object
+   it retains.  The retainer sets themselves are hash-consed in a table
+   that can be searched without a lock (see RetainerSet.c).
+
+The sequential traversal takes shortcuts in retainClosure() that copy the
+retainer set of a non-retainer parent to its child.  They rely on every
+retainer in the parent's set having already gone through the child, which
+does not hold when other threads are traversing the same closures, so a
+parallel traversal never takes them: a closure's retainer set only grows
+one retainer at a time, as each retainer reaches it.  The sets therefore
+do not come from the same computation as the sequential ones and need not
+be identical to them, and their numbering depends on the order in which
+the threads create them.
+*/
+
+#if defined(THREADED_RTS)
+typedef struct {
+    StgClosure *c;      // the closure to traverse from
+    StgClosure *cp;     // its parent
+    retainer r;         // its most recent retainer
+} retainerWork;
+
+static retainerWork *work_pool = NULL;
+static uint32_t work_pool_size = 0;
+static volatile uint32_t work_pool_top;
+static SpinLock work_pool_lock;
+
+// number of threads that have joined the traversal, and how many of them
+// have found the work pool empty
+static volatile uint32_t retainer_threads;
+static volatile uint32_t retainer_idle_threads;
+
+/* -----------------------------------------------------------------------------
+ *  Adds a closure to be traversed by any of the threads of a parallel
+ *  traversal.
+ * -------------------------------------------------------------------------- */
+static void
+pushRetainerWork( StgClosure *c, StgClosure *cp, retainer r )
+{
+    ACQUIRE_SPIN_LOCK(&work_pool_lock);
+    if (work_pool_top == work_pool_size) {
+        work_pool_size = work_pool_size == 0 ? 1024 : work_pool_size * 2;
+        work_pool = stgReallocBytes(work_pool,
+                                    work_pool_size * sizeof(retainerWork),
+                                    "pushRetainerWork");
+    }
+    work_pool[work_pool_top].c  = c;
+    work_pool[work_pool_top].cp = cp;
+    work_pool[work_pool_top].r  = r;
+    work_pool_top++;
+    RELEASE_SPIN_LOCK(&work_pool_lock);
+}
+
+/* -----------------------------------------------------------------------------
+ *  Takes a closure to traverse from the work pool, waiting for one of the
+ *  other threads to give some away if it is empty.  Returns false when
+ *  the traversal is over.
+ * -------------------------------------------------------------------------- */
+static bool
+popRetainerWork( retainerWork *w )
+{
+    bool idle = false;
+
+    for (;;) {
+        ACQUIRE_SPIN_LOCK(&work_pool_lock);
+        if (work_pool_top > 0) {
+            work_pool_top--;
+            *w = work_pool[work_pool_top];
+            if (idle) {
+                retainer_idle_threads--;
+            }
+            RELEASE_SPIN_LOCK(&work_pool_lock);
+            return true;
+        }
+        if (!idle) {
+            retainer_idle_threads++;
+            idle = true;
+        }
+        if (retainer_idle_threads == retainer_threads) {
+            // Nobody is left to produce any more work.
+            RELEASE_SPIN_LOCK(&work_pool_lock);
+            return false;
+        }
+        RELEASE_SPIN_LOCK(&work_pool_lock);
+
+        while (work_pool_top == 0 &&
+               retainer_idle_threads != retainer_threads) {
+            busy_wait_nop();
+        }
+    }
+}
+#endif
+
 /* -----------------------------------------------------------------------------
  * Initializes *info from ptrs and payload.
  * Invariants:
@@ -375,7 +517,8 @@ find_srt( stackPos *info )
  *  Note: SRTs are considered to  be children as well.
  * -------------------------------------------------------------------------- */
 static INLINE void
-push( StgClosure *c, retainer c_child_r, StgClosure **first_child )
+push( traverseState *ts, StgClosure *c, retainer c_child_r,
+      StgClosure **first_child )
 {
     stackElement se;
     bdescr *nbd;      // Next Block Descriptor
@@ -573,27 +716,27 @@ push( StgClosure *c, retainer c_child_r, StgClosure **first_child )
         return;
     }
 
-    if (stackTop - 1 < stackBottom) {
+    if (ts->stackTop - 1 < ts->stackBottom) {
 #if defined(DEBUG_RETAINER)
         // debugBelch("push() to the next stack.\n");
 #endif
         // currentStack->free is updated when the active stack is switched
         // to the next stack.
-        currentStack->free = (StgPtr)stackTop;
+        ts->currentStack->free = (StgPtr)ts->stackTop;
 
-        if (currentStack->link == NULL) {
-            nbd = allocGroup(BLOCKS_IN_STACK);
+        if (ts->currentStack->link == NULL) {
+            nbd = allocGroup_lock(BLOCKS_IN_STACK);
             nbd->link = NULL;
-            nbd->u.back = currentStack;
-            currentStack->link = nbd;
+            nbd->u.back = ts->currentStack;
+            ts->currentStack->link = nbd;
         } else
-            nbd = currentStack->link;
+            nbd = ts->currentStack->link;
 
-        newStackBlock(nbd);
+        newStackBlock(ts, nbd);
     }
 
     // adjust stackTop (acutal push)
-    stackTop--;
+    ts->stackTop--;
     // If the size of stackElement was huge, we would better replace the
     // following statement by either a memcpy() call or a switch statement
     // on the type of the element. Currently, the size of stackElement is
@@ -604,7 +747,7 @@ push( StgClosure *c, retainer c_child_r, StgClosure **first_child )
     // This is caused by the fact that there are execution paths through the
     // large switch statement above where some cases do not initialize this
     // field. Is this really harmless? Can we avoid the warning?
-    *stackTop = se;
+    *ts->stackTop = se;
 
 #if defined(DEBUG_RETAINER)
     stackSize++;
@@ -628,7 +771,7 @@ push( StgClosure *c, retainer c_child_r, StgClosure **first_child )
  *    is called only within popOff() and nowhere else.
  * -------------------------------------------------------------------------- */
 static void
-popOffReal(void)
+popOffReal( traverseState *ts )
 {
     bdescr *pbd;    // Previous Block Descriptor
 
@@ -636,13 +779,13 @@ popOffReal(void)
     // debugBelch("pop() to the previous stack.\n");
 #endif
 
-    ASSERT(stackTop + 1 == stackLimit);
-    ASSERT(stackBottom == (stackElement *)currentStack->start);
+    ASSERT(ts->stackTop + 1 == ts->stackLimit);
+    ASSERT(ts->stackBottom == (stackElement *)ts->currentStack->start);
 
-    if (firstStack == currentStack) {
+    if (ts->firstStack == ts->currentStack) {
         // The stack is completely empty.
-        stackTop++;
-        ASSERT(stackTop == stackLimit);
+        ts->stackTop++;
+        ASSERT(ts->stackTop == ts->stackLimit);
 #if defined(DEBUG_RETAINER)
         stackSize--;
         if (stackSize > maxStackSize) maxStackSize = stackSize;
@@ -656,13 +799,13 @@ popOffReal(void)
 
     // currentStack->free is updated when the active stack is switched back
     // to the previous stack.
-    currentStack->free = (StgPtr)stackLimit;
+    ts->currentStack->free = (StgPtr)ts->stackLimit;
 
     // find the previous block descriptor
-    pbd = currentStack->u.back;
+    pbd = ts->currentStack->u.back;
     ASSERT(pbd != NULL);
 
-    returnToOldStack(pbd);
+    returnToOldStack(ts, pbd);
 
 #if defined(DEBUG_RETAINER)
     stackSize--;
@@ -675,17 +818,17 @@ popOffReal(void)
 }
 
 static INLINE void
-popOff(void) {
+popOff( traverseState *ts ) {
 #if defined(DEBUG_RETAINER)
     // debugBelch("\tpopOff(): stackTop = 0x%x, currentStackBoundary = 0x%x\n", stackTop, currentStackBoundary);
 #endif
 
-    ASSERT(stackTop != stackLimit);
-    ASSERT(!isEmptyRetainerStack());
+    ASSERT(ts->stackTop != ts->stackLimit);
+    ASSERT(!isEmptyRetainerStack(ts));
 
     // <= (instead of <) is wrong!
-    if (stackTop + 1 < stackLimit) {
-        stackTop++;
+    if (ts->stackTop + 1 < ts->stackLimit) {
+        ts->stackTop++;
 #if defined(DEBUG_RETAINER)
         stackSize--;
         if (stackSize > maxStackSize) maxStackSize = stackSize;
@@ -697,7 +840,7 @@ popOff(void) {
         return;
     }
 
-    popOffReal();
+    popOffReal(ts);
 }
 
 /* -----------------------------------------------------------------------------
@@ -717,7 +860,7 @@ popOff(void) {
  *    is empty.
  * -------------------------------------------------------------------------- */
 static INLINE void
-pop( StgClosure **c, StgClosure **cp, retainer *r )
+pop( traverseState *ts, StgClosure **c, StgClosure **cp, retainer *r )
 {
     stackElement *se;
 
@@ -726,12 +869,12 @@ pop( StgClosure **c, StgClosure **cp, retainer *r )
 #endif
 
     do {
-        if (isOnBoundary()) {     // if the current stack chunk is depleted
+        if (isOnBoundary(ts)) {   // if the current stack chunk is depleted
             *c = NULL;
             return;
         }
 
-        se = stackTop;
+        se = ts->stackTop;
 
         switch (get_itbl(se->c)->type) {
             // two children (fixed), no SRT
@@ -740,7 +883,7 @@ pop( StgClosure **c, StgClosure **cp, retainer *r )
             *c = se->c->payload[1];
             *cp = se->c;
             *r = se->c_child_r;
-            popOff();
+            popOff(ts);
             return;
 
             // three children (fixed), no SRT
@@ -753,7 +896,7 @@ pop( StgClosure **c, StgClosure **cp, retainer *r )
                 // no popOff
             } else {
                 *c = ((StgMVar *)se->c)->value;
-                popOff();
+                popOff(ts);
             }
             *cp = se->c;
             *r = se->c_child_r;
@@ -767,7 +910,7 @@ pop( StgClosure **c, StgClosure **cp, retainer *r )
                 // no popOff
             } else {
                 *c = ((StgWeak *)se->c)->finalizer;
-                popOff();
+                popOff(ts);
             }
             *cp = se->c;
             *r = se->c_child_r;
@@ -784,7 +927,7 @@ pop( StgClosure **c, StgClosure **cp, retainer *r )
             uint32_t field_no = se->info.next.step & 3;
             if (entry_no == ((StgTRecChunk *)se->c)->next_entry_idx) {
                 *c = NULL;
-                popOff();
+                popOff(ts);
                 return;
             }
             entry = &((StgTRecChunk *)se->c)->entries[entry_no];
@@ -817,7 +960,7 @@ pop( StgClosure **c, StgClosure **cp, retainer *r )
         case SMALL_MUT_ARR_PTRS_FROZEN_DIRTY:
             *c = find_ptrs(&se->info);
             if (*c == NULL) {
-                popOff();
+                popOff(ts);
                 break;
             }
             *cp = se->c;
@@ -869,7 +1012,7 @@ pop( StgClosure **c, StgClosure **cp, retainer *r )
                 *r = se->c_child_r;
                 return;
             }
-            popOff();
+            popOff(ts);
             break;
 
             // no child (fixed), no SRT
@@ -927,6 +1070,11 @@ endRetainerProfiling( void )
 #if defined(SECOND_APPROACH)
     outputAllRetainerSet(prof_file);
 #endif
+#if defined(THREADED_RTS)
+    stgFree(work_pool);
+    work_pool = NULL;
+    work_pool_size = 0;
+#endif
 }
 
 /* -----------------------------------------------------------------------------
@@ -947,6 +1095,16 @@ static INLINE void
 maybeInitRetainerSet( StgClosure *c )
 {
     if (!isRetainerSetFieldValid(c)) {
+#if defined(THREADED_RTS)
+        if (parallel_traversal) {
+            // If this fails another thread has just made RSET(c) valid.
+            StgWord old = (StgWord)RSET(c);
+            if (((old & 1) ^ flip) != 0) {
+                cas((StgVolatilePtr)&RSET(c), old, (StgWord)NULL | flip);
+            }
+            return;
+        }
+#endif
         setRetainerSetToNull(c);
     }
 }
@@ -1090,17 +1248,26 @@ getRetainerFrom( StgClosure *c )
 
 /* -----------------------------------------------------------------------------
  *  Associates the retainer set *s with the closure *c, that is, *s becomes
- *  the retainer set of *c.
+ *  the retainer set of *c, provided that the retainer set of *c is still
+ *  *old.  Returns false if another thread of a parallel traversal has
+ *  changed it in the meantime.
  *  Invariants:
  *    c != NULL
  *    s != NULL
  * -------------------------------------------------------------------------- */
-static INLINE void
-associate( StgClosure *c, RetainerSet *s )
+static INLINE bool
+associate( StgClosure *c, RetainerSet *old STG_UNUSED, RetainerSet *s )
 {
     // StgWord has the same size as pointers, so the following type
     // casting is okay.
+#if defined(THREADED_RTS)
+    if (parallel_traversal) {
+        StgWord o = (StgWord)old | flip;
+        return cas((StgVolatilePtr)&RSET(c), o, (StgWord)s | flip) == o;
+    }
+#endif
     RSET(c) = (RetainerSet *)((StgWord)s | flip);
+    return true;
 }
 
 /* -----------------------------------------------------------------------------
@@ -1108,7 +1275,8 @@ associate( StgClosure *c, RetainerSet *s )
    -------------------------------------------------------------------------- */
 
 static void
-retain_large_bitmap (StgPtr p, StgLargeBitmap *large_bitmap, uint32_t size,
+retain_large_bitmap (traverseState *ts, StgPtr p,
+                     StgLargeBitmap *large_bitmap, uint32_t size,
                      StgClosure *c, retainer c_child_r)
 {
     uint32_t i, b;
@@ -1118,7 +1286,7 @@ retain_large_bitmap (StgPtr p, StgLargeBitmap *large_bitmap, uint32_t size,
     bitmap = large_bitmap->bitmap[b];
     for (i = 0; i < size; ) {
         if ((bitmap & 1) == 0) {
-            retainClosure((StgClosure *)*p, c, c_child_r);
+            retainClosure(ts, (StgClosure *)*p, c, c_child_r);
         }
         i++;
         p++;
@@ -1132,12 +1300,12 @@ retain_large_bitmap (StgPtr p, StgLargeBitmap *large_bitmap, uint32_t size,
 }
 
 static INLINE StgPtr
-retain_small_bitmap (StgPtr p, uint32_t size, StgWord bitmap,
-                     StgClosure *c, retainer c_child_r)
+retain_small_bitmap (traverseState *ts, StgPtr p, uint32_t size,
+                     StgWord bitmap, StgClosure *c, retainer c_child_r)
 {
     while (size > 0) {
         if ((bitmap & 1) == 0) {
-            retainClosure((StgClosure *)*p, c, c_child_r);
+            retainClosure(ts, (StgClosure *)*p, c, c_child_r);
         }
         p++;
         bitmap = bitmap >> 1;
@@ -1165,7 +1333,7 @@ retain_small_bitmap (StgPtr p, uint32_t size, StgWord bitmap,
  *    retainClosure() is invoked instead of evacuate().
  * -------------------------------------------------------------------------- */
 static void
-retainStack( StgClosure *c, retainer c_child_r,
+retainStack( traverseState *ts, StgClosure *c, retainer c_child_r,
              StgPtr stackStart, StgPtr stackEnd )
 {
     stackElement *oldStackBoundary;
@@ -1185,8 +1353,8 @@ retainStack( StgClosure *c, retainer c_child_r,
       record the current currentStackBoundary, which will be restored
       at the exit.
     */
-    oldStackBoundary = currentStackBoundary;
-    currentStackBoundary = stackTop;
+    oldStackBoundary = ts->currentStackBoundary;
+    ts->currentStackBoundary = ts->stackTop;
 
 #if defined(DEBUG_RETAINER)
     // debugBelch("retainStack() called: oldStackBoundary = 0x%x, currentStackBoundary = 0x%x\n", oldStackBoundary, currentStackBoundary);
@@ -1201,7 +1369,7 @@ retainStack( StgClosure *c, retainer c_child_r,
         switch(info->i.type) {
 
         case UPDATE_FRAME:
-            retainClosure(((StgUpdateFrame *)p)->updatee, c, c_child_r);
+            retainClosure(ts, ((StgUpdateFrame *)p)->updatee, c, c_child_r);
             p += sizeofW(StgUpdateFrame);
             continue;
 
@@ -1215,11 +1383,11 @@ retainStack( StgClosure *c, retainer c_child_r,
             bitmap = BITMAP_BITS(info->i.layout.bitmap);
             size   = BITMAP_SIZE(info->i.layout.bitmap);
             p++;
-            p = retain_small_bitmap(p, size, bitmap, c, c_child_r);
+            p = retain_small_bitmap(ts, p, size, bitmap, c, c_child_r);
 
         follow_srt:
             if (info->i.srt) {
-                retainClosure(GET_SRT(info),c,c_child_r);
+                retainClosure(ts, GET_SRT(info),c,c_child_r);
             }
             continue;
 
@@ -1227,11 +1395,11 @@ retainStack( StgClosure *c, retainer c_child_r,
             StgBCO *bco;
 
             p++;
-            retainClosure((StgClosure *)*p, c, c_child_r);
+            retainClosure(ts, (StgClosure *)*p, c, c_child_r);
             bco = (StgBCO *)*p;
             p++;
             size = BCO_BITMAP_SIZE(bco);
-            retain_large_bitmap(p, BCO_BITMAP(bco), size, c, c_child_r);
+            retain_large_bitmap(ts, p, BCO_BITMAP(bco), size, c, c_child_r);
             p += size;
             continue;
         }
@@ -1240,7 +1408,7 @@ retainStack( StgClosure *c, retainer c_child_r,
         case RET_BIG:
             size = GET_LARGE_BITMAP(&info->i)->size;
             p++;
-            retain_large_bitmap(p, GET_LARGE_BITMAP(&info->i),
+            retain_large_bitmap(ts, p, GET_LARGE_BITMAP(&info->i),
                                 size, c, c_child_r);
             p += size;
             // and don't forget to follow the SRT
@@ -1250,7 +1418,7 @@ retainStack( StgClosure *c, retainer c_child_r,
             StgRetFun *ret_fun = (StgRetFun *)p;
             const StgFunInfoTable *fun_info;
 
-            retainClosure(ret_fun->fun, c, c_child_r);
+            retainClosure(ts, ret_fun->fun, c, c_child_r);
             fun_info = get_fun_itbl(UNTAG_CONST_CLOSURE(ret_fun->fun));
 
             p = (P_)&ret_fun->payload;
@@ -1258,18 +1426,18 @@ retainStack( StgClosure *c, retainer c_child_r,
             case ARG_GEN:
                 bitmap = BITMAP_BITS(fun_info->f.b.bitmap);
                 size = BITMAP_SIZE(fun_info->f.b.bitmap);
-                p = retain_small_bitmap(p, size, bitmap, c, c_child_r);
+                p = retain_small_bitmap(ts, p, size, bitmap, c, c_child_r);
                 break;
             case ARG_GEN_BIG:
                 size = GET_FUN_LARGE_BITMAP(fun_info)->size;
-                retain_large_bitmap(p, GET_FUN_LARGE_BITMAP(fun_info),
+                retain_large_bitmap(ts, p, GET_FUN_LARGE_BITMAP(fun_info),
                                     size, c, c_child_r);
                 p += size;
                 break;
             default:
                 bitmap = BITMAP_BITS(stg_arg_bitmaps[fun_info->f.fun_type]);
                 size = BITMAP_SIZE(stg_arg_bitmaps[fun_info->f.fun_type]);
-                p = retain_small_bitmap(p, size, bitmap, c, c_child_r);
+                p = retain_small_bitmap(ts, p, size, bitmap, c, c_child_r);
                 break;
             }
             goto follow_srt;
@@ -1282,7 +1450,7 @@ retainStack( StgClosure *c, retainer c_child_r,
     }
 
     // restore currentStackBoundary
-    currentStackBoundary = oldStackBoundary;
+    ts->currentStackBoundary = oldStackBoundary;
 #if defined(DEBUG_RETAINER)
     // debugBelch("retainStack() finished: currentStackBoundary = 0x%x\n", currentStackBoundary);
 #endif
@@ -1297,7 +1465,8 @@ retainStack( StgClosure *c, retainer c_child_r,
  * ------------------------------------------------------------------------- */
 
 static INLINE StgPtr
-retain_PAP_payload (StgClosure *pap,    /* NOT tagged */
+retain_PAP_payload (traverseState *ts,
+                    StgClosure *pap,    /* NOT tagged */
                     retainer c_child_r, /* NOT tagged */
                     StgClosure *fun,    /* tagged */
                     StgClosure** payload, StgWord n_args)
@@ -1306,7 +1475,7 @@ retain_PAP_payload (StgClosure *pap,    /* NOT tagged */
     StgWord bitmap;
     const StgFunInfoTable *fun_info;
 
-    retainClosure(fun, pap, c_child_r);
+    retainClosure(ts, fun, pap, c_child_r);
     fun = UNTAG_CLOSURE(fun);
     fun_info = get_fun_itbl(fun);
     ASSERT(fun_info->i.type != PAP);
@@ -1316,22 +1485,22 @@ retain_PAP_payload (StgClosure *pap,    /* NOT tagged */
     switch (fun_info->f.fun_type) {
     case ARG_GEN:
         bitmap = BITMAP_BITS(fun_info->f.b.bitmap);
-        p = retain_small_bitmap(p, n_args, bitmap,
+        p = retain_small_bitmap(ts, p, n_args, bitmap,
                                 pap, c_child_r);
         break;
     case ARG_GEN_BIG:
-        retain_large_bitmap(p, GET_FUN_LARGE_BITMAP(fun_info),
+        retain_large_bitmap(ts, p, GET_FUN_LARGE_BITMAP(fun_info),
                             n_args, pap, c_child_r);
         p += n_args;
         break;
     case ARG_BCO:
-        retain_large_bitmap((StgPtr)payload, BCO_BITMAP(fun),
+        retain_large_bitmap(ts, (StgPtr)payload, BCO_BITMAP(fun),
                             n_args, pap, c_child_r);
         p += n_args;
         break;
     default:
         bitmap = BITMAP_BITS(stg_arg_bitmaps[fun_info->f.fun_type]);
-        p = retain_small_bitmap(p, n_args, bitmap, pap, c_child_r);
+        p = retain_small_bitmap(ts, p, n_args, bitmap, pap, c_child_r);
         break;
     }
     return p;
@@ -1354,7 +1523,8 @@ retain_PAP_payload (StgClosure *pap,    /* NOT tagged */
  *    *c0 can be TSO (as well as AP_STACK).
  * -------------------------------------------------------------------------- */
 static void
-retainClosure( StgClosure *c0, StgClosure *cp0, retainer r0 )
+retainClosure( traverseState *ts, StgClosure *c0, StgClosure *cp0,
+               retainer r0 )
 {
     // c = Current closure                          (possibly tagged)
     // cp = Current closure's Parent                (NOT tagged)
@@ -1384,7 +1554,7 @@ retainClosure( StgClosure *c0, StgClosure *cp0, retainer r0 )
 loop:
     //debugBelch("loop");
     // pop to (c, cp, r);
-    pop(&c, &cp, &r);
+    pop(ts, &c, &cp, &r);
 
     if (c == NULL) {
 #if defined(DEBUG_RETAINER)
@@ -1493,11 +1663,10 @@ inner_loop:
 
     // The above objects are ignored in computing the average number of times
     // an object is visited.
-    timesAnyObjectVisited++;
+    ts->timesAnyObjectVisited++;
 
     // If this is the first visit to c, initialize its retainer set.
     maybeInitRetainerSet(c);
-    retainerSetOfc = retainerSetOf(c);
 
     // Now compute s:
     //    isRetainer(cp) == true => s == NULL
@@ -1509,16 +1678,26 @@ inner_loop:
 
     // (c, cp, r, s) is available.
 
+    // In a parallel traversal associate() fails if another thread has
+    // changed the retainer set of *c since we read it, and we start again.
+retry:
+    retainerSetOfc = retainerSetOf(c);
+
     // (c, cp, r, s, R_r) is available, so compute the retainer set for *c.
     if (retainerSetOfc == NULL) {
-        // This is the first visit to *c.
-        numObjectVisited++;
-
-        if (s == NULL)
-            associate(c, singleton(r));
-        else
+        // This is the first visit to *c.  In a parallel traversal s may
+        // hold retainers whose threads have not reached *c yet: they
+        // would find themselves in its set already and skip its children.
+        if (s == NULL || parallel_traversal) {
+            if (!associate(c, NULL, singleton(r)))
+                goto retry;
+        } else {
             // s is actually the retainer set of *c!
-            associate(c, s);
+            if (!associate(c, NULL, s))
+                goto retry;
+        }
+
+        ts->numObjectVisited++;
 
         // compute c_child_r
         c_child_r = isRetainer(c) ? getRetainerFrom(c) : r;
@@ -1527,19 +1706,22 @@ inner_loop:
         if (isMember(r, retainerSetOfc))
             goto loop;          // no need to process child
 
-        if (s == NULL)
-            associate(c, addElement(r, retainerSetOfc));
-        else {
+        if (s == NULL) {
+            if (!associate(c, retainerSetOfc, addElement(r, retainerSetOfc)))
+                goto retry;
+        } else {
             // s is not NULL and cp is not a retainer. This means that
             // each time *cp is visited, so is *c. Thus, if s has
             // exactly one more element in its retainer set than c, s
-            // is also the new retainer set for *c.
-            if (s->num == retainerSetOfc->num + 1) {
-                associate(c, s);
+            // is also the new retainer set for *c.  That no longer
+            // holds if other threads are visiting *c at the same time.
+            if (s->num == retainerSetOfc->num + 1 && !parallel_traversal) {
+                associate(c, retainerSetOfc, s);
             }
             // Otherwise, just add R_r to the current retainer set of *c.
-            else {
-                associate(c, addElement(r, retainerSetOfc));
+            else if (!associate(c, retainerSetOfc,
+                                addElement(r, retainerSetOfc))) {
+                goto retry;
             }
         }
 
@@ -1560,7 +1742,7 @@ inner_loop:
     // would be hard.
     switch (typeOfc) {
     case STACK:
-        retainStack(c, c_child_r,
+        retainStack(ts, c, c_child_r,
                     ((StgStack *)c)->sp,
                     ((StgStack *)c)->stack + ((StgStack *)c)->stack_size);
         goto loop;
@@ -1569,16 +1751,16 @@ inner_loop:
     {
         StgTSO *tso = (StgTSO *)c;
 
-        retainClosure((StgClosure*) tso->stackobj,           c, c_child_r);
-        retainClosure((StgClosure*) tso->blocked_exceptions, c, c_child_r);
-        retainClosure((StgClosure*) tso->bq,                 c, c_child_r);
-        retainClosure((StgClosure*) tso->trec,               c, c_child_r);
+        retainClosure(ts, (StgClosure*) tso->stackobj,           c, c_child_r);
+        retainClosure(ts, (StgClosure*) tso->blocked_exceptions, c, c_child_r);
+        retainClosure(ts, (StgClosure*) tso->bq,                 c, c_child_r);
+        retainClosure(ts, (StgClosure*) tso->trec,               c, c_child_r);
         if (   tso->why_blocked == BlockedOnMVar
                || tso->why_blocked == BlockedOnMVarRead
                || tso->why_blocked == BlockedOnBlackHole
                || tso->why_blocked == BlockedOnMsgThrowTo
             ) {
-            retainClosure(tso->block_info.closure, c, c_child_r);
+            retainClosure(ts, tso->block_info.closure, c, c_child_r);
         }
         goto loop;
     }
@@ -1586,36 +1768,36 @@ inner_loop:
     case BLOCKING_QUEUE:
     {
         StgBlockingQueue *bq = (StgBlockingQueue *)c;
-        retainClosure((StgClosure*) bq->link,           c, c_child_r);
-        retainClosure((StgClosure*) bq->bh,             c, c_child_r);
-        retainClosure((StgClosure*) bq->owner,          c, c_child_r);
+        retainClosure(ts, (StgClosure*) bq->link,           c, c_child_r);
+        retainClosure(ts, (StgClosure*) bq->bh,             c, c_child_r);
+        retainClosure(ts, (StgClosure*) bq->owner,          c, c_child_r);
         goto loop;
     }
 
     case PAP:
     {
         StgPAP *pap = (StgPAP *)c;
-        retain_PAP_payload(c, c_child_r, pap->fun, pap->payload, pap->n_args);
+        retain_PAP_payload(ts, c, c_child_r, pap->fun, pap->payload, pap->n_args);
         goto loop;
     }
 
     case AP:
     {
         StgAP *ap = (StgAP *)c;
-        retain_PAP_payload(c, c_child_r, ap->fun, ap->payload, ap->n_args);
+        retain_PAP_payload(ts, c, c_child_r, ap->fun, ap->payload, ap->n_args);
         goto loop;
     }
 
     case AP_STACK:
-        retainClosure(((StgAP_STACK *)c)->fun, c, c_child_r);
-        retainStack(c, c_child_r,
+        retainClosure(ts, ((StgAP_STACK *)c)->fun, c, c_child_r);
+        retainStack(ts, c, c_child_r,
                     (StgPtr)((StgAP_STACK *)c)->payload,
                     (StgPtr)((StgAP_STACK *)c)->payload +
                              ((StgAP_STACK *)c)->size);
         goto loop;
     }
 
-    push(c, c_child_r, &first_child);
+    push(ts, c, c_child_r, &first_child);
 
     // If first_child is null, c has no child.
     // If first_child is not null, the top stack element points to the next
@@ -1623,6 +1805,16 @@ inner_loop:
     if (first_child == NULL)
         goto loop;
 
+#if defined(THREADED_RTS)
+    // If another thread has run out of work, and we have more of our own,
+    // let it have the objects reachable from first_child.
+    if (RTS_UNLIKELY(retainer_idle_threads > 0) && work_pool_top == 0
+        && !isOnBoundary(ts)) {
+        pushRetainerWork(first_child, c, c_child_r);
+        goto loop;
+    }
+#endif
+
     // (c, cp, r) = (first_child, c, c_child_r)
     r = c_child_r;
     cp = c;
@@ -1634,34 +1826,72 @@ inner_loop:
  *  Compute the retainer set for every object reachable from *tl.
  * -------------------------------------------------------------------------- */
 static void
-retainRoot(void *user STG_UNUSED, StgClosure **tl)
+retainRoot(void *user, StgClosure **tl)
 {
+    traverseState *ts = (traverseState *)user;
     StgClosure *c;
+    retainer r;
 
     // We no longer assume that only TSOs and WEAKs are roots; any closure can
     // be a root.
 
-    ASSERT(isEmptyRetainerStack());
-    currentStackBoundary = stackTop;
-
     c = UNTAG_CLOSURE(*tl);
     maybeInitRetainerSet(c);
     if (c != &stg_END_TSO_QUEUE_closure && isRetainer(c)) {
-        retainClosure(c, c, getRetainerFrom(c));
+        r = getRetainerFrom(c);
     } else {
-        retainClosure(c, c, CCS_SYSTEM);
+        r = CCS_SYSTEM;
     }
 
+#if defined(THREADED_RTS)
+    if (parallel_traversal) {
+        // The GC threads will pick it up in retainerWorker()
+        pushRetainerWork(c, c, r);
+        return;
+    }
+#endif
+
+    ASSERT(isEmptyRetainerStack(ts));
+    ts->currentStackBoundary = ts->stackTop;
+
+    retainClosure(ts, c, c, r);
+
     // NOT TRUE: ASSERT(isMember(getRetainerFrom(*tl), retainerSetOf(*tl)));
     // *tl might be a TSO which is ThreadComplete, in which
     // case we ignore it for the purposes of retainer profiling.
 }
 
+#if defined(THREADED_RTS)
+/* -----------------------------------------------------------------------------
+ *  The task run by each GC thread in a parallel traversal: traverse from
+ *  the roots and donated objects in the work pool until there are none
+ *  left.
+ * -------------------------------------------------------------------------- */
+static void
+retainerWorker( uint32_t thread_index, void *user STG_UNUSED )
+{
+    traverseState *ts = &traverse_states[thread_index];
+    retainerWork w;
+
+    initializeTraverseStack(ts);
+
+    ACQUIRE_SPIN_LOCK(&work_pool_lock);
+    retainer_threads++;
+    RELEASE_SPIN_LOCK(&work_pool_lock);
+
+    while (popRetainerWork(&w)) {
+        ASSERT(isEmptyRetainerStack(ts));
+        ts->currentStackBoundary = ts->stackTop;
+        retainClosure(ts, w.c, w.cp, w.r);
+    }
+}
+#endif
+
 /* -----------------------------------------------------------------------------
  *  Compute the retainer set for each of the objects in the heap.
  * -------------------------------------------------------------------------- */
 static void
-computeRetainerSet( void )
+computeRetainerSet( traverseState *ts )
 {
     StgWeak *weak;
     uint32_t g, n;
@@ -1672,7 +1902,7 @@ computeRetainerSet( void )
     RetainerSet tmpRetainerSet;
 #endif
 
-    markCapabilities(retainRoot, NULL); // for scheduler roots
+    markCapabilities(retainRoot, ts); // for scheduler roots
 
     // This function is called after a major GC, when key, value, and finalizer
     // all are guaranteed to be valid, or reachable.
@@ -1688,12 +1918,20 @@ computeRetainerSet( void )
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         for (weak = generations[g].weak_ptr_list; weak != NULL; weak = weak->link) {
             // retainRoot((StgClosure *)weak);
-            retainRoot(NULL, (StgClosure **)&weak);
+            retainRoot(ts, (StgClosure **)&weak);
         }
     }
 
     // Consider roots from the stable ptr table.
-    markStablePtrTable(retainRoot, NULL);
+    markStablePtrTable(retainRoot, ts);
+
+#if defined(THREADED_RTS)
+    // In a parallel traversal the roots have only been collected so far.
+    if (parallel_traversal) {
+        runOnGcThreads(retainerWorker, NULL);
+    }
+#endif
+
     // Remember old stable name addresses.
     rememberOldStableNameAddresses ();
 
@@ -1828,8 +2066,8 @@ resetStaticObjectForRetainerProfiling( StgClosure *static_objects )
 void
 retainerProfile(void)
 {
-#if defined(DEBUG_RETAINER)
   uint32_t i;
+#if defined(DEBUG_RETAINER)
   uint32_t totalHeapSize;   // total raw heap size (computed by linear scanning)
 #endif
 
@@ -1887,19 +2125,44 @@ retainerProfile(void)
     costArray[i] = 0;
 #endif
 
+  // Use the GC threads if the GC that has just finished was parallel.
+  // See Note [Parallel retainer profiling].
+#if defined(THREADED_RTS) && !defined(DEBUG_RETAINER)
+  parallel_traversal = n_gc_threads > 1;
+#endif
+  n_traverse_states = parallel_traversal ? n_capabilities : 1;
+  traverse_states = stgCallocBytes(n_traverse_states, sizeof(traverseState),
+                                   "retainerProfile");
+
   /*
     We initialize the traverse stack each time the retainer profiling is
     performed (because the traverse stack size varies on each retainer profiling
     and this operation is not costly anyhow). However, we just refresh the
     retainer sets.
    */
-  initializeTraverseStack();
+#if defined(THREADED_RTS)
+  if (parallel_traversal) {
+      // each GC thread initializes its own stack in retainerWorker()
+      initSpinLock(&work_pool_lock);
+      work_pool_top = 0;
+      retainer_threads = 0;
+      retainer_idle_threads = 0;
+  } else
+#endif
+  {
+      initializeTraverseStack(&traverse_states[0]);
+  }
 #if defined(DEBUG_RETAINER)
   initializeAllRetainerSet();
 #else
   refreshAllRetainerSet();
 #endif
-  computeRetainerSet();
+  computeRetainerSet(&traverse_states[0]);
+
+  for (i = 0; i < n_traverse_states; i++) {
+      numObjectVisited += traverse_states[i].numObjectVisited;
+      timesAnyObjectVisited += traverse_states[i].timesAnyObjectVisited;
+  }
 
 #if defined(DEBUG_RETAINER)
   debugBelch("After traversing:\n");
@@ -1941,7 +2204,15 @@ retainerProfile(void)
 #endif
 
   // post-processing
-  closeTraverseStack();
+  for (i = 0; i < n_traverse_states; i++) {
+      if (traverse_states[i].firstStack != NULL) {
+          closeTraverseStack(&traverse_states[i]);
+      }
+  }
+  stgFree(traverse_states);
+  traverse_states = NULL;
+  n_traverse_states = 0;
+  parallel_traversal = false;
 #if defined(DEBUG_RETAINER)
   closeAllRetainerSet();
 #else
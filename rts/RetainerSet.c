@@ -20,7 +20,7 @@
 
 #include <string.h>
 
-#define HASH_TABLE_SIZE 255
+#define HASH_TABLE_SIZE 4093
 #define hash(hk)  (hk % HASH_TABLE_SIZE)
 static RetainerSet *hashTable[HASH_TABLE_SIZE];
 
@@ -28,6 +28,20 @@ static Arena *arena;            // arena in which we store retainer sets
 
 static int nextId;              // id of next retainer set
 
+static uint32_t numRetainerSets; // number of retainer sets in hashTable[]
+
+/*
+  The retainer sets may be looked up by several threads at once during a
+  parallel retainer traversal (see Note [Parallel retainer profiling] in
+  RetainerProfile.c).  Lookups do not take any lock: a bucket is only ever
+  extended by consing a fully initialised set onto its head.  Creating a
+  set takes retainer_set_lock, and searches the bucket again in case
+  another thread created the same set in the meantime.
+ */
+#if defined(THREADED_RTS)
+static SpinLock retainer_set_lock;
+#endif
+
 /* -----------------------------------------------------------------------------
  * rs_MANY is a distinguished retainer set, such that
  *
@@ -70,6 +84,10 @@ initializeAllRetainerSet(void)
     for (i = 0; i < HASH_TABLE_SIZE; i++)
         hashTable[i] = NULL;
     nextId = 2;   // Initial value must be positive, 2 is MANY.
+    numRetainerSets = 0;
+#if defined(THREADED_RTS)
+    initSpinLock(&retainer_set_lock);
+#endif
 }
 
 /* -----------------------------------------------------------------------------
@@ -88,6 +106,7 @@ refreshAllRetainerSet(void)
     for (i = 0; i < HASH_TABLE_SIZE; i++)
         hashTable[i] = NULL;
     nextId = 2;
+    numRetainerSets = 0;
 #endif /* FIRST_APPROACH */
 }
 
@@ -100,33 +119,98 @@ closeAllRetainerSet(void)
     arenaFree(arena);
 }
 
+/* -----------------------------------------------------------------------------
+ *  Returns true if no more retainer sets may be created, see
+ *  RtsFlags.ProfFlags.maxRetainerSets.  Retainer sets that would be created
+ *  from then on are replaced by rs_MANY.
+ * -------------------------------------------------------------------------- */
+STATIC_INLINE bool
+retainerSetsFull( void )
+{
+    return RtsFlags.ProfFlags.maxRetainerSets != 0 &&
+        numRetainerSets >= RtsFlags.ProfFlags.maxRetainerSets;
+}
+
+/* -----------------------------------------------------------------------------
+ *  Links a new retainer set into hashTable[].  retainer_set_lock must be
+ *  held.
+ * -------------------------------------------------------------------------- */
+STATIC_INLINE void
+publishRetainerSet( RetainerSet *rs )
+{
+    rs->link = hashTable[hash(rs->hashKey)];
+    rs->id = nextId++;
+    numRetainerSets++;
+
+    // The new retainer set is placed at the head of the linked list.  It
+    // must be fully initialised before lock-free readers can see it.
+    write_barrier();
+    hashTable[hash(rs->hashKey)] = rs;
+}
+
 /* -----------------------------------------------------------------------------
  *  Finds or creates if needed a singleton retainer set.
  * -------------------------------------------------------------------------- */
 RetainerSet *
 singleton(retainer r)
 {
-    RetainerSet *rs;
+    RetainerSet *rs, *head;
     StgWord hk;
 
     hk = hashKeySingleton(r);
-    for (rs = hashTable[hash(hk)]; rs != NULL; rs = rs->link)
+    head = hashTable[hash(hk)];
+    for (rs = head; rs != NULL; rs = rs->link)
         if (rs->num == 1 &&  rs->element[0] == r) return rs;    // found it
 
+    ACQUIRE_SPIN_LOCK(&retainer_set_lock);
+
+    // Another thread may have created it since we looked.
+    for (rs = hashTable[hash(hk)]; rs != head; rs = rs->link)
+        if (rs->num == 1 &&  rs->element[0] == r) goto done;
+
+    if (retainerSetsFull()) {
+        rs = &rs_MANY;
+        goto done;
+    }
+
     // create it
     rs = arenaAlloc( arena, sizeofRetainerSet(1) );
     rs->num = 1;
     rs->hashKey = hk;
-    rs->link = hashTable[hash(hk)];
-    rs->id = nextId++;
     rs->element[0] = r;
+    publishRetainerSet(rs);
 
-    // The new retainer set is placed at the head of the linked list.
-    hashTable[hash(hk)] = rs;
-
+done:
+    RELEASE_SPIN_LOCK(&retainer_set_lock);
     return rs;
 }
 
+/* -----------------------------------------------------------------------------
+ *  Returns true if *nrs is *rs augmented with r, where nl is the number of
+ *  retainers in *rs less than r.
+ * -------------------------------------------------------------------------- */
+STATIC_INLINE bool
+isAddElement(RetainerSet *nrs, retainer r, RetainerSet *rs, uint32_t nl)
+{
+    uint32_t i;
+
+    // check their size
+    if (rs->num + 1 != nrs->num) return false;
+
+    // compare the first nl retainers and find the first non-matching one.
+    for (i = 0; i < nl; i++)
+        if (rs->element[i] != nrs->element[i]) return false;
+
+    // compare r itself
+    if (r != nrs->element[i]) return false;       // i == nl
+
+    // compare the remaining retainers
+    for (; i < rs->num; i++)
+        if (rs->element[i] != nrs->element[i + 1]) return false;
+
+    return true;
+}
+
 /* -----------------------------------------------------------------------------
  *   Finds or creates a retainer set *rs augmented with r.
  *   Invariants:
@@ -143,6 +227,7 @@ addElement(retainer r, RetainerSet *rs)
     uint32_t i;
     uint32_t nl;        // Number of retainers in *rs Less than r
     RetainerSet *nrs;   // New Retainer Set
+    RetainerSet *head;
     StgWord hk;         // Hash Key
 
 #if defined(DEBUG_RETAINER)
@@ -166,38 +251,33 @@ addElement(retainer r, RetainerSet *rs)
     // remaining (rs->num - nl) retainers.
 
     hk = hashKeyAddElement(r, rs);
-    for (nrs = hashTable[hash(hk)]; nrs != NULL; nrs = nrs->link) {
-        // test *rs and *nrs for equality
-
-        // check their size
-        if (rs->num + 1 != nrs->num) continue;
-
-        // compare the first nl retainers and find the first non-matching one.
-        for (i = 0; i < nl; i++)
-            if (rs->element[i] != nrs->element[i]) break;
-        if (i < nl) continue;
+    head = hashTable[hash(hk)];
+    for (nrs = head; nrs != NULL; nrs = nrs->link) {
+        if (isAddElement(nrs, r, rs, nl)) {
+#if defined(DEBUG_RETAINER)
+            // debugBelch("%p\n", nrs);
+#endif
+            // The set we are seeking already exists!
+            return nrs;
+        }
+    }
 
-        // compare r itself
-        if (r != nrs->element[i]) continue;       // i == nl
+    ACQUIRE_SPIN_LOCK(&retainer_set_lock);
 
-        // compare the remaining retainers
-        for (; i < rs->num; i++)
-            if (rs->element[i] != nrs->element[i + 1]) break;
-        if (i < rs->num) continue;
+    // Another thread may have created it since we looked.
+    for (nrs = hashTable[hash(hk)]; nrs != head; nrs = nrs->link) {
+        if (isAddElement(nrs, r, rs, nl)) goto done;
+    }
 
-#if defined(DEBUG_RETAINER)
-        // debugBelch("%p\n", nrs);
-#endif
-        // The set we are seeking already exists!
-        return nrs;
+    if (retainerSetsFull()) {
+        nrs = &rs_MANY;
+        goto done;
     }
 
     // create a new retainer set
     nrs = arenaAlloc( arena, sizeofRetainerSet(rs->num + 1) );
     nrs->num = rs->num + 1;
     nrs->hashKey = hk;
-    nrs->link = hashTable[hash(hk)];
-    nrs->id = nextId++;
     for (i = 0; i < nl; i++) {              // copy the first nl retainers
         nrs->element[i] = rs->element[i];
     }
@@ -205,12 +285,13 @@ addElement(retainer r, RetainerSet *rs)
     for (; i < rs->num; i++) {              // copy the remaining retainers
         nrs->element[i + 1] = rs->element[i];
     }
-
-    hashTable[hash(hk)] = nrs;
+    publishRetainerSet(nrs);
 
 #if defined(DEBUG_RETAINER)
     // debugBelch("%p\n", nrs);
 #endif
+done:
+    RELEASE_SPIN_LOCK(&retainer_set_lock);
     return nrs;
 }
 
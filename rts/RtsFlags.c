@@ -201,6 +201,7 @@ void initRtsFlagsDefaults(void)
     RtsFlags.ProfFlags.includeTSOs        = false;
     RtsFlags.ProfFlags.showCCSOnException = false;
     RtsFlags.ProfFlags.maxRetainerSetSize = 8;
+    RtsFlags.ProfFlags.maxRetainerSets    = 0;
     RtsFlags.ProfFlags.ccsLength          = 25;
     RtsFlags.ProfFlags.modSelector        = NULL;
     RtsFlags.ProfFlags.descrSelector      = NULL;
@@ -219,6 +220,10 @@ void initRtsFlagsDefaults(void)
     RtsFlags.TraceFlags.sparks_sampled= false;
     RtsFlags.TraceFlags.sparks_full   = false;
     RtsFlags.TraceFlags.user          = false;
+    RtsFlags.TraceFlags.stack_samples = false;
+    RtsFlags.TraceFlags.stackSampleDepth = 16;
+    RtsFlags.TraceFlags.alloc_samples = false;
+    RtsFlags.TraceFlags.allocSampleInterval = 512 * 1024;
 #endif
 
 #if defined(PROFILING)
@@ -236,6 +241,14 @@ void initRtsFlagsDefaults(void)
     RtsFlags.MiscFlags.machineReadable         = false;
     RtsFlags.MiscFlags.internalCounters        = false;
     RtsFlags.MiscFlags.linkerMemBase           = 0;
+    RtsFlags.MiscFlags.linkerLazy              = false;
+    RtsFlags.MiscFlags.linkerStats             = false;
+    RtsFlags.MiscFlags.linkerThreads           = 1;
+    RtsFlags.MiscFlags.compactThreads          = 1;
+    RtsFlags.MiscFlags.compactForwarding       = false;
+    RtsFlags.MiscFlags.finalizerThreads        = 0;
+    RtsFlags.MiscFlags.linkerIndexDir          = NULL;
+    RtsFlags.MiscFlags.tickless                = false;
 
 #if defined(THREADED_RTS)
     RtsFlags.ParFlags.nCapabilities     = 1;
@@ -336,6 +349,9 @@ usage_text[] = {
 "    -hb<bio>...  closures with specified biographies (lag,drag,void,use)",
 "",
 "  -R<size>       Set the maximum retainer set size (default: 8)",
+"  --max-retainer-sets=<n>",
+"                 Stop creating new retainer sets after <n> of them",
+"                 (default: 0, unlimited)",
 "",
 "  -L<chars>      Maximum length of a cost-centre stack in a heap profile",
 "                 (default: 25)",
@@ -359,12 +375,19 @@ usage_text[] = {
 "                p    par spark events (sampled)",
 "                f    par spark events (full detail)",
 "                u    user events (emitted from Haskell code)",
+"                c    stack samples of running threads, every tick (-V)",
+"                m    allocation samples, see --alloc-sample-interval",
 "                a    all event classes above",
 #  if defined(DEBUG)
 "                t    add time stamps (only useful with -v)",
 #  endif
 "               -x    disable an event class, for any flag above",
 "             the initial enabled event classes are 'sgpu'",
+"  --stack-sample-depth=<n>",
+"             Number of stack frames recorded per stack sample (default: 16)",
+"  --alloc-sample-interval=<size>",
+"             Bytes allocated per capability between allocation samples",
+"             (default: 512k)",
 #endif
 
 #if !defined(PROFILING)
@@ -437,6 +460,30 @@ usage_text[] = {
 #endif
 "  --install-signal-handlers=<yes|no>",
 "            Install signal handlers (default: yes)",
+"  --linker-lazy",
+"            Only relocate object code in the GHCi linker when one of its",
+"            symbols is first used",
+"  --linker-stats",
+"            Report the time spent in each phase of the GHCi linker on exit",
+"  --linker-threads[=<n>]",
+"            Use up to <n> OS threads in the GHCi linker (default: 1)",
+"            If <n> is omitted or 0, use one thread per processor",
+"  --linker-index=<dir>",
+"            Keep indices of the symbols in static archives in <dir>, and",
+"            only read archive members when their symbols are used",
+"  --compact-threads[=<n>]",
+"            Copy evaluated data into compact regions on up to <n> OS",
+"            threads (default: 1)",
+"            If <n> is omitted or 0, use one thread per processor",
+"  --compact-forwarding",
+"            Preserve sharing in compact regions by forwarding the objects",
+"            copied so far, rather than keeping a table of them",
+"  --finalizer-threads=<n>",
+"            Run C finalizers on <n> OS threads (default: 0, run them on",
+"            idle capabilities)",
+"  --tickless",
+"            Stop the timer while no capability has more than one thread",
+"            to run, and time context switches for each capability",
 #if defined(mingw32_HOST_OS)
 "  --install-seh-handlers=<yes|no>",
 "            Install exception handlers (default: yes)",
@@ -898,6 +945,88 @@ error = true;
                       OPTION_SAFE;
                       RtsFlags.MiscFlags.internalCounters = true;
                   }
+                  else if (strequal("linker-lazy",
+                                    &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.MiscFlags.linkerLazy = true;
+                  }
+                  else if (strequal("linker-stats",
+                                    &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.MiscFlags.linkerStats = true;
+                  }
+                  else if (!strncmp("linker-index=",
+                                    &rts_argv[arg][2], 13)) {
+                      OPTION_UNSAFE;
+                      if (rts_argv[arg][15] == '\0') {
+                          bad_option( rts_argv[arg] );
+                      } else {
+                          RtsFlags.MiscFlags.linkerIndexDir = rts_argv[arg]+15;
+                      }
+                  }
+                  else if (!strncmp("linker-threads",
+                                    &rts_argv[arg][2], 14)) {
+                      OPTION_UNSAFE;
+                      if (rts_argv[arg][16] == '\0') {
+                          RtsFlags.MiscFlags.linkerThreads = 0;
+                      } else if (rts_argv[arg][16] == '=') {
+                          int threads = strtol(rts_argv[arg]+17,
+                                               (char **) NULL, 10);
+                          if (threads < 0) {
+                              errorBelch("%s: thread count must not be "
+                                         "negative", rts_argv[arg]);
+                              error = true;
+                          } else {
+                              RtsFlags.MiscFlags.linkerThreads = threads;
+                          }
+                      } else {
+                          bad_option( rts_argv[arg] );
+                      }
+                  }
+                  else if (!strncmp("finalizer-threads=",
+                                    &rts_argv[arg][2], 18)) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                          int threads = strtol(rts_argv[arg]+20,
+                                               (char **) NULL, 10);
+                          if (threads < 0) {
+                              errorBelch("%s: thread count must not be "
+                                         "negative", rts_argv[arg]);
+                              error = true;
+                          } else {
+                              RtsFlags.MiscFlags.finalizerThreads = threads;
+                          }
+                      );
+                  }
+                  else if (strequal("tickless",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.MiscFlags.tickless = true;
+                  }
+                  else if (strequal("compact-forwarding",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.MiscFlags.compactForwarding = true;
+                  }
+                  else if (!strncmp("compact-threads",
+                                    &rts_argv[arg][2], 15)) {
+                      OPTION_UNSAFE;
+                      if (rts_argv[arg][17] == '\0') {
+                          RtsFlags.MiscFlags.compactThreads = 0;
+                      } else if (rts_argv[arg][17] == '=') {
+                          int threads = strtol(rts_argv[arg]+18,
+                                               (char **) NULL, 10);
+                          if (threads < 0) {
+                              errorBelch("%s: thread count must not be "
+                                         "negative", rts_argv[arg]);
+                              error = true;
+                          } else {
+                              RtsFlags.MiscFlags.compactThreads = threads;
+                          }
+                      } else {
+                          bad_option( rts_argv[arg] );
+                      }
+                  }
                   else if (strequal("info",
                                &rts_argv[arg][2])) {
                       OPTION_SAFE;
@@ -956,6 +1085,38 @@ error = true;
                       }
                   }
 #endif
+                  else if (!strncmp("stack-sample-depth=",
+                                    &rts_argv[arg][2], 19)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          int depth;
+                          depth = strtol(rts_argv[arg]+21, (char **) NULL, 10);
+                          if (depth <= 0 || depth > STACK_SAMPLE_MAX_DEPTH) {
+                              errorBelch("%s: depth must be between 1 and %d",
+                                         rts_argv[arg], STACK_SAMPLE_MAX_DEPTH);
+                              error = true;
+                          } else {
+                              RtsFlags.TraceFlags.stackSampleDepth = depth;
+                          }
+                          );
+                  }
+                  else if (!strncmp("alloc-sample-interval=",
+                                    &rts_argv[arg][2], 22)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.allocSampleInterval =
+                              decodeSize(rts_argv[arg], 24, BLOCK_SIZE,
+                                         HS_WORD_MAX);
+                          );
+                  }
+                  else if (!strncmp("max-retainer-sets=",
+                                    &rts_argv[arg][2], 18)) {
+                      OPTION_SAFE;
+                      PROFILING_BUILD_ONLY(
+                          RtsFlags.ProfFlags.maxRetainerSets =
+                              strtol(rts_argv[arg]+20, (char **) NULL, 10);
+                          );
+                  }
                   else if (!strncmp("long-gc-sync=", &rts_argv[arg][2], 13)) {
                       OPTION_SAFE;
                       if (rts_argv[arg][2] == '\0') {
@@ -2018,6 +2179,8 @@ static void read_trace_flags(const char *arg)
             RtsFlags.TraceFlags.sparks_sampled = enabled;
             RtsFlags.TraceFlags.sparks_full    = enabled;
             RtsFlags.TraceFlags.user           = enabled;
+            RtsFlags.TraceFlags.stack_samples  = enabled;
+            RtsFlags.TraceFlags.alloc_samples  = enabled;
             enabled = true;
             break;
 
@@ -2045,6 +2208,14 @@ static void read_trace_flags(const char *arg)
             RtsFlags.TraceFlags.user      = enabled;
             enabled = true;
             break;
+        case 'c':
+            RtsFlags.TraceFlags.stack_samples = enabled;
+            enabled = true;
+            break;
+        case 'm':
+            RtsFlags.TraceFlags.alloc_samples = enabled;
+            enabled = true;
+            break;
         default:
             errorBelch("unknown trace option: %c",*c);
             break;
@@ -249,6 +249,11 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
     /* initialise the stable name table */
     initStableNameTable();
 
+#if defined(THREADED_RTS)
+    /* start the threads that run C finalizers, if any */
+    initFinalizerThreads();
+#endif
+
     /* Add some GC roots for things in the base package that the RTS
      * knows about.  We don't know whether these turn out to be CAFs
      * or refer to CAFs, but we have to assume that they might.
@@ -391,6 +396,11 @@ hs_exit_(bool wait_foreign)
     /* stop all running tasks */
     exitScheduler(wait_foreign);
 
+#if defined(THREADED_RTS)
+    /* run the C finalizers queued for the finalizer threads */
+    exitFinalizerThreads();
+#endif
+
     /* run C finalizers for all active weak pointers */
     for (i = 0; i < n_capabilities; i++) {
         runAllCFinalizers(capabilities[i]->weak_ptr_list_hd);
@@ -13,8 +13,11 @@
 #include "TopHandler.h"
 #include "HsFFI.h"
 
+#include "RtsUtils.h"
 #include "sm/Storage.h"
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #if !defined(mingw32_HOST_OS)
 #include "posix/Signals.h"
@@ -569,6 +572,8 @@
       SymI_HasProto(stg_compactGetNextBlockzh)                          \
       SymI_HasProto(stg_compactAllocateBlockzh)                         \
       SymI_HasProto(stg_compactFixupPointerszh)                         \
+      SymI_HasProto(compactWriteFile)                                   \
+      SymI_HasProto(compactMapFile)                                     \
       SymI_HasProto(stg_compactSizzezh)                                 \
       SymI_HasProto(closure_flags)                                      \
       SymI_HasProto(cmp_thread)                                         \
@@ -1052,3 +1057,240 @@ RtsSymbolVal rtsSyms[] = {
 #endif
       { 0, 0, false } /* sentinel */
 };
+
+/* -----------------------------------------------------------------------------
+   Note [RTS symbol index]
+   ~~~~~~~~~~~~~~~~~~~~~~~
+   rtsSyms has well over a thousand entries, and every process that uses the
+   linker used to malloc an RtsSymbolInfo for each of them and insert it into
+   symhash.  Instead, initRtsSymbolIndex() builds a minimal perfect hash over
+   the names in three flat arrays, and the linker consults it before symhash
+   (see lookupSymbolInfo in Linker.c).  It uses "hash and displace": the
+   names are split into small buckets by their hash, and each bucket, largest
+   first, is given the first seed that sends all of its names to free slots.
+   A lookup is then one string hash, one mix and one strcmp.
+
+   The RtsSymbolInfo of an RTS symbol lives in rts_sym_infos and is never in
+   symhash, so the rules in ghciInsertSymbolTable (a strong definition
+   overriding a weak RTS one, say) apply to it in place.  When the object
+   that overrode it is unloaded, the RTS definition comes back.
+
+   The index is built when the linker is initialised rather than when the RTS
+   is compiled, as the set of symbols depends on the way and the platform;
+   building it takes a few microseconds and no per-symbol allocation.  If an
+   entry of rtsSyms is repeated, the first one wins, as it did in symhash.
+   -------------------------------------------------------------------------- */
+
+static uint32_t  rts_sym_slots;     // number of slots
+static uint32_t  rts_sym_buckets;   // number of buckets
+static uint32_t *rts_sym_seeds;     // seed of each bucket
+static int32_t  *rts_sym_index;     // index into rtsSyms of each slot, or -1
+static RtsSymbolInfo *rts_sym_infos; // symbol in each slot
+
+// FNV-1a
+static uint32_t
+rtsSymbolHash (const SymbolName *lbl)
+{
+    uint32_t h = 2166136261U;
+    for (; *lbl; lbl++) {
+        h = (h ^ (uint8_t)*lbl) * 16777619U;
+    }
+    return h;
+}
+
+STATIC_INLINE uint32_t
+rtsSymbolSlot (uint32_t h, uint32_t seed)
+{
+    h += seed * 0x9e3779b9U;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h % rts_sym_slots;
+}
+
+static bool
+placeRtsSymbolBucket (uint32_t *syms, uint32_t n, const uint32_t *hashes,
+                      uint32_t bucket, uint32_t *slots)
+{
+    uint32_t seed, i, j;
+
+    for (seed = 0; seed < 1U << 16; seed++) {
+        for (i = 0; i < n; i++) {
+            slots[i] = rtsSymbolSlot(hashes[syms[i]], seed);
+            if (rts_sym_index[slots[i]] != -1) break;
+            for (j = 0; j < i && slots[j] != slots[i]; j++) {}
+            if (j < i) break;
+        }
+        if (i == n) {
+            rts_sym_seeds[bucket] = seed;
+            for (i = 0; i < n; i++) {
+                rts_sym_index[slots[i]] = syms[i];
+                rts_sym_infos[slots[i]].value = rtsSyms[syms[i]].addr;
+                rts_sym_infos[slots[i]].owner = NULL;
+                rts_sym_infos[slots[i]].weak  = rtsSyms[syms[i]].weak;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Largest bucket first
+static uint32_t *rts_sym_bucket_size;
+
+static int
+cmpRtsSymbolBuckets (const void *a, const void *b)
+{
+    uint32_t x = rts_sym_bucket_size[*(const uint32_t *)a];
+    uint32_t y = rts_sym_bucket_size[*(const uint32_t *)b];
+    return (x < y) - (x > y);
+}
+
+static bool
+buildRtsSymbolIndex (uint32_t n_syms, const uint32_t *hashes)
+{
+    uint32_t *start, *syms, *order, slots[64];
+    uint32_t i, j, b;
+    bool ok = true;
+
+    start = stgCallocBytes(rts_sym_buckets + 1, sizeof(uint32_t),
+                           "buildRtsSymbolIndex");
+    syms  = stgMallocBytes(n_syms * sizeof(uint32_t), "buildRtsSymbolIndex");
+    order = stgMallocBytes(rts_sym_buckets * sizeof(uint32_t),
+                           "buildRtsSymbolIndex");
+
+    // sort the symbols into buckets, keeping the order of rtsSyms, and
+    // drop repeated names
+    for (i = 0; i < n_syms; i++) {
+        start[hashes[i] % rts_sym_buckets + 1]++;
+    }
+    for (b = 0; b < rts_sym_buckets; b++) {
+        start[b + 1] += start[b];
+    }
+    rts_sym_bucket_size = stgCallocBytes(rts_sym_buckets, sizeof(uint32_t),
+                                         "buildRtsSymbolIndex");
+    for (i = 0; i < n_syms; i++) {
+        b = hashes[i] % rts_sym_buckets;
+        uint32_t *bucket = &syms[start[b]];
+        for (j = 0; j < rts_sym_bucket_size[b]; j++) {
+            if (hashes[bucket[j]] == hashes[i]
+                && strcmp(rtsSyms[bucket[j]].lbl, rtsSyms[i].lbl) == 0) {
+                break;
+            }
+        }
+        if (j == rts_sym_bucket_size[b]) {
+            bucket[rts_sym_bucket_size[b]++] = i;
+        }
+    }
+
+    for (b = 0; b < rts_sym_buckets; b++) {
+        order[b] = b;
+    }
+    qsort(order, rts_sym_buckets, sizeof(uint32_t), cmpRtsSymbolBuckets);
+
+    for (i = 0; i < rts_sym_buckets && ok; i++) {
+        b = order[i];
+        if (rts_sym_bucket_size[b] > sizeof(slots) / sizeof(slots[0])) {
+            ok = false;
+        } else if (rts_sym_bucket_size[b] > 0) {
+            ok = placeRtsSymbolBucket(&syms[start[b]],
+                                      rts_sym_bucket_size[b], hashes, b,
+                                      slots);
+        }
+    }
+
+    stgFree(rts_sym_bucket_size);
+    rts_sym_bucket_size = NULL;
+    stgFree(order);
+    stgFree(syms);
+    stgFree(start);
+    return ok;
+}
+
+void
+initRtsSymbolIndex (void)
+{
+    uint32_t n_syms, i, *hashes;
+
+    for (n_syms = 0; rtsSyms[n_syms].lbl != NULL; n_syms++) {}
+
+    hashes = stgMallocBytes(n_syms * sizeof(uint32_t), "initRtsSymbolIndex");
+    for (i = 0; i < n_syms; i++) {
+        hashes[i] = rtsSymbolHash(rtsSyms[i].lbl);
+    }
+
+    // Four symbols to a bucket on average, and a few spare slots to make
+    // seeds easy to find; try more slots if we are unlucky.
+    rts_sym_buckets = n_syms / 4 + 1;
+    rts_sym_slots = n_syms + n_syms / 8 + 1;
+    for (;;) {
+        rts_sym_seeds = stgMallocBytes(rts_sym_buckets * sizeof(uint32_t),
+                                       "initRtsSymbolIndex");
+        rts_sym_index = stgMallocBytes(rts_sym_slots * sizeof(int32_t),
+                                       "initRtsSymbolIndex");
+        rts_sym_infos = stgMallocBytes(rts_sym_slots * sizeof(RtsSymbolInfo),
+                                       "initRtsSymbolIndex");
+        for (i = 0; i < rts_sym_slots; i++) {
+            rts_sym_index[i] = -1;
+        }
+        if (buildRtsSymbolIndex(n_syms, hashes)) {
+            break;
+        }
+        exitRtsSymbolIndex();
+        rts_sym_buckets += rts_sym_buckets / 2;
+        rts_sym_slots += rts_sym_slots / 2;
+    }
+
+    IF_DEBUG(linker, debugBelch("initRtsSymbolIndex: %d symbols in %d slots\n",
+                                n_syms, rts_sym_slots));
+    stgFree(hashes);
+}
+
+void
+exitRtsSymbolIndex (void)
+{
+    stgFree(rts_sym_seeds);
+    stgFree(rts_sym_index);
+    stgFree(rts_sym_infos);
+    rts_sym_seeds = NULL;
+    rts_sym_index = NULL;
+    rts_sym_infos = NULL;
+}
+
+RtsSymbolInfo *
+lookupRtsSymbolInfo (const SymbolName *lbl)
+{
+    uint32_t h, slot;
+    int32_t i;
+
+    if (rts_sym_index == NULL) {
+        return NULL;
+    }
+    h = rtsSymbolHash(lbl);
+    slot = rtsSymbolSlot(h, rts_sym_seeds[h % rts_sym_buckets]);
+    i = rts_sym_index[slot];
+    if (i == -1 || strcmp(rtsSyms[i].lbl, lbl) != 0) {
+        return NULL;
+    }
+    return &rts_sym_infos[slot];
+}
+
+bool
+isRtsSymbolInfo (RtsSymbolInfo *pinfo)
+{
+    return rts_sym_infos != NULL
+        && pinfo >= rts_sym_infos
+        && pinfo < rts_sym_infos + rts_sym_slots;
+}
+
+void
+restoreRtsSymbolInfo (RtsSymbolInfo *pinfo)
+{
+    RtsSymbolVal *sym = &rtsSyms[rts_sym_index[pinfo - rts_sym_infos]];
+
+    pinfo->value = sym->addr;
+    pinfo->owner = NULL;
+    pinfo->weak  = sym->weak;
+}
@@ -25,3 +25,10 @@ typedef struct _RtsSymbolVal {
 } RtsSymbolVal;
 
 extern RtsSymbolVal rtsSyms[];
+
+/* The index of rtsSyms used by the linker, see Note [RTS symbol index] */
+void initRtsSymbolIndex (void);
+void exitRtsSymbolIndex (void);
+RtsSymbolInfo *lookupRtsSymbolInfo (const SymbolName *lbl);
+bool isRtsSymbolInfo (RtsSymbolInfo *pinfo);
+void restoreRtsSymbolInfo (RtsSymbolInfo *pinfo);
@@ -181,6 +181,9 @@ schedule (Capability *initialCapability, Task *task)
   StgThreadReturnCode ret;
   uint32_t prev_what_next;
   bool ready_to_gc;
+#if defined(THREADED_RTS)
+  bool batch_throwto = false;
+#endif
 
   cap = initialCapability;
 
@@ -274,6 +277,18 @@ schedule (Capability *initialCapability, Task *task)
 
     scheduleFindWork(&cap);
 
+#if defined(THREADED_RTS)
+    // Send any throwTo messages waiting on our outbox, unless the
+    // thread we just ran blocked in a throwTo and there are more to
+    // come; see Note [Batched throwTo] in RaiseAsync.c
+    if (cap->outbox != (Message*)END_TSO_QUEUE &&
+        !(batch_throwto && !emptyRunQueue(cap) &&
+          cap->n_outbox < THROWTO_BATCH)) {
+        flushThrowTos(cap);
+    }
+    batch_throwto = false;
+#endif
+
     /* work pushing, currently relevant only for THREADED_RTS:
        (pushes threads, wakes up idle capabilities for stealing) */
     schedulePushWork(cap,task);
@@ -405,6 +420,7 @@ run_thread:
 
     // reset the interrupt flag before running Haskell code
     cap->interrupt = 0;
+    cap->stack_sample = 0;
 
     cap->in_haskell = true;
     cap->idle = 0;
@@ -495,9 +511,21 @@ run_thread:
         traceEventStopThread(cap, t, ret, 0);
     }
 
+#if defined(THREADED_RTS)
+    batch_throwto = ret == ThreadBlocked &&
+                    t->why_blocked == BlockedOnMsgThrowTo;
+#endif
+
     ASSERT_FULL_CAPABILITY_INVARIANTS(cap,task);
     ASSERT(t->cap == cap);
 
+    if (cap->stack_sample) {
+        traceStackSample(cap, t);
+    }
+    if (RTS_UNLIKELY(cap->total_allocated >= cap->alloc_sample_at)) {
+        traceAllocSample(cap, t);
+    }
+
     // ----------------------------------------------------------------------
 
     // Costs for the scheduler are assigned to CCS_SYSTEM
@@ -530,10 +558,14 @@ run_thread:
         break;
 
     case ThreadBlocked:
+        // This Capability may have nothing left to run, so it may need
+        // the ticker again; see Note [Tickless mode] in Timer.c.
+        tickerWanted();
         scheduleHandleThreadBlocked(t);
         break;
 
     case ThreadFinished:
+        tickerWanted();
         if (scheduleHandleThreadFinished(cap, task, t)) return cap;
         ASSERT_FULL_CAPABILITY_INVARIANTS(cap,task);
         break;
@@ -1101,11 +1133,14 @@ schedulePostRunThread (Capability *cap, StgTSO *t)
 static bool
 scheduleHandleHeapOverflow( Capability *cap, StgTSO *t )
 {
-    if (cap->r.rHpLim == NULL || cap->context_switch) {
+    if ((cap->r.rHpLim == NULL && !cap->stack_sample) || cap->context_switch) {
         // Sometimes we miss a context switch, e.g. when calling
         // primitives in a tight loop, MAYBE_GC() doesn't check the
         // context switch flag, and we end up waiting for a GC.
         // See #1984, and concurrent/should_run/1984
+        //
+        // A stop requested only to take a stack sample is not a
+        // context switch (see Note [Stack sampling] in Trace.c).
         cap->context_switch = 0;
         appendToRunQueue(cap,t);
     } else {
@@ -1387,6 +1422,47 @@ static void stopAllCapabilities (Capability **pCap, Task *task)
 }
 #endif
 
+/* -----------------------------------------------------------------------------
+ * tryStopAllCapabilities()
+ *
+ * Like stopAllCapabilities(), but if some other Capability is already
+ * synchronising we return false rather than yield to it, so that no GC can
+ * happen while we hold cap.  Used by compactAddParallel(), which is called
+ * from a primop.
+ *
+ * To resume after tryStopAllCapabilities(), use resumeAllCapabilities().
+ * -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+bool tryStopAllCapabilities (Capability *cap, Task *task)
+{
+    PendingSync sync = {
+        .type = SYNC_OTHER,
+        .idle = NULL,
+        .task = task
+    };
+
+    if (cas((StgVolatilePtr)&pending_sync, (StgWord)NULL,
+            (StgWord)&sync) != (StgWord)NULL) {
+        return false;
+    }
+
+    // This is on the path of a primop, so don't wait for the other
+    // Capabilities to context switch: stop them now, as a GC does.
+    interruptAllCapabilities();
+
+    acquireAllCapabilities(cap,task);
+
+    pending_sync = 0;
+    return true;
+}
+
+void resumeAllCapabilities (Capability *cap, Task *task)
+{
+    releaseAllCapabilities(n_capabilities, cap, task);
+}
+#endif
+
 /* -----------------------------------------------------------------------------
  * requestSync()
  *
@@ -1529,6 +1605,12 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
         return;
     }
 
+#if defined(THREADED_RTS)
+    // We might not get this Capability back after the GC, so don't
+    // leave messages on it; see Note [Batched throwTo] in RaiseAsync.c
+    flushThrowTos(cap);
+#endif
+
     heap_census = scheduleNeedHeapProfile(true);
 
     // Figure out which generation we are collecting, so that we can
@@ -1792,6 +1874,10 @@ delete_threads_and_gc:
     doIdleGCWork(cap, true /* all of it */);
 
 #if defined(THREADED_RTS)
+    // and let the finalizer threads finish theirs; see Note [Finalizer
+    // threads] in Weak.c
+    waitFinalizerThreads();
+
     // reset pending_sync *before* GC, so that when the GC threads
     // emerge they don't immediately re-enter the GC.
     pending_sync = 0;
@@ -1975,6 +2061,7 @@ forkProcess(HsStablePtr *entry
 
 #if defined(THREADED_RTS)
     ACQUIRE_LOCK(&all_tasks_mutex);
+    ACQUIRE_LOCK(&finalizer_mutex);
 #endif
 
     stopTimer(); // See #4074
@@ -1998,6 +2085,7 @@ forkProcess(HsStablePtr *entry
 #if defined(THREADED_RTS)
         /* N.B. releaseCapability_ below may need to take all_tasks_mutex */
         RELEASE_LOCK(&all_tasks_mutex);
+        RELEASE_LOCK(&finalizer_mutex);
 #endif
 
         for (i=0; i < n_capabilities; i++) {
@@ -2030,6 +2118,12 @@ forkProcess(HsStablePtr *entry
         resetTracing();
 #endif
 
+#if defined(THREADED_RTS)
+        // the queued C finalizers still have to run.  After
+        // resetTracing(), because the finalizer threads post events.
+        restartFinalizerThreads();
+#endif
+
         // Now, all OS threads except the thread that forked are
         // stopped.  We need to stop all Haskell threads, including
         // those involved in foreign calls.  Also we need to delete
@@ -2395,11 +2489,19 @@ suspendThread (StgRegTable *reg, bool interruptible)
   // Otherwise allocate() will write to invalid memory.
   cap->r.rCurrentTSO = NULL;
 
+#if defined(THREADED_RTS)
+  // The Capability may go idle; see Note [Batched throwTo]
+  if (cap->outbox != (Message*)END_TSO_QUEUE) {
+      flushThrowTos(cap);
+  }
+#endif
+
   ACQUIRE_LOCK(&cap->lock);
 
   suspendTask(cap,task);
   cap->in_haskell = false;
   releaseCapability_(cap,false);
+  tickerWanted();
 
   RELEASE_LOCK(&cap->lock);
 
@@ -12,6 +12,7 @@
 #include "rts/OSThreads.h"
 #include "Capability.h"
 #include "Trace.h"
+#include "Timer.h"
 
 #include "BeginPrivate.h"
 
@@ -40,6 +41,17 @@ void scheduleThreadOn(Capability *cap, StgWord cpu, StgTSO *tso);
 void wakeUpRts(void);
 #endif
 
+/* tryStopAllCapabilities(), resumeAllCapabilities()
+ *
+ * Stop all Haskell execution without ever giving up our Capability, for
+ * callers that can't let a GC happen.  Returns false if another sync is
+ * in progress.
+ */
+#if defined(THREADED_RTS)
+bool tryStopAllCapabilities (Capability *cap, Task *task);
+void resumeAllCapabilities (Capability *cap, Task *task);
+#endif
+
 /* raiseExceptionHelper */
 StgWord raiseExceptionHelper (StgRegTable *reg, StgTSO *tso, StgClosure *exception);
 
@@ -139,6 +151,7 @@ appendToRunQueue (Capability *cap, StgTSO *tso)
     }
     cap->run_queue_tl = tso;
     cap->n_run_queue++;
+    tickerWanted();
 }
 
 /* Push a thread on the beginning of the run queue.
@@ -160,6 +173,7 @@ pushOnRunQueue (Capability *cap, StgTSO *tso)
         cap->run_queue_tl = tso;
     }
     cap->n_run_queue++;
+    tickerWanted();
 }
 
 /* Pop the first thread off the runnable queue.
@@ -65,6 +65,9 @@ newSpark (StgRegTable *reg, StgClosure *p)
         if (pushWSDeque(pool,p)) {
             cap->spark_stats.created++;
             traceEventSparkCreate(cap);
+            // The spark is only shared out when this Capability next
+            // context switches; see Note [Tickless mode] in Timer.c.
+            tickerWanted();
         } else {
             /* overflowing the spark pool */
             cap->spark_stats.overflowed++;
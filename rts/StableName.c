@@ -12,6 +12,7 @@
 #include "Rts.h"
 #include "RtsAPI.h"
 
+#include "Capability.h"
 #include "Hash.h"
 #include "RtsUtils.h"
 #include "Trace.h"
@@ -30,13 +31,75 @@ Mutex stable_name_mutex;
 
 static void enlargeStableNameTable(void);
 
+/* Note [Concurrent stable names]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Programs that use StableNames for observable sharing call makeStableName#
+   on millions of objects, from every Capability.  So that they do not
+   serialise on stable_name_mutex:
+
+   - addrToStableHash, which maps objects to stable names, is an
+     open-addressing table that is read without taking any lock.  An entry
+     is claimed by a CAS on its addr field, and its sn field is written
+     once the stable name table entry is filled in; a lookup that finds the
+     address before that waits for the sn.  Entries are only removed by the
+     GC.
+
+   - Each Capability keeps a batch of free stable name table entries
+     (cap->free_stable_names), refilled from stable_name_free under the
+     lock, so making a new stable name normally takes no lock at all.
+
+   - Growing addrToStableHash or stable_name_table is done with the lock
+     held, after "freezing" the tables: the grower sets sn_frozen and waits
+     for the mutators inside enterStableNameTables()/
+     exitStableNameTables() to leave.  The old versions are kept until the
+     next GC, as in Note [Enlarging the stable pointer table], since lookups
+     and stg_makeStableNamezh may still be reading them.
+
+   - After a GC, updateStableNameTable() only rehashes the entries whose
+     objects have moved or died, rather than rebuilding the whole table.
+*/
+
 /*
  * This hash table maps Haskell objects to stable names, so that every
  * call to lookupStableName on a given object will return the same
  * stable name.
  */
 
-static HashTable *addrToStableHash = NULL;
+typedef struct {
+    StgPtr  addr;       // the object; NULL if free, SN_HASH_DELETED if removed
+    StgWord sn;         // its stable name, or 0 until that is filled in
+} snHashEntry;
+
+typedef struct snHashTable_ {
+    StgWord mask;       // number of slots - 1
+    StgWord used;       // slots claimed, including removed ones
+    StgWord deleted;    // slots removed
+    StgWord limit;      // grow before claiming more slots than this
+    struct snHashTable_ *retired;   // older versions, freed at the next GC
+    snHashEntry slots[];
+} snHashTable;
+
+#define SN_HASH_DELETED ((StgPtr)1)
+#define INIT_SN_HASH_SIZE 256
+
+static snHashTable *addrToStableHash = NULL;
+
+/* Old versions of stable_name_table, freed at the next GC. */
+#if SIZEOF_VOID_P == 4
+#define MAX_N_OLD_SNTS 32
+#elif SIZEOF_VOID_P == 8
+#define MAX_N_OLD_SNTS 64
+#else
+#error unknown SIZEOF_VOID_P
+#endif
+
+static snEntry *old_SNTs[MAX_N_OLD_SNTS];
+static uint32_t n_old_SNTs = 0;
+
+#if defined(THREADED_RTS)
+static volatile StgWord sn_writers = 0;
+static volatile StgWord sn_frozen = 0;
+#endif
 
 void
 stableNameLock(void)
@@ -51,6 +114,195 @@ stableNameUnlock(void)
     RELEASE_LOCK(&stable_name_mutex);
 }
 
+/* -----------------------------------------------------------------------------
+ * Keeping the tables still while they are updated by a mutator
+ * -------------------------------------------------------------------------- */
+
+STATIC_INLINE void
+enterStableNameTables(void)
+{
+#if defined(THREADED_RTS)
+    for (;;) {
+        atomic_inc(&sn_writers, 1);
+        if (VOLATILE_LOAD(&sn_frozen) == 0) {
+            return;
+        }
+        atomic_dec(&sn_writers);
+        // whoever froze the tables is holding the lock until it is done
+        ACQUIRE_LOCK(&stable_name_mutex);
+        RELEASE_LOCK(&stable_name_mutex);
+    }
+#endif
+}
+
+STATIC_INLINE void
+exitStableNameTables(void)
+{
+#if defined(THREADED_RTS)
+    atomic_dec(&sn_writers);
+#endif
+}
+
+// Must be holding stable_name_mutex
+static void
+freezeStableNameTables(void)
+{
+#if defined(THREADED_RTS)
+    xchg((StgPtr)&sn_frozen, 1);
+    while (VOLATILE_LOAD(&sn_writers) != 0) {
+        busy_wait_nop();
+    }
+#endif
+}
+
+static void
+thawStableNameTables(void)
+{
+#if defined(THREADED_RTS)
+    write_barrier();
+    sn_frozen = 0;
+#endif
+}
+
+/* -----------------------------------------------------------------------------
+ * The hash table
+ * -------------------------------------------------------------------------- */
+
+static snHashTable *
+allocSnHashTable(StgWord size)
+{
+    snHashTable *t;
+
+    t = stgMallocBytes(sizeof(snHashTable) + size * sizeof(snHashEntry),
+                       "allocSnHashTable");
+    memset(t->slots, 0, size * sizeof(snHashEntry));
+    t->mask = size - 1;
+    t->used = 0;
+    t->deleted = 0;
+    t->limit = size / 4 * 3;
+    t->retired = NULL;
+    return t;
+}
+
+static void
+freeSnHashTables(snHashTable *t)
+{
+    snHashTable *next;
+
+    for (; t != NULL; t = next) {
+        next = t->retired;
+        stgFree(t);
+    }
+}
+
+STATIC_INLINE StgWord
+snHash(snHashTable *t, StgPtr p)
+{
+    return hashWord(NULL, (StgWord)p) & t->mask;
+}
+
+// The entry may still be being filled in by another Capability
+STATIC_INLINE StgWord
+waitForSnHashEntry(snHashEntry *e)
+{
+    StgWord sn;
+
+    while ((sn = VOLATILE_LOAD(&e->sn)) == 0) {
+#if defined(THREADED_RTS)
+        busy_wait_nop();
+#endif
+    }
+    load_load_barrier();
+    return sn;
+}
+
+// Find the stable name of p, or 0.  Doesn't need the lock.
+static StgWord
+lookupSnHash(StgPtr p)
+{
+    snHashTable *t = addrToStableHash;
+    StgWord i;
+    StgPtr q;
+
+    for (i = snHash(t, p); (q = t->slots[i].addr) != NULL; i = (i + 1) & t->mask) {
+        if (q == p) {
+            return waitForSnHashEntry(&t->slots[i]);
+        }
+    }
+    return 0;
+}
+
+// Add p -> sn during GC.  p must not be in the table already.
+static void
+insertSnHash(snHashTable *t, StgPtr p, StgWord sn)
+{
+    StgWord i;
+    StgPtr q;
+
+    for (i = snHash(t, p); (q = t->slots[i].addr) != NULL; i = (i + 1) & t->mask) {
+        if (q == SN_HASH_DELETED) {
+            t->deleted--;
+            break;
+        }
+    }
+    if (q == NULL) {
+        t->used++;
+    }
+    t->slots[i].addr = p;
+    t->slots[i].sn = sn;
+}
+
+// Remove p -> sn during GC.
+static void
+removeSnHash(snHashTable *t, StgPtr p, StgWord sn)
+{
+    StgWord i;
+    StgPtr q;
+
+    for (i = snHash(t, p); (q = t->slots[i].addr) != NULL; i = (i + 1) & t->mask) {
+        if (q == p && t->slots[i].sn == sn) {
+            t->slots[i].addr = SN_HASH_DELETED;
+            t->slots[i].sn = 0;
+            t->deleted++;
+            return;
+        }
+    }
+}
+
+// Copy the live entries of t into a new table of the given size
+static snHashTable *
+rehashSnHashTable(snHashTable *t, StgWord size)
+{
+    snHashTable *new_t = allocSnHashTable(size);
+    StgWord i;
+
+    for (i = 0; i <= t->mask; i++) {
+        if (t->slots[i].addr != NULL && t->slots[i].addr != SN_HASH_DELETED) {
+            insertSnHash(new_t, t->slots[i].addr, t->slots[i].sn);
+        }
+    }
+    return new_t;
+}
+
+// Grow addrToStableHash, which was t when it was found to be full.
+static void
+enlargeSnHashTable(snHashTable *t)
+{
+    snHashTable *new_t;
+
+    stableNameLock();
+    if (addrToStableHash == t) {
+        freezeStableNameTables();
+        new_t = rehashSnHashTable(t, (t->mask + 1) * 2);
+        // lookups may still be reading t, so it lives until the next GC
+        new_t->retired = t;
+        write_barrier();
+        addrToStableHash = new_t;
+        thawStableNameTables();
+    }
+    stableNameUnlock();
+}
+
 /* -----------------------------------------------------------------------------
  * Initialising the table
  * -------------------------------------------------------------------------- */
@@ -77,10 +329,10 @@ initStableNameTable(void)
                                        "initStableNameTable");
     /* we don't use index 0 in the stable name table, because that
      * would conflict with the hash table lookup operations which
-     * return NULL if an entry isn't found in the hash table.
+     * return 0 if an entry isn't found in the hash table.
      */
     initSnEntryFreeList(stable_name_table + 1,INIT_SNT_SIZE-1,NULL);
-    addrToStableHash = allocHashTable();
+    addrToStableHash = allocSnHashTable(INIT_SN_HASH_SIZE);
 
 #if defined(THREADED_RTS)
     initMutex(&stable_name_mutex);
@@ -91,31 +343,78 @@ initStableNameTable(void)
  * Enlarging the tables
  * -------------------------------------------------------------------------- */
 
+// Must be holding stable_name_mutex
 static void
 enlargeStableNameTable(void)
 {
     uint32_t old_SNT_size = SNT_size;
+    snEntry *new_stable_name_table;
 
     // 2nd and subsequent times
     SNT_size *= 2;
-    stable_name_table =
-        stgReallocBytes(stable_name_table,
-                        SNT_size * sizeof(snEntry),
-                        "enlargeStableNameTable");
+
+    new_stable_name_table =
+        stgMallocBytes(SNT_size * sizeof(snEntry),
+                       "enlargeStableNameTable");
+
+    // Capabilities fill in entries they have reserved without the lock
+    freezeStableNameTables();
+    memcpy(new_stable_name_table,
+           stable_name_table,
+           old_SNT_size * sizeof(snEntry));
+    ASSERT(n_old_SNTs < MAX_N_OLD_SNTS);
+    old_SNTs[n_old_SNTs++] = stable_name_table;
+    write_barrier();
+    stable_name_table = new_stable_name_table;
+    thawStableNameTables();
 
     initSnEntryFreeList(stable_name_table + old_SNT_size, old_SNT_size, NULL);
 }
 
+// Reserve a batch of free entries for cap
+static void
+refillFreeStableNames(Capability *cap)
+{
+    snEntry *sn;
+
+    stableNameLock();
+    while (cap->n_free_stable_names < STABLE_NAME_BATCH) {
+        if (stable_name_free == NULL) {
+            enlargeStableNameTable();
+        }
+        sn = stable_name_free;
+        stable_name_free = (snEntry*)(sn->addr);
+        // An entry with a NULL addr and sn_obj is ignored by the GC
+        sn->addr = NULL;
+        sn->old = NULL;
+        sn->sn_obj = NULL;
+        cap->free_stable_names[cap->n_free_stable_names++] =
+            sn - stable_name_table;
+    }
+    stableNameUnlock();
+}
+
 
 /* -----------------------------------------------------------------------------
  * Freeing entries and tables
  * -------------------------------------------------------------------------- */
 
+static void
+freeOldSNTs(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_old_SNTs; i++) {
+        stgFree(old_SNTs[i]);
+    }
+    n_old_SNTs = 0;
+}
+
 void
 exitStableNameTable(void)
 {
     if (addrToStableHash)
-        freeHashTable(addrToStableHash, NULL);
+        freeSnHashTables(addrToStableHash);
     addrToStableHash = NULL;
 
     if (stable_name_table)
@@ -123,6 +422,8 @@ exitStableNameTable(void)
     stable_name_table = NULL;
     SNT_size = 0;
 
+    freeOldSNTs();
+
 #if defined(THREADED_RTS)
     closeMutex(&stable_name_mutex);
 #endif
@@ -132,7 +433,7 @@ STATIC_INLINE void
 freeSnEntry(snEntry *sn)
 {
   ASSERT(sn->sn_obj == NULL);
-  removeHashTable(addrToStableHash, (W_)sn->old, NULL);
+  removeSnHash(addrToStableHash, sn->old, sn - stable_name_table);
   sn->addr = (P_)stable_name_free;
   stable_name_free = sn;
 }
@@ -175,13 +476,11 @@ removeIndirections (StgClosure* p)
 }
 
 StgWord
-lookupStableName (StgPtr p)
+lookupStableName (Capability *cap, StgPtr p)
 {
-  stableNameLock();
-
-  if (stable_name_free == NULL) {
-    enlargeStableNameTable();
-  }
+  snHashTable *t;
+  StgWord i, sn;
+  StgPtr q;
 
   /* removing indirections increases the likelihood
    * of finding a match in the stable name hash table.
@@ -191,27 +490,68 @@ lookupStableName (StgPtr p)
   // register the untagged pointer.  This just makes things simpler.
   p = (StgPtr)UNTAG_CLOSURE((StgClosure*)p);
 
-  StgWord sn = (StgWord)lookupHashTable(addrToStableHash,(W_)p);
-
+  sn = lookupSnHash(p);
   if (sn != 0) {
-    ASSERT(stable_name_table[sn].addr == p);
     debugTrace(DEBUG_stable, "cached stable name %ld at %p",sn,p);
-    stableNameUnlock();
     return sn;
   }
 
-  sn = stable_name_free - stable_name_table;
-  stable_name_free  = (snEntry*)(stable_name_free->addr);
+  // Make sure we have an entry to use before entering the tables: see
+  // Note [Concurrent stable names]
+  if (cap->n_free_stable_names == 0) {
+    refillFreeStableNames(cap);
+  }
+
+retry:
+  enterStableNameTables();
+  t = addrToStableHash;
+
+  if (atomic_inc(&t->used, 1) > t->limit) {
+    atomic_dec(&t->used);
+    exitStableNameTables();
+    enlargeSnHashTable(t);
+    goto retry;
+  }
+
+  for (i = snHash(t, p); ; i = (i + 1) & t->mask) {
+    q = t->slots[i].addr;
+    if (q == NULL) {
+      q = (StgPtr)cas((StgVolatilePtr)&t->slots[i].addr, 0, (StgWord)p);
+      if (q == NULL) break;
+    }
+    if (q == p) {
+      // Another Capability got there first
+      atomic_dec(&t->used);
+      exitStableNameTables();
+      return waitForSnHashEntry(&t->slots[i]);
+    }
+  }
+
+  sn = cap->free_stable_names[--cap->n_free_stable_names];
   stable_name_table[sn].addr = p;
-  stable_name_table[sn].sn_obj = NULL;
   /* debugTrace(DEBUG_stable, "new stable name %d at %p\n",sn,p); */
+  write_barrier();
+  t->slots[i].sn = sn;
+  exitStableNameTables();
 
-  /* add the new stable name to the hash table */
-  insertHashTable(addrToStableHash, (W_)p, (void *)sn);
+  return sn;
+}
 
-  stableNameUnlock();
+/* -----------------------------------------------------------------------------
+ * Set the StableName object of a stable name, unless another Capability
+ * has already done so.  Returns the object that was set.
+ * -------------------------------------------------------------------------- */
 
-  return sn;
+StgClosure *
+setStableNameObject (StgWord sn, StgClosure *sn_obj)
+{
+  StgClosure *old;
+
+  enterStableNameTables();
+  old = (StgClosure *)cas((StgVolatilePtr)&stable_name_table[sn].sn_obj,
+                          0, (StgWord)sn_obj);
+  exitStableNameTables();
+  return old == NULL ? sn_obj : old;
 }
 
 /* -----------------------------------------------------------------------------
@@ -312,38 +652,43 @@ gcStableNameTable( void )
 /* -----------------------------------------------------------------------------
  * Update the StableName hash table
  *
- * The boolean argument 'full' indicates that a major collection is
- * being done, so we might as well throw away the hash table and build
- * a new one.  For a minor collection, we just re-hash the elements
- * that changed.
+ * Only the entries for objects that moved or died need to be rehashed.
+ * All the old addresses are removed before any new one is added, since
+ * with compaction an object may move to where another one used to be.
  * -------------------------------------------------------------------------- */
 
 void
-updateStableNameTable(bool full)
+updateStableNameTable(void)
 {
-    if (full && addrToStableHash != NULL && 0 != keyCountHashTable(addrToStableHash)) {
-        freeHashTable(addrToStableHash,NULL);
-        addrToStableHash = allocHashTable();
-    }
+    snHashTable *t = addrToStableHash;
+    StgWord live;
 
-    if(full) {
-        FOR_EACH_STABLE_NAME(
-            p, {
-                if (p->addr != NULL) {
-                    // Target still alive, Re-hash this stable name
-                    insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
-                }
-            });
-    } else {
-        FOR_EACH_STABLE_NAME(
-            p, {
-                if (p->addr != p->old) {
-                    removeHashTable(addrToStableHash, (W_)p->old, NULL);
-                    /* Movement happened: */
-                    if (p->addr != NULL) {
-                        insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
-                    }
-                }
-            });
+    // No mutator is looking at the old tables now
+    freeOldSNTs();
+    freeSnHashTables(t->retired);
+    t->retired = NULL;
+
+    FOR_EACH_STABLE_NAME(
+        p, {
+            if (p->addr != p->old && p->old != NULL) {
+                removeSnHash(t, p->old, p - stable_name_table);
+            }
+        });
+
+    FOR_EACH_STABLE_NAME(
+        p, {
+            if (p->addr != p->old && p->addr != NULL) {
+                insertSnHash(t, p->addr, p - stable_name_table);
+            }
+        });
+
+    // Rebuild the table if removed entries are filling it up, leaving
+    // plenty of room for the mutators to add to it.
+    if (t->used >= t->limit) {
+        live = t->used - t->deleted;
+        StgWord size = INIT_SN_HASH_SIZE;
+        while (size < live * 4) size *= 2;
+        addrToStableHash = rehashSnHashTable(t, size);
+        freeSnHashTables(t);
     }
 }
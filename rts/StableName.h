@@ -12,13 +12,14 @@
 
 void    initStableNameTable   ( void );
 void    exitStableNameTable      ( void );
-StgWord lookupStableName      ( StgPtr p );
+StgWord lookupStableName      ( Capability *cap, StgPtr p );
+StgClosure *setStableNameObject ( StgWord sn, StgClosure *sn_obj );
 
 void    rememberOldStableNameAddresses ( void );
 
 void    threadStableNameTable ( evac_fn evac, void *user );
 void    gcStableNameTable     ( void );
-void    updateStableNameTable ( bool full );
+void    updateStableNameTable ( void );
 
 void    stableNameLock            ( void );
 void    stableNameUnlock          ( void );
@@ -12,6 +12,7 @@
 #include "Rts.h"
 #include "RtsAPI.h"
 
+#include "Capability.h"
 #include "Hash.h"
 #include "RtsUtils.h"
 #include "Trace.h"
@@ -112,10 +113,35 @@ static uint32_t n_old_SPTs = 0;
 
 #if defined(THREADED_RTS)
 Mutex stable_ptr_mutex;
+
+// Set while the table is being enlarged, see Note [Per-capability stable
+// pointers]
+static volatile StgWord spt_frozen = 0;
 #endif
 
 static void enlargeStablePtrTable(void);
 
+/* Note [Per-capability stable pointers]
+ *
+ * FFI callbacks can make and free stable pointers at a high rate on every
+ * Capability, so in the threaded RTS a thread holding a Capability doesn't
+ * take stable_ptr_mutex to do so.  Instead each Capability caches some free
+ * entries (cap->free_stable_ptrs), which it refills from stable_ptr_free in
+ * batches, and returns to it in batches when the cache is full.  Entries in
+ * a cache have a NULL addr, so the GC ignores them.  Threads without a
+ * Capability use the free list under the lock as before.
+ *
+ * The only thing that can go wrong when a Capability writes an entry without
+ * the lock is that enlargeStablePtrTable() may be copying the table at the
+ * same time, losing the write.  So writers set cap->writing_stable_ptrs while
+ * they write, and enlargeStablePtrTable() sets spt_frozen and waits until no
+ * Capability is writing before copying.  A writer that sees spt_frozen waits
+ * for the lock, which the enlarger holds until it is done.
+ *
+ * deRefStablePtr() takes no lock at all, see Note [Enlarging the stable
+ * pointer table].
+ */
+
 /* -----------------------------------------------------------------------------
  * We must lock the StablePtr table during GC, to prevent simultaneous
  * calls to freeStablePtr().
@@ -163,6 +189,47 @@ initStablePtrTable(void)
 #endif
 }
 
+/* -----------------------------------------------------------------------------
+ * Writing to the table without the lock
+ * -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+// The Capability held by the calling thread, or NULL
+STATIC_INLINE Capability *
+myStablePtrCap(void)
+{
+    Task *task = myTask();
+
+    if (task != NULL && task->cap != NULL && task->cap->running_task == task) {
+        return task->cap;
+    }
+    return NULL;
+}
+
+STATIC_INLINE void
+beginStablePtrWrite(Capability *cap)
+{
+    for (;;) {
+        xchg((StgPtr)&cap->writing_stable_ptrs, 1);
+        if (VOLATILE_LOAD(&spt_frozen) == 0) {
+            return;
+        }
+        cap->writing_stable_ptrs = 0;
+        ACQUIRE_LOCK(&stable_ptr_mutex);
+        RELEASE_LOCK(&stable_ptr_mutex);
+    }
+}
+
+STATIC_INLINE void
+endStablePtrWrite(Capability *cap)
+{
+    write_barrier();
+    cap->writing_stable_ptrs = 0;
+}
+
+#endif
+
 /* -----------------------------------------------------------------------------
  * Enlarging the table
  * -------------------------------------------------------------------------- */
@@ -183,6 +250,19 @@ enlargeStablePtrTable(void)
     new_stable_ptr_table =
         stgMallocBytes(SPT_size * sizeof(spEntry),
                        "enlargeStablePtrTable");
+
+#if defined(THREADED_RTS)
+    // Wait for Capabilities writing to the table, see Note [Per-capability
+    // stable pointers]
+    uint32_t i;
+    xchg((StgPtr)&spt_frozen, 1);
+    for (i = 0; i < n_capabilities; i++) {
+        while (VOLATILE_LOAD(&capabilities[i]->writing_stable_ptrs) != 0) {
+            busy_wait_nop();
+        }
+    }
+#endif
+
     memcpy(new_stable_ptr_table,
            stable_ptr_table,
            old_SPT_size * sizeof(spEntry));
@@ -195,6 +275,11 @@ enlargeStablePtrTable(void)
      */
     stable_ptr_table = new_stable_ptr_table;
 
+#if defined(THREADED_RTS)
+    write_barrier();
+    spt_frozen = 0;
+#endif
+
     initSpEntryFreeList(stable_ptr_table + old_SPT_size, old_SPT_size, NULL);
 }
 
@@ -258,9 +343,39 @@ freeStablePtrUnsafe(StgStablePtr sp)
     freeSpEntry(&stable_ptr_table[(StgWord)sp]);
 }
 
+#if defined(THREADED_RTS)
+// Return cached entries to the free list until n are left
+static void
+flushStablePtrCache(Capability *cap, uint32_t n)
+{
+    stablePtrLock();
+    while (cap->n_free_stable_ptrs > n) {
+        freeSpEntry(&stable_ptr_table[
+                        cap->free_stable_ptrs[--cap->n_free_stable_ptrs]]);
+    }
+    stablePtrUnlock();
+}
+#endif
+
 void
 freeStablePtr(StgStablePtr sp)
 {
+#if defined(THREADED_RTS)
+    Capability *cap = myStablePtrCap();
+
+    if (cap != NULL) {
+        ASSERT((StgWord)sp < SPT_size);
+        beginStablePtrWrite(cap);
+        stable_ptr_table[(StgWord)sp].addr = NULL;
+        endStablePtrWrite(cap);
+        if (cap->n_free_stable_ptrs == STABLE_PTR_CACHE_SIZE) {
+            flushStablePtrCache(cap, STABLE_PTR_CACHE_SIZE / 2);
+        }
+        cap->free_stable_ptrs[cap->n_free_stable_ptrs++] = (StgWord)sp;
+        return;
+    }
+#endif
+
     stablePtrLock();
     freeStablePtrUnsafe(sp);
     stablePtrUnlock();
@@ -270,11 +385,46 @@ freeStablePtr(StgStablePtr sp)
  * Looking up
  * -------------------------------------------------------------------------- */
 
+#if defined(THREADED_RTS)
+// Take a batch of free entries for cap's cache
+static void
+refillStablePtrCache(Capability *cap)
+{
+    spEntry *sp;
+
+    stablePtrLock();
+    while (cap->n_free_stable_ptrs < STABLE_PTR_CACHE_SIZE / 2) {
+        if (!stable_ptr_free) enlargeStablePtrTable();
+        sp = stable_ptr_free;
+        stable_ptr_free = (spEntry*)(sp->addr);
+        sp->addr = NULL;
+        cap->free_stable_ptrs[cap->n_free_stable_ptrs++] =
+            sp - stable_ptr_table;
+    }
+    stablePtrUnlock();
+}
+#endif
+
 StgStablePtr
 getStablePtr(StgPtr p)
 {
   StgWord sp;
 
+#if defined(THREADED_RTS)
+  Capability *cap = myStablePtrCap();
+
+  if (cap != NULL) {
+      if (cap->n_free_stable_ptrs == 0) {
+          refillStablePtrCache(cap);
+      }
+      sp = cap->free_stable_ptrs[--cap->n_free_stable_ptrs];
+      beginStablePtrWrite(cap);
+      stable_ptr_table[sp].addr = p;
+      endStablePtrWrite(cap);
+      return (StgStablePtr)(sp);
+  }
+#endif
+
   stablePtrLock();
   if (!stable_ptr_free) enlargeStablePtrTable();
   sp = stable_ptr_free - stable_ptr_table;
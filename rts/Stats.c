@@ -66,6 +66,9 @@ static RTSStats stats;
 
 static W_ GC_end_faults = 0;
 
+// Whether the current GC is timing its phases; see Note [GC phase timing]
+static bool gc_phase_timing = false;
+
 static Time *GC_coll_cpu = NULL;
 static Time *GC_coll_elapsed = NULL;
 static Time *GC_coll_max_pause = NULL;
@@ -302,9 +305,54 @@ stat_startGC (Capability *cap, gc_thread *gct)
         gct->gc_start_faults = getPageFaults();
     }
 
+    gc_phase_timing =
+        RtsFlags.GcFlags.giveStats != NO_GC_STATS ||
+        rtsConfig.gcDoneHook != NULL;
+
     updateNurseriesStats();
 }
 
+/* Note [GC phase timing]
+   ~~~~~~~~~~~~~~~~~~~~~~
+   The total time of a GC doesn't tell us where the time went: a slow GC
+   might be spending it in the copy loop, in a long remembered set, in
+   repeated passes over the weak pointer list, and so on.  So each GC
+   thread keeps an elapsed-time counter per GcPhase (see sm/GC.h), which
+   GarbageCollect() maintains by bracketing each phase with
+   stat_startGCPhase()/stat_endGCPhase().  A phase may be entered several
+   times in one GC (the scavenge and weak phases alternate until no more
+   weak pointers are found), so the counters accumulate.
+
+   The phase times of the thread that initiated the GC end up in
+   GCDetails and in an EVENT_GC_PHASES event.  In a parallel GC the other
+   threads only take part in the copy loop (plus marking their own roots),
+   so for those we report the per-thread work counters and copy loop time
+   in an EVENT_GC_THREAD_WORK event per thread, and the slowest thread's
+   copy loop time in GCDetails.
+
+   Reading the clock costs a few tens of nanoseconds, and there are only a
+   handful of phase boundaries per GC, but we still only time phases when
+   somebody is going to look at the results: when GC statistics or a
+   gcDoneHook are enabled (GC events imply the former).
+*/
+
+void
+stat_startGCPhase (gc_thread *gct)
+{
+    if (gc_phase_timing) {
+        gct->gc_phase_start = getProcessElapsedTime();
+    }
+}
+
+void
+stat_endGCPhase (gc_thread *gct, GcPhase phase)
+{
+    if (gc_phase_timing) {
+        gct->gc_phase_elapsed[phase] +=
+            getProcessElapsedTime() - gct->gc_phase_start;
+    }
+}
+
 /* -----------------------------------------------------------------------------
    Called at the end of each GC
    -------------------------------------------------------------------------- */
@@ -314,7 +362,7 @@ stat_endGC (Capability *cap, gc_thread *gct, W_ live, W_ copied, W_ slop,
             uint32_t gen, uint32_t par_n_threads, W_ par_max_copied,
             W_ par_balanced_copied, W_ gc_spin_spin, W_ gc_spin_yield,
             W_ mut_spin_spin, W_ mut_spin_yield, W_ any_work, W_ no_work,
-            W_ scav_find_work)
+            W_ scav_find_work, W_ scanned, Time par_max_scavenge_elapsed)
 {
     // -------------------------------------------------
     // Collect all the stats about this GC in stats.gc. We always do this since
@@ -337,6 +385,21 @@ stat_endGC (Capability *cap, gc_thread *gct, W_ live, W_ copied, W_ slop,
     stats.gc.copied_bytes = copied * sizeof(W_);
     stats.gc.par_max_copied_bytes = par_max_copied * sizeof(W_);
     stats.gc.par_balanced_copied_bytes = par_balanced_copied * sizeof(W_);
+    stats.gc.scanned_bytes = scanned * sizeof(W_);
+
+    // See Note [GC phase timing]
+    stats.gc.mut_lists_elapsed_ns =
+        gct->gc_phase_elapsed[GC_PHASE_MUT_LISTS];
+    stats.gc.roots_elapsed_ns = gct->gc_phase_elapsed[GC_PHASE_ROOTS];
+    stats.gc.stable_tables_elapsed_ns =
+        gct->gc_phase_elapsed[GC_PHASE_STABLE_TABLES];
+    stats.gc.scavenge_elapsed_ns = gct->gc_phase_elapsed[GC_PHASE_SCAVENGE];
+    stats.gc.weak_elapsed_ns = gct->gc_phase_elapsed[GC_PHASE_WEAK];
+    stats.gc.sparks_elapsed_ns = gct->gc_phase_elapsed[GC_PHASE_SPARKS];
+    stats.gc.mark_compact_elapsed_ns =
+        gct->gc_phase_elapsed[GC_PHASE_MARK_COMPACT];
+    stats.gc.tidy_elapsed_ns = gct->gc_phase_elapsed[GC_PHASE_TIDY];
+    stats.gc.par_max_scavenge_elapsed_ns = par_max_scavenge_elapsed;
 
     bool stats_enabled =
         RtsFlags.GcFlags.giveStats != NO_GC_STATS ||
@@ -434,6 +497,11 @@ stat_endGC (Capability *cap, gc_thread *gct, W_ live, W_ copied, W_ slop,
                           stats.gc.copied_bytes,
                           stats.gc.par_balanced_copied_bytes);
 
+        traceEventGcPhases(cap,
+                           CAPSET_HEAP_DEFAULT,
+                           stats.gc.gen,
+                           gct->gc_phase_elapsed);
+
         // Post EVENT_GC_END with the same timestamp as used for stats
         // (though converted from Time=StgInt64 to EventTimestamp=StgWord64).
         // Here, as opposed to other places, the event is emitted on the cap
@@ -35,7 +35,11 @@ void      stat_endGC  (Capability *cap, struct gc_thread_ *_gct, W_ live,
                        W_ par_max_copied, W_ par_balanced_copied,
                        W_ gc_spin_spin, W_ gc_spin_yield, W_ mut_spin_spin,
                        W_ mut_spin_yield, W_ any_work, W_ no_work,
-                       W_ scav_find_work);
+                       W_ scav_find_work, W_ scanned,
+                       Time par_max_scavenge_elapsed);
+
+void      stat_startGCPhase(struct gc_thread_ *_gct);
+void      stat_endGCPhase  (struct gc_thread_ *_gct, GcPhase phase);
 
 #if defined(PROFILING)
 void      stat_startRP(void);
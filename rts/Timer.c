@@ -31,6 +31,142 @@ static int ticks_to_ctxt_switch = 0;
 /* idle ticks left before we perform a GC */
 static int ticks_to_gc = 0;
 
+/*
+   Note [Tickless mode]
+   ~~~~~~~~~~~~~~~~~~~~
+   The ticker is there to preempt threads, to take profiling samples, and
+   to notice when the program has gone idle.  A Capability running the
+   only thread it has needs none of that, yet by default it is still
+   interrupted every -C interval, and the process is woken every -V
+   interval.  With +RTS --tickless:
+
+   * Each Capability has its own context switch deadline,
+     cap->ticks_to_ctxt_switch.  handle_tick() counts it down only while
+     the Capability has threads waiting to run (or, in the threaded RTS,
+     tasks returning from foreign calls waiting for it, throwTo messages
+     waiting to be sent, or sparks that another Capability might take),
+     and interrupts just that Capability when it expires.  While the
+     Capability has nothing waiting the deadline is disarmed, so the next
+     thread to be woken up there starts with a full time slice.
+
+   * When no Capability has anything waiting, at least one is running
+     Haskell code, and there are no profiling ticks to take, the ticker
+     goes quiet: handle_tick() stops the timer, and the timerfd ticker
+     disarms its timerfd (see Pthread.c), so the process takes no timer
+     interrupts at all.  Whatever might give a Capability something to
+     switch to -- appendToRunQueue(), pushOnRunQueue(), newSpark(),
+     newReturningTask() -- or leave it with no Haskell code to run -- a
+     thread blocking or finishing, a safe foreign call -- calls
+     tickerWanted(), which restarts it.
+
+   While no Haskell code is running the ticker runs as usual, so the
+   idle GC and deadlock detection (+RTS -I) are not affected.
+
+   The ticker sets ticker_quiet and then looks at the Capabilities once
+   more; tickerWanted() changes a Capability and then looks at
+   ticker_quiet, with a store/load barrier in between on both sides.  So
+   either the ticker sees the change and carries on, or tickerWanted()
+   sees that the ticker has gone quiet and restarts it.
+
+   The per-Capability deadlines are counted in ticks of the one ticker,
+   rather than with a timer of their own, so they are only as precise as
+   the tick interval, as before.
+*/
+
+volatile StgWord ticker_quiet = 0;
+
+/* Has this Capability threads or tasks waiting to run, throwTo messages
+ * to send, or work to share? */
+static bool
+capabilityWantsTicks (Capability *cap)
+{
+    return !emptyThreadQueues(cap)
+#if defined(THREADED_RTS)
+        || cap->n_returning_tasks != 0
+        || cap->outbox != (Message*)END_TSO_QUEUE
+        || !emptySparkPoolCap(cap)
+#endif
+        ;
+}
+
+/* Can the ticker go quiet?  See Note [Tickless mode]. */
+static bool
+tickerIdle (void)
+{
+    bool running = false;
+    uint32_t i;
+
+    if (profTicksWanted()) {
+        return false;
+    }
+    for (i = 0; i < n_capabilities; i++) {
+        if (capabilityWantsTicks(capabilities[i])) {
+            return false;
+        }
+        running = running || capabilities[i]->in_haskell;
+    }
+    return running;
+}
+
+/* Count down the context switch deadline of each busy Capability. */
+static void
+handleTicklessTick (void)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_capabilities; i++) {
+        Capability *cap = capabilities[i];
+        if (!capabilityWantsTicks(cap)) {
+            cap->ticks_to_ctxt_switch = RtsFlags.ConcFlags.ctxtSwitchTicks;
+        } else if (RtsFlags.ConcFlags.ctxtSwitchTicks > 0) {
+            cap->ticks_to_ctxt_switch--;
+            if (cap->ticks_to_ctxt_switch <= 0) {
+                cap->ticks_to_ctxt_switch =
+                    RtsFlags.ConcFlags.ctxtSwitchTicks;
+                contextSwitchCapability(cap);
+            }
+        }
+    }
+}
+
+static void
+quietTicker (void)
+{
+    if (cas(&ticker_quiet, 0, 1) != 0) {
+        return;
+    }
+    stopTimer();
+    store_load_barrier();
+    if (!tickerIdle()) {
+        resumeTicker();
+    }
+}
+
+void
+resumeTicker (void)
+{
+    if (cas(&ticker_quiet, 1, 0) == 1) {
+        startTimer();
+    }
+}
+
+#if defined(THREADED_RTS)
+/* Stop the thread running on any Capability with throwTo messages
+ * waiting on its outbox, so that the scheduler sends them.  See Note
+ * [Batched throwTo] in RaiseAsync.c. */
+static void
+handleThrowToTick (void)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_capabilities; i++) {
+        if (capabilities[i]->outbox != (Message*)END_TSO_QUEUE) {
+            contextSwitchCapability(capabilities[i]);
+        }
+    }
+}
+#endif
+
 /*
  * Function: handle_tick()
  *
@@ -42,7 +178,16 @@ void
 handle_tick(int unused STG_UNUSED)
 {
   handleProfTick();
-  if (RtsFlags.ConcFlags.ctxtSwitchTicks > 0) {
+#if defined(THREADED_RTS)
+  handleThrowToTick();
+#endif
+  if (RtsFlags.MiscFlags.tickless) {
+      handleTicklessTick();
+      if (tickerIdle()) {
+          quietTicker();
+          return;
+      }
+  } else if (RtsFlags.ConcFlags.ctxtSwitchTicks > 0) {
       ticks_to_ctxt_switch--;
       if (ticks_to_ctxt_switch <= 0) {
           ticks_to_ctxt_switch = RtsFlags.ConcFlags.ctxtSwitchTicks;
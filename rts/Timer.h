@@ -10,3 +10,24 @@
 
 RTS_PRIVATE void initTimer (void);
 RTS_PRIVATE void exitTimer (bool wait);
+
+// Set while the ticker is stopped because no Capability needs it (+RTS
+// --tickless).  See Note [Tickless mode] in Timer.c.
+extern RTS_PRIVATE volatile StgWord ticker_quiet;
+RTS_PRIVATE void resumeTicker (void);
+
+// Call after giving a Capability another thread to run, or leaving it
+// without one, to restart the ticker if it has gone quiet.
+EXTERN_INLINE void
+tickerWanted (void);
+
+EXTERN_INLINE void
+tickerWanted (void)
+{
+    if (RtsFlags.MiscFlags.tickless) {
+        store_load_barrier();
+        if (ticker_quiet) {
+            resumeTicker();
+        }
+    }
+}
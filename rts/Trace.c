@@ -34,6 +34,8 @@ int TRACE_spark_sampled;
 int TRACE_spark_full;
 int TRACE_user;
 int TRACE_cap;
+int TRACE_stack_samples;
+int TRACE_alloc_samples;
 
 #if defined(THREADED_RTS)
 static Mutex trace_utx;
@@ -83,13 +85,21 @@ void initTracing (void)
     TRACE_user =
         RtsFlags.TraceFlags.user;
 
+    TRACE_stack_samples =
+        RtsFlags.TraceFlags.stack_samples;
+
+    TRACE_alloc_samples =
+        RtsFlags.TraceFlags.alloc_samples;
+
     // We trace cap events if we're tracing anything else
     TRACE_cap =
         TRACE_sched ||
         TRACE_gc ||
         TRACE_spark_sampled ||
         TRACE_spark_full ||
-        TRACE_user;
+        TRACE_user ||
+        TRACE_stack_samples ||
+        TRACE_alloc_samples;
 
     eventlog_enabled = RtsFlags.TraceFlags.tracing == TRACE_EVENTLOG &&
                         eventlog_writer != NULL;
@@ -370,6 +380,58 @@ void traceEventGcStats_  (Capability *cap,
     }
 }
 
+void traceEventGcPhases_ (Capability *cap,
+                          CapsetID    heap_capset,
+                          uint32_t    gen,
+                          Time       *phase_elapsed)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* no stderr equivalent for these ones */
+    } else
+#endif
+    {
+        postEventGcPhases(cap, heap_capset, gen, phase_elapsed);
+    }
+}
+
+void traceEventGcThreadWork_ (Capability *cap,
+                              uint32_t    gc_thread,
+                              W_          copied,
+                              W_          scanned,
+                              W_          any_work,
+                              W_          no_work,
+                              W_          scav_find_work,
+                              Time        scavenge_elapsed)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* no stderr equivalent for these ones */
+    } else
+#endif
+    {
+        postEventGcThreadWork(cap, gc_thread, copied, scanned,
+                              any_work, no_work, scav_find_work,
+                              scavenge_elapsed);
+    }
+}
+
+void traceFinalizerBacklog_ (Capability *cap,
+                             W_          c_finalizers,
+                             W_          haskell_finalizers,
+                             uint32_t    haskell_threads)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* no stderr equivalent for these ones */
+    } else
+#endif
+    {
+        postFinalizerBacklog(cap, c_finalizers, haskell_finalizers,
+                             haskell_threads);
+    }
+}
+
 void traceCapEvent_ (Capability   *cap,
                      EventTypeNum  tag)
 {
@@ -806,6 +868,168 @@ void traceThreadStatus_ (StgTSO *tso USED_IF_DEBUG)
     }
 }
 
+/* Note [Stack sampling]
+   ~~~~~~~~~~~~~~~~~~~~~
+
+   With +RTS -lc, every timer tick (+RTS -V) asks each Capability that
+   is running Haskell code to stop (see handleProfTick()).  When the
+   thread returns to the scheduler its stack is in a consistent state,
+   and we record the return addresses of the topmost frames in an
+   EVENT_STACK_SAMPLE.  Nothing about the code being run changes, so
+   this works with optimised, non-profiled binaries; the addresses can
+   be symbolised offline against the binary's symbol table or DWARF
+   information (as Libdw.c does for the RTS's own backtraces).
+
+   A thread can only stop at a heap check, so samples are biased towards
+   allocation points, in the same way as cost-centre ticks are.  The
+   request to stop does not count as a context switch: the thread
+   returns ThreadYielding without cap->context_switch set, so
+   scheduleHandleYield() puts it back at the front of the run queue.
+*/
+void traceStackSample_ (Capability *cap, StgTSO *tso)
+{
+    StgWord frames[STACK_SAMPLE_MAX_DEPTH];
+    uint32_t depth = 0;
+    const uint32_t max_depth = RtsFlags.TraceFlags.stackSampleDepth;
+    StgStack *stack = tso->stackobj;
+    StgPtr sp = stack->sp;
+    StgPtr end = stack->stack + stack->stack_size;
+
+    if (tso->what_next == ThreadKilled || tso->what_next == ThreadComplete) {
+        return;
+    }
+
+    while (sp < end && depth < max_depth) {
+        const StgRetInfoTable *info = get_ret_itbl((StgClosure *)sp);
+
+        frames[depth++] = *sp;
+
+        if (info->i.type == STOP_FRAME) {
+            break;
+        }
+        if (info->i.type == UNDERFLOW_FRAME) {
+            stack = ((StgUnderflowFrame *)sp)->next_chunk;
+            sp = stack->sp;
+            end = stack->stack + stack->stack_size;
+            continue;
+        }
+        sp += stack_frame_sizeW((StgClosure *)sp);
+    }
+
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        ACQUIRE_LOCK(&trace_utx);
+        tracePreface();
+        debugBelch("cap %d: stack sample of thread %" FMT_Word ":",
+                   cap->no, (W_)tso->id);
+        for (uint32_t i = 0; i < depth; i++) {
+            debugBelch(" %p", (void *)frames[i]);
+        }
+        debugBelch("\n");
+        RELEASE_LOCK(&trace_utx);
+    } else
+#endif
+    if (eventlog_enabled) {
+        postStackSample(cap, tso->id, frames, depth);
+    }
+}
+
+/* Note [Allocation sampling]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Heap profiling by cost centre needs a profiled build, but we would
+   like to know where production binaries allocate.  With +RTS -lm each
+   Capability takes a sample every --alloc-sample-interval bytes of
+   allocation:
+
+     - cap->alloc_sample_at is the value of cap->total_allocated at which
+       the next sample is due (~0 when sampling is off).
+
+     - total_allocated is brought up to date every time the mutator moves
+       on to a new nursery block in stg_gc_noregs, which also compares it
+       against alloc_sample_at, and returns to the scheduler (as
+       ThreadYielding, but without a context switch) when a sample is
+       due.  Allocation done by the RTS through allocate() is counted
+       too, and picked up at the next block boundary.
+
+     - The scheduler then calls traceAllocSample_(), which records
+
+         - the return address of the frame on top of the thread's stack,
+           skipping the frames pushed by the heap check failure code
+           (stg_gc_fun, stg_enter, stg_ret_*), i.e. the continuation of
+           the code that was allocating, and
+
+         - the info pointer of the first closure in the nursery block
+           that was just filled, i.e. the object that happens to lie at a
+           fixed position in the stream of allocated bytes.
+
+   Both can be symbolised offline, as for Note [Stack sampling].  Since
+   a sample is taken at a byte position rather than per object, large
+   objects and allocation-heavy code are sampled in proportion to the
+   bytes they allocate; each event carries the number of bytes it stands
+   for.  The cost when sampling is off is one comparison per nursery
+   block.
+*/
+
+// The return address of the frame that the heap check failure code will
+// return to, skipping the frames it pushed to save the live registers.
+static StgWord allocSampleFrame (StgTSO *tso)
+{
+    StgStack *stack = tso->stackobj;
+    StgPtr sp = stack->sp;
+    StgPtr end = stack->stack + stack->stack_size;
+
+    while (sp < end) {
+        const StgInfoTable *info = ((StgClosure *)sp)->header.info;
+
+        if (info != &stg_ret_v_info && info != &stg_ret_p_info &&
+            info != &stg_ret_n_info && info != &stg_ret_f_info &&
+            info != &stg_ret_d_info && info != &stg_ret_l_info &&
+            info != &stg_gc_fun_info && info != &stg_enter_info) {
+            return *sp;
+        }
+        sp += stack_frame_sizeW((StgClosure *)sp);
+    }
+    return 0;
+}
+
+void traceAllocSample_ (Capability *cap, StgTSO *tso)
+{
+    const W_ interval = RtsFlags.TraceFlags.allocSampleInterval / sizeof(W_);
+    // bytes allocated since the previous sample was due
+    const W_ weight =
+        (cap->total_allocated - cap->alloc_sample_at + interval) * sizeof(W_);
+    bdescr *bd;
+    StgWord frame = 0;
+    StgWord info = 0;
+
+    cap->alloc_sample_at = cap->total_allocated + interval;
+
+    if (tso->what_next == ThreadKilled || tso->what_next == ThreadComplete) {
+        return;
+    }
+
+    frame = allocSampleFrame(tso);
+    bd = cap->r.rCurrentNursery->u.back;
+    if (bd != NULL && bd->free > bd->start) {
+        info = (StgWord)((StgClosure *)bd->start)->header.info;
+    }
+
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        ACQUIRE_LOCK(&trace_utx);
+        tracePreface();
+        debugBelch("cap %d: allocation sample of thread %" FMT_Word
+                   ": %" FMT_Word " bytes, frame %p, info %p\n",
+                   cap->no, (W_)tso->id, weight,
+                   (void *)frame, (void *)info);
+        RELEASE_LOCK(&trace_utx);
+    } else
+#endif
+    if (eventlog_enabled) {
+        postAllocSample(cap, tso->id, weight, frame, info);
+    }
+}
+
 #if defined(DEBUG)
 void traceBegin (const char *str, ...)
 {
@@ -70,6 +70,8 @@ extern int TRACE_spark_sampled;
 extern int TRACE_spark_full;
 /* extern int TRACE_user; */  // only used in Trace.c
 extern int TRACE_cap;
+extern int TRACE_stack_samples;
+extern int TRACE_alloc_samples;
 
 // -----------------------------------------------------------------------------
 // Posting events
@@ -154,6 +156,25 @@ void traceEventGcStats_  (Capability *cap,
                           W_        par_tot_copied,
                           W_        par_balanced_copied);
 
+void traceEventGcPhases_ (Capability *cap,
+                          CapsetID    heap_capset,
+                          uint32_t    gen,
+                          Time       *phase_elapsed);
+
+void traceEventGcThreadWork_ (Capability *cap,
+                              uint32_t    gc_thread,
+                              W_          copied,
+                              W_          scanned,
+                              W_          any_work,
+                              W_          no_work,
+                              W_          scav_find_work,
+                              Time        scavenge_elapsed);
+
+void traceFinalizerBacklog_ (Capability *cap,
+                             W_          c_finalizers,
+                             W_          haskell_finalizers,
+                             uint32_t    haskell_threads);
+
 /*
  * Record a spark event
  */
@@ -249,6 +270,28 @@ void traceThreadLabel_(Capability *cap,
 
 void traceThreadStatus_ (StgTSO *tso);
 
+/*
+ * Record the return addresses of the top frames of a thread's stack
+ * (see Note [Stack sampling] in Trace.c)
+ */
+#define traceStackSample(cap, tso)              \
+    if (RTS_UNLIKELY(TRACE_stack_samples)) {    \
+        traceStackSample_(cap, tso);            \
+    }
+
+void traceStackSample_ (Capability *cap, StgTSO *tso);
+
+/*
+ * Record an allocation sample for the thread that just stopped at a
+ * nursery block boundary (see Note [Allocation sampling] in Trace.c)
+ */
+#define traceAllocSample(cap, tso)              \
+    if (RTS_UNLIKELY(TRACE_alloc_samples)) {    \
+        traceAllocSample_(cap, tso);            \
+    }
+
+void traceAllocSample_ (Capability *cap, StgTSO *tso);
+
 /*
  * Events for describing capabilities and capability sets in the eventlog
  */
@@ -312,6 +355,12 @@ void flushTrace(void);
                            copied, slop, fragmentation, \
                            par_n_threads, par_max_copied, \
                            par_tot_copied, par_balanced_copied) /* nothing */
+#define traceEventGcPhases_(cap, heap_capset, gen, phase_elapsed) /* nothing */
+#define traceEventGcThreadWork_(cap, gc_thread, copied, scanned, \
+                                any_work, no_work, scav_find_work, \
+                                scavenge_elapsed) /* nothing */
+#define traceFinalizerBacklog_(cap, c_finalizers, haskell_finalizers, \
+                               haskell_threads) /* nothing */
 #define traceHeapEvent(cap, tag, heap_capset, info1) /* nothing */
 #define traceEventHeapInfo_(heap_capset, gens, \
                             maxHeapSize, allocAreaSize, \
@@ -323,6 +372,8 @@ void flushTrace(void);
 #define debugTrace(class, str, ...) /* nothing */
 #define debugTraceCap(class, cap, str, ...) /* nothing */
 #define traceThreadStatus(class, tso) /* nothing */
+#define traceStackSample(cap, tso) /* nothing */
+#define traceAllocSample(cap, tso) /* nothing */
 #define traceThreadLabel_(cap, tso, label) /* nothing */
 #define traceCapEvent(cap, tag) /* nothing */
 #define traceCapsetEvent(tag, capset, info) /* nothing */
@@ -692,6 +743,43 @@ INLINE_HEADER void traceEventGcStats(Capability *cap            STG_UNUSED,
                        par_tot_copied, par_balanced_copied);
 }
 
+INLINE_HEADER void traceEventGcPhases(Capability *cap           STG_UNUSED,
+                                      CapsetID    heap_capset   STG_UNUSED,
+                                      uint32_t    gen           STG_UNUSED,
+                                      Time       *phase_elapsed STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceEventGcPhases_(cap, heap_capset, gen, phase_elapsed);
+    }
+}
+
+INLINE_HEADER void traceEventGcThreadWork(Capability *cap            STG_UNUSED,
+                                          uint32_t    gc_thread      STG_UNUSED,
+                                          W_          copied         STG_UNUSED,
+                                          W_          scanned        STG_UNUSED,
+                                          W_          any_work       STG_UNUSED,
+                                          W_          no_work        STG_UNUSED,
+                                          W_          scav_find_work STG_UNUSED,
+                                          Time        scavenge_elapsed STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceEventGcThreadWork_(cap, gc_thread, copied, scanned,
+                                any_work, no_work, scav_find_work,
+                                scavenge_elapsed);
+    }
+}
+
+INLINE_HEADER void traceFinalizerBacklog(Capability *cap         STG_UNUSED,
+                                         W_          c_finalizers STG_UNUSED,
+                                         W_          haskell_finalizers STG_UNUSED,
+                                         uint32_t    haskell_threads STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceFinalizerBacklog_(cap, c_finalizers, haskell_finalizers,
+                               haskell_threads);
+    }
+}
+
 INLINE_HEADER void traceEventHeapInfo(CapsetID    heap_capset   STG_UNUSED,
                                       uint32_t  gens          STG_UNUSED,
                                       W_        maxHeapSize   STG_UNUSED,
@@ -23,6 +23,246 @@ static StgWeak *finalizer_list = NULL;
 // Count of the above list.
 static uint32_t n_finalizers = 0;
 
+// Each thread running Haskell finalizers takes at least this many of
+// them, and there is at most one thread per capability, so that idle
+// capabilities can take some of them (see scheduleFinalizers())
+#define HASKELL_FINALIZER_CHUNK 1000
+
+/* -----------------------------------------------------------------------------
+   Running C finalizers on background threads
+
+   Note [Finalizer threads]
+   ~~~~~~~~~~~~~~~~~~~~~~~~
+   A program that frees millions of ForeignPtrs in one GC has millions of
+   C finalizers (usually free()) to run.  By default they are run by
+   idle capabilities, a chunk at a time (see "Incrementally running C
+   finalizers" below), and any that are left are run at the start of the
+   next GC, in the pause.
+
+   With --finalizer-threads=<n>, scheduleFinalizers() instead copies each
+   C finalizer (the function and its arguments, four words) out of the
+   dead weak pointers into malloc()ed batches of C_FINALIZER_BATCH, and
+   queues them for a pool of n OS threads.
+
+   The copies don't live in the heap, but what their arguments point to
+   may: collectDeadWeakPtrs() keeps the value of a dead weak pointer
+   alive for one GC only, and a C finalizer's ptr may point into it (the
+   pinned bytes of a mallocForeignPtr, see Note [MallocPtr finalizers]).
+   So, just as any C finalizers left on finalizer_list are run before
+   the next GC, scheduleDoGC() calls waitFinalizerThreads() to wait for
+   the queue to drain before it collects.  hs_exit() waits for the
+   queue to drain too, before it runs the finalizers of the weak
+   pointers that are still alive.
+
+   In the child of forkProcess() the finalizer threads are gone, and so
+   are the batches they were running; new threads run the batches still
+   queued (see restartFinalizerThreads()).
+
+   Like all C finalizers, these must not call back into Haskell.  The
+   number still queued is reported by EVENT_FINALIZER_BACKLOG.
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+#define C_FINALIZER_BATCH 1024
+
+typedef struct {
+    void *fptr;
+    void *ptr;
+    void *eptr;
+    StgWord flag;
+} CFinalizer;
+
+typedef struct CFinalizerBatch_ {
+    struct CFinalizerBatch_ *link;
+    uint32_t n;
+    CFinalizer finalizers[C_FINALIZER_BATCH];
+} CFinalizerBatch;
+
+Mutex finalizer_mutex;
+static Condition finalizer_work;     // a batch was queued, or we're exiting
+static Condition finalizer_drained;  // a finalizer thread exited
+static Condition finalizer_done;     // the backlog went down to zero
+static CFinalizerBatch *finalizer_batches = NULL;
+static CFinalizerBatch *finalizer_batches_tl = NULL;
+static StgWord c_finalizer_backlog = 0;   // queued or running
+static uint32_t finalizer_threads = 0;    // threads still running
+static bool finalizer_threads_exiting = false;
+
+static void *
+finalizerThread (void *arg STG_UNUSED)
+{
+    CFinalizerBatch *batch;
+    StgWord backlog;
+    uint32_t i;
+
+    ACQUIRE_LOCK(&finalizer_mutex);
+    for (;;) {
+        while (finalizer_batches == NULL && !finalizer_threads_exiting) {
+            waitCondition(&finalizer_work, &finalizer_mutex);
+        }
+        batch = finalizer_batches;
+        if (batch == NULL) {
+            break;
+        }
+        finalizer_batches = batch->link;
+        if (finalizer_batches == NULL) {
+            finalizer_batches_tl = NULL;
+        }
+        RELEASE_LOCK(&finalizer_mutex);
+
+        for (i = 0; i < batch->n; i++) {
+            CFinalizer *f = &batch->finalizers[i];
+            if (f->flag)
+                ((void (*)(void *, void *))f->fptr)(f->eptr, f->ptr);
+            else
+                ((void (*)(void *))f->fptr)(f->ptr);
+        }
+
+        ACQUIRE_LOCK(&finalizer_mutex);
+        c_finalizer_backlog -= batch->n;
+        backlog = c_finalizer_backlog;
+        if (backlog == 0) {
+            broadcastCondition(&finalizer_done);
+        }
+        RELEASE_LOCK(&finalizer_mutex);
+
+        traceFinalizerBacklog(NULL, backlog, 0, 0);
+        stgFree(batch);
+
+        ACQUIRE_LOCK(&finalizer_mutex);
+    }
+    finalizer_threads--;
+    signalCondition(&finalizer_drained);
+    RELEASE_LOCK(&finalizer_mutex);
+    return NULL;
+}
+
+static void
+startFinalizerThreads (void)
+{
+    uint32_t i;
+
+    for (i = 0; i < RtsFlags.MiscFlags.finalizerThreads; i++) {
+        OSThreadId tid;
+        if (createOSThread(&tid, (char *)"ghc_finalizer",
+                           finalizerThread, NULL) != 0) {
+            barf("startFinalizerThreads: can't create a finalizer thread");
+        }
+        finalizer_threads++;
+    }
+}
+
+void
+initFinalizerThreads (void)
+{
+    initMutex(&finalizer_mutex);
+    initCondition(&finalizer_work);
+    initCondition(&finalizer_drained);
+    initCondition(&finalizer_done);
+    finalizer_threads_exiting = false;
+    startFinalizerThreads();
+}
+
+// Wait until the finalizer threads have run every C finalizer queued so
+// far.  Called before a GC; see Note [Finalizer threads].
+void
+waitFinalizerThreads (void)
+{
+    ACQUIRE_LOCK(&finalizer_mutex);
+    while (c_finalizer_backlog > 0) {
+        waitCondition(&finalizer_done, &finalizer_mutex);
+    }
+    RELEASE_LOCK(&finalizer_mutex);
+}
+
+// Run the C finalizers still queued, and stop the finalizer threads.
+void
+exitFinalizerThreads (void)
+{
+    ACQUIRE_LOCK(&finalizer_mutex);
+    finalizer_threads_exiting = true;
+    broadcastCondition(&finalizer_work);
+    while (finalizer_threads > 0) {
+        waitCondition(&finalizer_drained, &finalizer_mutex);
+    }
+    RELEASE_LOCK(&finalizer_mutex);
+}
+
+// In the child of forkProcess(), which holds finalizer_mutex across the
+// fork: the finalizer threads are gone, so start new ones to run the
+// batches that were queued.  The batches the old threads were running
+// are lost, so count only the queued ones in the backlog.
+void
+restartFinalizerThreads (void)
+{
+    CFinalizerBatch *batch;
+
+    initMutex(&finalizer_mutex);
+    initCondition(&finalizer_work);
+    initCondition(&finalizer_drained);
+    initCondition(&finalizer_done);
+    c_finalizer_backlog = 0;
+    for (batch = finalizer_batches; batch != NULL; batch = batch->link) {
+        c_finalizer_backlog += batch->n;
+    }
+    finalizer_threads = 0;
+    startFinalizerThreads();
+}
+
+// Copy the C finalizers of the dead weak pointers into batches, and queue
+// them for the finalizer threads.
+static void
+queueCFinalizers (Capability *cap, StgWeak *list)
+{
+    CFinalizerBatch *hd = NULL, *tl = NULL;
+    StgCFinalizerList *c;
+    StgWeak *w;
+    StgWord n = 0, backlog;
+
+    for (w = list; w; w = w->link) {
+        for (c = (StgCFinalizerList *)w->cfinalizers;
+             (StgClosure *)c != &stg_NO_FINALIZER_closure;
+             c = (StgCFinalizerList *)c->link)
+        {
+            if (tl == NULL || tl->n == C_FINALIZER_BATCH) {
+                CFinalizerBatch *batch =
+                    stgMallocBytes(sizeof(CFinalizerBatch), "queueCFinalizers");
+                batch->link = NULL;
+                batch->n = 0;
+                if (tl == NULL) hd = batch; else tl->link = batch;
+                tl = batch;
+            }
+            tl->finalizers[tl->n].fptr = c->fptr;
+            tl->finalizers[tl->n].ptr = c->ptr;
+            tl->finalizers[tl->n].eptr = c->eptr;
+            tl->finalizers[tl->n].flag = c->flag;
+            tl->n++;
+            n++;
+        }
+    }
+
+    if (n == 0) return;
+
+    debugTrace(DEBUG_weak, "weak: queueing %" FMT_Word " C finalizers", n);
+
+    ACQUIRE_LOCK(&finalizer_mutex);
+    if (finalizer_batches_tl == NULL) {
+        finalizer_batches = hd;
+    } else {
+        finalizer_batches_tl->link = hd;
+    }
+    finalizer_batches_tl = tl;
+    c_finalizer_backlog += n;
+    backlog = c_finalizer_backlog;
+    broadcastCondition(&finalizer_work);
+    RELEASE_LOCK(&finalizer_mutex);
+
+    traceFinalizerBacklog(cap, backlog, 0, 0);
+}
+
+#endif /* THREADED_RTS */
+
 void
 runCFinalizers(StgCFinalizerList *list)
 {
@@ -89,7 +329,7 @@ scheduleFinalizers(Capability *cap, StgWeak *list)
     StgTSO *t;
     StgMutArrPtrs *arr;
     StgWord size;
-    uint32_t n, i;
+    uint32_t n, i, j, threads, chunk;
 
     ASSERT(n_finalizers == 0);
 
@@ -130,41 +370,71 @@ scheduleFinalizers(Capability *cap, StgWeak *list)
 
     n_finalizers = i;
 
-    // No Haskell finalizers to run?
-    if (n == 0) return;
+#if defined(THREADED_RTS)
+    // See Note [Finalizer threads]
+    if (RtsFlags.MiscFlags.finalizerThreads > 0) {
+        queueCFinalizers(cap, list);
+        finalizer_list = NULL;
+        n_finalizers = 0;
+    }
+#endif
 
-    debugTrace(DEBUG_weak, "weak: batching %d finalizers", n);
+    // No Haskell finalizers to run?
+    if (n == 0) {
+        if (n_finalizers > 0) {
+            traceFinalizerBacklog(cap, n_finalizers, 0, 0);
+        }
+        return;
+    }
 
-    size = n + mutArrPtrsCardTableSize(n);
-    arr = (StgMutArrPtrs *)allocate(cap, sizeofW(StgMutArrPtrs) + size);
-    TICK_ALLOC_PRIM(sizeofW(StgMutArrPtrs), n, 0);
-    SET_HDR(arr, &stg_MUT_ARR_PTRS_FROZEN_CLEAN_info, CCS_SYSTEM);
-    arr->ptrs = n;
-    arr->size = size;
+    // Share the Haskell finalizers out between up to one thread per
+    // capability; the scheduler pushes threads to idle capabilities.
+    threads = (n + HASKELL_FINALIZER_CHUNK - 1) / HASKELL_FINALIZER_CHUNK;
+#if defined(THREADED_RTS)
+    threads = stg_min(threads, enabled_capabilities);
+#else
+    threads = 1;
+#endif
 
-    n = 0;
-    for (w = list; w; w = w->link) {
-        if (w->finalizer != &stg_NO_FINALIZER_closure) {
-            arr->payload[n] = w->finalizer;
-            n++;
+    debugTrace(DEBUG_weak, "weak: batching %d finalizers on %d threads",
+               n, threads);
+    traceFinalizerBacklog(cap, n_finalizers, n, threads);
+
+    w = list;
+    for (j = 0; j < threads; j++) {
+        // the first (n % threads) threads take one more
+        chunk = n / threads + (j < n % threads ? 1 : 0);
+
+        size = chunk + mutArrPtrsCardTableSize(chunk);
+        arr = (StgMutArrPtrs *)allocate(cap, sizeofW(StgMutArrPtrs) + size);
+        TICK_ALLOC_PRIM(sizeofW(StgMutArrPtrs), chunk, 0);
+        SET_HDR(arr, &stg_MUT_ARR_PTRS_FROZEN_CLEAN_info, CCS_SYSTEM);
+        arr->ptrs = chunk;
+        arr->size = size;
+
+        for (i = 0; i < chunk; w = w->link) {
+            if (w->finalizer != &stg_NO_FINALIZER_closure) {
+                arr->payload[i] = w->finalizer;
+                i++;
+            }
+        }
+        // set all the cards to 1
+        for (i = chunk; i < size; i++) {
+            arr->payload[i] = (StgClosure *)(W_)(-1);
         }
-    }
-    // set all the cards to 1
-    for (i = n; i < size; i++) {
-        arr->payload[i] = (StgClosure *)(W_)(-1);
-    }
 
-    t = createIOThread(cap,
-                       RtsFlags.GcFlags.initialStkSize,
-                       rts_apply(cap,
+        t = createIOThread(cap,
+                           RtsFlags.GcFlags.initialStkSize,
                            rts_apply(cap,
-                               (StgClosure *)runFinalizerBatch_closure,
-                               rts_mkInt(cap,n)),
-                           (StgClosure *)arr)
-        );
-
-    scheduleThread(cap,t);
-    labelThread(cap, t, "weak finalizer thread");
+                               rts_apply(cap,
+                                   (StgClosure *)runFinalizerBatch_closure,
+                                   rts_mkInt(cap,chunk)),
+                               (StgClosure *)arr)
+            );
+
+        scheduleThread(cap,t);
+        labelThread(cap, t, "weak finalizer thread");
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -21,4 +21,13 @@ void scheduleFinalizers(Capability *cap, StgWeak *w);
 void markWeakList(void);
 bool runSomeFinalizers(bool all);
 
+#if defined(THREADED_RTS)
+extern Mutex finalizer_mutex;
+
+void initFinalizerThreads(void);
+void exitFinalizerThreads(void);
+void waitFinalizerThreads(void);
+void restartFinalizerThreads(void);
+#endif
+
 #include "EndPrivate.h"
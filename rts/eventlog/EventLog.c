@@ -105,7 +105,12 @@ char *EventDesc[] = {
   [EVENT_HEAP_PROF_SAMPLE_BEGIN]  = "Start of heap profile sample",
   [EVENT_HEAP_PROF_SAMPLE_STRING] = "Heap profile string sample",
   [EVENT_HEAP_PROF_SAMPLE_COST_CENTRE] = "Heap profile cost-centre sample",
-  [EVENT_USER_BINARY_MSG]     = "User binary message"
+  [EVENT_USER_BINARY_MSG]     = "User binary message",
+  [EVENT_STACK_SAMPLE]        = "Stack sample",
+  [EVENT_GC_PHASES]           = "GC phase timings",
+  [EVENT_GC_THREAD_WORK]      = "GC thread work",
+  [EVENT_ALLOC_SAMPLE]        = "Allocation sample",
+  [EVENT_FINALIZER_BACKLOG]   = "Finalizer backlog"
 };
 
 // Event type.
@@ -394,6 +399,20 @@ postHeaderEvents(void)
                                + sizeof(StgWord64) * 3;
             break;
 
+        case EVENT_GC_PHASES:         // (heap_capset, generation,
+                                      //  phase_ns*)
+            eventTypes[t].size = sizeof(EventCapsetID)
+                               + sizeof(StgWord16)
+                               + sizeof(StgWord64) * N_GC_PHASES;
+            break;
+
+        case EVENT_GC_THREAD_WORK:    // (gc_thread, copied_bytes,
+                                      //  scanned_bytes, any_work, no_work,
+                                      //  scav_find_work, scavenge_ns)
+            eventTypes[t].size = sizeof(StgWord16)
+                               + sizeof(StgWord64) * 6;
+            break;
+
         case EVENT_TASK_CREATE:   // (taskId, cap, tid)
             eventTypes[t].size = sizeof(EventTaskId)
                                + sizeof(EventCapNo)
@@ -442,6 +461,22 @@ postHeaderEvents(void)
             eventTypes[t].size = EVENT_SIZE_DYNAMIC;
             break;
 
+        case EVENT_STACK_SAMPLE:
+            eventTypes[t].size = EVENT_SIZE_DYNAMIC;
+            break;
+
+        case EVENT_ALLOC_SAMPLE: // (thread, weight_bytes,
+                                 //  return_addr, info_ptr)
+            eventTypes[t].size = sizeof(EventThreadID)
+                               + sizeof(StgWord64) * 3;
+            break;
+
+        case EVENT_FINALIZER_BACKLOG: // (c_finalizers, haskell_finalizers,
+                                      //  haskell_threads)
+            eventTypes[t].size = sizeof(StgWord64) * 2
+                               + sizeof(StgWord16);
+            break;
+
         default:
             continue; /* ignore deprecated events */
         }
@@ -941,6 +976,48 @@ void postEventGcStats  (Capability    *cap,
     postWord64(eb, par_balanced_copied);
 }
 
+void postEventGcPhases (Capability    *cap,
+                        EventCapsetID  heap_capset,
+                        uint32_t       gen,
+                        Time          *phase_elapsed)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_GC_PHASES);
+
+    postEventHeader(eb, EVENT_GC_PHASES);
+    /* EVENT_GC_PHASES (heap_capset, generation, phase_ns*) */
+    postCapsetID(eb, heap_capset);
+    postWord16(eb, gen);
+    for (uint32_t i = 0; i < N_GC_PHASES; i++) {
+        postWord64(eb, TimeToNS(phase_elapsed[i]));
+    }
+}
+
+void postEventGcThreadWork (Capability *cap,
+                            uint32_t    gc_thread,
+                            W_          copied,
+                            W_          scanned,
+                            W_          any_work,
+                            W_          no_work,
+                            W_          scav_find_work,
+                            Time        scavenge_elapsed)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_GC_THREAD_WORK);
+
+    postEventHeader(eb, EVENT_GC_THREAD_WORK);
+    /* EVENT_GC_THREAD_WORK (gc_thread, copied_bytes, scanned_bytes,
+                             any_work, no_work, scav_find_work,
+                             scavenge_ns) */
+    postWord16(eb, gc_thread);
+    postWord64(eb, copied);
+    postWord64(eb, scanned);
+    postWord64(eb, any_work);
+    postWord64(eb, no_work);
+    postWord64(eb, scav_find_work);
+    postWord64(eb, TimeToNS(scavenge_elapsed));
+}
+
 void postTaskCreateEvent (EventTaskId taskId,
                           EventCapNo capno,
                           EventKernelThreadId tid)
@@ -1111,6 +1188,78 @@ void postThreadLabel(Capability    *cap,
     postBuf(eb, (StgWord8*) label, strsize);
 }
 
+void postStackSample(Capability    *cap,
+                     EventThreadID  id,
+                     StgWord       *frames,
+                     uint32_t       depth)
+{
+    // EVENT_STACK_SAMPLE (thread, depth, return_addr*)
+    if (depth > STACK_SAMPLE_MAX_DEPTH) {
+        depth = STACK_SAMPLE_MAX_DEPTH;
+    }
+    const StgWord size = sizeof(EventThreadID) + sizeof(StgWord16)
+                       + depth * sizeof(StgWord64);
+
+    EventsBuf *eb = &capEventBuf[cap->no];
+    if (ensureRoomForVariableEvent(eb, size)) {
+        errorBelch("Event size exceeds buffer size, bail out");
+        return;
+    }
+
+    postEventHeader(eb, EVENT_STACK_SAMPLE);
+    postPayloadSize(eb, size);
+    postThreadID(eb, id);
+    postWord16(eb, depth);
+    for (uint32_t i = 0; i < depth; i++) {
+        postWord64(eb, frames[i]);
+    }
+}
+
+void postAllocSample(Capability    *cap,
+                     EventThreadID  id,
+                     W_             weight,
+                     StgWord        frame,
+                     StgWord        info)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_ALLOC_SAMPLE);
+
+    postEventHeader(eb, EVENT_ALLOC_SAMPLE);
+    /* EVENT_ALLOC_SAMPLE (thread, weight_bytes, return_addr, info_ptr) */
+    postThreadID(eb, id);
+    postWord64(eb, weight);
+    postWord64(eb, frame);
+    postWord64(eb, info);
+}
+
+void postFinalizerBacklog(Capability *cap,
+                          W_          c_finalizers,
+                          W_          haskell_finalizers,
+                          uint32_t    haskell_threads)
+{
+    EventsBuf *eb;
+
+    // The finalizer threads have no capability
+    if (cap == NULL) {
+        ACQUIRE_LOCK(&eventBufMutex);
+        eb = &eventBuf;
+    } else {
+        eb = &capEventBuf[cap->no];
+    }
+    ensureRoomForEvent(eb, EVENT_FINALIZER_BACKLOG);
+
+    postEventHeader(eb, EVENT_FINALIZER_BACKLOG);
+    /* EVENT_FINALIZER_BACKLOG (c_finalizers, haskell_finalizers,
+                                haskell_threads) */
+    postWord64(eb, c_finalizers);
+    postWord64(eb, haskell_finalizers);
+    postWord16(eb, haskell_threads);
+
+    if (cap == NULL) {
+        RELEASE_LOCK(&eventBufMutex);
+    }
+}
+
 void closeBlockMarker (EventsBuf *ebuf)
 {
     if (ebuf->marker)
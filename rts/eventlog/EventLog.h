@@ -127,6 +127,20 @@ void postEventGcStats  (Capability    *cap,
                         W_           par_tot_copied,
                         W_           par_balanced_copied);
 
+void postEventGcPhases (Capability    *cap,
+                        EventCapsetID  heap_capset,
+                        uint32_t       gen,
+                        Time          *phase_elapsed);
+
+void postEventGcThreadWork (Capability *cap,
+                            uint32_t    gc_thread,
+                            W_          copied,
+                            W_          scanned,
+                            W_          any_work,
+                            W_          no_work,
+                            W_          scav_find_work,
+                            Time        scavenge_elapsed);
+
 void postTaskCreateEvent (EventTaskId taskId,
                           EventCapNo cap,
                           EventKernelThreadId tid);
@@ -137,6 +151,33 @@ void postTaskMigrateEvent (EventTaskId taskId,
 
 void postTaskDeleteEvent (EventTaskId taskId);
 
+/*
+ * Post the return addresses of the top frames of a thread's stack
+ */
+void postStackSample(Capability    *cap,
+                     EventThreadID  id,
+                     StgWord       *frames,
+                     uint32_t       depth);
+
+/*
+ * Post an allocation sample: the continuation of the allocating code and
+ * the info pointer of the sampled object
+ */
+void postAllocSample(Capability    *cap,
+                     EventThreadID  id,
+                     W_             weight,
+                     StgWord        frame,
+                     StgWord        info);
+
+/*
+ * Post the number of finalizers waiting to run, from a capability or
+ * (cap == NULL) from a finalizer thread
+ */
+void postFinalizerBacklog(Capability *cap,
+                          W_          c_finalizers,
+                          W_          haskell_finalizers,
+                          uint32_t    haskell_threads);
+
 void postHeapProfBegin(StgWord8 profile_id);
 
 void postHeapProfSampleBegin(StgInt era);
@@ -100,6 +100,14 @@
 #  include "elf_reloc.h"
 #endif
 
+/* Sections can be relocated on demand unless they need PLT stubs next to
+ * them (which are allocated with the section) or use the AArch64 relocation
+ * code, which relocates the whole object at once.  See Note [Lazy linking]
+ * in Linker.c. */
+#if !defined(NEED_PLT) && !defined(aarch64_HOST_ARCH)
+#  define LAZY_SECTIONS 1
+#endif
+
 /*
 
    Note [Many ELF Sections]
@@ -635,6 +643,44 @@ mapObjectFileSection (int fd, Elf_Word offset, Elf_Word size,
 }
 #endif
 
+#if defined(LAZY_SECTIONS)
+/* Find the relocation section of each section, so that it can be relocated
+ * on its own.  If a section has more than one, give up and relocate the
+ * object eagerly after all. */
+static void
+setupLazySections_ELF ( ObjectCode* oc )
+{
+   Elf_Shdr* shdr = oc->info->sectionHeader;
+   Elf_Word i, target;
+
+   for (i = 0; i < (Elf_Word)oc->n_sections; i++) {
+       if (shdr[i].sh_type != SHT_REL && shdr[i].sh_type != SHT_RELA) {
+           continue;
+       }
+       target = shdr[i].sh_info;
+       if (target == 0 || target >= (Elf_Word)oc->n_sections) {
+           continue;
+       }
+       if (oc->sections[target].info->relocationSection != 0) {
+           oc->lazySections = false;
+           break;
+       }
+       oc->sections[target].info->relocationSection = i;
+   }
+
+   for (i = 0; i < (Elf_Word)oc->n_sections; i++) {
+       Section *s = &oc->sections[i];
+       if (!oc->lazySections && s->info->copyPending) {
+           memcpy(s->start, oc->image + shdr[i].sh_offset, s->size);
+           s->info->copyPending = false;
+       }
+       if (oc->lazySections && s->kind != SECTIONKIND_OTHER && s->size > 0) {
+           linker_lazy_sections++;
+       }
+   }
+}
+#endif
+
 int
 ocGetNames_ELF ( ObjectCode* oc )
 {
@@ -658,6 +704,10 @@ ocGetNames_ELF ( ObjectCode* oc )
    oc->sections = sections;
    oc->n_sections = shnum;
 
+#if defined(LAZY_SECTIONS)
+   oc->lazySections = RtsFlags.MiscFlags.linkerLazy;
+#endif
+
    if (oc->imageMapped) {
 #if defined(openbsd_HOST_OS)
        fd = open(oc->fileName, O_RDONLY, S_IRUSR);
@@ -763,9 +813,16 @@ ocGetNames_ELF ( ObjectCode* oc )
           // (i.e. we cannot map the secions separately), or if the section
           // size is small.
           else if (!oc->imageMapped || size < getPageSize() / 3) {
-              start = m32_alloc(size, 8);
+              M32Arena arena =
+                  (shdr[i].sh_flags & SHF_EXECINSTR) ? M32_ARENA_TEXT
+                  : (shdr[i].sh_flags & SHF_WRITE) ? M32_ARENA_DATA
+                  : M32_ARENA_RODATA;
+              start = m32_alloc(arena, size, 8);
               if (start == NULL) goto fail;
-              memcpy(start, oc->image + offset, size);
+              // when relocating lazily, copy it when it's relocated
+              if (!oc->lazySections) {
+                  memcpy(start, oc->image + offset, size);
+              }
               alloc = SECTION_M32;
           } else {
               start = mapObjectFileSection(fd, offset, size,
@@ -788,6 +845,8 @@ ocGetNames_ELF ( ObjectCode* oc )
           oc->sections[i].info->stub_offset = NULL;
           oc->sections[i].info->stub_size = 0;
           oc->sections[i].info->stubs = NULL;
+          oc->sections[i].info->copyPending =
+              oc->lazySections && alloc == SECTION_M32;
 #endif
 
           addProddableBlock(oc, start, size);
@@ -950,6 +1009,12 @@ ocGetNames_ELF ( ObjectCode* oc )
       }
    }
 
+#if defined(LAZY_SECTIONS)
+   if (oc->lazySections) {
+       setupLazySections_ELF(oc);
+   }
+#endif
+
 #if defined(NEED_GOT)
    if(makeGot( oc ))
        errorBelch("Failed to create GOT for %s",
@@ -1741,18 +1806,18 @@ do_Elf_Rela_relocations ( ObjectCode* oc, char* ehdrC,
 #endif /* !aarch64_HOST_ARCH */
 
 
-int
-ocResolve_ELF ( ObjectCode* oc )
+/* Give the STT_SECTION symbols their addresses */
+static void
+resolveSectionSymbols_ELF ( ObjectCode* oc )
 {
-   char*     ehdrC = (char*)(oc->image);
-   Elf_Ehdr* ehdr  = (Elf_Ehdr*) ehdrC;
-   Elf_Shdr* shdr  = (Elf_Shdr*) (ehdrC + ehdr->e_shoff);
-   const Elf_Word shnum = elf_shnum(ehdr);
-
 #if defined(SHN_XINDEX)
-    Elf_Word* shndxTable = get_shndx_table(ehdr);
+    Elf_Word* shndxTable = get_shndx_table(oc->info->elfHeader);
 #endif
 
+    if (oc->info->sectionSymbolsResolved) {
+        return;
+    }
+
     /* resolve section symbols
      * these are special symbols that point to sections, and have no name.
      * Usually there should be one symbol for each text and data section.
@@ -1794,6 +1859,153 @@ ocResolve_ELF ( ObjectCode* oc )
         }
     }
 
+    oc->info->sectionSymbolsResolved = true;
+}
+
+#if defined(LAZY_SECTIONS)
+
+/* Relocate section secno, and all the sections of the same object that it
+ * refers to, transitively, if they haven't been already.  See Note [Lazy
+ * linking] in Linker.c. */
+static int
+relocateSections_ELF ( ObjectCode* oc, Elf_Word secno )
+{
+   char*     ehdrC = (char*)(oc->image);
+   Elf_Shdr* shdr  = oc->info->sectionHeader;
+   const Elf_Word shnum = oc->n_sections;
+#if defined(SHN_XINDEX)
+   Elf_Word* shndxTable = get_shndx_table(oc->info->elfHeader);
+#endif
+   Elf_Word *todo, n_todo = 0;
+   int ok = 1;
+
+   if (oc->sections[secno].info->relocated) {
+       return 1;
+   }
+
+   todo = stgMallocBytes(shnum * sizeof(Elf_Word), "relocateSections_ELF");
+   oc->sections[secno].info->relocated = true;
+   todo[n_todo++] = secno;
+
+   while (ok && n_todo > 0) {
+       Elf_Word s = todo[--n_todo];
+       Section *sec = &oc->sections[s];
+       Elf_Word r = sec->info->relocationSection;
+
+       linker_lazy_sections_resolved++;
+
+       if (sec->info->copyPending) {
+           memcpy(sec->start, ehdrC + shdr[s].sh_offset, sec->size);
+           sec->info->copyPending = false;
+       }
+
+       if (r == 0 || sec->kind == SECTIONKIND_OTHER) {
+           continue;
+       }
+
+       /* Find the sections that this one refers to.  Elf_Rel and Elf_Rela
+        * both start with r_offset and r_info. */
+       Elf_Sym* stab = (Elf_Sym*) (ehdrC + shdr[shdr[r].sh_link].sh_offset);
+       size_t entsize = shdr[r].sh_type == SHT_REL
+                          ? sizeof(Elf_Rel) : sizeof(Elf_Rela);
+       size_t nent = shdr[r].sh_size / entsize;
+
+       for (size_t j = 0; j < nent; j++) {
+           Elf_Rel *rel = (Elf_Rel*)(ehdrC + shdr[r].sh_offset + j * entsize);
+           Elf_Word symno = ELF_R_SYM(rel->r_info);
+           Elf_Word target = stab[symno].st_shndx;
+
+           if (target == SHN_UNDEF) {
+               continue;
+           }
+#if defined(SHN_XINDEX)
+           if (target == SHN_XINDEX) {
+               ASSERT(shndxTable);
+               target = shndxTable[symno];
+           } else
+#endif
+           if (target >= SHN_LORESERVE) {
+               continue;
+           }
+           if (target < shnum
+               && !oc->sections[target].info->relocated
+               && oc->sections[target].kind != SECTIONKIND_OTHER) {
+               oc->sections[target].info->relocated = true;
+               todo[n_todo++] = target;
+           }
+       }
+
+       if (shdr[r].sh_type == SHT_REL) {
+           ok = do_Elf_Rel_relocations ( oc, ehdrC, shdr, r );
+       } else {
+           ok = do_Elf_Rela_relocations ( oc, ehdrC, shdr, r );
+       }
+   }
+
+   stgFree(todo);
+
+#if defined(powerpc_HOST_ARCH)
+   ocFlushInstructionCache( oc );
+#endif
+
+   return ok;
+}
+
+#endif /* LAZY_SECTIONS */
+
+/* Make sure the section holding addr, a symbol of oc, is relocated. */
+int
+ocResolveSymbol_ELF ( ObjectCode* oc, SymbolAddr* addr )
+{
+#if defined(LAZY_SECTIONS)
+   resolveSectionSymbols_ELF(oc);
+
+   for (int i = 1; i < oc->n_sections; i++) {
+       Section *s = &oc->sections[i];
+       if (s->kind != SECTIONKIND_OTHER && s->size > 0
+           && (StgWord)addr >= (StgWord)s->start
+           && (StgWord)addr < (StgWord)s->start + s->size) {
+           return relocateSections_ELF(oc, i);
+       }
+   }
+#else
+   (void)oc;
+   (void)addr;
+#endif
+   return 1;
+}
+
+int
+ocResolve_ELF ( ObjectCode* oc )
+{
+   char*     ehdrC = (char*)(oc->image);
+   Elf_Ehdr* ehdr  = (Elf_Ehdr*) ehdrC;
+   Elf_Shdr* shdr  = (Elf_Shdr*) (ehdrC + ehdr->e_shoff);
+   const Elf_Word shnum = elf_shnum(ehdr);
+
+    resolveSectionSymbols_ELF(oc);
+
+#if defined(LAZY_SECTIONS)
+    /* Only relocate what the initialisers need for now; the rest is done
+     * by ocResolveSymbol_ELF. */
+    if (oc->lazySections) {
+        char* sh_strtab = ehdrC + shdr[elf_shstrndx(ehdr)].sh_offset;
+        for (Elf_Word i = 0; i < shnum; i++) {
+            int is_bss = false;
+            SectionKind kind = getSectionKind_ELF(&shdr[i], &is_bss);
+            if (kind == SECTIONKIND_INIT_ARRAY
+                || (kind != SECTIONKIND_OTHER
+                    && (0 == memcmp(".init", sh_strtab + shdr[i].sh_name, 5)
+                     || 0 == memcmp(".ctors", sh_strtab + shdr[i].sh_name, 6)))) {
+                if (!relocateSections_ELF(oc, i)) {
+                    return 0;
+                }
+            }
+        }
+        return 1;
+    }
+#endif
+
 #if defined(NEED_GOT)
     if(fillGot( oc ))
         return 0;
@@ -13,6 +13,7 @@ int ocVerifyImage_ELF    ( ObjectCode* oc );
 int ocGetNames_ELF       ( ObjectCode* oc );
 int ocResolve_ELF        ( ObjectCode* oc );
 int ocRunInit_ELF        ( ObjectCode* oc );
+int ocResolveSymbol_ELF  ( ObjectCode* oc, SymbolAddr* addr );
 int ocAllocateSymbolExtras_ELF( ObjectCode *oc );
 
 #include "EndPrivate.h"
@@ -141,6 +141,9 @@ struct ObjectCodeFormatInfo {
     /* pointer to the global offset table */
     void *                got_start;
     size_t                got_size;
+
+    /* have the STT_SECTION symbols been given addresses yet? */
+    bool                  sectionSymbolsResolved;
 };
 
 typedef
@@ -167,6 +170,14 @@ struct SectionFormatInfo {
     char * name;
 
     Elf_Shdr *sectionHeader;
+
+    /*
+     * The following fields are relevant for lazily relocated sections only,
+     * see Note [Lazy linking] in Linker.c.
+     */
+    Elf_Word relocationSection; /* the SHT_REL(A) section for this one, or 0 */
+    bool relocated;             /* its relocations have been done */
+    bool copyPending;           /* its contents are still only in the image */
 };
 #endif /* OBJECTFORMAT_ELF */
 #endif /* ElfTypes_h */
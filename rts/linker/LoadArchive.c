@@ -4,8 +4,10 @@
 #include "sm/Storage.h"
 #include "sm/OSMem.h"
 #include "RtsUtils.h"
+#include "RtsSymbolInfo.h"
 #include "LinkerInternals.h"
 #include "linker/M32Alloc.h"
+#include "linker/Parallel.h"
 
 /* Platform specific headers */
 #if defined(OBJFORMAT_PEi386)
@@ -24,6 +26,13 @@
 #include <ctype.h>
 #include <fs_rts.h>
 
+#if defined(OBJFORMAT_ELF)
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define FAIL(...) do {\
    errorBelch("loadArchive: "__VA_ARGS__); \
    goto fail;\
@@ -243,6 +252,345 @@ lookupGNUArchiveIndex(int gnuFileIndexSize, char **fileName_,
     return true;
 }
 
+/* Parse the headers and symbol tables of a member */
+static int initArchiveMember (ObjectCode *oc)
+{
+#if defined(OBJFORMAT_MACHO)
+    ocInit_MachO( oc );
+#elif defined(OBJFORMAT_ELF)
+    ocInit_ELF( oc );
+#else
+    (void)oc;
+#endif
+    return 1;
+}
+
+#if defined(OBJFORMAT_ELF)
+
+/* Note [Archive symbol index]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Loading an archive normally reads every member and parses its symbol
+   table, just to fill in symhash, although most members of a big library
+   are never used.  With +RTS --linker-index=<dir>, after an archive has
+   been loaded that way we write down in <dir> which symbols each member
+   defines and where the member is in the archive.  The next time the
+   archive is loaded, if its size and modification time haven't changed,
+   we only read that index: each member gets an ObjectCode marked
+   `deferred`, with no image, whose symbols go into symhash with a NULL
+   address.
+
+   A deferred member is read and loaded as usual (loadArchiveMember) when
+   loadSymbol() first finds one of its symbols; ghciInsertSymbolTable()
+   then fills in the addresses of the symbols registered from the index.
+   The names read from the index are the keys in symhash, so they are kept
+   in oc->indexNames for as long as the object lives.
+
+   An index is a file named after a hash of the archive's path, in the
+   host's byte order:
+
+       magic "GHCAIDX1"
+       archive size (u64), modification time (i64), archive path (string)
+       number of members (u32)
+       for each member:
+           offset (u64), size (u64), name (string), number of symbols (u32)
+           for each symbol: weak (u8), name (string)
+
+   where a string is a u32 length followed by that many bytes.  An index
+   that doesn't match the archive, or that we can't read, is ignored and
+   rewritten.  Thin archives are not indexed.
+*/
+
+#define ARCHIVE_INDEX_MAGIC "GHCAIDX1"
+
+/* The index of the archive at path, in RtsFlags.MiscFlags.linkerIndexDir */
+static char *archiveIndexPath (pathchar *path)
+{
+    const char *dir = RtsFlags.MiscFlags.linkerIndexDir;
+    uint64_t h = UINT64_C(14695981039346656037);   /* FNV-1a */
+    size_t len = strlen(dir) + 22;
+    char *index;
+
+    for (const char *p = path; *p; p++) {
+        h = (h ^ (unsigned char)*p) * UINT64_C(1099511628211);
+    }
+    index = stgMallocBytes(len, "archiveIndexPath");
+    snprintf(index, len, "%s/%016" PRIx64 ".idx", dir, h);
+    return index;
+}
+
+typedef struct {
+    char *p, *end;
+} IndexReader;
+
+static bool readIndex (IndexReader *r, void *dst, size_t n)
+{
+    if ((size_t)(r->end - r->p) < n) return false;
+    memcpy(dst, r->p, n);
+    r->p += n;
+    return true;
+}
+
+static bool readIndexString (IndexReader *r, char **str, uint32_t *len)
+{
+    if (!readIndex(r, len, sizeof(uint32_t))) return false;
+    if ((size_t)(r->end - r->p) < *len) return false;
+    *str = r->p;
+    r->p += *len;
+    return true;
+}
+
+/* Check the index in buf against the archive, and if reg is set, register
+ * the archive's members and their symbols from it.  We check the whole
+ * index before registering anything, so that a bad one does no harm. */
+static bool parseArchiveIndex (pathchar *path, struct stat *st,
+                               char *buf, size_t size, bool reg)
+{
+    IndexReader r = { buf, buf + size };
+    char magic[8];
+    uint64_t archive_size, offset, member_size;
+    int64_t mtime;
+    uint32_t n_members, n_syms, len, i, j;
+    char *str;
+    uint8_t weak;
+
+    if (!readIndex(&r, magic, sizeof(magic))
+        || memcmp(magic, ARCHIVE_INDEX_MAGIC, sizeof(magic)) != 0
+        || !readIndex(&r, &archive_size, sizeof(archive_size))
+        || archive_size != (uint64_t)st->st_size
+        || !readIndex(&r, &mtime, sizeof(mtime))
+        || mtime != (int64_t)st->st_mtime
+        || !readIndexString(&r, &str, &len)
+        || len != strlen(path) || memcmp(str, path, len) != 0
+        || !readIndex(&r, &n_members, sizeof(n_members))) {
+        return false;
+    }
+
+    for (i = 0; i < n_members; i++) {
+        char *member_name;
+        uint32_t member_name_len;
+        IndexReader syms;
+        size_t names_size = 0;
+
+        if (!readIndex(&r, &offset, sizeof(offset))
+            || !readIndex(&r, &member_size, sizeof(member_size))
+            || offset > archive_size || member_size > archive_size - offset
+            || member_size > INT_MAX
+            || !readIndexString(&r, &member_name, &member_name_len)
+            || !readIndex(&r, &n_syms, sizeof(n_syms))) {
+            return false;
+        }
+
+        syms = r;
+        for (j = 0; j < n_syms; j++) {
+            if (!readIndex(&r, &weak, sizeof(weak))
+                || !readIndexString(&r, &str, &len)) {
+                return false;
+            }
+            names_size += len + 1;
+        }
+
+        if (!reg) continue;
+
+        char *name = stgMallocBytes(member_name_len + 1, "parseArchiveIndex");
+        memcpy(name, member_name, member_name_len);
+        name[member_name_len] = '\0';
+        ObjectCode *oc = mkOc(path, NULL, (int)member_size, false, name, 0);
+        stgFree(name);
+
+        oc->deferred = true;
+        oc->archiveOffset = offset;
+        oc->n_symbols = n_syms;
+        oc->symbols = stgMallocBytes(stg_max(n_syms, 1) * sizeof(SymbolName*),
+                                     "parseArchiveIndex(symbols)");
+        oc->indexNames = stgMallocBytes(stg_max(names_size, 1),
+                                        "parseArchiveIndex(names)");
+
+        char *names = oc->indexNames;
+        for (j = 0; j < n_syms; j++) {
+            readIndex(&syms, &weak, sizeof(weak));
+            readIndexString(&syms, &str, &len);
+            memcpy(names, str, len);
+            names[len] = '\0';
+            oc->symbols[j] = names;
+            // can't fail, as the owner is OBJECT_LOADED
+            ghciInsertSymbolTable(path, symhash, names, NULL, weak, oc);
+            names += len + 1;
+        }
+
+        oc->next = objects;
+        objects = oc;
+    }
+
+    return r.p == r.end;
+}
+
+/* Register an archive's members from its index, see Note [Archive symbol
+ * index].  Returns true if we did, or false if the archive has to be read. */
+static bool loadArchiveIndex (pathchar *path)
+{
+    struct stat st;
+    char *index, *buf;
+    FILE *f;
+    long size;
+    bool ok = false;
+
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+
+    index = archiveIndexPath(path);
+    f = fopen(index, "rb");
+    stgFree(index);
+    if (f == NULL) {
+        return false;
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) <= 0
+        || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        return false;
+    }
+    buf = stgMallocBytes(size, "loadArchiveIndex");
+    if (fread(buf, 1, size, f) == (size_t)size
+        && parseArchiveIndex(path, &st, buf, size, false)) {
+        ok = parseArchiveIndex(path, &st, buf, size, true);
+    }
+    stgFree(buf);
+    fclose(f);
+
+    DEBUG_LOG("%s index of `%" PATH_FMT "'\n", ok ? "loaded" : "ignored", path);
+    return ok;
+}
+
+static bool writeIndex (FILE *f, const void *src, size_t n)
+{
+    return fwrite(src, 1, n, f) == n;
+}
+
+static bool writeIndexString (FILE *f, const char *str)
+{
+    uint32_t len = strlen(str);
+    return writeIndex(f, &len, sizeof(len)) && writeIndex(f, str, len);
+}
+
+/* Write the index of an archive that has just been loaded.  Failing to is
+ * not an error; we'll just read the archive again next time. */
+static void writeArchiveIndex (pathchar *path, ObjectCode **members,
+                               uint32_t n_members)
+{
+    struct stat st;
+    char *index, *tmp;
+    size_t tmp_len;
+    FILE *f;
+    bool ok;
+    uint64_t archive_size, offset, member_size;
+    int64_t mtime;
+    uint32_t i, n_syms;
+    int j;
+
+    if (stat(path, &st) != 0) {
+        return;
+    }
+
+    index = archiveIndexPath(path);
+    tmp_len = strlen(index) + 24;
+    tmp = stgMallocBytes(tmp_len, "writeArchiveIndex");
+    snprintf(tmp, tmp_len, "%s.%d", index, (int)getpid());
+
+    f = fopen(tmp, "wb");
+    if (f == NULL) {
+        DEBUG_LOG("can't write index `%s'\n", tmp);
+        goto done;
+    }
+
+    archive_size = st.st_size;
+    mtime = st.st_mtime;
+    ok = writeIndex(f, ARCHIVE_INDEX_MAGIC, 8)
+        && writeIndex(f, &archive_size, sizeof(archive_size))
+        && writeIndex(f, &mtime, sizeof(mtime))
+        && writeIndexString(f, path)
+        && writeIndex(f, &n_members, sizeof(n_members));
+
+    for (i = 0; ok && i < n_members; i++) {
+        ObjectCode *oc = members[i];
+
+        offset = oc->archiveOffset;
+        member_size = oc->fileSize;
+        n_syms = 0;
+        for (j = 0; j < oc->n_symbols; j++) {
+            if (oc->symbols[j] != NULL) n_syms++;
+        }
+        ok = writeIndex(f, &offset, sizeof(offset))
+            && writeIndex(f, &member_size, sizeof(member_size))
+            && writeIndexString(f, oc->archiveMemberName)
+            && writeIndex(f, &n_syms, sizeof(n_syms));
+
+        for (j = 0; ok && j < oc->n_symbols; j++) {
+            if (oc->symbols[j] == NULL) continue;
+            uint8_t weak = isSymbolWeak(oc, oc->symbols[j]);
+            ok = writeIndex(f, &weak, sizeof(weak))
+                && writeIndexString(f, oc->symbols[j]);
+        }
+    }
+
+    if (fclose(f) == 0 && ok && rename(tmp, index) == 0) {
+        DEBUG_LOG("wrote index `%s'\n", index);
+    } else {
+        unlink(tmp);
+    }
+
+done:
+    stgFree(tmp);
+    stgFree(index);
+}
+
+/* Read and load an archive member whose symbols were registered from the
+ * archive's index, see Note [Archive symbol index].
+ *
+ * Returns: 1 if ok, 0 on error.
+ */
+HsInt loadArchiveMember (ObjectCode *oc)
+{
+    FILE *f;
+    char *image;
+
+    ASSERT(oc->deferred);
+    DEBUG_LOG("Loading deferred member `%s'\n", oc->archiveMemberName);
+
+    f = pathopen(oc->fileName, WSTR("rb"));
+    if (!f) {
+        errorBelch("loadArchiveMember: can't read `%" PATH_FMT "'",
+                   oc->fileName);
+        return 0;
+    }
+    image = stgMallocBytes(oc->fileSize, "loadArchiveMember(image)");
+    if (fseek(f, oc->archiveOffset, SEEK_SET) != 0
+        || fread(image, 1, oc->fileSize, f) != (size_t)oc->fileSize) {
+        errorBelch("loadArchiveMember: error whilst reading `%s'",
+                   oc->archiveMemberName);
+        stgFree(image);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+
+    /* The symbols from the index stay in symhash; ocGetNames fills in
+       their addresses, and then oc->symbols lists them again. */
+    oc->image = image;
+    stgFree(oc->symbols);
+    oc->symbols = NULL;
+    oc->n_symbols = 0;
+
+    ocInit_ELF( oc );
+    if (0 == loadOc(oc)) {
+        return 0;
+    }
+    oc->deferred = false;
+    return 1;
+}
+
+#endif /* OBJFORMAT_ELF */
+
 static HsInt loadArchive_ (pathchar *path)
 {
     ObjectCode* oc = NULL;
@@ -259,6 +607,9 @@ static HsInt loadArchive_ (pathchar *path)
     char *gnuFileIndex;
     int gnuFileIndexSize;
     int misalignment = 0;
+    ObjectCode **members = NULL;
+    uint32_t n_members = 0, n_loaded = 0, members_size = 0, i;
+    long offset;
 
     DEBUG_LOG("start\n");
     DEBUG_LOG("Loading archive `%" PATH_FMT "'\n", path);
@@ -271,6 +622,13 @@ static HsInt loadArchive_ (pathchar *path)
         return 1; /* success */
     }
 
+#if defined(OBJFORMAT_ELF)
+    /* See Note [Archive symbol index] */
+    if (RtsFlags.MiscFlags.linkerIndexDir != NULL && loadArchiveIndex(path)) {
+        return 1;
+    }
+#endif
+
     gnuFileIndex = NULL;
     gnuFileIndexSize = 0;
 
@@ -504,6 +862,7 @@ static HsInt loadArchive_ (pathchar *path)
 #else // not darwin
             image = stgMallocBytes(memberSize, "loadArchive(image)");
 #endif
+            offset = isThin ? 0 : ftell(f);
             if (isThin) {
                 if (!readThinArchiveMember(n, memberSize, path,
                         fileName, image)) {
@@ -525,23 +884,17 @@ static HsInt loadArchive_ (pathchar *path)
 
             oc = mkOc(path, image, memberSize, false, archiveMemberName
                      , misalignment);
-#if defined(OBJFORMAT_MACHO)
-            ocInit_MachO( oc );
-#endif
-#if defined(OBJFORMAT_ELF)
-            ocInit_ELF( oc );
-#endif
 
             stgFree(archiveMemberName);
+            oc->archiveOffset = offset;
 
-            if (0 == loadOc(oc)) {
-                stgFree(fileName);
-                fclose(f);
-                return 0;
-            } else {
-                oc->next = objects;
-                objects = oc;
+            if (n_members == members_size) {
+                members_size = members_size ? 2 * members_size : 16;
+                members = stgReallocBytes(members,
+                                          members_size * sizeof(ObjectCode*),
+                                          "loadArchive(members)");
             }
+            members[n_members++] = oc;
         }
         else if (isGnuIndex) {
             if (gnuFileIndex != NULL) {
@@ -605,8 +958,37 @@ while reading filename from `%" PATH_FMT "'", path);
         }
         DEBUG_LOG("reached end of archive loading while loop\n");
     }
+
+    /* Parse the members, on several threads if we may, then add their
+       symbols in archive order.  See Note [Parallel linking] in Linker.c */
+    forEachObject(members, n_members, initArchiveMember);
+
+    while (n_loaded < n_members) {
+        oc = members[n_loaded++];
+        if (0 == loadOc(oc)) {
+            // the loop at fail: starts after this member, so free it here
+            removeOcSymbols(oc);
+            freeObjectCode(oc);
+            goto fail;
+        }
+        oc->next = objects;
+        objects = oc;
+    }
+
+#if defined(OBJFORMAT_ELF)
+    if (RtsFlags.MiscFlags.linkerIndexDir != NULL && !isThin) {
+        writeArchiveIndex(path, members, n_members);
+    }
+#endif
+
     retcode = 1;
 fail:
+    for (i = n_loaded; i < n_members; i++) {
+        freeObjectCode(members[i]);
+    }
+    if (members != NULL)
+        stgFree(members);
+
     if (f != NULL)
         fclose(f);
 
@@ -630,7 +1012,9 @@ fail:
 HsInt loadArchive (pathchar *path)
 {
    ACQUIRE_LOCK(&linker_mutex);
+   LinkerPhase prev = switchLinkerPhase(LINKER_PHASE_PRELOAD);
    HsInt r = loadArchive_(path);
+   switchLinkerPhase(prev);
    RELEASE_LOCK(&linker_mutex);
    return r;
 }
@@ -93,8 +93,27 @@ implementation of the M32 allocator must be done with care (i.e. do not try to
 improve the allocator to avoid wasting this space without modifying the linker
 code accordingly).
 
-Object allocation is *not* thread-safe (however it could be done easily with a
-lock in the allocator structure). Object deallocation is thread-safe.
+Arenas, shards and batches
+--------------------------
+
+Memory is allocated from one of several arenas (see M32Arena), one for each
+kind of contents: code, writable data and read-only data.  Small objects from
+different arenas never share a page, so that the pages of an arena can be
+given their own protection (e.g. to map code W^X once it is relocated).
+
+Each arena is split into M32_SHARDS allocators, each with its own lock and its
+own "filling" list, and a thread allocates from the allocator picked by its
+kernel thread id, so threads loading objects at the same time don't usually
+contend.  When an allocator needs a new page, it maps M32_BATCH_PAGES pages at
+once and keeps the ones it doesn't need yet, which saves system calls and
+keeps an allocator's pages together in the address space.
+
+Every allocator counts the pages it has mapped, the bytes it has handed out,
+the bytes lost to alignment and the bytes left unused at the end of pages
+that it stopped filling; see m32_stats().
+
+Allocation takes the allocator's lock (in the threaded RTS).  Deallocation
+doesn't need it, since it only touches the page counter.
 
 */
 
@@ -105,7 +124,9 @@ lock in the allocator structure). Object deallocation is thread-safe.
  * M32 ALLOCATOR (see Note [M32 Allocator]
  ***************************************************************************/
 
-#define M32_MAX_PAGES 32
+#define M32_MAX_PAGES 4
+#define M32_SHARDS 4
+#define M32_BATCH_PAGES 8
 #define M32_REFCOUNT_BYTES 8
 
 
@@ -120,15 +141,22 @@ struct m32_alloc_t {
 /**
  * Allocator
  *
- * Currently an allocator is just a set of pages being filled. The maximum
- * number of pages can be configured with M32_MAX_PAGES.
+ * An allocator is a set of pages being filled, whose number can be
+ * configured with M32_MAX_PAGES, and some pages that have been mapped but
+ * not used yet.
  */
 typedef struct m32_allocator_t {
+#if defined(THREADED_RTS)
+   Mutex lock;
+#endif
    struct m32_alloc_t pages[M32_MAX_PAGES];
+   void * spare[M32_BATCH_PAGES];
+   uint32_t n_spare;
+   M32Stats stats;
 } m32_allocator;
 
-// We use a global memory allocator
-static struct m32_allocator_t alloc;
+// The allocators of each arena
+static struct m32_allocator_t allocators[M32_ARENAS][M32_SHARDS];
 
 /**
  * Wrapper for `unmap` that handles error cases.
@@ -146,26 +174,37 @@ munmapForLinker (void * addr, size_t size)
 }
 
 /**
- * Initialize the allocator structure
+ * Initialize the allocator structures
  * This is the real implementation. There is another dummy implementation below.
  * See the note titled "Compile Time Trickery" at the top of this file.
  */
 void
 m32_allocator_init(void)
 {
-   memset(&alloc, 0, sizeof(struct m32_allocator_t));
-   // Preallocate the initial M32_MAX_PAGES to ensure that they don't
-   // fragment the memory.
-   size_t pgsz = getPageSize();
-   char* bigchunk = mmapForLinker(pgsz * M32_MAX_PAGES,MAP_ANONYMOUS,-1,0);
-   int i;
-   for (i=0; i<M32_MAX_PAGES; i++) {
-      alloc.pages[i].base_addr = bigchunk + i*pgsz;
-      *((uintptr_t*)alloc.pages[i].base_addr) = 1;
-      alloc.pages[i].current_size = M32_REFCOUNT_BYTES;
+   int i, j;
+   memset(allocators, 0, sizeof(allocators));
+   for (i=0; i<M32_ARENAS; i++) {
+      for (j=0; j<M32_SHARDS; j++) {
+#if defined(THREADED_RTS)
+         initMutex(&allocators[i][j].lock);
+#endif
+      }
    }
 }
 
+/**
+ * The allocator of the given arena that this thread should use.
+ */
+static m32_allocator *
+m32_my_allocator(M32Arena arena)
+{
+#if defined(THREADED_RTS)
+   return &allocators[arena][kernelThreadId() % M32_SHARDS];
+#else
+   return &allocators[arena][0];
+#endif
+}
+
 /**
  * Atomically decrement the object counter on the given page and release the
  * page if necessary. The given address must be the *base address* of the page.
@@ -181,7 +220,19 @@ m32_free_internal(void * addr) {
 }
 
 /**
- * Release the allocator's reference to pages on the "filling" list. This
+ * Stop filling the i'th page of an allocator. Must hold its lock.
+ */
+static void
+m32_retire_page(m32_allocator *a, int i)
+{
+   a->stats.wasted += getPageSize() - a->pages[i].current_size;
+   m32_free_internal(a->pages[i].base_addr);
+   a->pages[i].base_addr    = 0;
+   a->pages[i].current_size = 0;
+}
+
+/**
+ * Release the allocators' references to pages on the "filling" lists. This
  * should be called when it is believed that no more allocations will be needed
  * from the allocator to ensure that empty pages waiting to be filled aren't
  * unnecessarily held.
@@ -191,11 +242,17 @@ m32_free_internal(void * addr) {
  */
 void
 m32_allocator_flush(void) {
-   int i;
-   for (i=0; i<M32_MAX_PAGES; i++) {
-      void * addr =  __sync_fetch_and_and(&alloc.pages[i].base_addr, 0x0);
-      if (addr != 0) {
-         m32_free_internal(addr);
+   int i, j, k;
+   for (i=0; i<M32_ARENAS; i++) {
+      for (j=0; j<M32_SHARDS; j++) {
+         m32_allocator *a = &allocators[i][j];
+         ACQUIRE_LOCK(&a->lock);
+         for (k=0; k<M32_MAX_PAGES; k++) {
+            if (a->pages[k].base_addr != 0) {
+               m32_retire_page(a, k);
+            }
+         }
+         RELEASE_LOCK(&a->lock);
       }
    }
 }
@@ -234,21 +291,58 @@ m32_free(void *addr, size_t size)
 }
 
 /**
- * Allocate `size` bytes of memory with the given alignment.
+ * Take a fresh page for an allocator, mapping a batch of them if it has
+ * none left. Must hold its lock.
+ */
+static void *
+m32_new_page(m32_allocator *a)
+{
+   size_t pgsz = getPageSize();
+
+   if (a->n_spare == 0) {
+      char *batch = mmapForLinker(pgsz * M32_BATCH_PAGES,MAP_ANONYMOUS,-1,0);
+      int i;
+      if (batch == NULL) {
+         return NULL;
+      }
+      // hand out the lowest pages first
+      for (i=M32_BATCH_PAGES-1; i>=0; i--) {
+         a->spare[a->n_spare++] = batch + i*pgsz;
+      }
+      a->stats.pages += M32_BATCH_PAGES;
+   }
+   return a->spare[--a->n_spare];
+}
+
+/**
+ * Allocate `size` bytes of memory with the given alignment, in the given
+ * arena.
  *
  * This is the real implementation. There is another dummy implementation below.
  * See the note titled "Compile Time Trickery" at the top of this file.
  */
 void *
-m32_alloc(size_t size, size_t alignment)
+m32_alloc(M32Arena arena, size_t size, size_t alignment)
 {
    size_t pgsz = getPageSize();
+   m32_allocator *a = m32_my_allocator(arena);
+   void * addr;
 
    if (m32_is_large_object(size,alignment)) {
        // large object
-       return mmapForLinker(size,MAP_ANONYMOUS,-1,0);
+       addr = mmapForLinker(size,MAP_ANONYMOUS,-1,0);
+       if (addr != NULL) {
+          ACQUIRE_LOCK(&a->lock);
+          a->stats.large     += roundUpToPage(size);
+          a->stats.allocated += size;
+          a->stats.wasted    += roundUpToPage(size) - size;
+          RELEASE_LOCK(&a->lock);
+       }
+       return addr;
    }
 
+   ACQUIRE_LOCK(&a->lock);
+
    // small object
    // Try to find a page that can contain it
    int empty = -1;
@@ -256,7 +350,7 @@ m32_alloc(size_t size, size_t alignment)
    int i;
    for (i=0; i<M32_MAX_PAGES; i++) {
       // empty page
-      if (alloc.pages[i].base_addr == 0) {
+      if (a->pages[i].base_addr == 0) {
          empty = empty == -1 ? i : empty;
          continue;
       }
@@ -265,21 +359,24 @@ m32_alloc(size_t size, size_t alignment)
       // few bytes left to allocate and we don't get to use or free them
       // until we use up all the "filling" pages. This will unnecessarily
       // allocate new pages and fragment the address space.
-      if (*((uintptr_t*)(alloc.pages[i].base_addr)) == 1) {
-         alloc.pages[i].current_size = M32_REFCOUNT_BYTES;
+      if (*((uintptr_t*)(a->pages[i].base_addr)) == 1) {
+         a->pages[i].current_size = M32_REFCOUNT_BYTES;
       }
       // page can contain the buffer?
-      size_t alsize = ROUND_UP(alloc.pages[i].current_size, alignment);
+      size_t alsize = ROUND_UP(a->pages[i].current_size, alignment);
       if (size <= pgsz - alsize) {
-         void * addr = (char*)alloc.pages[i].base_addr + alsize;
-         alloc.pages[i].current_size = alsize + size;
+         addr = (char*)a->pages[i].base_addr + alsize;
+         a->stats.padding   += alsize - a->pages[i].current_size;
+         a->stats.allocated += size;
+         a->pages[i].current_size = alsize + size;
          // increment the counter atomically
-         __sync_fetch_and_add((uintptr_t*)alloc.pages[i].base_addr, 1);
+         __sync_fetch_and_add((uintptr_t*)a->pages[i].base_addr, 1);
+         RELEASE_LOCK(&a->lock);
          return addr;
       }
       // most filled?
       if (most_filled == -1
-       || alloc.pages[most_filled].current_size < alloc.pages[i].current_size)
+       || a->pages[most_filled].current_size < a->pages[i].current_size)
       {
          most_filled = i;
       }
@@ -287,27 +384,53 @@ m32_alloc(size_t size, size_t alignment)
 
    // If we haven't found an empty page, flush the most filled one
    if (empty == -1) {
-      m32_free_internal(alloc.pages[most_filled].base_addr);
-      alloc.pages[most_filled].base_addr    = 0;
-      alloc.pages[most_filled].current_size = 0;
+      m32_retire_page(a, most_filled);
       empty = most_filled;
    }
 
-   // Allocate a new page
-   void * addr = mmapForLinker(pgsz,MAP_ANONYMOUS,-1,0);
+   // Start a new page
+   addr = m32_new_page(a);
    if (addr == NULL) {
+      RELEASE_LOCK(&a->lock);
       return NULL;
    }
-   alloc.pages[empty].base_addr    = addr;
+   a->pages[empty].base_addr    = addr;
    // Add M32_REFCOUNT_BYTES bytes for the counter + padding
-   alloc.pages[empty].current_size =
+   a->pages[empty].current_size =
        size+ROUND_UP(M32_REFCOUNT_BYTES,alignment);
+   a->stats.padding   += ROUND_UP(M32_REFCOUNT_BYTES,alignment)
+                           - M32_REFCOUNT_BYTES;
+   a->stats.allocated += size;
    // Initialize the counter:
    // 1 for the allocator + 1 for the returned allocated memory
    *((uintptr_t*)addr)            = 2;
+   RELEASE_LOCK(&a->lock);
    return (char*)addr + ROUND_UP(M32_REFCOUNT_BYTES,alignment);
 }
 
+/**
+ * Add up the statistics of the allocators of an arena.
+ *
+ * This is the real implementation. There is another dummy implementation below.
+ * See the note titled "Compile Time Trickery" at the top of this file.
+ */
+void
+m32_stats(M32Arena arena, M32Stats *stats)
+{
+   int i;
+   memset(stats, 0, sizeof(M32Stats));
+   for (i=0; i<M32_SHARDS; i++) {
+      m32_allocator *a = &allocators[arena][i];
+      ACQUIRE_LOCK(&a->lock);
+      stats->pages     += a->stats.pages;
+      stats->large     += a->stats.large;
+      stats->allocated += a->stats.allocated;
+      stats->padding   += a->stats.padding;
+      stats->wasted    += a->stats.wasted;
+      RELEASE_LOCK(&a->lock);
+   }
+}
+
 #elif RTS_LINKER_USE_MMAP == 0
 
 // The following implementations of these functions should never be called. If
@@ -333,7 +456,14 @@ m32_free(void *addr STG_UNUSED, size_t size STG_UNUSED)
 }
 
 void *
-m32_alloc(size_t size STG_UNUSED, size_t alignment STG_UNUSED)
+m32_alloc(M32Arena arena STG_UNUSED, size_t size STG_UNUSED,
+          size_t alignment STG_UNUSED)
+{
+    barf("%s: RTS_LINKER_USE_MMAP is %d", __func__, RTS_LINKER_USE_MMAP);
+}
+
+void
+m32_stats(M32Arena arena STG_UNUSED, M32Stats *stats STG_UNUSED)
 {
     barf("%s: RTS_LINKER_USE_MMAP is %d", __func__, RTS_LINKER_USE_MMAP);
 }
@@ -26,12 +26,30 @@
 #define M32_NO_RETURN    GNUC3_ATTRIBUTE(__noreturn__)
 #endif
 
+/* The arenas of the allocator, see Note [M32 Allocator] */
+typedef enum {
+    M32_ARENA_TEXT,             /* code, e.g. jump islands */
+    M32_ARENA_DATA,             /* writable data */
+    M32_ARENA_RODATA,           /* read-only data */
+    M32_ARENAS
+} M32Arena;
+
+typedef struct {
+    StgWord64 pages;            /* pages mapped for small objects */
+    StgWord64 large;            /* bytes mapped for large objects */
+    StgWord64 allocated;        /* bytes handed out */
+    StgWord64 padding;          /* bytes lost to alignment */
+    StgWord64 wasted;           /* bytes left unused at the end of pages */
+} M32Stats;
+
 void m32_allocator_init(void) M32_NO_RETURN;
 
 void m32_allocator_flush(void) M32_NO_RETURN;
 
 void m32_free(void *addr, size_t size) M32_NO_RETURN;
 
-void * m32_alloc(size_t size, size_t alignment) M32_NO_RETURN;
+void * m32_alloc(M32Arena arena, size_t size, size_t alignment) M32_NO_RETURN;
+
+void m32_stats(M32Arena arena, M32Stats *stats) M32_NO_RETURN;
 
 #include "EndPrivate.h"
@@ -0,0 +1,128 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2019
+ *
+ * Running a linker phase on many objects at once
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "Rts.h"
+#include "RtsUtils.h"
+#include "linker/Parallel.h"
+
+/* See Note [Parallel linking] in Linker.c.  The caller holds linker_mutex
+ * and keeps it for the duration; the workers only run fn, which must not
+ * touch any state shared between the objects. */
+
+typedef struct {
+    ObjectCode **ocs;
+    uint32_t n;
+    int (*fn)(ObjectCode *oc);
+    volatile StgWord next;      // index of the next object to take
+    volatile StgWord failed;    // set if fn failed on any object
+#if defined(THREADED_RTS)
+    Mutex lock;
+    Condition finished;
+    uint32_t running;           // workers that haven't finished yet
+#endif
+} ObjectWork;
+
+/* How many threads to use for a phase over n objects */
+uint32_t
+linkerThreads ( uint32_t n )
+{
+#if defined(THREADED_RTS)
+    uint32_t threads = RtsFlags.MiscFlags.linkerThreads;
+
+    if (threads == 0) {
+        threads = getNumberOfProcessors();
+    }
+    return stg_min(threads, n);
+#else
+    (void)n;
+    return 1;
+#endif
+}
+
+static void
+workOnObjects ( ObjectWork *w )
+{
+    StgWord i;
+
+    while ((i = atomic_inc(&w->next, 1) - 1) < w->n) {
+        if (!w->fn(w->ocs[i])) {
+            w->failed = 1;
+        }
+    }
+}
+
+#if defined(THREADED_RTS)
+static void *
+objectWorker ( void *arg )
+{
+    ObjectWork *w = arg;
+
+    workOnObjects(w);
+
+    ACQUIRE_LOCK(&w->lock);
+    if (--w->running == 0) {
+        signalCondition(&w->finished);
+    }
+    RELEASE_LOCK(&w->lock);
+    return NULL;
+}
+#endif
+
+/* Run fn on each of the objects, on up to linkerThreads(n) threads
+ * including this one, and wait for them all.  The order in which the
+ * objects are taken is unspecified.
+ *
+ * Returns: 1 if fn succeeded on every object, 0 otherwise. */
+int
+forEachObject ( ObjectCode **ocs, uint32_t n, int (*fn)(ObjectCode *oc) )
+{
+    ObjectWork w;
+
+    w.ocs = ocs;
+    w.n = n;
+    w.fn = fn;
+    w.next = 0;
+    w.failed = 0;
+
+#if defined(THREADED_RTS)
+    uint32_t threads = linkerThreads(n);
+
+    initMutex(&w.lock);
+    initCondition(&w.finished);
+    w.running = 0;
+
+    for (uint32_t t = 1; t < threads; t++) {
+        OSThreadId tid;
+        ACQUIRE_LOCK(&w.lock);
+        w.running++;
+        RELEASE_LOCK(&w.lock);
+        if (createOSThread(&tid, (char *)"ghc_linker", objectWorker, &w) != 0) {
+            // carry on with the threads we have
+            ACQUIRE_LOCK(&w.lock);
+            w.running--;
+            RELEASE_LOCK(&w.lock);
+            break;
+        }
+    }
+
+    workOnObjects(&w);
+
+    ACQUIRE_LOCK(&w.lock);
+    while (w.running > 0) {
+        waitCondition(&w.finished, &w.lock);
+    }
+    RELEASE_LOCK(&w.lock);
+
+    closeCondition(&w.finished);
+    closeMutex(&w.lock);
+#else
+    workOnObjects(&w);
+#endif
+
+    return !w.failed;
+}
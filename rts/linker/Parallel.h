@@ -0,0 +1,11 @@
+#pragma once
+
+#include "LinkerInternals.h"
+
+#include "BeginPrivate.h"
+
+uint32_t linkerThreads ( uint32_t n );
+
+int forEachObject ( ObjectCode **ocs, uint32_t n, int (*fn)(ObjectCode *oc) );
+
+#include "EndPrivate.h"
@@ -76,7 +76,8 @@ int ocAllocateSymbolExtras( ObjectCode* oc, int count, int first )
     if (RTS_LINKER_USE_MMAP) {
         n = roundUpToPage(oc->fileSize);
 
-        oc->symbol_extras = m32_alloc(sizeof(SymbolExtra) * count, 8);
+        oc->symbol_extras = m32_alloc(M32_ARENA_TEXT,
+                                      sizeof(SymbolExtra) * count, 8);
         if (oc->symbol_extras == NULL) return 0;
     }
     else {
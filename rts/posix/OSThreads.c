@@ -214,6 +214,158 @@ freeThreadLocalKey (ThreadLocalKey *key)
     }
 }
 
+#if defined(linux_HOST_OS) && defined(HAVE_SCHED_H) && \
+    defined(HAVE_SCHED_GETAFFINITY) && defined(HAVE_SCHED_SETAFFINITY)
+#define USE_USABLE_CPUS 1
+
+/*
+   Note [Usable CPUs]
+   ~~~~~~~~~~~~~~~~~~
+   A process may be allowed to use far fewer CPUs than the machine has.
+   A container on a 64-core node may be confined to four of them by a
+   cpuset, which shows up in the process's affinity mask, or given four
+   CPUs' worth of time by a CFS quota on its cgroup.  So on Linux:
+
+   * The CPUs we may use are those in the affinity mask the process
+     started with (sched_getaffinity).  We read it once, before any of
+     our threads has been bound to a CPU with -qa, because threads
+     inherit the mask of the thread that creates them.
+
+   * getNumberOfProcessors(), which is what -N and -maxN go by, is the
+     number of those CPUs, or fewer if the cgroup's CPU quota allows
+     less time than that: a quota of 2.5 CPUs counts as 3.  We read the
+     quota from /sys/fs/cgroup, which inside a container is the
+     container's own cgroup, in either the cgroup v2 (cpu.max) or v1
+     (cpu/cpu.cfs_quota_us) layout.
+
+   * setThreadAffinity() binds capabilities to the usable CPUs only,
+     taking them in usable_cpus[] order.  That order puts the first
+     hyperthread of every core before the second hyperthread of any,
+     so that capabilities share a core only when there are more of them
+     than cores.  The siblings of each CPU come from sysfs.
+*/
+
+static pthread_once_t usable_cpus_once = PTHREAD_ONCE_INIT;
+static uint32_t n_usable_cpus = 0;     // CPUs in our affinity mask
+static uint32_t *usable_cpus = NULL;   // ... in placement order
+static uint32_t cpu_quota = 0;         // the cgroup's CPU quota, or 0
+
+// The lowest-numbered hyperthread on the same core as the given CPU
+static uint32_t
+firstSibling (uint32_t cpu)
+{
+    char path[80];
+    unsigned int first;
+    FILE *f;
+
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list",
+             cpu);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return cpu;
+    }
+    if (fscanf(f, "%u", &first) != 1) {
+        first = cpu;
+    }
+    fclose(f);
+    return first;
+}
+
+// The number of CPUs' worth of time the cgroup's CFS quota allows,
+// rounded up, or 0 if there is no quota.
+static uint32_t
+readCpuQuota (void)
+{
+    char quota_str[32];
+    long long quota = -1, period = 0;
+    FILE *f;
+
+    // cgroup v2: "max 100000" or "<quota> <period>"
+    f = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%31s %lld", quota_str, &period) == 2
+            && strcmp(quota_str, "max") != 0) {
+            quota = strtoll(quota_str, NULL, 10);
+        }
+        fclose(f);
+    } else {
+        // cgroup v1: the quota is -1 if there is none
+        f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+        if (f != NULL) {
+            if (fscanf(f, "%lld", &quota) != 1) {
+                quota = -1;
+            }
+            fclose(f);
+        }
+        f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+        if (f != NULL) {
+            if (fscanf(f, "%lld", &period) != 1) {
+                period = 0;
+            }
+            fclose(f);
+        }
+    }
+
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    return (uint32_t)stg_max(1, (quota + period - 1) / period);
+}
+
+static void
+initUsableCpus (void)
+{
+    cpu_set_t mask;
+    uint32_t *sibling, *rank;
+    uint32_t cpu, i, j, k, n;
+
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+        // use every CPU, in order
+        CPU_ZERO(&mask);
+        n = stg_max(1, sysconf(_SC_NPROCESSORS_ONLN));
+        for (cpu = 0; cpu < n && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &mask);
+        }
+    }
+
+    n = CPU_COUNT(&mask);
+    usable_cpus = stgMallocBytes(n * sizeof(uint32_t), "initUsableCpus");
+    sibling = stgMallocBytes(n * sizeof(uint32_t), "initUsableCpus");
+    rank = stgMallocBytes(n * sizeof(uint32_t), "initUsableCpus");
+
+    // Rank each CPU by how many usable hyperthreads of its core come
+    // before it, so that rank 0 holds one CPU from each core.
+    for (cpu = 0, i = 0; cpu < CPU_SETSIZE && i < n; cpu++) {
+        if (!CPU_ISSET(cpu, &mask)) continue;
+        usable_cpus[i] = cpu;
+        sibling[i] = firstSibling(cpu);
+        rank[i] = 0;
+        for (j = 0; j < i; j++) {
+            if (sibling[j] == sibling[i]) rank[i]++;
+        }
+        i++;
+    }
+
+    // Order the CPUs by rank, keeping CPUs of equal rank in order
+    for (i = 1; i < n; i++) {
+        cpu = usable_cpus[i];
+        k = rank[i];
+        for (j = i; j > 0 && rank[j-1] > k; j--) {
+            usable_cpus[j] = usable_cpus[j-1];
+            rank[j] = rank[j-1];
+        }
+        usable_cpus[j] = cpu;
+        rank[j] = k;
+    }
+
+    stgFree(sibling);
+    stgFree(rank);
+    n_usable_cpus = n;
+    cpu_quota = readCpuQuota();
+}
+#endif /* USE_USABLE_CPUS */
+
 #if defined(THREADED_RTS)
 
 static void *
@@ -246,7 +398,14 @@ getNumberOfProcessors (void)
     static uint32_t nproc = 0;
 
     if (nproc == 0) {
-#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+#if defined(USE_USABLE_CPUS)
+        // See Note [Usable CPUs]
+        pthread_once(&usable_cpus_once, initUsableCpus);
+        nproc = n_usable_cpus;
+        if (cpu_quota != 0 && cpu_quota < nproc) {
+            nproc = cpu_quota;
+        }
+#elif defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
         nproc = sysconf(_SC_NPROCESSORS_ONLN);
 #elif defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_CONF)
         nproc = sysconf(_SC_NPROCESSORS_CONF);
@@ -285,7 +444,30 @@ uint32_t getNumberOfProcessors (void)
 
 #endif /* defined(THREADED_RTS) */
 
-#if defined(HAVE_SCHED_H) && defined(HAVE_SCHED_SETAFFINITY)
+#if defined(USE_USABLE_CPUS)
+// Schedules the thread to run on usable CPU n of m (see Note [Usable
+// CPUs]).  m may be less than the number of usable CPUs, in which case
+// the thread will be allowed to run on usable CPUs n, n+m, n+2m etc.,
+// or more, in which case CPUs are shared round-robin.
+void
+setThreadAffinity (uint32_t n, uint32_t m)
+{
+    cpu_set_t cs;
+    uint32_t i;
+
+    pthread_once(&usable_cpus_once, initUsableCpus);
+    CPU_ZERO(&cs);
+    if (m > n_usable_cpus) {
+        CPU_SET(usable_cpus[n % n_usable_cpus], &cs);
+    } else {
+        for (i = n; i < n_usable_cpus; i += m) {
+            CPU_SET(usable_cpus[i], &cs);
+        }
+    }
+    sched_setaffinity(0, sizeof(cpu_set_t), &cs);
+}
+
+#elif defined(HAVE_SCHED_H) && defined(HAVE_SCHED_SETAFFINITY)
 // Schedules the thread to run on CPU n of m.  m may be less than the
 // number of physical CPUs, in which case, the thread will be allowed
 // to run on CPU n, n+m, n+2m etc.
@@ -137,7 +137,20 @@ static void *itimer_thread_func(void *_handle_tick)
             ACQUIRE_LOCK(&mutex);
             // should we really stop?
             if (stopped) {
+#if defined(USE_TIMERFD_FOR_ITIMER) && USE_TIMERFD_FOR_ITIMER
+                // Disarm the timerfd while we wait, so that a stopped
+                // ticker costs no timer interrupts (see Note [Tickless
+                // mode] in Timer.c).
+                struct itimerspec disarm;
+                memset(&disarm, 0, sizeof(disarm));
+                timerfd_settime(timerfd, 0, &disarm, NULL);
                 waitCondition(&start_cond, &mutex);
+                if (timerfd_settime(timerfd, 0, &it, NULL)) {
+                    barf("timerfd_settime");
+                }
+#else
+                waitCondition(&start_cond, &mutex);
+#endif
             }
             RELEASE_LOCK(&mutex);
         } else {
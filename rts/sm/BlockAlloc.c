@@ -461,6 +461,26 @@ finish:
     return bd;
 }
 
+// Make the 'mblocks' mblocks at 'mblock', which the caller got from
+// claimMBlocksAt() and has committed, into a block group of their own.
+// Unlike allocGroup(), this leaves the contents of the blocks alone: only
+// the bdescrs of the first mblock are written.
+bdescr *
+allocMBlockGroupAt (void *mblock, uint32_t mblocks)
+{
+    bdescr *bd;
+
+    initMBlock(mblock, 0); // only need to init the 1st one
+    recordAllocatedBlocks(0, mblocks * BLOCKS_PER_MBLOCK);
+
+    bd = FIRST_BDESCR(mblock);
+    bd->blocks = MBLOCK_GROUP_BLOCKS(mblocks);
+    initGroup(bd);
+
+    IF_DEBUG(sanity, checkFreeListSanity());
+    return bd;
+}
+
 STATIC_INLINE
 uint32_t nodeWithLeastBlocks (void)
 {
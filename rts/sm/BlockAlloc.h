@@ -12,6 +12,7 @@
 
 bdescr *allocLargeChunk (W_ min, W_ max);
 bdescr *allocLargeChunkOnNode (uint32_t node, W_ min, W_ max);
+bdescr *allocMBlockGroupAt (void *mblock, uint32_t mblocks);
 
 /* Debugging  -------------------------------------------------------------- */
 
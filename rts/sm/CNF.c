@@ -23,6 +23,7 @@
 #include "BlockAlloc.h"
 #include "Trace.h"
 #include "sm/ShouldCompact.h"
+#include "sm/OSMem.h"
 
 #include <string.h>
 
@@ -32,6 +33,11 @@
 #if defined(HAVE_LIMITS_H)
 #include <limits.h>
 #endif
+#include <errno.h>
+#if !defined(mingw32_HOST_OS)
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
 /*
   Note [Compact Normal Forms]
@@ -148,6 +154,9 @@
   does not attempt to reconstruct info tables, and uses info tables to detect
   pointers. In practice this means only the exact same binary should be
   used.
+
+  Compacts can also be written to files that are mapped back into memory
+  without any fixup, see Note [Compact files].
 */
 
 typedef enum {
@@ -157,6 +166,21 @@ typedef enum {
     ALLOCATE_IMPORT_APPEND,
 } AllocateOp;
 
+// Mark the n_blocks blocks of the group at head as a compact block
+static void
+initCompactBlockGroup(bdescr *head, uint32_t n_blocks, generation *g)
+{
+    bdescr *block;
+
+    initBdescr(head, g, g);
+    head->flags = BF_COMPACT;
+    for (block = head + 1, n_blocks --; n_blocks > 0; block++, n_blocks--) {
+        block->link = head;
+        block->blocks = 0;
+        block->flags = BF_COMPACT;
+    }
+}
+
 static StgCompactNFDataBlock *
 compactAllocateBlockInternal(Capability            *cap,
                              StgWord                aligned_size,
@@ -164,7 +188,7 @@ compactAllocateBlockInternal(Capability            *cap,
                              AllocateOp             operation)
 {
     StgCompactNFDataBlock *self;
-    bdescr *block, *head;
+    bdescr *block;
     uint32_t n_blocks;
     generation *g;
 
@@ -235,20 +259,17 @@ compactAllocateBlockInternal(Capability            *cap,
     }
     RELEASE_SM_LOCK;
 
-    cap->total_allocated += aligned_size / sizeof(StgWord);
+    // cap is NULL when compactMapFile() reads a file in a safe foreign
+    // call, without a Capability of its own
+    if (cap != NULL) {
+        cap->total_allocated += aligned_size / sizeof(StgWord);
+    }
 
     self = (StgCompactNFDataBlock*) block->start;
     self->self = self;
     self->next = NULL;
 
-    head = block;
-    initBdescr(head, g, g);
-    head->flags = BF_COMPACT;
-    for (block = head + 1, n_blocks --; n_blocks > 0; block++, n_blocks--) {
-        block->link = head;
-        block->blocks = 0;
-        block->flags = BF_COMPACT;
-    }
+    initCompactBlockGroup(block, n_blocks, g);
 
     return self;
 }
@@ -393,7 +414,7 @@ compactNew (Capability *cap, StgWord size)
     return self;
 }
 
-static StgCompactNFDataBlock *
+StgCompactNFDataBlock *
 compactAppendBlock (Capability       *cap,
                     StgCompactNFData *str,
                     StgWord           aligned_size)
@@ -791,113 +812,96 @@ any_needs_fixup(StgCompactNFDataBlock *block)
     return false;
 }
 
+// An entry of the fixup table: pointers into [start, end) move by delta
+typedef struct {
+    StgWord start;
+    StgWord end;
+    StgWord delta;
+} FixupEntry;
+
 #if defined(DEBUG)
 static void
-spew_failing_pointer(StgWord *fixup_table, uint32_t count, StgWord address)
+spew_failing_pointer(FixupEntry *fixup_table, uint32_t count, StgWord address)
 {
     uint32_t i;
-    StgWord key, value;
-    StgCompactNFDataBlock *block;
-    bdescr *bd;
-    StgWord size;
+    FixupEntry *e;
 
     debugBelch("Failed to adjust 0x%" FMT_HexWord ". Block dump follows...\n",
                address);
 
     for (i  = 0; i < count; i++) {
-        key = fixup_table [2 * i];
-        value = fixup_table [2 * i + 1];
-
-        block = (StgCompactNFDataBlock*)value;
-        bd = Bdescr((P_)block);
-        size = (W_)bd->free - (W_)bd->start;
+        e = &fixup_table[i];
 
         debugBelch("%" FMT_Word32 ": was 0x%" FMT_HexWord "-0x%" FMT_HexWord
-                   ", now 0x%" FMT_HexWord "-0x%" FMT_HexWord "\n", i, key,
-                   key+size, value, value+size);
+                   ", now 0x%" FMT_HexWord "-0x%" FMT_HexWord "\n", i,
+                   e->start, e->end, e->start + e->delta, e->end + e->delta);
     }
 }
 #endif
 
-STATIC_INLINE StgCompactNFDataBlock *
-find_pointer(StgWord *fixup_table, uint32_t count, StgClosure *q)
+STATIC_INLINE FixupEntry *
+find_pointer(FixupEntry *fixup_table, uint32_t count, StgClosure *q)
 {
     StgWord address = (W_)q;
     uint32_t a, b, c;
-    StgWord key, value;
-    bdescr *bd;
+
+    if (count == 0)
+        return NULL;
 
     a = 0;
     b = count;
     while (a < b-1) {
         c = (a+b)/2;
 
-        key = fixup_table[c * 2];
-        value = fixup_table[c * 2 + 1];
-
-        if (key > address)
+        if (fixup_table[c].start > address)
             b = c;
         else
             a = c;
     }
 
-    // three cases here: 0, 1 or 2 blocks to check
-    for ( ; a < b; a++) {
-        key = fixup_table[a * 2];
-        value = fixup_table[a * 2 + 1];
-
-        if (key > address)
-            goto fail;
-
-        bd = Bdescr((P_)value);
-
-        if (key + bd->blocks * BLOCK_SIZE <= address)
-            goto fail;
-
-        return (StgCompactNFDataBlock*)value;
-    }
+    if (fixup_table[a].start <= address && address < fixup_table[a].end)
+        return &fixup_table[a];
 
- fail:
-    // We should never get here
-
-#if defined(DEBUG)
-    spew_failing_pointer(fixup_table, count, address);
-#endif
     return NULL;
 }
 
 static bool
-fixup_one_pointer(StgWord *fixup_table, uint32_t count, StgClosure **p)
+fixup_one_pointer(FixupEntry *fixup_table, uint32_t count, StgClosure **p)
 {
     StgWord tag;
     StgClosure *q;
-    StgCompactNFDataBlock *block;
+    FixupEntry *e;
 
 
     q = *p;
     tag = GET_CLOSURE_TAG(q);
     q = UNTAG_CLOSURE(q);
 
-    // We can encounter a pointer outside the compact if it points to
-    // a static constructor that does not (directly or indirectly)
-    // reach any CAFs. (see Note [Compact Normal Forms])
-    if (!HEAP_ALLOCED(q))
-        return true;
+    e = find_pointer(fixup_table, count, q);
+    if (e == NULL) {
+        // We can encounter a pointer outside the compact if it points to
+        // a static constructor that does not (directly or indirectly)
+        // reach any CAFs. (see Note [Compact Normal Forms])
+        if (!HEAP_ALLOCED(q))
+            return true;
 
-    block = find_pointer(fixup_table, count, q);
-    if (block == NULL)
+        // We should never get here
+#if defined(DEBUG)
+        spew_failing_pointer(fixup_table, count, (W_)q);
+#endif
         return false;
-    if (block == block->self)
+    }
+    if (e->delta == 0)
         return true;
 
-    q = (StgClosure*)((W_)q - (W_)block->self + (W_)block);
+    q = (StgClosure*)((W_)q + e->delta);
     *p = TAG_CLOSURE(tag, q);
 
     return true;
 }
 
 static bool
-fixup_mut_arr_ptrs (StgWord          *fixup_table,
+fixup_mut_arr_ptrs (FixupEntry       *fixup_table,
                     uint32_t               count,
                     StgMutArrPtrs    *a)
 {
@@ -913,16 +917,15 @@ fixup_mut_arr_ptrs (StgWord          *fixup_table,
     return true;
 }
 
+// Fix up the closures in [p, end).  The only COMPACT_NFDATA allowed is the
+// one at nfdata, if that is not NULL.
 static bool
-fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
+fixup_range(StgPtr p, StgPtr end, StgPtr nfdata,
+            FixupEntry *fixup_table, uint32_t count)
 {
     const StgInfoTable *info;
-    bdescr *bd;
-    StgPtr p;
 
-    bd = Bdescr((P_)block);
-    p = bd->start + sizeofW(StgCompactNFDataBlock);
-    while (p < bd->free) {
+    while (p < end) {
         ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
         info = get_itbl((StgClosure*)p);
 
@@ -992,7 +995,7 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
         }
 
         case COMPACT_NFDATA:
-            if (p == (bd->start + sizeofW(StgCompactNFDataBlock))) {
+            if (p == nfdata) {
                 // Ignore the COMPACT_NFDATA header
                 // (it will be fixed up later)
                 p += sizeofW(StgCompactNFData);
@@ -1011,21 +1014,34 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
     return true;
 }
 
+static bool
+fixup_block(StgCompactNFDataBlock *block, FixupEntry *fixup_table,
+            uint32_t count)
+{
+    bdescr *bd;
+    StgPtr start;
+
+    bd = Bdescr((P_)block);
+    start = bd->start + sizeofW(StgCompactNFDataBlock);
+    return fixup_range(start, bd->free, start, fixup_table, count);
+}
+
 static int
 cmp_fixup_table_item (const void *e1, const void *e2)
 {
-    const StgWord *w1 = e1;
-    const StgWord *w2 = e2;
+    const FixupEntry *w1 = e1;
+    const FixupEntry *w2 = e2;
 
-    return *w1 - *w2;
+    return (w1->start > w2->start) - (w1->start < w2->start);
 }
 
-static StgWord *
+static FixupEntry *
 build_fixup_table (StgCompactNFDataBlock *block, uint32_t *pcount)
 {
     uint32_t count;
     StgCompactNFDataBlock *tmp;
-    StgWord *table;
+    FixupEntry *table;
+    bdescr *bd;
 
     count = 0;
     tmp = block;
@@ -1034,17 +1050,19 @@ build_fixup_table (StgCompactNFDataBlock *block, uint32_t *pcount)
         tmp = tmp->next;
     } while(tmp && tmp->owner);
 
-    table = stgMallocBytes(sizeof(StgWord) * 2 * count, "build_fixup_table");
+    table = stgMallocBytes(sizeof(FixupEntry) * count, "build_fixup_table");
 
     count = 0;
     do {
-        table[count * 2] = (W_)block->self;
-        table[count * 2 + 1] = (W_)block;
+        bd = Bdescr((P_)block);
+        table[count].start = (W_)block->self;
+        table[count].end = (W_)block->self + bd->blocks * BLOCK_SIZE;
+        table[count].delta = (W_)block - (W_)block->self;
         count++;
         block = block->next;
     } while(block && block->owner);
 
-    qsort(table, count, sizeof(StgWord) * 2, cmp_fixup_table_item);
+    qsort(table, count, sizeof(FixupEntry), cmp_fixup_table_item);
 
     *pcount = count;
     return table;
@@ -1053,7 +1071,7 @@ build_fixup_table (StgCompactNFDataBlock *block, uint32_t *pcount)
 static bool
 fixup_loop(StgCompactNFDataBlock *block, StgClosure **proot)
 {
-    StgWord *table;
+    FixupEntry *table;
     bool ok;
     uint32_t count;
 
@@ -1184,3 +1202,507 @@ compactFixupPointers(StgCompactNFData *str,
 
     return (StgPtr)root;
 }
+
+/* -----------------------------------------------------------------------------
+   Compact files
+   -------------------------------------------------------------------------- */
+
+/*
+  Note [Compact files]
+  ~~~~~~~~~~~~~~~~~~~~
+
+  compactWriteFile() saves a compact region to a file from which
+  compactMapFile() can map it straight into the heap, with no pointers to
+  adjust, and with pages read from the file only as they are touched.
+
+  To make that possible the file holds an image of the compact laid out for
+  a fixed range of the heap's address space, its base:
+
+  * The image is a sequence of megablock groups, each holding one compact
+    block at FIRST_BLOCK() of its first megablock, as the block allocator
+    would place it.  A group is one megablock unless the block it holds
+    has more data than fits in one (a large array, say), in which case
+    it has as many as that needs.  The bdescrs at the start of each group
+    are left as zeroes (holes, in a sparse file) for the reader to set up.
+
+  * The writer packs the used parts of the compact's blocks into these
+    megablocks, in order, and adjusts every pointer for where the closures
+    will be, using the same fixup table as importing a compact does.  The
+    StgCompactNFData is rebuilt for the image.
+
+  * The base is picked from the top half of the heap's reserved address
+    space (which the heap grows into from the bottom), at a place chosen
+    by hashing the file name, so that a program can map several files.
+
+  compactMapFile() claims the base's megablocks if they are free, maps the
+  file over them privately and copy-on-write, and sets up their bdescrs:
+  the compact then looks just like one that was imported at the right
+  address, and compactFixupPointers() only walks the block headers.  If the
+  megablocks are not free (or the RTS has no reserved address space) it
+  reads the image into newly allocated blocks instead, and
+  compactFixupPointers() adjusts the pointers as it does for any import.
+
+  As with serialized compacts, a file can only be read by the same binary
+  that wrote it, since closures refer to info tables by address.  The
+  header records the address of one info table to catch the common
+  mistakes, and the sizes of words and blocks.
+*/
+
+#if !defined(mingw32_HOST_OS)
+
+#define CNF_FILE_MAGIC "GHCCNF01"
+
+// Images are placed at a multiple of this in the heap's address space
+#define CNF_FILE_PLACEMENT (1024 * MBLOCK_SIZE)
+
+typedef struct {
+    char    magic[8];
+    StgWord word_size;
+    StgWord block_size;
+    StgWord mblock_size;
+    StgWord info;           // &stg_COMPACT_NFDATA_CLEAN_info in the writer
+    StgWord base;           // where the image must be mapped
+    StgWord n_mblocks;      // size of the image
+    StgWord n_groups;       // number of megablock groups in the image
+    StgWord image_offset;   // file offset of the image
+    StgWord root;           // the root closure, in the image
+    // followed by CompactFileGroup groups[n_groups]
+} CompactFileHeader;
+
+typedef struct {
+    StgWord mblocks;        // size of the group
+    StgWord used;           // bytes in use in its block (including the
+                            // StgCompactNFDataBlock)
+} CompactFileGroup;
+
+static StgWord
+compactFileBase (const char *path, StgCompactNFDataBlock *first,
+                 StgWord n_mblocks)
+{
+#if defined(USE_LARGE_ADDRESS_SPACE)
+    StgWord top, size, slots;
+    uint32_t h = 2166136261U;
+
+    top = mblock_address_space.begin +
+        (StgWord)MBLOCK_ROUND_DOWN((mblock_address_space.end -
+                                    mblock_address_space.begin) / 2);
+    size = n_mblocks * MBLOCK_SIZE;
+    if (size > mblock_address_space.end - top) {
+        return (StgWord)MBLOCK_ROUND_DOWN(mblock_address_space.end - size);
+    }
+
+    for (; *path; path++) {
+        h = (h ^ (StgWord8)*path) * 16777619U;
+    }
+    slots = (mblock_address_space.end - top - size) / CNF_FILE_PLACEMENT + 1;
+    return top + (h % slots) * CNF_FILE_PLACEMENT;
+#else
+    // The image can't be mapped anyway, but its base should look like a
+    // heap address to fixup_one_pointer()
+    (void)path;
+    (void)n_mblocks;
+    return (StgWord)MBLOCK_ROUND_DOWN(first);
+#endif
+}
+
+static bool
+writeFully (int fd, const void *buf, StgWord size, off_t offset)
+{
+    const StgWord8 *p = buf;
+    ssize_t r;
+
+    while (size > 0) {
+        r = pwrite(fd, p, size, offset);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) continue;
+            return false;
+        }
+        p += r;
+        size -= r;
+        offset += r;
+    }
+    return true;
+}
+
+static bool
+readFully (int fd, void *buf, StgWord size, off_t offset)
+{
+    StgWord8 *p = buf;
+    ssize_t r;
+
+    while (size > 0) {
+        r = pread(fd, p, size, offset);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) continue;
+            if (r == 0) errno = 0; // truncated: not an I/O error
+            return false;
+        }
+        p += r;
+        size -= r;
+        offset += r;
+    }
+    return true;
+}
+
+int
+compactWriteFile (StgCompactNFDataBlock *first, StgClosure *root,
+                  const char *path)
+{
+    StgCompactNFDataBlock *block, img_block;
+    StgCompactNFData *str, img_str;
+    CompactFileHeader hdr;
+    FixupEntry *table = NULL;
+    CompactFileGroup *groups = NULL;
+    uint32_t n_src, i, g;
+    StgWord cursor, limit, group_start, len, max_len, start, base, align;
+    StgWord totalW;
+    StgWord8 *buf = NULL;
+    int fd = -1, ret = -1;
+    bdescr *bd;
+
+    str = firstBlockGetCompact(first);
+
+    n_src = 0;
+    for (block = first; block; block = block->next) {
+        n_src++;
+    }
+    table = stgMallocBytes(sizeof(FixupEntry) * n_src, "compactWriteFile");
+    groups = stgMallocBytes(sizeof(CompactFileGroup) * n_src,
+                            "compactWriteFile");
+
+    // Lay out the image: the data of each block goes after the data of
+    // the previous one, in the same group if it fits, and otherwise at
+    // the start of a new group big enough for it.  The offsets are from
+    // the start of the image until we know the base.
+    g = 0;
+    group_start = 0;
+    cursor = FIRST_BLOCK_OFF + sizeof(StgCompactNFDataBlock)
+        + sizeof(StgCompactNFData);
+    limit = MBLOCK_SIZE;
+    max_len = 0;
+    for (block = first, i = 0; block; block = block->next, i++) {
+        bd = Bdescr((P_)block);
+        start = (StgWord)block + sizeof(StgCompactNFDataBlock);
+        if (block == first) {
+            start += sizeof(StgCompactNFData);
+        }
+        len = (StgWord)bd->free - start;
+        if (cursor + len > limit) {
+            groups[g].mblocks = (limit - group_start) / MBLOCK_SIZE;
+            groups[g].used = cursor - group_start - FIRST_BLOCK_OFF;
+            g++;
+            group_start = limit;
+            cursor = group_start + FIRST_BLOCK_OFF
+                + sizeof(StgCompactNFDataBlock);
+            limit = (StgWord)MBLOCK_ROUND_UP(cursor + len);
+        }
+        table[i].start = start;
+        table[i].end = start + len;
+        table[i].delta = cursor;   // made relative to start below
+        cursor += len;
+        max_len = stg_max(max_len, len);
+    }
+    groups[g].mblocks = (limit - group_start) / MBLOCK_SIZE;
+    groups[g].used = cursor - group_start - FIRST_BLOCK_OFF;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CNF_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.word_size = sizeof(StgWord);
+    hdr.block_size = BLOCK_SIZE;
+    hdr.mblock_size = MBLOCK_SIZE;
+    hdr.info = (StgWord)&stg_COMPACT_NFDATA_CLEAN_info;
+    hdr.n_mblocks = limit / MBLOCK_SIZE;
+    hdr.n_groups = g + 1;
+    // a multiple of any page size we are likely to run with
+    align = stg_max(getPageSize(), 65536);
+    hdr.image_offset = (sizeof(hdr) + hdr.n_groups * sizeof(CompactFileGroup)
+                        + align - 1) / align * align;
+    base = hdr.base = compactFileBase(path, first, hdr.n_mblocks);
+
+    for (i = 0; i < n_src; i++) {
+        table[i].delta = base + table[i].delta - table[i].start;
+    }
+
+    // Entries can only be out of order if the blocks are, but check
+    qsort(table, n_src, sizeof(FixupEntry), cmp_fixup_table_item);
+
+    hdr.root = (StgWord)root;
+    if (!fixup_one_pointer(table, n_src, (StgClosure**)&hdr.root)) {
+        errno = EINVAL;
+        goto out;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) goto out;
+    if (ftruncate(fd, hdr.image_offset + hdr.n_mblocks * MBLOCK_SIZE) != 0 ||
+        !writeFully(fd, &hdr, sizeof(hdr), 0) ||
+        !writeFully(fd, groups, hdr.n_groups * sizeof(CompactFileGroup),
+                    sizeof(hdr))) {
+        goto out;
+    }
+
+    // The block headers, and the rebuilt StgCompactNFData
+    img_str = *str;
+    totalW = 0;
+    group_start = 0;
+    for (g = 0; g < hdr.n_groups; g++) {
+        StgWord here = base + group_start + FIRST_BLOCK_OFF;
+
+        group_start += groups[g].mblocks * MBLOCK_SIZE;
+        img_block.self = (StgCompactNFDataBlock*)here;
+        img_block.owner = (StgCompactNFData*)
+            (base + FIRST_BLOCK_OFF + sizeof(StgCompactNFDataBlock));
+        img_block.next = g + 1 < hdr.n_groups ?
+            (StgCompactNFDataBlock*)(base + group_start + FIRST_BLOCK_OFF)
+            : NULL;
+        if (!writeFully(fd, &img_block, sizeof(img_block),
+                        hdr.image_offset + here - base)) {
+            goto out;
+        }
+        totalW += MBLOCK_GROUP_BLOCKS(groups[g].mblocks) * BLOCK_SIZE_W;
+        img_str.last = (StgCompactNFDataBlock*)here;
+    }
+
+    SET_INFO((StgClosure*)&img_str, &stg_COMPACT_NFDATA_CLEAN_info);
+    img_str.totalW = totalW;
+    img_str.nursery = img_str.last;
+    img_str.hp = (StgPtr)((StgWord)img_str.last
+                          + groups[hdr.n_groups - 1].used);
+    img_str.hpLim = (StgPtr)(base + hdr.n_mblocks * MBLOCK_SIZE);
+    img_str.hash = NULL;
+    img_str.result = NULL;
+    if (!writeFully(fd, &img_str, sizeof(img_str), hdr.image_offset +
+                    FIRST_BLOCK_OFF + sizeof(StgCompactNFDataBlock))) {
+        goto out;
+    }
+
+    // The closures, moved and adjusted
+    buf = stgMallocBytes(stg_max(max_len, sizeof(StgWord)),
+                         "compactWriteFile");
+    for (block = first, i = 0; block; block = block->next, i++) {
+        FixupEntry *e;
+
+        bd = Bdescr((P_)block);
+        start = (StgWord)block + sizeof(StgCompactNFDataBlock);
+        if (block == first) {
+            start += sizeof(StgCompactNFData);
+        }
+        len = (StgWord)bd->free - start;
+        if (len == 0) continue;
+
+        e = find_pointer(table, n_src, (StgClosure*)start);
+        ASSERT(e != NULL && e->start == start);
+        memcpy(buf, (void*)start, len);
+        if (!fixup_range((P_)buf, (P_)(buf + len), NULL, table, n_src)) {
+            errno = EINVAL;
+            goto out;
+        }
+        if (!writeFully(fd, buf, len,
+                        hdr.image_offset + start + e->delta - base)) {
+            goto out;
+        }
+    }
+
+    ret = 0;
+
+ out:
+    if (fd >= 0) {
+        int saved = errno;
+        if (close(fd) != 0 && ret == 0) {
+            ret = -1;
+        } else {
+            errno = saved;
+        }
+    }
+    if (buf) stgFree(buf);
+    stgFree(groups);
+    stgFree(table);
+    return ret;
+}
+
+#if defined(USE_LARGE_ADDRESS_SPACE)
+static StgCompactNFDataBlock *
+mapCompactImage (int fd, CompactFileHeader *hdr, CompactFileGroup *groups)
+{
+    StgWord8 *base = (StgWord8*)hdr->base;
+    StgWord size = hdr->n_mblocks * MBLOCK_SIZE;
+    StgCompactNFDataBlock *first = NULL;
+    bdescr *bd;
+    StgWord g, m;
+
+    if (hdr->image_offset % getPageSize() != 0) {
+        return NULL;
+    }
+
+    ACQUIRE_SM_LOCK;
+    if (claimMBlocksAt(base, hdr->n_mblocks) == NULL) {
+        RELEASE_SM_LOCK;
+        return NULL;
+    }
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             fd, hdr->image_offset) == MAP_FAILED) {
+        freeMBlocks(base, hdr->n_mblocks);
+        RELEASE_SM_LOCK;
+        return NULL;
+    }
+
+    // Account for the blocks as compactAllocateBlock() does
+    for (g = 0, m = 0; g < hdr->n_groups; m += groups[g].mblocks, g++) {
+        bd = allocMBlockGroupAt(base + m * MBLOCK_SIZE, groups[g].mblocks);
+        // Only the first megablock of a group has bdescrs: the rest of it
+        // is closures already.
+        initCompactBlockGroup(bd, stg_min(bd->blocks, BLOCKS_PER_MBLOCK), g0);
+        bd->free = (StgPtr)((StgWord)bd->start + groups[g].used);
+        if (first == NULL) {
+            first = (StgCompactNFDataBlock*)bd->start;
+            dbl_link_onto(bd, &g0->compact_blocks_in_import);
+        }
+        g0->n_compact_blocks_in_import += bd->blocks;
+        g0->n_new_large_words += bd->blocks * BLOCK_SIZE_W;
+    }
+    RELEASE_SM_LOCK;
+
+    IF_DEBUG(compact, debugBelch("Mapped compact file at %p\n", base));
+    return first;
+}
+#endif
+
+static StgCompactNFDataBlock *
+readCompactImage (int fd, CompactFileHeader *hdr, CompactFileGroup *groups)
+{
+    StgCompactNFDataBlock **blocks, *prev = NULL, *first;
+    StgWord g, m, n;
+    bdescr *bd;
+
+    blocks = stgMallocBytes(sizeof(StgCompactNFDataBlock*) * hdr->n_groups,
+                            "readCompactImage");
+
+    for (g = 0, m = 0; g < hdr->n_groups; m += groups[g].mblocks, g++) {
+        blocks[g] = compactAllocateBlock(NULL, groups[g].used, prev);
+        if (!readFully(fd, blocks[g], groups[g].used, hdr->image_offset
+                       + m * MBLOCK_SIZE + FIRST_BLOCK_OFF)) {
+            goto fail;
+        }
+        prev = blocks[g];
+    }
+
+    first = blocks[0];
+    stgFree(blocks);
+    return first;
+
+ fail:
+    // Nobody has seen these blocks yet, so give them back
+    ACQUIRE_SM_LOCK;
+    for (n = 0; n <= g; n++) {
+        bd = Bdescr((P_)blocks[n]);
+        if (n == 0) {
+            dbl_link_remove(bd, &g0->compact_blocks_in_import);
+        }
+        g0->n_compact_blocks_in_import -= bd->blocks;
+        freeGroup(bd);
+    }
+    RELEASE_SM_LOCK;
+    stgFree(blocks);
+    return NULL;
+}
+
+StgCompactNFDataBlock *
+compactMapFile (const char *path, StgClosure **root)
+{
+    StgCompactNFDataBlock *first = NULL;
+    CompactFileHeader hdr;
+    CompactFileGroup *groups = NULL;
+    StgWord g, total;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (!readFully(fd, &hdr, sizeof(hdr), 0)) {
+        goto out;
+    }
+    // A file from another program (or another RTS) is not an I/O error,
+    // so errno is 0 when we reject it.
+    errno = 0;
+    if (memcmp(hdr.magic, CNF_FILE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.word_size != sizeof(StgWord) ||
+        hdr.block_size != BLOCK_SIZE ||
+        hdr.mblock_size != MBLOCK_SIZE ||
+        hdr.info != (StgWord)&stg_COMPACT_NFDATA_CLEAN_info ||
+        hdr.n_groups == 0 ||
+        hdr.n_groups > hdr.n_mblocks ||
+        hdr.n_mblocks > HS_INT32_MAX ||
+        (hdr.base & MBLOCK_MASK) != 0) {
+        IF_DEBUG(compact, debugBelch("%s is not a compact file "
+                                     "written by this program\n", path));
+        goto out;
+    }
+
+    groups = stgMallocBytes(sizeof(CompactFileGroup) * hdr.n_groups,
+                            "compactMapFile");
+    if (!readFully(fd, groups, sizeof(CompactFileGroup) * hdr.n_groups,
+                   sizeof(hdr))) {
+        goto out;
+    }
+    errno = 0;
+    total = 0;
+    for (g = 0; g < hdr.n_groups; g++) {
+        if (groups[g].mblocks == 0 ||
+            groups[g].mblocks > hdr.n_mblocks - total ||
+            groups[g].used < sizeof(StgCompactNFDataBlock) +
+                             (g == 0 ? sizeof(StgCompactNFData) : 0) ||
+            groups[g].used >
+                MBLOCK_GROUP_BLOCKS(groups[g].mblocks) * BLOCK_SIZE) {
+            goto out;
+        }
+        total += groups[g].mblocks;
+    }
+    if (total != hdr.n_mblocks) {
+        goto out;
+    }
+
+#if defined(USE_LARGE_ADDRESS_SPACE)
+    first = mapCompactImage(fd, &hdr, groups);
+#endif
+    if (first == NULL) {
+        IF_DEBUG(compact, debugBelch("Can't map compact file %s at %p, "
+                                     "reading it\n", path, (void*)hdr.base));
+        first = readCompactImage(fd, &hdr, groups);
+    }
+    if (first != NULL) {
+        *root = (StgClosure*)hdr.root;
+    }
+
+ out:
+    if (groups) stgFree(groups);
+    if (first != NULL) {
+        close(fd);  // the mapping keeps the file open
+    } else {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+    }
+    return first;
+}
+
+#else /* mingw32_HOST_OS */
+
+int
+compactWriteFile (StgCompactNFDataBlock *first STG_UNUSED,
+                  StgClosure *root STG_UNUSED,
+                  const char *path STG_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+StgCompactNFDataBlock *
+compactMapFile (const char *path STG_UNUSED, StgClosure **root STG_UNUSED)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+#endif /* mingw32_HOST_OS */
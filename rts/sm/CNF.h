@@ -24,6 +24,13 @@ void              compactResize(Capability       *cap,
                                 StgCompactNFData *str,
                                 StgWord           new_size);
 void              compactFree  (StgCompactNFData *str);
+StgCompactNFDataBlock *compactAppendBlock(Capability       *cap,
+                                          StgCompactNFData *str,
+                                          StgWord           aligned_size);
+StgWord           compactAddParallel(Capability       *cap,
+                                     StgCompactNFData *str,
+                                     StgClosure       *p,
+                                     StgWord           sharing);
 void              compactMarkKnown(StgCompactNFData *str);
 StgWord           compactContains(StgCompactNFData *str,
                                   StgPtr            what);
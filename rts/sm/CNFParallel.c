@@ -0,0 +1,730 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2019
+ *
+ * Copying evaluated data into a compact region on several threads
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+#include "RtsUtils.h"
+
+#include "Capability.h"
+#include "Schedule.h"
+#include "Storage.h"
+#include "CNF.h"
+#include "Hash.h"
+#include "Trace.h"
+#include "sm/ShouldCompact.h"
+
+#include <string.h>
+
+/*
+   Note [Parallel compaction]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~
+   compactAdd# and compactAddWithSharing# normally copy in Cmm
+   (stg_compactAddWorkerzh), one object at a time, evaluating thunks as
+   they go.  With --compact-threads, compactAddParallel() first tries to
+   do the copy in C on several OS threads:
+
+   * Copying is a traversal of the source graph.  Each worker keeps a
+     stack of tasks, each a source pointer and the field of the copy that
+     should point to it.  Idle workers take tasks from a shared queue,
+     which busy workers fill from the bottom of their stacks (the oldest,
+     and usually the largest, subtrees).  The other workers are only
+     started once the calling thread has copied COMPACT_PAR_START objects,
+     so small additions never pay for them.
+
+   * Each worker allocates from its own compact block.  The calling thread
+     starts in the compact's nursery; the other workers append blocks of
+     the usual size to the chain, under the lock.  When the copy is done
+     each block's free pointer is set from its worker's.
+
+   * For compactAddWithSharing#, the compact's hash is replaced by
+     COMPACT_PAR_STRIPES ordinary hash tables, each with its own lock.  A
+     worker allocates the copy of an object while holding the lock of its
+     stripe, so that an object is copied exactly once, and the address of
+     the copy can be given to other workers before its fields are filled.
+     With --compact-forwarding there are no tables at all: see
+     Note [Compaction with forwarding pointers].
+
+   Evaluating a thunk means running Haskell code, which the workers
+   cannot do, so they give up as soon as they see one (or anything that
+   the Cmm code would raise an exception for).  The remaining tasks are
+   then drained without copying, storing a static closure in each field
+   so that the compact stays well-formed, and compactAddParallel()
+   returns false: the caller runs the Cmm code from the beginning, and
+   the copies already made are wasted space in the compact.  A structure
+   that was fully evaluated before it is added (by deepseq, say) is always
+   copied in parallel.
+
+   No GC can happen while we copy: the calling thread keeps its
+   Capability, so a GC waits for us.  Evaluated closures do not change
+   under our feet, and thunks that another Capability updates meanwhile
+   are either followed (if the update is visible) or make us give up.
+
+   Note [Compaction with forwarding pointers]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   A hash table from source addresses to copies takes several words per
+   object copied, often more than the copies themselves.  With
+   --compact-forwarding, compactAddWithSharing# instead overwrites the info
+   pointer of each object it copies with a forwarding pointer to the copy,
+   as the GC does (the copy holds the original info pointer), and each
+   worker logs the objects it has forwarded: one word per object, freed
+   as soon as the copy is done, when unforward() puts the info pointers
+   back.
+
+   No Haskell code may see a forwarded object, so we first stop every
+   other Capability with tryStopAllCapabilities().  We must not yield our
+   own Capability (a GC would move the objects that the Cmm caller holds),
+   so if some other sync, such as a GC, is already under way we fall back
+   to the Cmm code and its hash table.  Because the workers never run
+   Haskell code and we keep our Capability, no GC can see a forwarded
+   object either.
+
+   A worker reads an object's info pointer once, and follows it if it is
+   a forwarding pointer.  Objects are forwarded under the stripe lock, as
+   objects are entered in the tables of the hashing mode, so each is
+   copied once; the copy is made before the forwarding pointer is
+   written, since the copy is where the info pointer is kept.
+*/
+
+#if defined(THREADED_RTS)
+
+// Objects the calling thread copies on its own before starting the others
+#define COMPACT_PAR_START 4096
+
+// Tasks taken from the shared queue at once
+#define COMPACT_PAR_CHUNK 64
+
+#define COMPACT_PAR_STRIPES 64
+
+// What the fields of an abandoned copy point to
+#define COMPACT_PAR_HOLE ((StgClosure *)&stg_END_TSO_QUEUE_closure)
+
+typedef struct {
+    StgClosure *p;     // the object to copy (tagged)
+    StgClosure **pp;   // where to store the address of the copy
+} CompactTask;
+
+typedef struct {
+    Mutex lock;
+    HashTable *table;
+} CompactStripe;
+
+struct CompactCopy_;
+
+typedef struct {
+    struct CompactCopy_ *cc;
+    CompactTask *stack;
+    uint32_t n, size;
+    bdescr *bd;          // the block we're allocating from, or NULL
+    StgPtr hp, hpLim;
+    StgWord copied;      // objects copied
+    StgClosure **forwarded;  // objects we have forwarded
+    uint32_t n_forwarded, size_forwarded;
+} CompactWorker;
+
+typedef struct CompactCopy_ {
+    Capability *cap;
+    StgCompactNFData *str;
+    CompactStripe *stripes;          // NULL if not sharing
+    bool forwarding;                 // share by forwarding, not hashing
+    volatile StgWord aborted;
+
+    CompactWorker *workers;
+    uint32_t max_workers;
+    volatile uint32_t n_workers;     // workers started, including us
+
+    Mutex lock;                      // protects the fields below and
+                                     // the compact's chain of blocks
+    Condition work;
+    Condition finished;
+    CompactTask *queue;
+    uint32_t n_queue, size_queue;
+    volatile uint32_t idle;          // workers waiting for tasks
+    uint32_t running;                // other workers not yet finished
+    bool started;                    // other workers have been started
+    bool done;
+} CompactCopy;
+
+static uint32_t
+compactThreads (void)
+{
+    uint32_t threads = RtsFlags.MiscFlags.compactThreads;
+
+    if (threads == 0) {
+        threads = getNumberOfProcessors();
+    }
+    return threads;
+}
+
+static void
+pushTask (CompactTask **tasks, uint32_t *n, uint32_t *size,
+          StgClosure *p, StgClosure **pp)
+{
+    if (*n == *size) {
+        *size *= 2;
+        *tasks = stgReallocBytes(*tasks, *size * sizeof(CompactTask),
+                                 "pushTask");
+    }
+    (*tasks)[*n].p = p;
+    (*tasks)[*n].pp = pp;
+    (*n)++;
+}
+
+STATIC_INLINE void
+pushWork (CompactWorker *w, StgClosure *p, StgClosure **pp)
+{
+    pushTask(&w->stack, &w->n, &w->size, p, pp);
+}
+
+static void
+logForwarded (CompactWorker *w, StgClosure *p)
+{
+    if (w->n_forwarded == w->size_forwarded) {
+        w->size_forwarded *= 2;
+        w->forwarded = stgReallocBytes(w->forwarded,
+                                       w->size_forwarded * sizeof(StgClosure *),
+                                       "logForwarded");
+    }
+    w->forwarded[w->n_forwarded++] = p;
+}
+
+// Put back the info pointers of the objects a worker forwarded
+static void
+unforward (CompactWorker *w)
+{
+    StgClosure *p, *copy;
+    uint32_t i;
+
+    for (i = 0; i < w->n_forwarded; i++) {
+        p = w->forwarded[i];
+        copy = (StgClosure *)UN_FORWARDING_PTR(p->header.info);
+        p->header.info = copy->header.info;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Allocation
+   -------------------------------------------------------------------------- */
+
+static StgPtr
+allocateSlow (CompactWorker *w, StgWord sizeW)
+{
+    CompactCopy *cc = w->cc;
+    StgCompactNFData *str = cc->str;
+    StgCompactNFDataBlock *block;
+    bdescr *bd;
+    StgPtr to;
+
+    ACQUIRE_LOCK(&cc->lock);
+
+    // Large objects get a block of their own, as in allocateForCompact()
+    if (sizeW > LARGE_OBJECT_THRESHOLD/sizeof(W_)) {
+        block = compactAppendBlock(cc->cap, str,
+                                   BLOCK_ROUND_UP(sizeW * sizeof(W_) +
+                                       sizeof(StgCompactNFDataBlock)));
+        bd = Bdescr((P_)block);
+        to = bd->free;
+        bd->free += sizeW;
+        RELEASE_LOCK(&cc->lock);
+        return to;
+    }
+
+    if (w->bd != NULL) {
+        w->bd->free = w->hp;
+    }
+    block = compactAppendBlock(cc->cap, str, str->autoBlockW * sizeof(W_));
+    bd = Bdescr((P_)block);
+    w->bd = bd;
+    w->hp = bd->free;
+    w->hpLim = bd->start + bd->blocks * BLOCK_SIZE_W;
+    RELEASE_LOCK(&cc->lock);
+
+    to = w->hp;
+    w->hp += sizeW;
+    return to;
+}
+
+STATIC_INLINE StgPtr
+allocateCopy (CompactWorker *w, StgWord sizeW)
+{
+    StgPtr to;
+
+    if (w->hp + sizeW <= w->hpLim) {
+        to = w->hp;
+        w->hp += sizeW;
+        return to;
+    }
+    return allocateSlow(w, sizeW);
+}
+
+// Allocate space for the copy of p, and copy it.  When sharing, returns
+// false and sets *to to the existing copy if some worker has already
+// claimed p.
+static bool
+claimCopy (CompactWorker *w, StgClosure *p, StgWord sizeW, StgPtr *to)
+{
+    CompactCopy *cc = w->cc;
+    CompactStripe *stripe;
+    const StgInfoTable *info;
+    StgPtr shared;
+
+    if (cc->stripes == NULL) {
+        *to = allocateCopy(w, sizeW);
+        memcpy(*to, p, sizeW * sizeof(W_));
+        return true;
+    }
+
+    stripe = &cc->stripes[((StgWord)p >> 4) % COMPACT_PAR_STRIPES];
+    ACQUIRE_LOCK(&stripe->lock);
+
+    if (cc->forwarding) {
+        info = p->header.info;
+        if (IS_FORWARDING_PTR(info)) {
+            RELEASE_LOCK(&stripe->lock);
+            *to = (StgPtr)UN_FORWARDING_PTR(info);
+            return false;
+        }
+        *to = allocateCopy(w, sizeW);
+        memcpy(*to, p, sizeW * sizeof(W_));
+        write_barrier();
+        p->header.info = (const StgInfoTable *)MK_FORWARDING_PTR(*to);
+        RELEASE_LOCK(&stripe->lock);
+        logForwarded(w, p);
+        return true;
+    }
+
+    shared = lookupHashTable(stripe->table, (StgWord)p);
+    if (shared != NULL) {
+        RELEASE_LOCK(&stripe->lock);
+        *to = shared;
+        return false;
+    }
+    *to = allocateCopy(w, sizeW);
+    insertHashTable(stripe->table, (StgWord)p, *to);
+    RELEASE_LOCK(&stripe->lock);
+    memcpy(*to, p, sizeW * sizeof(W_));
+    return true;
+}
+
+/* -----------------------------------------------------------------------------
+   Copying
+   -------------------------------------------------------------------------- */
+
+// Copy the object that p points to, and push a task for each of its
+// pointer fields.  Returns false if the object can't be copied here.
+static bool
+copyOne (CompactWorker *w, StgClosure *p, StgClosure **pp)
+{
+    StgCompactNFData *str = w->cc->str;
+    const StgInfoTable *info;
+    StgWord info_ptr;
+    StgClosure *q;
+    StgWord tag, sizeW, should, i;
+    StgPtr to;
+
+eval:
+    tag = GET_CLOSURE_TAG(p);
+    q = UNTAG_CLOSURE(p);
+
+    // Read the info pointer only once: another worker may be about to
+    // forward the object (see Note [Compaction with forwarding pointers])
+    info_ptr = (StgWord)((volatile StgClosure *)q)->header.info;
+    if (IS_FORWARDING_PTR(info_ptr)) {
+        *pp = TAG_CLOSURE(tag, (StgClosure *)UN_FORWARDING_PTR(info_ptr));
+        return true;
+    }
+    info = INFO_PTR_TO_STRUCT((const StgInfoTable *)info_ptr);
+
+    switch (info->type) {
+
+    case IND:
+    case IND_STATIC:
+        p = ((StgInd *)q)->indirectee;
+        goto eval;
+
+    case BLACKHOLE:
+    {
+        // An updated thunk points to its value; one under evaluation
+        // points to the TSO evaluating it, or to a blocking queue.
+        StgClosure *r = ((StgInd *)q)->indirectee;
+        if (GET_CLOSURE_TAG(r) == 0) {
+            const StgInfoTable *i = r->header.info;
+            if (i == &stg_TSO_info
+                || i == &stg_WHITEHOLE_info
+                || i == &stg_BLOCKING_QUEUE_CLEAN_info
+                || i == &stg_BLOCKING_QUEUE_DIRTY_info) {
+                return false;
+            }
+        }
+        p = r;
+        goto eval;
+    }
+
+    case ARR_WORDS:
+        should = shouldCompact(str, q);
+        if (should == SHOULDCOMPACT_IN_CNF) { *pp = p; return true; }
+        if (should == SHOULDCOMPACT_PINNED) { return false; }
+
+        sizeW = arr_words_sizeW((StgArrBytes *)q);
+        if (claimCopy(w, q, sizeW, &to)) {
+            w->copied++;
+        }
+        *pp = (StgClosure *)to;
+        return true;
+
+    case MUT_ARR_PTRS_FROZEN_CLEAN:
+    case MUT_ARR_PTRS_FROZEN_DIRTY:
+    {
+        StgMutArrPtrs *arr = (StgMutArrPtrs *)q, *copy;
+
+        should = shouldCompact(str, q);
+        if (should == SHOULDCOMPACT_IN_CNF) { *pp = p; return true; }
+
+        sizeW = mut_arr_ptrs_sizeW(arr);
+        if (claimCopy(w, q, sizeW, &to)) {
+            copy = (StgMutArrPtrs *)to;
+            for (i = 0; i < arr->ptrs; i++) {
+                pushWork(w, arr->payload[i], &copy->payload[i]);
+            }
+            w->copied++;
+        }
+        *pp = TAG_CLOSURE(tag, (StgClosure *)to);
+        return true;
+    }
+
+    case SMALL_MUT_ARR_PTRS_FROZEN_CLEAN:
+    case SMALL_MUT_ARR_PTRS_FROZEN_DIRTY:
+    {
+        StgSmallMutArrPtrs *arr = (StgSmallMutArrPtrs *)q, *copy;
+
+        should = shouldCompact(str, q);
+        if (should == SHOULDCOMPACT_IN_CNF) { *pp = p; return true; }
+
+        sizeW = small_mut_arr_ptrs_sizeW(arr);
+        if (claimCopy(w, q, sizeW, &to)) {
+            copy = (StgSmallMutArrPtrs *)to;
+            for (i = 0; i < arr->ptrs; i++) {
+                pushWork(w, arr->payload[i], &copy->payload[i]);
+            }
+            w->copied++;
+        }
+        *pp = TAG_CLOSURE(tag, (StgClosure *)to);
+        return true;
+    }
+
+    case CONSTR_0_1:
+    case CONSTR_0_2:
+    case CONSTR_NOCAF:
+        should = shouldCompact(str, q);
+        if (should == SHOULDCOMPACT_IN_CNF ||
+            should == SHOULDCOMPACT_STATIC) { *pp = p; return true; }
+        goto constructor;
+
+    case CONSTR:
+    case CONSTR_1_0:
+    case CONSTR_2_0:
+    case CONSTR_1_1:
+        should = shouldCompact(str, q);
+        if (should == SHOULDCOMPACT_IN_CNF) { *pp = p; return true; }
+
+    constructor:
+    {
+        StgClosure *copy;
+
+        sizeW = sizeofW(StgHeader) + info->layout.payload.ptrs
+            + info->layout.payload.nptrs;
+        if (claimCopy(w, q, sizeW, &to)) {
+            copy = (StgClosure *)to;
+            // Push the fields in reverse, so that the first is copied
+            // first, as the Cmm code does.
+            for (i = info->layout.payload.ptrs; i > 0; i--) {
+                pushWork(w, q->payload[i-1], &copy->payload[i-1]);
+            }
+            w->copied++;
+        }
+        *pp = TAG_CLOSURE(tag, (StgClosure *)to);
+        return true;
+    }
+
+    default:
+        // Thunks need evaluating, and the Cmm code raises an exception
+        // for functions and mutable objects.
+        return false;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Sharing out the work
+   -------------------------------------------------------------------------- */
+
+// Move the bottom half of our stack to the shared queue.
+static void
+shareWork (CompactWorker *w)
+{
+    CompactCopy *cc = w->cc;
+    uint32_t n = w->n / 2, i;
+
+    ACQUIRE_LOCK(&cc->lock);
+    for (i = 0; i < n; i++) {
+        pushTask(&cc->queue, &cc->n_queue, &cc->size_queue,
+                 w->stack[i].p, w->stack[i].pp);
+    }
+    broadcastCondition(&cc->work);
+    RELEASE_LOCK(&cc->lock);
+
+    memmove(w->stack, w->stack + n, (w->n - n) * sizeof(CompactTask));
+    w->n -= n;
+}
+
+// Take some tasks from the shared queue, waiting for them if necessary.
+// Returns false when every worker is idle, so the copy is finished.
+static bool
+getWork (CompactWorker *w)
+{
+    CompactCopy *cc = w->cc;
+    uint32_t n;
+
+    ACQUIRE_LOCK(&cc->lock);
+    while (cc->n_queue == 0 && !cc->done) {
+        cc->idle++;
+        if (cc->idle == cc->n_workers) {
+            cc->done = true;
+            broadcastCondition(&cc->work);
+        } else {
+            waitCondition(&cc->work, &cc->lock);
+        }
+        cc->idle--;
+    }
+    if (cc->n_queue == 0) {
+        RELEASE_LOCK(&cc->lock);
+        return false;
+    }
+    n = stg_min(cc->n_queue, COMPACT_PAR_CHUNK);
+    for (; n > 0; n--) {
+        cc->n_queue--;
+        pushWork(w, cc->queue[cc->n_queue].p, cc->queue[cc->n_queue].pp);
+    }
+    RELEASE_LOCK(&cc->lock);
+    return true;
+}
+
+static void initWorker (CompactCopy *cc, CompactWorker *w);
+static void *compactWorker (void *arg);
+
+static void
+startWorkers (CompactCopy *cc)
+{
+    uint32_t i;
+
+    for (i = 1; i < cc->max_workers; i++) {
+        OSThreadId tid;
+
+        initWorker(cc, &cc->workers[i]);
+        ACQUIRE_LOCK(&cc->lock);
+        cc->n_workers++;
+        cc->running++;
+        RELEASE_LOCK(&cc->lock);
+        if (createOSThread(&tid, (char *)"ghc_compact", compactWorker,
+                           &cc->workers[i]) != 0) {
+            // carry on with the threads we have
+            ACQUIRE_LOCK(&cc->lock);
+            cc->n_workers--;
+            cc->running--;
+            RELEASE_LOCK(&cc->lock);
+            stgFree(cc->workers[i].stack);
+            stgFree(cc->workers[i].forwarded);
+            break;
+        }
+    }
+}
+
+static void
+runWorker (CompactWorker *w)
+{
+    CompactCopy *cc = w->cc;
+    CompactTask t;
+
+    do {
+        while (w->n > 0) {
+            t = w->stack[--w->n];
+            if (cc->aborted) {
+                *t.pp = COMPACT_PAR_HOLE;
+                continue;
+            }
+            if (!copyOne(w, t.p, t.pp)) {
+                *t.pp = COMPACT_PAR_HOLE;
+                cc->aborted = 1;
+                continue;
+            }
+            if (!cc->started) {
+                if (w->copied >= COMPACT_PAR_START && w->n > 1) {
+                    cc->started = true;
+                    startWorkers(cc);
+                }
+            } else if (cc->idle > 0 && w->n > 1) {
+                shareWork(w);
+            }
+        }
+    } while (getWork(w));
+}
+
+static void
+initWorker (CompactCopy *cc, CompactWorker *w)
+{
+    w->cc = cc;
+    w->size = 64;
+    w->n = 0;
+    w->stack = stgMallocBytes(w->size * sizeof(CompactTask), "initWorker");
+    w->bd = NULL;
+    w->hp = NULL;
+    w->hpLim = NULL;
+    w->copied = 0;
+    w->size_forwarded = 64;
+    w->n_forwarded = 0;
+    w->forwarded = stgMallocBytes(w->size_forwarded * sizeof(StgClosure *),
+                                  "initWorker");
+}
+
+static void *
+compactWorker (void *arg)
+{
+    CompactWorker *w = arg;
+    CompactCopy *cc = w->cc;
+
+    runWorker(w);
+
+    ACQUIRE_LOCK(&cc->lock);
+    if (w->bd != NULL) {
+        w->bd->free = w->hp;
+    }
+    if (--cc->running == 0) {
+        signalCondition(&cc->finished);
+    }
+    RELEASE_LOCK(&cc->lock);
+    return NULL;
+}
+
+#endif /* THREADED_RTS */
+
+/* Copy p into the compact on up to --compact-threads threads, storing the
+ * address of the copy in str->result.  See Note [Parallel compaction].
+ *
+ * Returns: true if the copy is done, false if the caller must do it. */
+StgWord
+compactAddParallel (Capability *cap USED_IF_THREADS,
+                    StgCompactNFData *str USED_IF_THREADS,
+                    StgClosure *p USED_IF_THREADS,
+                    StgWord sharing USED_IF_THREADS)
+{
+#if defined(THREADED_RTS)
+    CompactCopy cc;
+    CompactWorker *w;
+    bdescr *nursery;
+    Task *task = NULL;
+    uint32_t i;
+
+    cc.forwarding = sharing && RtsFlags.MiscFlags.compactForwarding;
+    if (!cc.forwarding && compactThreads() <= 1) {
+        return false;
+    }
+
+    // See Note [Compaction with forwarding pointers]
+    if (cc.forwarding) {
+        task = myTask();
+        if (!tryStopAllCapabilities(cap, task)) {
+            return false;
+        }
+    }
+
+    cc.cap = cap;
+    cc.str = str;
+    cc.aborted = 0;
+    cc.max_workers = compactThreads();
+    cc.workers = stgMallocBytes(cc.max_workers * sizeof(CompactWorker),
+                                "compactAddParallel");
+    cc.n_workers = 1;
+    initMutex(&cc.lock);
+    initCondition(&cc.work);
+    initCondition(&cc.finished);
+    cc.size_queue = 64;
+    cc.n_queue = 0;
+    cc.queue = stgMallocBytes(cc.size_queue * sizeof(CompactTask),
+                              "compactAddParallel");
+    cc.idle = 0;
+    cc.running = 0;
+    cc.started = cc.max_workers <= 1;
+    cc.done = false;
+
+    if (sharing) {
+        cc.stripes = stgMallocBytes(COMPACT_PAR_STRIPES * sizeof(CompactStripe),
+                                    "compactAddParallel");
+        for (i = 0; i < COMPACT_PAR_STRIPES; i++) {
+            initMutex(&cc.stripes[i].lock);
+            cc.stripes[i].table = cc.forwarding ? NULL : allocHashTable();
+        }
+    } else {
+        cc.stripes = NULL;
+    }
+
+    // We copy into the nursery, the others into blocks of their own
+    nursery = Bdescr((P_)str->nursery);
+    w = &cc.workers[0];
+    initWorker(&cc, w);
+    w->bd = nursery;
+    w->hp = str->hp;
+    w->hpLim = str->hpLim;
+
+    pushWork(w, p, &str->result);
+    runWorker(w);
+
+    ACQUIRE_LOCK(&cc.lock);
+    while (cc.running > 0) {
+        waitCondition(&cc.finished, &cc.lock);
+    }
+    RELEASE_LOCK(&cc.lock);
+
+    // Carry on allocating where we stopped
+    if (w->bd != nursery) {
+        w->bd->free = w->hp;
+        str->nursery = (StgCompactNFDataBlock *)w->bd->start;
+        str->hpLim = w->bd->start + w->bd->blocks * BLOCK_SIZE_W;
+    }
+    str->hp = w->hp;
+
+    debugTrace(DEBUG_compact,
+               "compactAddParallel: %d threads, %s%s",
+               cc.n_workers, cc.aborted ? "gave up" : "done",
+               cc.forwarding ? ", forwarding" : "");
+
+    for (i = 0; i < cc.n_workers; i++) {
+        unforward(&cc.workers[i]);
+        stgFree(cc.workers[i].stack);
+        stgFree(cc.workers[i].forwarded);
+    }
+    if (cc.forwarding) {
+        resumeAllCapabilities(cap, task);
+    }
+    stgFree(cc.workers);
+    stgFree(cc.queue);
+    if (cc.stripes != NULL) {
+        for (i = 0; i < COMPACT_PAR_STRIPES; i++) {
+            if (cc.stripes[i].table != NULL) {
+                freeHashTable(cc.stripes[i].table, NULL);
+            }
+            closeMutex(&cc.stripes[i].lock);
+        }
+        stgFree(cc.stripes);
+    }
+    closeCondition(&cc.finished);
+    closeCondition(&cc.work);
+    closeMutex(&cc.lock);
+
+    return !cc.aborted;
+#else
+    return false;
+#endif
+}
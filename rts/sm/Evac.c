@@ -27,6 +27,7 @@
 #include "LdvProfile.h"
 #include "CNF.h"
 #include "Scav.h"
+#include "MarkWeak.h"
 
 #if defined(THREADED_RTS) && !defined(PARALLEL_GC)
 #define evacuate(p) evacuate1(p)
@@ -39,6 +40,22 @@
         copy_tag(p, info, src, size, stp, tag)
 #endif
 
+/* Note that we are about to copy an object out of a block holding the
+ * keys of weak pointers that might be dead, so that traverseWeakPtrList()
+ * looks at them again: see Note [Weak key index] in MarkWeak.c.  Such
+ * blocks never have any of the other flags that evacuate() checks for,
+ * so we return true to carry on and copy the object.
+ */
+STATIC_INLINE bool
+weak_key_block (bdescr *bd)
+{
+    if (bd->flags & BF_WEAK_KEYS) {
+        touchWeakKeyBlock(bd);
+        return true;
+    }
+    return false;
+}
+
 /* Used to avoid long recursion due to selector thunks
  */
 #define MAX_THUNK_SELECTOR_DEPTH 16
@@ -563,7 +580,9 @@ loop:
 
   bd = Bdescr((P_)q);
 
-  if ((bd->flags & (BF_LARGE | BF_MARKED | BF_EVACUATED | BF_COMPACT)) != 0) {
+  if ((bd->flags & (BF_LARGE | BF_MARKED | BF_EVACUATED | BF_COMPACT
+                    | BF_WEAK_KEYS)) != 0
+      && !weak_key_block(bd)) {
       // pointer into to-space: just return it.  It might be a pointer
       // into a generation that we aren't collecting (> N), or it
       // might just be a pointer into to-space.  The latter doesn't
@@ -915,6 +934,9 @@ evacuate_BLACKHOLE(StgClosure **p)
         }
         return;
     }
+    if (bd->flags & BF_WEAK_KEYS) {
+        weak_key_block(bd);
+    }
     gen_no = bd->dest_no;
     info = q->header.info;
     if (IS_FORWARDING_PTR(info))
@@ -0,0 +1,302 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2019
+ *
+ * Executable memory for adjustors, allocated in slabs of fixed-size stubs
+ *
+ * ---------------------------------------------------------------------------*/
+
+// This is non-posix compliant: mmap() with MAP_ANON, and memfd_create().
+// #include "PosixSource.h"
+
+#include "Rts.h"
+
+#include "RtsUtils.h"
+#include "Capability.h"
+#include "Task.h"
+#include "sm/OSMem.h"
+#include "sm/ExecSlab.h"
+#include "Trace.h"
+
+#if defined(USE_EXEC_SLABS)
+
+#if defined(HAVE_UNISTD_H)
+#include <unistd.h>
+#endif
+#include <sys/mman.h>
+#if defined(linux_HOST_OS)
+#include <sys/syscall.h>
+#endif
+
+/*
+   Note [Adjustor slabs]
+   ~~~~~~~~~~~~~~~~~~~~~
+   Adjustors (see Adjustor.c) are small: a few dozen bytes of code and
+   data each.  Rather than going to libffi or the block allocator for each
+   one, allocateExec() takes stubs of up to EXEC_SLAB_MAX_SIZE bytes from
+   slabs: pages carved into slots of one of EXEC_SLAB_CLASSES sizes.
+
+   * Where we can (Linux, through a memfd) each slab is mapped twice:
+     writable at one address and executable at another, so no page is
+     ever writable and executable at once.  Elsewhere the slab is mapped
+     once, readable, writable and executable, as exec blocks were.  The
+     slab header at the start of the page records the distance from the
+     executable mapping to the writable one.
+
+   * The word before each stub holds its size class, shifted left and
+     tagged with 1.  The other allocateExec() implementations keep an even
+     word there (a pointer, or a shifted size), so freeExec() can tell our
+     stubs apart, and find their slab, without a lookup.
+
+   * Each Capability caches a free list of stubs of each size, which only
+     the Task running on it touches, so making and freeing an adjustor
+     from Haskell code takes no lock.  The caches are refilled from, and
+     overflow into, global free lists protected by exec_slab_mutex, which
+     map new slabs when they run dry.  Free stubs are linked through their
+     first word, written through the writable mapping.
+
+   Slabs are never unmapped: freed stubs are reused for later adjustors.
+   If no slab can be mapped (an SELinux policy may forbid both kinds of
+   mapping, say) allocateExec() falls back to its old implementation.
+*/
+
+// Number of free stubs of each size a Capability may cache
+#define EXEC_SLAB_CACHE 64
+
+static const W_ exec_slab_sizes[EXEC_SLAB_CLASSES] = { 32, 64, 128 };
+
+typedef struct {
+    W_ writable_delta;  // writable mapping minus executable mapping
+} ExecSlab;
+
+// Global free lists of executable stub addresses
+static void *free_execs[EXEC_SLAB_CLASSES];
+static uint32_t n_free_execs[EXEC_SLAB_CLASSES];
+
+static bool exec_slabs_failed = false;
+static W_ exec_slab_page_size;
+
+#if defined(THREADED_RTS)
+static Mutex exec_slab_mutex;
+#endif
+
+#if defined(linux_HOST_OS) && defined(SYS_memfd_create)
+#define EXEC_SLAB_MEMFD 1
+static int exec_slab_fd = -1;
+static off_t exec_slab_fd_size = 0;
+#endif
+
+void
+initExecSlabs (void)
+{
+#if defined(THREADED_RTS)
+    initMutex(&exec_slab_mutex);
+#endif
+    exec_slab_page_size = getPageSize();
+}
+
+STATIC_INLINE AdjustorWritable
+writableStub (AdjustorExecutable exec)
+{
+    ExecSlab *slab =
+        (ExecSlab *)((W_)exec & ~(exec_slab_page_size - 1));
+    return (StgWord8 *)exec + slab->writable_delta;
+}
+
+STATIC_INLINE void
+pushFreeExec (void **list, AdjustorExecutable exec)
+{
+    *(void **)writableStub(exec) = *list;
+    *list = exec;
+}
+
+STATIC_INLINE AdjustorExecutable
+popFreeExec (void **list)
+{
+    AdjustorExecutable exec = *list;
+    *list = *(void **)exec;
+    return exec;
+}
+
+static bool
+mapExecSlab (StgWord8 **exec, StgWord8 **writable)
+{
+    W_ size = exec_slab_page_size;
+
+#if defined(EXEC_SLAB_MEMFD)
+    if (exec_slab_fd == -1) {
+        exec_slab_fd = syscall(SYS_memfd_create, "ghc-adjustors",
+                               1 /* MFD_CLOEXEC */);
+        if (exec_slab_fd == -1) {
+            return false;
+        }
+    }
+    if (ftruncate(exec_slab_fd, exec_slab_fd_size + size) != 0) {
+        return false;
+    }
+    *writable = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     exec_slab_fd, exec_slab_fd_size);
+    if (*writable == MAP_FAILED) {
+        return false;
+    }
+    *exec = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED,
+                 exec_slab_fd, exec_slab_fd_size);
+    if (*exec == MAP_FAILED) {
+        munmap(*writable, size);
+        return false;
+    }
+    exec_slab_fd_size += size;
+#else
+    *exec = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                 MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (*exec == MAP_FAILED) {
+        return false;
+    }
+    *writable = *exec;
+#endif
+    return true;
+}
+
+// Map a new slab of stubs of the given class and add them to the global
+// free list.  Must be called with exec_slab_mutex held.
+static bool
+newExecSlab (uint32_t c)
+{
+    StgWord8 *exec, *writable;
+    W_ slot = sizeof(W_) + exec_slab_sizes[c];
+    W_ off;
+
+    if (exec_slabs_failed) {
+        return false;
+    }
+    if (!mapExecSlab(&exec, &writable)) {
+        debugTrace(DEBUG_gc, "can't map an adjustor slab, falling back");
+        exec_slabs_failed = true;
+        return false;
+    }
+    debugTrace(DEBUG_gc, "allocate adjustor slab %p (class %d)", exec, c);
+
+    ((ExecSlab *)writable)->writable_delta = writable - exec;
+
+    for (off = ROUNDUP_BYTES_TO_WDS(sizeof(ExecSlab)) * sizeof(W_);
+         off + slot <= exec_slab_page_size; off += slot) {
+        *(W_ *)(writable + off) = ((W_)c << 1) | 1;
+        pushFreeExec(&free_execs[c], exec + off + sizeof(W_));
+        n_free_execs[c]++;
+    }
+    return true;
+}
+
+#if defined(THREADED_RTS)
+// The Capability held by the calling Task, whose caches it may use
+STATIC_INLINE Capability *
+myExecCap (void)
+{
+    Task *task = myTask();
+
+    if (task != NULL && task->cap != NULL && task->cap->running_task == task) {
+        return task->cap;
+    }
+    return NULL;
+}
+
+// Move half a cache's worth of stubs of class c between a Capability and
+// the global free list.
+static bool
+refillExecCache (Capability *cap, uint32_t c)
+{
+    ACQUIRE_LOCK(&exec_slab_mutex);
+    while (cap->n_free_execs[c] < EXEC_SLAB_CACHE / 2) {
+        if (n_free_execs[c] == 0 && !newExecSlab(c)) {
+            break;
+        }
+        pushFreeExec(&cap->free_execs[c], popFreeExec(&free_execs[c]));
+        n_free_execs[c]--;
+        cap->n_free_execs[c]++;
+    }
+    RELEASE_LOCK(&exec_slab_mutex);
+    return cap->n_free_execs[c] > 0;
+}
+
+static void
+flushExecCache (Capability *cap, uint32_t c)
+{
+    ACQUIRE_LOCK(&exec_slab_mutex);
+    while (cap->n_free_execs[c] > EXEC_SLAB_CACHE / 2) {
+        pushFreeExec(&free_execs[c], popFreeExec(&cap->free_execs[c]));
+        cap->n_free_execs[c]--;
+        n_free_execs[c]++;
+    }
+    RELEASE_LOCK(&exec_slab_mutex);
+}
+#endif
+
+AdjustorWritable
+allocateExecSlab (W_ bytes, AdjustorExecutable *exec_ret)
+{
+    AdjustorExecutable exec;
+    uint32_t c;
+
+    for (c = 0; c < EXEC_SLAB_CLASSES && exec_slab_sizes[c] < bytes; c++) {}
+    if (c == EXEC_SLAB_CLASSES) {
+        return NULL;
+    }
+
+#if defined(THREADED_RTS)
+    Capability *cap = myExecCap();
+    if (cap != NULL) {
+        if (cap->n_free_execs[c] == 0 && !refillExecCache(cap, c)) {
+            return NULL;
+        }
+        exec = popFreeExec(&cap->free_execs[c]);
+        cap->n_free_execs[c]--;
+        *exec_ret = exec;
+        return writableStub(exec);
+    }
+#endif
+
+    ACQUIRE_LOCK(&exec_slab_mutex);
+    if (n_free_execs[c] == 0 && !newExecSlab(c)) {
+        RELEASE_LOCK(&exec_slab_mutex);
+        return NULL;
+    }
+    exec = popFreeExec(&free_execs[c]);
+    n_free_execs[c]--;
+    RELEASE_LOCK(&exec_slab_mutex);
+
+    *exec_ret = exec;
+    return writableStub(exec);
+}
+
+bool
+freeExecSlab (AdjustorExecutable exec)
+{
+    W_ header = ((W_ *)exec)[-1];
+    uint32_t c;
+
+    if ((header & 1) == 0) {
+        return false;
+    }
+    c = header >> 1;
+    ASSERT(c < EXEC_SLAB_CLASSES);
+
+#if defined(THREADED_RTS)
+    Capability *cap = myExecCap();
+    if (cap != NULL) {
+        if (cap->n_free_execs[c] == EXEC_SLAB_CACHE) {
+            flushExecCache(cap, c);
+        }
+        pushFreeExec(&cap->free_execs[c], exec);
+        cap->n_free_execs[c]++;
+        return true;
+    }
+#endif
+
+    ACQUIRE_LOCK(&exec_slab_mutex);
+    pushFreeExec(&free_execs[c], exec);
+    n_free_execs[c]++;
+    RELEASE_LOCK(&exec_slab_mutex);
+    return true;
+}
+
+#endif /* USE_EXEC_SLABS */
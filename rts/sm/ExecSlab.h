@@ -0,0 +1,37 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2019
+ *
+ * Executable memory for adjustors, allocated in slabs of fixed-size stubs
+ *
+ * ---------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "BeginPrivate.h"
+
+// Windows has its own executable memory, and on iOS adjustors must come
+// from libffi's trampolines.
+#if !defined(mingw32_HOST_OS) && !defined(ios_HOST_OS)
+#define USE_EXEC_SLABS 1
+#endif
+
+#if defined(USE_EXEC_SLABS)
+
+// The largest stub allocateExecSlab() will hand out
+#define EXEC_SLAB_MAX_SIZE 128
+
+void initExecSlabs (void);
+
+// Returns the writable address of a new stub of at least the given size,
+// and its executable address in *exec_ret, or NULL if the stub is too big
+// or no slab can be mapped.
+AdjustorWritable allocateExecSlab (W_ bytes, AdjustorExecutable *exec_ret);
+
+// Frees a stub if it came from allocateExecSlab(), returning false if it
+// did not.
+bool freeExecSlab (AdjustorExecutable exec);
+
+#endif
+
+#include "EndPrivate.h"
@@ -141,6 +141,20 @@ uint32_t n_gc_threads;
 // For stats:
 static long copied;        // *words* copied & scavenged during this GC
 
+// The GC thread running GarbageCollect(), the capabilities that are not
+// taking part in *this* GC, and the task being run by runOnGcThreads().
+// runOnGcThreads() is called from outside GC.c, where the register
+// holding gct may have been reused (see GCTDecl.h), hence gc_main_thread.
+static uint32_t gc_main_thread;
+#if defined(THREADED_RTS)
+static bool *gc_idle_cap;
+static gc_task_fn gc_task;
+static void *gc_task_user;
+// Set once weak pointer processing has finished; until then the other
+// GC threads wait for more work in scavenge_until_all_done().
+static volatile bool gc_weak_done;
+#endif
+
 #if defined(PROF_SPIN) && defined(THREADED_RTS)
 // spin and yield counts for the quasi-SpinLock in waitForGcThreads
 volatile StgWord64 waitForGcThreads_spin = 0;
@@ -206,7 +220,8 @@ GarbageCollect (uint32_t collect_gen,
   generation *gen;
   StgWord live_blocks, live_words, par_max_copied, par_balanced_copied,
       gc_spin_spin, gc_spin_yield, mut_spin_spin, mut_spin_yield,
-      any_work, no_work, scav_find_work;
+      any_work, no_work, scav_find_work, scanned;
+  Time par_max_scavenge_elapsed;
 #if defined(THREADED_RTS)
   gc_thread *saved_gct;
 #endif
@@ -236,6 +251,11 @@ GarbageCollect (uint32_t collect_gen,
   // this is the main thread
   SET_GCT(gc_threads[cap->no]);
 
+  gc_main_thread = cap->no;
+#if defined(THREADED_RTS)
+  gc_idle_cap = idle_cap;
+#endif
+
   // tell the stats department that we've started a GC
   stat_startGC(cap, gct);
 
@@ -358,6 +378,9 @@ GarbageCollect (uint32_t collect_gen,
   // NB. do this after the mutable lists have been saved above, otherwise
   // the other GC threads will be writing into the old mutable lists.
   inc_running();
+#if defined(THREADED_RTS)
+  gc_weak_done = false;
+#endif
   wakeup_gc_threads(gct->thread_index, idle_cap);
 
   traceEventGcWork(gct->cap);
@@ -366,6 +389,7 @@ GarbageCollect (uint32_t collect_gen,
   // of markSomeCapabilities() because markSomeCapabilities() can only
   // call back into the GC via mark_root() (due to the gct register
   // variable).
+  stat_startGCPhase(gct);
   if (n_gc_threads == 1) {
       for (n = 0; n < n_capabilities; n++) {
 #if defined(THREADED_RTS)
@@ -384,8 +408,10 @@ GarbageCollect (uint32_t collect_gen,
           }
       }
   }
+  stat_endGCPhase(gct, GC_PHASE_MUT_LISTS);
 
   // follow roots from the CAF list (used by GHCi)
+  stat_startGCPhase(gct);
   gct->evac_gen_no = 0;
   markCAFs(mark_root, gct);
 
@@ -405,12 +431,15 @@ GarbageCollect (uint32_t collect_gen,
   // Mark the weak pointer list, and prepare to detect dead weak pointers.
   markWeakPtrList();
   initWeakForGC();
+  stat_endGCPhase(gct, GC_PHASE_ROOTS);
 
   // Mark the stable pointer table.
+  stat_startGCPhase(gct);
   markStablePtrTable(mark_root, gct);
 
   // Remember old stable name addresses.
   rememberOldStableNameAddresses ();
+  stat_endGCPhase(gct, GC_PHASE_STABLE_TABLES);
 
   /* -------------------------------------------------------------------------
    * Repeatedly scavenge all the areas we know about until there's no
@@ -419,26 +448,36 @@ GarbageCollect (uint32_t collect_gen,
   for (;;)
   {
       scavenge_until_all_done();
-      // The other threads are now stopped.  We might recurse back to
-      // here, but from now on this is the only thread.
+      // The other threads are now idle, waiting for work that
+      // traverseWeakPtrList() might evacuate; see Note [Weak key index]
+      // in MarkWeak.c.
 
       // must be last...  invariant is that everything is fully
       // scavenged at this point.
+      stat_startGCPhase(gct);
       if (traverseWeakPtrList()) { // returns true if evaced something
+          stat_endGCPhase(gct, GC_PHASE_WEAK);
           inc_running();
           continue;
       }
+      stat_endGCPhase(gct, GC_PHASE_WEAK);
 
       // If we get to here, there's really nothing left to do.
       break;
   }
+#if defined(THREADED_RTS)
+  gc_weak_done = true;
+#endif
 
   shutdown_gc_threads(gct->thread_index, idle_cap);
 
   // Now see which stable names are still alive.
+  stat_startGCPhase(gct);
   gcStableNameTable();
+  stat_endGCPhase(gct, GC_PHASE_STABLE_TABLES);
 
 #if defined(THREADED_RTS)
+  stat_startGCPhase(gct);
   if (n_gc_threads == 1) {
       for (n = 0; n < n_capabilities; n++) {
           pruneSparkQueue(capabilities[n]);
@@ -450,6 +489,7 @@ GarbageCollect (uint32_t collect_gen,
          }
       }
   }
+  stat_endGCPhase(gct, GC_PHASE_SPARKS);
 #endif
 
 #if defined(PROFILING)
@@ -467,14 +507,18 @@ GarbageCollect (uint32_t collect_gen,
 
   // Finally: compact or sweep the oldest generation.
   if (major_gc && oldest_gen->mark) {
+      stat_startGCPhase(gct);
       if (oldest_gen->compact)
           compact(gct->scavenged_static_objects);
       else
           sweep(oldest_gen);
+      stat_endGCPhase(gct, GC_PHASE_MARK_COMPACT);
   }
 
   copied = 0;
+  scanned = 0;
   par_max_copied = 0;
+  par_max_scavenge_elapsed = 0;
   par_balanced_copied = 0;
   gc_spin_spin = 0;
   gc_spin_yield = 0;
@@ -490,9 +534,16 @@ GarbageCollect (uint32_t collect_gen,
 
       for (i=0; i < n_gc_threads; i++) {
           copied += gc_threads[i]->copied;
+          scanned += gc_threads[i]->scanned;
       }
       for (i=0; i < n_gc_threads; i++) {
           thread = gc_threads[i];
+          traceEventGcThreadWork(thread->cap, thread->thread_index,
+                                 thread->copied * sizeof(W_),
+                                 thread->scanned * sizeof(W_),
+                                 thread->any_work, thread->no_work,
+                                 thread->scav_find_work,
+                                 thread->gc_phase_elapsed[GC_PHASE_SCAVENGE]);
           if (n_gc_threads > 1) {
               debugTrace(DEBUG_gc,"thread %d:", i);
               debugTrace(DEBUG_gc,"   copied           %ld",
@@ -518,6 +569,9 @@ GarbageCollect (uint32_t collect_gen,
               scav_find_work += thread->scav_find_work;
 
               par_max_copied = stg_max(gc_threads[i]->copied, par_max_copied);
+              par_max_scavenge_elapsed =
+                  stg_max(thread->gc_phase_elapsed[GC_PHASE_SCAVENGE],
+                          par_max_scavenge_elapsed);
               par_balanced_copied_acc +=
                   stg_min(n_gc_threads * gc_threads[i]->copied, copied);
           }
@@ -540,6 +594,7 @@ GarbageCollect (uint32_t collect_gen,
   live_words = 0;
   live_blocks = 0;
 
+  stat_startGCPhase(gct);
   for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
 
     if (g == N) {
@@ -706,6 +761,7 @@ GarbageCollect (uint32_t collect_gen,
         }
     }
   } // for all generations
+  stat_endGCPhase(gct, GC_PHASE_TIDY);
 
   // update the max size of older generations after a major GC
   resize_generations();
@@ -736,7 +792,9 @@ GarbageCollect (uint32_t collect_gen,
 #endif
 
   // Update the stable name hash table
-  updateStableNameTable(major_gc);
+  stat_startGCPhase(gct);
+  updateStableNameTable();
+  stat_endGCPhase(gct, GC_PHASE_STABLE_TABLES);
 
   // unlock the StablePtr table.  Must be before scheduleFinalizers(),
   // because a finalizer may call hs_free_fun_ptr() or
@@ -860,7 +918,8 @@ GarbageCollect (uint32_t collect_gen,
              live_blocks * BLOCK_SIZE_W - live_words /* slop */,
              N, n_gc_threads, par_max_copied, par_balanced_copied,
              gc_spin_spin, gc_spin_yield, mut_spin_spin, mut_spin_yield,
-             any_work, no_work, scav_find_work);
+             any_work, no_work, scav_find_work, scanned,
+             par_max_scavenge_elapsed);
 
 #if defined(RTS_USER_SIGNALS)
   if (RtsFlags.MiscFlags.install_signal_handlers) {
@@ -909,6 +968,9 @@ new_gc_thread (uint32_t n, gc_thread *t)
     t->thread_index = n;
     t->free_blocks = NULL;
     t->gc_count = 0;
+    t->weak_key_blocks = NULL;
+    t->n_weak_key_blocks = 0;
+    t->weak_key_blocks_size = 0;
 
     init_gc_thread(t);
 
@@ -993,6 +1055,7 @@ freeGcThreads (void)
             {
                 freeWSDeque(gc_threads[i]->gens[g].todo_q);
             }
+            stgFree (gc_threads[i]->weak_key_blocks);
             stgFree (gc_threads[i]);
         }
         stgFree (gc_threads);
@@ -1001,6 +1064,7 @@ freeGcThreads (void)
         {
             freeWSDeque(gc_threads[0]->gens[g].todo_q);
         }
+        stgFree (gc_threads[0]->weak_key_blocks);
         stgFree (gc_threads);
 #endif
         gc_threads = NULL;
@@ -1081,6 +1145,7 @@ scavenge_until_all_done (void)
 {
     DEBUG_ONLY( uint32_t r );
 
+    stat_startGCPhase(gct);
 
 loop:
 #if defined(THREADED_RTS)
@@ -1107,7 +1172,14 @@ loop:
 
     debugTrace(DEBUG_gc, "%d GC threads still running", r);
 
-    while (gc_running_threads != 0) {
+    // The main thread returns to process weak pointers once everything
+    // has been scavenged; the others stay to help scavenge whatever
+    // that evacuates, until it has finished.
+    while (gc_running_threads != 0
+#if defined(THREADED_RTS)
+           || (gct->thread_index != gc_main_thread && !gc_weak_done)
+#endif
+           ) {
         // usleep(1);
         if (any_work()) {
             inc_running();
@@ -1120,6 +1192,7 @@ loop:
         // scavenge_loop() to perform any pending work.
     }
 
+    stat_endGCPhase(gct, GC_PHASE_SCAVENGE);
     traceEventGcDone(gct->cap);
 }
 
@@ -1153,19 +1226,22 @@ gcWorkerThread (Capability *cap)
 
     // Every thread evacuates some roots.
     gct->evac_gen_no = 0;
+    stat_startGCPhase(gct);
     markCapability(mark_root, gct, cap, true/*prune sparks*/);
+    stat_endGCPhase(gct, GC_PHASE_ROOTS);
+    stat_startGCPhase(gct);
     scavenge_capability_mut_lists(cap);
+    stat_endGCPhase(gct, GC_PHASE_MUT_LISTS);
 
     scavenge_until_all_done();
 
 #if defined(THREADED_RTS)
-    // Now that the whole heap is marked, we discard any sparks that
-    // were found to be unreachable.  The main GC thread is currently
-    // marking heap reachable via weak pointers, so it is
-    // non-deterministic whether a spark will be retained if it is
-    // only reachable via weak pointers.  To fix this problem would
-    // require another GC barrier, which is too high a price.
+    // Now that the whole heap is marked, including the parts reachable
+    // via weak pointers, we discard any sparks that were found to be
+    // unreachable.
+    stat_startGCPhase(gct);
     pruneSparkQueue(cap);
+    stat_endGCPhase(gct, GC_PHASE_SPARKS);
 #endif
 
     // Wait until we're told to continue
@@ -1174,6 +1250,19 @@ gcWorkerThread (Capability *cap)
     debugTrace(DEBUG_gc, "GC thread %d waiting to continue...",
                gct->thread_index);
     ACQUIRE_SPIN_LOCK(&gct->mut_spin);
+
+    // We may be asked to help with some more work before continuing;
+    // see runOnGcThreads().
+    while (gct->wakeup == GC_THREAD_RUNNING_TASK) {
+        gc_task(gct->thread_index, gc_task_user);
+        RELEASE_SPIN_LOCK(&gct->mut_spin);
+        write_barrier();
+        gct->wakeup = GC_THREAD_TASK_DONE;
+        while (gct->wakeup == GC_THREAD_TASK_DONE) {
+            busy_wait_nop();
+        }
+        ACQUIRE_SPIN_LOCK(&gct->mut_spin);
+    }
     debugTrace(DEBUG_gc, "GC thread %d on my way...", gct->thread_index);
 
     SET_GCT(saved_gct);
@@ -1296,6 +1385,60 @@ shutdown_gc_threads (uint32_t me USED_IF_THREADS,
 #endif
 }
 
+/* -----------------------------------------------------------------------------
+   Run a task on all the GC threads
+
+   After a parallel GC the other GC threads wait in gcWorkerThread()
+   until releaseGCThreads() lets them go.  Work that has to be done
+   after the GC proper but before the mutator resumes (e.g. a heap
+   census) can use them in the meantime: runOnGcThreads() calls
+   task(thread_index, user) on every GC thread taking part in the
+   current GC, including the calling one, and returns when they have
+   all finished.  The task must divide the work between the threads
+   itself.
+
+   In a sequential GC, or the non-threaded RTS, the task just runs on
+   the calling thread.  Must be called from the thread running
+   GarbageCollect(), after the GC threads have been shut down.
+   -------------------------------------------------------------------------- */
+
+void
+runOnGcThreads (gc_task_fn task, void *user)
+{
+    const uint32_t me = gc_main_thread;
+#if defined(THREADED_RTS)
+    uint32_t i;
+
+    if (n_gc_threads > 1) {
+        gc_task = task;
+        gc_task_user = user;
+        for (i=0; i < n_gc_threads; i++) {
+            if (i == me || gc_idle_cap[i]) continue;
+            if (gc_threads[i]->wakeup != GC_THREAD_WAITING_TO_CONTINUE)
+                barf("runOnGcThreads");
+            gc_threads[i]->wakeup = GC_THREAD_RUNNING_TASK;
+            RELEASE_SPIN_LOCK(&gc_threads[i]->mut_spin);
+        }
+    }
+
+    task(me, user);
+
+    if (n_gc_threads > 1) {
+        for (i=0; i < n_gc_threads; i++) {
+            if (i == me || gc_idle_cap[i]) continue;
+            while (gc_threads[i]->wakeup != GC_THREAD_TASK_DONE) {
+                busy_wait_nop();
+                write_barrier();
+            }
+            ACQUIRE_SPIN_LOCK(&gc_threads[i]->mut_spin);
+            gc_threads[i]->wakeup = GC_THREAD_WAITING_TO_CONTINUE;
+        }
+    }
+#else
+    task(me, user);
+#endif
+}
+
 #if defined(THREADED_RTS)
 void
 releaseGCThreads (Capability *cap USED_IF_THREADS, bool idle_cap[])
@@ -1575,6 +1718,7 @@ init_gc_thread (gc_thread *t)
     t->any_work = 0;
     t->no_work = 0;
     t->scav_find_work = 0;
+    memset(t->gc_phase_elapsed, 0, sizeof(t->gc_phase_elapsed));
 }
 
 /* -----------------------------------------------------------------------------
@@ -23,6 +23,20 @@ void GarbageCollect (uint32_t force_major_gc,
 
 typedef void (*evac_fn)(void *user, StgClosure **root);
 
+/* The phases of a garbage collection that are timed separately.  See
+   Note [GC phase timing] in Stats.c. */
+typedef enum {
+    GC_PHASE_MUT_LISTS,         // scavenging the remembered sets
+    GC_PHASE_ROOTS,             // CAFs, capabilities, scheduler, weak list
+    GC_PHASE_STABLE_TABLES,     // the StablePtr and StableName tables
+    GC_PHASE_SCAVENGE,          // the copy loop
+    GC_PHASE_WEAK,              // traverseWeakPtrList()
+    GC_PHASE_SPARKS,            // pruning the spark pools
+    GC_PHASE_MARK_COMPACT,      // compacting or sweeping the old generation
+    GC_PHASE_TIDY,              // freeing from-space and dead large objects
+    N_GC_PHASES
+} GcPhase;
+
 StgClosure * isAlive      ( StgClosure *p );
 void         markCAFs     ( evac_fn evac, void *user );
 
@@ -60,6 +74,9 @@ void waitForGcThreads (Capability *cap, bool idle_cap[]);
 void releaseGCThreads (Capability *cap, bool idle_cap[]);
 #endif
 
+typedef void (*gc_task_fn)(uint32_t thread_index, void *user);
+void runOnGcThreads (gc_task_fn task, void *user);
+
 #define WORK_UNIT_WORDS 128
 
 #include "EndPrivate.h"
@@ -15,6 +15,7 @@
 
 #include "WSDeque.h"
 #include "GetTime.h" // for Ticks
+#include "GC.h" // for N_GC_PHASES
 
 #include "BeginPrivate.h"
 
@@ -121,6 +122,8 @@ typedef struct gen_workspace_ {
 #define GC_THREAD_STANDING_BY          1
 #define GC_THREAD_RUNNING              2
 #define GC_THREAD_WAITING_TO_CONTINUE  3
+#define GC_THREAD_RUNNING_TASK         4  // see runOnGcThreads()
+#define GC_THREAD_TASK_DONE            5
 
 typedef struct gc_thread_ {
     Capability *cap;
@@ -178,6 +181,12 @@ typedef struct gc_thread_ {
     W_ thunk_selector_depth;       // used to avoid unbounded recursion in
                                    // evacuate() for THUNK_SELECTOR
 
+    // Blocks holding weak keys that this thread has evacuated objects
+    // from; see Note [Weak key index] in MarkWeak.c.
+    bdescr **    weak_key_blocks;
+    uint32_t     n_weak_key_blocks;
+    uint32_t     weak_key_blocks_size;
+
     // -------------------
     // stats
 
@@ -192,6 +201,9 @@ typedef struct gc_thread_ {
     Time gc_start_elapsed;  // process elapsed time
     W_ gc_start_faults;
 
+    Time gc_phase_start;  // start of the current GC phase
+    Time gc_phase_elapsed[N_GC_PHASES]; // time spent in each phase
+
     // -------------------
     // workspaces
 
@@ -328,6 +328,81 @@ static void decommitMBlocks(char *addr, uint32_t n)
     }
 }
 
+// Take the address range [address, address+size) out of the free space,
+// without committing it.  Returns false if any of it is in use.
+static bool claimUncommittedMBlocks(W_ address, W_ size)
+{
+    struct free_list *iter, *new_iter;
+    W_ end = address + size;
+    W_ iter_end;
+
+    if ((address & MBLOCK_MASK) != 0 || end < address ||
+        address < mblock_address_space.begin ||
+        end > mblock_address_space.end)
+        return false;
+
+    if (address >= mblock_high_watermark) {
+        if (address > mblock_high_watermark) {
+            /* The space between the watermark and the range is free; no
+               free list entry ends at the watermark, so it's a new one */
+            for (iter = free_list_head; iter && iter->next; iter = iter->next);
+
+            new_iter = stgMallocBytes(sizeof(struct free_list), "claimMBlocksAt");
+            new_iter->address = mblock_high_watermark;
+            new_iter->size = address - mblock_high_watermark;
+            new_iter->next = NULL;
+            new_iter->prev = iter;
+            if (iter) {
+                iter->next = new_iter;
+            } else {
+                free_list_head = new_iter;
+            }
+        }
+        mblock_high_watermark = end;
+        return true;
+    }
+
+    for (iter = free_list_head; iter != NULL; iter = iter->next) {
+        if (iter->address <= address && end <= iter->address + iter->size)
+            break;
+    }
+    if (iter == NULL)
+        return false;
+
+    iter_end = iter->address + iter->size;
+    if (end < iter_end) {
+        new_iter = stgMallocBytes(sizeof(struct free_list), "claimMBlocksAt");
+        new_iter->address = end;
+        new_iter->size = iter_end - end;
+        new_iter->prev = iter;
+        new_iter->next = iter->next;
+        if (iter->next) {
+            iter->next->prev = new_iter;
+        }
+        iter->next = new_iter;
+    }
+
+    if (address > iter->address) {
+        iter->size = address - iter->address;
+    } else {
+        struct free_list *prev, *next;
+
+        prev = iter->prev;
+        next = iter->next;
+        if (prev == NULL) {
+            ASSERT(free_list_head == iter);
+            free_list_head = next;
+        } else {
+            prev->next = next;
+        }
+        if (next != NULL) {
+            next->prev = prev;
+        }
+        stgFree(iter);
+    }
+    return true;
+}
+
 void releaseFreeMemory(void)
 {
     // This function exists for releasing address space
@@ -587,6 +662,29 @@ getMBlocks(uint32_t n)
     return ret;
 }
 
+// Claim the 'n' mblocks at 'addr', if they are free, but do not commit
+// them: the caller maps something there itself.  Returns NULL if the
+// mblocks are in use, or if we can't tell (without a large address space).
+// See Note [Compact files] in CNF.c.
+void *
+claimMBlocksAt(void *addr STG_UNUSED, uint32_t n STG_UNUSED)
+{
+#if defined(USE_LARGE_ADDRESS_SPACE)
+    if (!claimUncommittedMBlocks((W_)addr, MBLOCK_SIZE * (W_)n)) {
+        return NULL;
+    }
+
+    debugTrace(DEBUG_gc, "claimed %d megablock(s) at %p",n,addr);
+
+    mblocks_allocated += n;
+    peak_mblocks_allocated = stg_max(peak_mblocks_allocated, mblocks_allocated);
+
+    return addr;
+#else
+    return NULL;
+#endif
+}
+
 void *
 getMBlocksOnNode(uint32_t node, uint32_t n)
 {
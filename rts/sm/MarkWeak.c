@@ -24,6 +24,8 @@
 #include "Weak.h"
 #include "Storage.h"
 #include "Threads.h"
+#include "Hash.h"
+#include "RtsUtils.h"
 
 #include "sm/GCUtils.h"
 #include "sm/MarkWeak.h"
@@ -71,6 +73,45 @@
 
    -------------------------------------------------------------------------- */
 
+/* -----------------------------------------------------------------------------
+   Note [Weak key index]
+   ~~~~~~~~~~~~~~~~~~~~~
+   Each round of traverseWeakPtrList() has to find the weak pointers whose
+   keys have become reachable since the last round.  Looking at every weak
+   pointer not yet known to be alive in each round is quadratic when weak
+   pointers keep each other's keys alive in a chain, and slow in a major
+   GC with many weak pointers whose keys are dying.
+
+   Instead, the first round looks at every weak pointer and files the
+   ones whose key is not alive in weak_key_index, a hash table from the
+   block descriptor of the key to the weak pointers with keys in that
+   block, chained through their link fields.  Those blocks get the
+   BF_WEAK_KEYS flag.  When evacuate() copies an object out of such a
+   block it clears the flag and records the block in the GC thread's
+   weak_key_blocks (see touchWeakKeyBlock()).  Later rounds only look
+   again at the weak pointers filed under the blocks recorded since, and
+   at those on weak_unindexed, whose keys are in large, compact or marked
+   blocks that evacuate() does not copy from.
+
+   Keys can also be copied without going through evacuate() (e.g. by
+   eval_thunk_selector()), and in a parallel GC one thread can copy an
+   object out of a block just as the main thread flags it.  So the
+   recorded blocks are only a hint: when a round finds no new live keys
+   from them, we look at every remaining weak pointer once more before
+   deciding that their keys are dead.  A round that finds no live keys
+   evacuates nothing, so no other thread can be copying while it runs,
+   and its answer is exact.
+
+   So a weak pointer is looked at in the first round, in the rounds after
+   an object has been copied out of its key's block, and in the final
+   check of each stage, rather than in every round.
+
+   In a parallel GC, the other GC threads stay in scavenge_until_all_done()
+   while the main thread processes weak pointers, and scavenge what it
+   evacuates alongside it, rather than leaving everything reachable from
+   weak pointers to the main thread.
+   -------------------------------------------------------------------------- */
+
 /* Which stage of processing various kinds of weak pointer are we at?
  * (see traverseWeakPtrList() below for discussion).
  */
@@ -83,8 +124,21 @@ StgWeak *dead_weak_ptr_list;
 // List of threads found to be unreachable
 StgTSO *resurrected_threads;
 
-static void    collectDeadWeakPtrs (generation *gen);
-static bool tidyWeakList (generation *gen);
+// Weak pointers whose keys are not known to be alive yet, by the block
+// holding the key, and those whose keys are in blocks that evacuate()
+// does not copy from.  See Note [Weak key index].
+static HashTable *weak_key_index;
+static StgWeak *weak_unindexed;
+
+// Have we looked at every weak pointer once in this GC yet?
+static bool weak_indexed;
+
+// Blocks recorded by the GC threads, gathered by tidyTouchedWeaks()
+static bdescr **weak_touched;
+static uint32_t weak_touched_size;
+
+static void    collectDeadWeakPtrs (void);
+static bool tidyWeakLists (void);
 static bool resurrectUnreachableThreads (generation *gen);
 static void    tidyThreadList (generation *gen);
 
@@ -102,12 +156,17 @@ initWeakForGC(void)
     weak_stage = WeakThreads;
     dead_weak_ptr_list = NULL;
     resurrected_threads = END_TSO_QUEUE;
+
+    weak_key_index = NULL;
+    weak_unindexed = NULL;
+    weak_indexed = false;
 }
 
 bool
 traverseWeakPtrList(void)
 {
   bool flag = false;
+  bool settled = false;
 
   switch (weak_stage) {
 
@@ -128,11 +187,7 @@ traverseWeakPtrList(void)
 
       // Use weak pointer relationships (value is reachable if
       // key is reachable):
-      for (g = 0; g <= N; g++) {
-          if (tidyWeakList(&generations[g])) {
-              flag = true;
-          }
-      }
+      flag = tidyWeakLists();
 
       // if we evacuated anything new, we must scavenge thoroughly
       // before we can determine which threads are unreachable.
@@ -153,20 +208,18 @@ traverseWeakPtrList(void)
       // before entering the WeakPtrs stage.
       if (flag) return true;
 
-      // otherwise, fall through...
+      // otherwise, fall through, with nothing changed since
+      // tidyWeakLists() found no new live keys.
+      settled = true;
   }
   /* fallthrough */
 
   case WeakPtrs:
   {
-      uint32_t g;
-
       // resurrecting threads might have made more weak pointers
       // alive, so traverse those lists again:
-      for (g = 0; g <= N; g++) {
-          if (tidyWeakList(&generations[g])) {
-              flag = true;
-          }
+      if (!settled) {
+          flag = tidyWeakLists();
       }
 
       /* If we didn't make any changes, then we can go round and kill all
@@ -174,9 +227,7 @@ traverseWeakPtrList(void)
        * of pending finalizers later on.
        */
       if (flag == false) {
-          for (g = 0; g <= N; g++) {
-              collectDeadWeakPtrs(&generations[g]);
-          }
+          collectDeadWeakPtrs();
 
           weak_stage = WeakDone;  // *now* we're done,
       }
@@ -190,10 +241,47 @@ traverseWeakPtrList(void)
   }
 }
 
-static void collectDeadWeakPtrs (generation *gen)
+// The GC threads taking part in this GC, which may have recorded blocks
+// in touchWeakKeyBlock()
+STATIC_INLINE gc_thread *
+weakGcThread (uint32_t i)
 {
-    StgWeak *w, *next_w;
-    for (w = gen->old_weak_ptr_list; w != NULL; w = next_w) {
+    return n_gc_threads == 1 ? gct : gc_threads[i];
+}
+
+static void
+collectWeakBlock (void *data, StgWord key, const void *value)
+{
+    StgWeak **dead = data;
+    StgWeak *w, *hd = (StgWeak *)value;
+
+    ((bdescr *)key)->flags &= ~BF_WEAK_KEYS;
+    for (w = hd; w->link != NULL; w = w->link) {}
+    w->link = *dead;
+    *dead = hd;
+}
+
+static void collectDeadWeakPtrs (void)
+{
+    StgWeak *w, *next_w, *dead;
+    uint32_t i;
+
+    dead = weak_unindexed;
+    if (weak_key_index != NULL) {
+        mapHashTable(weak_key_index, &dead, collectWeakBlock);
+        freeHashTable(weak_key_index, NULL);
+        weak_key_index = NULL;
+    }
+    weak_unindexed = NULL;
+
+    for (i = 0; i < n_gc_threads; i++) {
+        weakGcThread(i)->n_weak_key_blocks = 0;
+    }
+    stgFree(weak_touched);
+    weak_touched = NULL;
+    weak_touched_size = 0;
+
+    for (w = dead; w != NULL; w = next_w) {
         // If we have C finalizers, keep the value alive for this GC.
         // See Note [MallocPtr finalizers] in GHC.ForeignPtr, and #10904
         if (w->cfinalizers != &stg_NO_FINALIZER_closure) {
@@ -233,89 +321,239 @@ static bool resurrectUnreachableThreads (generation *gen)
     return flag;
 }
 
-static bool tidyWeakList(generation *gen)
+/* -----------------------------------------------------------------------------
+   Look at one weak pointer: if its key is alive, evacuate the rest of
+   it and move it to the weak pointer list of its generation, returning
+   true; otherwise file it under its key's block (see Note [Weak key
+   index]).
+   -------------------------------------------------------------------------- */
+
+static void indexWeak (StgWeak *w)
+{
+    bdescr *bd = Bdescr((P_)UNTAG_CLOSURE(w->key));
+    StgWeak *hd;
+
+    // dead keys are never in to-space
+    ASSERT((bd->flags & BF_EVACUATED) == 0);
+
+    if (bd->flags & (BF_LARGE | BF_COMPACT | BF_MARKED)) {
+        w->link = weak_unindexed;
+        weak_unindexed = w;
+        return;
+    }
+
+    if (weak_key_index == NULL) {
+        weak_key_index = allocHashTable();
+    }
+    hd = lookupHashTable(weak_key_index, (StgWord)bd);
+    if (hd != NULL) {
+        w->link = hd->link;
+        hd->link = w;
+    } else {
+        w->link = NULL;
+        insertHashTable(weak_key_index, (StgWord)bd, w);
+        bd->flags |= BF_WEAK_KEYS;
+    }
+}
+
+static bool tidyWeak (StgWeak *w)
 {
-    StgWeak *w, **last_w, *next_w;
     const StgInfoTable *info;
     StgClosure *new;
+
+    /* There might be a DEAD_WEAK on the list if finalizeWeak# was
+     * called on a live weak pointer object.  Just remove it.
+     */
+    if (w->header.info == &stg_DEAD_WEAK_info) {
+        return false;
+    }
+
+    info = get_itbl((StgClosure *)w);
+    if (info->type != WEAK) {
+        barf("tidyWeakList: not WEAK: %d, %p", info->type, w);
+    }
+
+    /* Now, check whether the key is reachable.
+     */
+    new = isAlive(w->key);
+    if (new == NULL) {
+        indexWeak(w);
+        return false;
+    }
+
+    generation *new_gen;
+
+    w->key = new;
+
+    // Find out which generation this weak ptr is in, and
+    // move it onto the weak ptr list of that generation.
+
+    new_gen = Bdescr((P_)w)->gen;
+    gct->evac_gen_no = new_gen->no;
+    gct->failed_to_evac = false;
+
+    // evacuate the fields of the weak ptr
+    scavengeLiveWeak(w);
+
+    if (gct->failed_to_evac) {
+        debugTrace(DEBUG_weak,
+                   "putting weak pointer %p into mutable list",
+                   w);
+        gct->failed_to_evac = false;
+        recordMutableGen_GC((StgClosure *)w, new_gen->no);
+    }
+
+    // and put it on the correct weak ptr list.
+    w->link = new_gen->weak_ptr_list;
+    new_gen->weak_ptr_list = w;
+
+    debugTrace(DEBUG_weak,
+               "weak pointer still alive at %p -> %p",
+               w, w->key);
+    return true;
+}
+
+static bool tidyWeakList (StgWeak *list)
+{
+    StgWeak *w, *next_w;
     bool flag = false;
-    last_w = &gen->old_weak_ptr_list;
-    for (w = gen->old_weak_ptr_list; w != NULL; w = next_w) {
-
-        /* There might be a DEAD_WEAK on the list if finalizeWeak# was
-         * called on a live weak pointer object.  Just remove it.
-         */
-        if (w->header.info == &stg_DEAD_WEAK_info) {
-            next_w = w->link;
-            *last_w = next_w;
-            continue;
+
+    for (w = list; w != NULL; w = next_w) {
+        next_w = w->link;
+        if (tidyWeak(w)) {
+            flag = true;
         }
+    }
+    return flag;
+}
 
-        info = get_itbl((StgClosure *)w);
-        switch (info->type) {
+// Look again at the weak pointers with keys in the given block
+static bool tidyWeakBlock (bdescr *bd)
+{
+    StgWeak *list;
 
-        case WEAK:
-            /* Now, check whether the key is reachable.
-             */
-            new = isAlive(w->key);
-            if (new != NULL) {
-                generation *new_gen;
+    list = removeHashTable(weak_key_index, (StgWord)bd, NULL);
+    if (list == NULL) {
+        return false;  // recorded twice
+    }
+    bd->flags &= ~BF_WEAK_KEYS;
+    return tidyWeakList(list);
+}
 
-                w->key = new;
+// Look again at the weak pointers whose keys might have been copied
+// since the last round.
+static bool tidyTouchedWeaks (void)
+{
+    StgWeak *list;
+    uint32_t i, j, n = 0;
+    bool flag = false;
 
-                // Find out which generation this weak ptr is in, and
-                // move it onto the weak ptr list of that generation.
+    // Gather the recorded blocks first: the other GC threads can record
+    // more while we evacuate below.
+    for (i = 0; i < n_gc_threads; i++) {
+        gc_thread *t = weakGcThread(i);
+        if (n + t->n_weak_key_blocks > weak_touched_size) {
+            weak_touched_size =
+                stg_max(2 * weak_touched_size, n + t->n_weak_key_blocks);
+            weak_touched =
+                stgReallocBytes(weak_touched,
+                                weak_touched_size * sizeof(bdescr *),
+                                "tidyTouchedWeaks");
+        }
+        for (j = 0; j < t->n_weak_key_blocks; j++) {
+            weak_touched[n++] = t->weak_key_blocks[j];
+        }
+        t->n_weak_key_blocks = 0;
+    }
 
-                new_gen = Bdescr((P_)w)->gen;
-                gct->evac_gen_no = new_gen->no;
-                gct->failed_to_evac = false;
+    if (weak_key_index != NULL) {
+        for (i = 0; i < n; i++) {
+            if (tidyWeakBlock(weak_touched[i])) {
+                flag = true;
+            }
+        }
+    }
 
-                // evacuate the fields of the weak ptr
-                scavengeLiveWeak(w);
+    list = weak_unindexed;
+    weak_unindexed = NULL;
+    if (tidyWeakList(list)) {
+        flag = true;
+    }
+    return flag;
+}
 
-                if (gct->failed_to_evac) {
-                    debugTrace(DEBUG_weak,
-                               "putting weak pointer %p into mutable list",
-                               w);
-                    gct->failed_to_evac = false;
-                    recordMutableGen_GC((StgClosure *)w, new_gen->no);
-                }
+// Look again at every weak pointer not known to be alive
+static bool tidyAllWeaks (void)
+{
+    StgWeak *list;
+    bool flag = false;
 
-                // remove this weak ptr from the old_weak_ptr list
-                *last_w = w->link;
-                next_w  = w->link;
+    if (weak_key_index != NULL) {
+        int i, n = keyCountHashTable(weak_key_index);
+        StgWord *blocks = stgMallocBytes(n * sizeof(StgWord), "tidyAllWeaks");
 
-                // and put it on the correct weak ptr list.
-                w->link = new_gen->weak_ptr_list;
-                new_gen->weak_ptr_list = w;
+        keysHashTable(weak_key_index, blocks, n);
+        for (i = 0; i < n; i++) {
+            if (tidyWeakBlock((bdescr *)blocks[i])) {
                 flag = true;
+            }
+        }
+        stgFree(blocks);
+    }
 
-                if (gen->no != new_gen->no) {
-                    debugTrace(DEBUG_weak,
-                      "moving weak pointer %p from %d to %d",
-                      w, gen->no, new_gen->no);
-                }
+    list = weak_unindexed;
+    weak_unindexed = NULL;
+    if (tidyWeakList(list)) {
+        flag = true;
+    }
+    return flag;
+}
 
+static bool tidyWeakLists (void)
+{
+    bool flag = false;
+    uint32_t g;
 
-                debugTrace(DEBUG_weak,
-                           "weak pointer still alive at %p -> %p",
-                           w, w->key);
-                continue;
-            }
-            else {
-                last_w = &(w->link);
-                next_w = w->link;
-                continue;
+    if (!weak_indexed) {
+        for (g = 0; g <= N; g++) {
+            generation *gen = &generations[g];
+            if (tidyWeakList(gen->old_weak_ptr_list)) {
+                flag = true;
             }
-
-        default:
-            barf("tidyWeakList: not WEAK: %d, %p", info->type, w);
+            gen->old_weak_ptr_list = NULL;
         }
+        weak_indexed = true;
+        return flag;
     }
 
+    flag = tidyTouchedWeaks();
+    if (!flag) {
+        // The recorded blocks are only a hint, see Note [Weak key index]
+        flag = tidyAllWeaks();
+    }
     return flag;
 }
 
+/* -----------------------------------------------------------------------------
+   Called by evacuate() when it copies an object out of a block flagged
+   with BF_WEAK_KEYS.  Two GC threads may both record the same block.
+   -------------------------------------------------------------------------- */
+
+void
+touchWeakKeyBlock (bdescr *bd)
+{
+    bd->flags &= ~BF_WEAK_KEYS;
+    if (gct->n_weak_key_blocks == gct->weak_key_blocks_size) {
+        gct->weak_key_blocks_size =
+            stg_max(64, 2 * gct->weak_key_blocks_size);
+        gct->weak_key_blocks =
+            stgReallocBytes(gct->weak_key_blocks,
+                            gct->weak_key_blocks_size * sizeof(bdescr *),
+                            "touchWeakKeyBlock");
+    }
+    gct->weak_key_blocks[gct->n_weak_key_blocks++] = bd;
+}
+
 static void tidyThreadList (generation *gen)
 {
     StgTSO *t, *tmp, *next, **prev;
@@ -24,5 +24,6 @@ void    initWeakForGC          ( void );
 bool    traverseWeakPtrList    ( void );
 void    markWeakPtrList        ( void );
 void    scavengeLiveWeak       ( StgWeak * );
+void    touchWeakKeyBlock      ( bdescr *bd );
 
 #include "EndPrivate.h"
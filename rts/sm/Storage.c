@@ -29,6 +29,7 @@
 #include "Trace.h"
 #include "GC.h"
 #include "Evac.h"
+#include "ExecSlab.h"
 #if defined(ios_HOST_OS)
 #include "Hash.h"
 #endif
@@ -194,6 +195,9 @@ initStorage (void)
   }
 
   exec_block = NULL;
+#if defined(USE_EXEC_SLABS)
+  initExecSlabs();
+#endif
 
 #if defined(THREADED_RTS)
   initSpinLock(&gc_alloc_block_sync);
@@ -1422,6 +1426,14 @@ void flushExec (W_ len, AdjustorExecutable exec_addr)
 AdjustorWritable allocateExec (W_ bytes, AdjustorExecutable *exec_ret)
 {
     void **ret, **exec;
+    // Small stubs come from slabs, see Note [Adjustor slabs] in ExecSlab.c
+    if (bytes <= EXEC_SLAB_MAX_SIZE) {
+        ret = allocateExecSlab(bytes, (AdjustorExecutable *)&exec);
+        if (ret != NULL) {
+            *exec_ret = exec;
+            return ret;
+        }
+    }
     ACQUIRE_SM_LOCK;
     ret = ffi_closure_alloc (sizeof(void *) + (size_t)bytes, (void**)&exec);
     RELEASE_SM_LOCK;
@@ -1435,6 +1447,10 @@ AdjustorWritable allocateExec (W_ bytes, AdjustorExecutable *exec_ret)
 void freeExec (AdjustorExecutable addr)
 {
     AdjustorWritable writable;
+    if (freeExecSlab(addr)) {
+        return;
+    }
+    // the header word is the (even) writable address, see allocateExec()
     writable = *((void**)addr - 1);
     ACQUIRE_SM_LOCK;
     ffi_closure_free (writable);
@@ -1495,6 +1511,16 @@ AdjustorWritable allocateExec (W_ bytes, AdjustorExecutable *exec_ret)
     void *ret;
     W_ n;
 
+#if defined(USE_EXEC_SLABS)
+    // Small stubs come from slabs, see Note [Adjustor slabs] in ExecSlab.c
+    if (bytes <= EXEC_SLAB_MAX_SIZE) {
+        ret = allocateExecSlab(bytes, exec_ret);
+        if (ret != NULL) {
+            return ret;
+        }
+    }
+#endif
+
     ACQUIRE_SM_LOCK;
 
     // round up to words.
@@ -1520,7 +1546,9 @@ AdjustorWritable allocateExec (W_ bytes, AdjustorExecutable *exec_ret)
         setExecutable(bd->start, bd->blocks * BLOCK_SIZE, true);
         exec_block = bd;
     }
-    *(exec_block->free) = n;  // store the size of this chunk
+    // store the size of this chunk, shifted so that the header is even
+    // and freeExec() can tell it from a slab stub's
+    *(exec_block->free) = n << 1;
     exec_block->gen_no += n;  // gen_no stores the number of words allocated
     ret = exec_block->free + 1;
     exec_block->free += n + 1;
@@ -1533,7 +1561,15 @@ AdjustorWritable allocateExec (W_ bytes, AdjustorExecutable *exec_ret)
 void freeExec (void *addr)
 {
     StgPtr p = (StgPtr)addr - 1;
-    bdescr *bd = Bdescr((StgPtr)p);
+    bdescr *bd;
+
+#if defined(USE_EXEC_SLABS)
+    if (freeExecSlab(addr)) {
+        return;
+    }
+#endif
+
+    bd = Bdescr((StgPtr)p);
 
     if ((bd->flags & BF_EXEC) == 0) {
         barf("freeExec: not executable");
@@ -1545,7 +1581,7 @@ void freeExec (void *addr)
 
     ACQUIRE_SM_LOCK;
 
-    bd->gen_no -= *(StgPtr)p;
+    bd->gen_no -= *(StgPtr)p >> 1;
     *(StgPtr)p = 0;
 
     if (bd->gen_no == 0) {
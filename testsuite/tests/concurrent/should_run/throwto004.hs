@@ -0,0 +1,18 @@
+import Control.Concurrent
+import Control.Monad
+import System.Timeout
+
+-- Many threads on different capabilities timing out at once, so that
+-- their throwTos are sent in batches.  Each timeout is thrown by a thread
+-- forked by the timer manager, which blocks in throwTo until the message
+-- has been sent, so the scheduler queues the messages of several of them
+-- on its outbox before sending them.
+main :: IO ()
+main = do
+  let n = 2000
+  done <- newEmptyMVar
+  forM_ [1..n] $ \i -> forkOn i $ do
+    r <- timeout 10000 (threadDelay 10000000)
+    putMVar done r
+  rs <- replicateM n (takeMVar done)
+  print (length (filter (== Nothing) rs))
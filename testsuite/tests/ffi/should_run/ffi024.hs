@@ -0,0 +1,38 @@
+-- Make and free many adjustors of different arities, from several threads
+-- at once, so that stubs are recycled through the per-capability caches.
+
+import Control.Concurrent
+import Control.Monad
+import Foreign.Ptr
+
+type F1 = Int -> IO Int
+type F4 = Int -> Int -> Int -> Int -> IO Int
+type F8 = Int -> Int -> Int -> Int -> Int -> Int -> Int -> Int -> IO Int
+
+foreign import ccall "wrapper" mk1 :: F1 -> IO (FunPtr F1)
+foreign import ccall "dynamic" call1 :: FunPtr F1 -> F1
+foreign import ccall "wrapper" mk4 :: F4 -> IO (FunPtr F4)
+foreign import ccall "dynamic" call4 :: FunPtr F4 -> F4
+foreign import ccall "wrapper" mk8 :: F8 -> IO (FunPtr F8)
+foreign import ccall "dynamic" call8 :: FunPtr F8 -> F8
+
+worker :: Int -> IO Int
+worker k = do
+  rs <- forM [1..2000] $ \i -> do
+    f1 <- mk1 (\a -> return (a + i))
+    f4 <- mk4 (\a b c d -> return (a + b + c + d + k))
+    f8 <- mk8 (\a b c d e f g h -> return (a + b + c + d + e + f + g + h))
+    r1 <- call1 f1 i
+    r4 <- call4 f4 1 2 3 4
+    r8 <- call8 f8 1 2 3 4 5 6 7 8
+    mapM_ freeHaskellFunPtr [castFunPtr f1, castFunPtr f4, castFunPtr f8]
+    return (r1 + r4 + r8)
+  return (sum rs)
+
+main :: IO ()
+main = do
+  vars <- forM [1..4] $ \k -> do
+    v <- newEmptyMVar
+    _ <- forkIO (worker k >>= putMVar v)
+    return v
+  mapM_ (takeMVar >=> print) vars
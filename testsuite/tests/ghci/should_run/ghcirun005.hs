@@ -0,0 +1,34 @@
+-- Exercises the interpreter's superinstructions, PUSH_L_ENTER (tail
+-- calls of locals) and PUSH_LL_PACK (building constructors), and serves
+-- as a bytecode benchmark for comparing dispatch strategies; see
+-- Note [Interpreter dispatch] in rts/Interpreter.c.
+
+data T = T Int Int Int
+
+main :: IO ()
+main = do
+  let n = 200000 :: Int
+  print (sumPairs (pairs n))
+  print (sumT (triples n))
+  print (apply n (\k -> k + 1) 0)
+
+pairs :: Int -> [(Int, Int)]
+pairs n = go 0
+  where go i | i >= n    = []
+             | otherwise = let p = (i, n - i) in p : go (i + 1)
+
+sumPairs :: [(Int, Int)] -> Int
+sumPairs = go 0
+  where go acc []            = acc
+        go acc ((a, b) : ps) = let acc' = acc + (a `mod` 7 * b `mod` 7) `mod` 7
+                               in acc' `seq` go acc' ps
+
+triples :: Int -> [T]
+triples n = [ T (i `mod` 5) (i `mod` 7) (i `mod` 3) | i <- [1 .. n] ]
+
+sumT :: [T] -> Int
+sumT ts = foldr (\(T a b c) k acc -> k $! acc + a - b + c) id ts 0
+
+apply :: Int -> (Int -> Int) -> Int -> Int
+apply 0 _ x = x
+apply k f x = let y = f x in y `seq` apply (k - 1) f y
@@ -0,0 +1,25 @@
+-- The call of f in 'call' has an inline cache in the interpreter
+-- (Note [Interpreter inline caches] in rts/Interpreter.c).  Calling it
+-- with functions of different kinds and arities in turn checks that a
+-- stale cache entry always falls back to the generic apply path.
+
+import Data.List (foldl')
+
+add3 :: Int -> Int -> Int -> Int
+add3 a b c = a + b + c
+{-# NOINLINE add3 #-}
+
+call :: (Int -> Int -> Int) -> Int -> Int
+call f x = f x (x + 1)
+{-# NOINLINE call #-}
+
+fns :: [Int -> Int -> Int]
+fns = [ (+)                             -- saturated
+      , add3 10                         -- a PAP
+      , \a -> \b -> a * b               -- arity 1, returns a function
+      , \a -> let g = add3 a in g 1     -- a PAP built at each call
+      , max ]
+
+main :: IO ()
+main = print (foldl' step 0 [1 .. 50000])
+  where step acc i = acc + call (fns !! (i `mod` length fns)) (i `mod` 100)
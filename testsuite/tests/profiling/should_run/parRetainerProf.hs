@@ -0,0 +1,17 @@
+import Control.Concurrent.MVar
+import Control.Monad
+import qualified Data.Map as Map
+
+-- Build a heap that is reachable from many roots (several MVars and the
+-- main thread) so that the parallel retainer traversal has to share work,
+-- and check that profiling it does not change the result.
+main :: IO ()
+main = do
+  let m = Map.fromList [ (i, show i) | i <- [1 .. 100000 :: Int] ]
+  vars <- forM [1 .. 16 :: Int] $ \k ->
+    newMVar (Map.filterWithKey (\i _ -> i `mod` k == 0) m)
+  forM_ [1 .. 5 :: Int] $ \_ ->
+    forM_ vars $ \v -> modifyMVar_ v (return . Map.map reverse)
+  sizes <- mapM (fmap Map.size . readMVar) vars
+  print (sum sizes)
+  print (Map.foldr (\s n -> n + length s) 0 m)
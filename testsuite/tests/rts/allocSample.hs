@@ -0,0 +1,9 @@
+-- Run a recursive, allocating loop with allocation sampling enabled, and
+-- check that stopping to take samples doesn't disturb the program.
+
+main :: IO ()
+main = print (go 0 (10000000 :: Int))
+  where
+    go :: Integer -> Int -> Integer
+    go acc 0 = acc
+    go acc n = go (acc + fromIntegral n) (n - 1)
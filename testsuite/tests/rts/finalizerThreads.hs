@@ -0,0 +1,28 @@
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import Foreign.ForeignPtr
+import Foreign.Marshal.Alloc
+import System.Mem
+
+main :: IO ()
+main = do
+  -- C finalizers, run on the finalizer threads
+  forM_ [1..100000::Int] $ \_ -> do
+    p <- mallocBytes 16
+    _ <- newForeignPtr finalizerFree p
+    return ()
+  performMajorGC
+
+  -- Haskell finalizers, shared out between several threads
+  count <- newIORef (0::Int)
+  forM_ [1..10000::Int] $ \i -> do
+    r <- newIORef i
+    _ <- mkWeakIORef r (atomicModifyIORef' count (\n -> (n+1, ())))
+    return ()
+  performMajorGC
+  let wait = do
+        n <- readIORef count
+        when (n < 10000) $ threadDelay 1000 >> wait
+  wait
+  print =<< readIORef count
@@ -0,0 +1,27 @@
+-- Check that the per-phase GC timings reported in GCDetails are sane:
+-- non-negative, and together no longer than the GC itself.
+
+import Control.Monad
+import Data.IORef
+import GHC.Stats
+import System.Mem
+
+main :: IO ()
+main = do
+  ref <- newIORef []
+  forM_ [1 .. 100000 :: Int] $ \i -> modifyIORef' ref (i :)
+  performMajorGC
+  d <- gc <$> getRTSStats
+  let phases = [ gcdetails_mut_lists_elapsed_ns d
+               , gcdetails_roots_elapsed_ns d
+               , gcdetails_stable_tables_elapsed_ns d
+               , gcdetails_scavenge_elapsed_ns d
+               , gcdetails_weak_elapsed_ns d
+               , gcdetails_sparks_elapsed_ns d
+               , gcdetails_mark_compact_elapsed_ns d
+               , gcdetails_tidy_elapsed_ns d
+               ]
+  print (all (>= 0) phases)
+  print (sum phases <= gcdetails_elapsed_ns d)
+  print (gcdetails_scanned_bytes d > 0)
+  readIORef ref >>= print . length
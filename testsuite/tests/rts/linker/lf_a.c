@@ -0,0 +1,33 @@
+extern int lf_b(void);
+extern int getNumberOfProcessors(void);
+
+int lf_a_init = 0;
+int lf_a_data = 2;
+const int lf_a_table[4] = { 10, 20, 30, 40 };
+
+__attribute__((constructor)) static void lf_a_ctor(void)
+{
+    lf_a_init = 40;
+}
+
+int lf_a(void)
+{
+    return lf_a_init + lf_b();
+}
+
+int lf_a_table_sum(void)
+{
+    return lf_a_table[0] + lf_a_table[1] + lf_a_table[2] + lf_a_table[3]
+        + lf_a_data;
+}
+
+// never called, so in --linker-lazy mode its section stays unrelocated
+int lf_a_unused(void)
+{
+    return lf_b() + 7;
+}
+
+int lf_a_rts(void)
+{
+    return getNumberOfProcessors() > 0;
+}
@@ -0,0 +1 @@
+int lf_b(void) { return 2; }
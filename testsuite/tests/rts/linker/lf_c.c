@@ -0,0 +1 @@
+int lf_c(void) { return 3; }
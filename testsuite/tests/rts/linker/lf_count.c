@@ -0,0 +1,9 @@
+// lf_counter is in a writable section of its own, and lf_count's text and
+// the string in lf_count_name are in executable and read-only ones.
+int lf_counter = 100;
+const char lf_count_name[] = "lf_count";
+
+int lf_count(void)
+{
+    return ++lf_counter + (lf_count_name[0] == 'l' ? 0 : 1000);
+}
@@ -0,0 +1,3 @@
+extern int lf_c(void);
+
+int lf_d(void) { return lf_c() * 10; }
@@ -0,0 +1 @@
+int lf_e(void) { return 5; }
@@ -0,0 +1 @@
+int lf_f(void) { return 6; }
@@ -0,0 +1 @@
+int lf_g(void) { return 7; }
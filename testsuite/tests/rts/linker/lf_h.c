@@ -0,0 +1 @@
+int lf_h(void) { return 8; }
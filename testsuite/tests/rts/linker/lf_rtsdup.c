@@ -0,0 +1,5 @@
+// A strong definition of an RTS symbol: loading this must fail.
+int getNumberOfProcessors(void)
+{
+    return -1;
+}
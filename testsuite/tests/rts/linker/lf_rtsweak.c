@@ -0,0 +1,10 @@
+// A weak definition of an RTS symbol, which must not replace the RTS's.
+__attribute__((weak)) int getNumberOfProcessors(void)
+{
+    return -1;
+}
+
+int lf_rtsweak(void)
+{
+    return getNumberOfProcessors() > 0;
+}
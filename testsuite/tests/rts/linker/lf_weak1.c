@@ -0,0 +1 @@
+__attribute__((weak)) int lf_weak(void) { return 1; }
@@ -0,0 +1,127 @@
+#include "ghcconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "Rts.h"
+
+// Drives the RTS linker from a script given on the command line, so that
+// the same loads, lookups and unloads can be run under different linker
+// flags (passed with +RTS ... -RTS).  Each command prints what it did:
+//
+//   obj <file>       loadObj
+//   par <n> <file>.. loadObj each of the n files on a thread of its own
+//   ar <file>        loadArchive
+//   resolve          resolveObjs
+//   call <sym>       look up <sym> as an int (void) function and call it
+//   lookup <sym>     look up <sym>
+//   unload <file>    unloadObj
+//   gc               performMajorGC
+//   status <file>    getObjectLoadStatus
+
+typedef int testfun(void);
+
+static const char *status_names[] = {
+    "loaded", "needed", "resolved", "unloaded", "don't resolve", "not loaded"
+};
+
+static void *lookup (const char *sym)
+{
+    char lbl[256];
+#if LEADING_UNDERSCORE
+    snprintf(lbl, sizeof(lbl), "_%s", sym);
+#else
+    snprintf(lbl, sizeof(lbl), "%s", sym);
+#endif
+    return lookupSymbol(lbl);
+}
+
+static const char *ok (HsInt r)
+{
+    return r ? "ok" : "failed";
+}
+
+#define MAX_PAR 16
+
+typedef struct {
+    pthread_t thread;
+    char *path;
+    HsInt r;
+} ParLoad;
+
+static void *parLoad (void *arg)
+{
+    ParLoad *p = arg;
+    p->r = loadObj((pathchar *)p->path);
+    return NULL;
+}
+
+int main (int argc, char *argv[])
+{
+    int i;
+
+    RtsConfig conf = defaultRtsConfig;
+    conf.rts_opts_enabled = RtsOptsAll;
+    hs_init_ghc(&argc, &argv, conf);
+
+    initLinker_(0);
+
+    for (i = 1; i < argc; i++) {
+        const char *cmd = argv[i];
+        const char *arg = i + 1 < argc ? argv[i+1] : "";
+
+        if (!strcmp(cmd, "obj")) {
+            printf("obj %s: %s\n", arg, ok(loadObj((pathchar *)arg)));
+            i++;
+        } else if (!strcmp(cmd, "par")) {
+            ParLoad par[MAX_PAR];
+            int j, n = atoi(arg);
+            if (n > MAX_PAR || i + 1 + n >= argc) {
+                errorBelch("linker_flags: bad par command");
+                exit(1);
+            }
+            for (j = 0; j < n; j++) {
+                par[j].path = argv[i + 2 + j];
+                pthread_create(&par[j].thread, NULL, parLoad, &par[j]);
+            }
+            for (j = 0; j < n; j++) {
+                pthread_join(par[j].thread, NULL);
+                printf("obj %s: %s\n", par[j].path, ok(par[j].r));
+            }
+            i += 1 + n;
+        } else if (!strcmp(cmd, "ar")) {
+            printf("ar %s: %s\n", arg, ok(loadArchive((pathchar *)arg)));
+            i++;
+        } else if (!strcmp(cmd, "resolve")) {
+            printf("resolve: %s\n", ok(resolveObjs()));
+        } else if (!strcmp(cmd, "call")) {
+            testfun *f = lookup(arg);
+            if (f == NULL) {
+                printf("call %s: not found\n", arg);
+            } else {
+                printf("call %s: %d\n", arg, f());
+            }
+            i++;
+        } else if (!strcmp(cmd, "lookup")) {
+            printf("lookup %s: %s\n", arg,
+                   lookup(arg) != NULL ? "found" : "not found");
+            i++;
+        } else if (!strcmp(cmd, "unload")) {
+            printf("unload %s: %s\n", arg, ok(unloadObj((pathchar *)arg)));
+            i++;
+        } else if (!strcmp(cmd, "gc")) {
+            performMajorGC();
+        } else if (!strcmp(cmd, "status")) {
+            printf("status %s: %s\n", arg,
+                   status_names[getObjectLoadStatus((pathchar *)arg)]);
+            i++;
+        } else {
+            errorBelch("linker_flags: unknown command %s", cmd);
+            exit(1);
+        }
+        fflush(stdout);
+    }
+
+    hs_exit();
+    return 0;
+}
@@ -0,0 +1,10 @@
+-- Take heap censuses (+RTS -hT) after parallel GCs, which spreads the
+-- census over the GC threads, while building up a large live heap.
+
+import qualified Data.Map as M
+
+main :: IO ()
+main = do
+  let m = M.fromList [ (i, show i) | i <- [1 .. 200000 :: Int] ]
+  print (M.size m)
+  print (sum (map length (M.elems m)))
@@ -0,0 +1,25 @@
+import Control.Concurrent
+import Control.Monad
+import System.Mem
+import System.Mem.StableName
+
+-- Make StableNames for the same objects from several threads at once,
+-- with GCs in between, and check that they all agree.
+
+main :: IO ()
+main = do
+  let xs = [ Just i | i <- [1 .. 100000 :: Int] ]
+  sum [ i | Just i <- xs ] `seq` return ()
+  mine <- mapM makeStableName xs
+  results <- forM [1 .. 4 :: Int] $ \t -> do
+    r <- newEmptyMVar
+    _ <- forkIO $ do
+      ns <- forM (if even t then xs else reverse xs) makeStableName
+      when (t == 1) performGC
+      putMVar r (if even t then ns else reverse ns)
+    return r
+  theirs <- mapM takeMVar results
+  performMajorGC
+  again <- mapM makeStableName xs
+  print (all (== mine) theirs, again == mine)
+  print (length (filter id (zipWith eqStableName mine (tail mine))))
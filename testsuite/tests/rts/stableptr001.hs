@@ -0,0 +1,25 @@
+-- Make, dereference and free StablePtrs from several Capabilities at
+-- once, while the table is being enlarged and GC'd.
+
+import Control.Concurrent
+import Control.Monad
+import Foreign.StablePtr
+import System.Mem
+
+worker :: Int -> IO Bool
+worker t = do
+  oks <- forM [1 .. 10 :: Int] $ \r -> do
+    sps <- forM [1 .. 20000] $ \i -> newStablePtr (t * 1000000 + r * 100000 + i)
+    when (r == t) performGC
+    vs <- mapM deRefStablePtr sps
+    mapM_ freeStablePtr sps
+    return (vs == [ t * 1000000 + r * 100000 + i | i <- [1 .. 20000] ])
+  return (and oks)
+
+main :: IO ()
+main = do
+  rs <- forM [1 .. 4] $ \t -> do
+    r <- newEmptyMVar
+    _ <- forkOn t (worker t >>= putMVar r)
+    return r
+  mapM takeMVar rs >>= print . and
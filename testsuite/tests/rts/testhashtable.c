@@ -0,0 +1,253 @@
+#include "Rts.h"
+#include "Hash.h"
+#include <stdio.h>
+#include <string.h>
+
+// Exercises the RTS hash table: insertions, hits, misses, removals
+// (including churn that leaves the number of keys unchanged), string keys
+// and duplicate keys.  The same phases are run on the chained table the
+// RTS used before (testhashtable_chained.c), and given an argument the
+// test reports the timings of each phase for both, which makes it usable
+// as a comparative microbenchmark.
+
+#define N 200000
+
+typedef struct chainedtable ChainedTable;
+ChainedTable *allocChainedTable (bool str);
+void insertChainedTable (ChainedTable *table, StgWord key, const void *data);
+void *lookupChainedTable (ChainedTable *table, StgWord key);
+void *removeChainedTable (ChainedTable *table, StgWord key, const void *data);
+int keyCountChainedTable (ChainedTable *table);
+void freeChainedTable (ChainedTable *table);
+
+// The operations the benchmark phases use, for either table
+typedef struct {
+    const char *name;
+    void *(*alloc)(bool str);
+    void (*insert)(void *table, StgWord key, const void *data);
+    void *(*lookup)(void *table, StgWord key);
+    void *(*remove)(void *table, StgWord key, const void *data);
+    int (*count)(void *table);
+    void (*free)(void *table);
+} TableOps;
+
+static void *rtsAlloc(bool str)
+{ return str ? allocStrHashTable() : allocHashTable(); }
+static void rtsInsert(void *t, StgWord key, const void *data)
+{ insertHashTable(t, key, data); }
+static void *rtsLookup(void *t, StgWord key)
+{ return lookupHashTable(t, key); }
+static void *rtsRemove(void *t, StgWord key, const void *data)
+{ return removeHashTable(t, key, data); }
+static int rtsCount(void *t)
+{ return keyCountHashTable(t); }
+static void rtsFree(void *t)
+{ freeHashTable(t, NULL); }
+
+static void *chainedAlloc(bool str)
+{ return allocChainedTable(str); }
+static void chainedInsert(void *t, StgWord key, const void *data)
+{ insertChainedTable(t, key, data); }
+static void *chainedLookup(void *t, StgWord key)
+{ return lookupChainedTable(t, key); }
+static void *chainedRemove(void *t, StgWord key, const void *data)
+{ return removeChainedTable(t, key, data); }
+static int chainedCount(void *t)
+{ return keyCountChainedTable(t); }
+static void chainedFree(void *t)
+{ freeChainedTable(t); }
+
+static const TableOps tables[] = {
+    { "rts",     rtsAlloc, rtsInsert, rtsLookup, rtsRemove,
+                 rtsCount, rtsFree },
+    { "chained", chainedAlloc, chainedInsert, chainedLookup, chainedRemove,
+                 chainedCount, chainedFree },
+};
+#define N_TABLES (sizeof(tables) / sizeof(tables[0]))
+
+#define N_PHASES 8
+static const char *phases[N_PHASES] = {
+    "word insert", "word lookup", "word miss", "word churn",
+    "str insert", "str lookup", "str remove", "small tables"
+};
+static double times[N_TABLES][N_PHASES];
+
+static StgWord keys[N];
+static char strs[N][40];
+static bool timing = false;
+static Time t0;
+
+static void start(void)
+{
+    t0 = getProcessElapsedTime();
+}
+
+static void stop(uint32_t t, uint32_t phase)
+{
+    times[t][phase] =
+        (double)TimeToUS(getProcessElapsedTime() - t0) / 1e6;
+}
+
+static void check(bool ok, const char *what, long i)
+{
+    if (!ok) {
+        printf("FAIL: %s (%ld)\n", what, i);
+        exit(1);
+    }
+}
+
+static void run(uint32_t t)
+{
+    const TableOps *ops = &tables[t];
+    void *h;
+    long i, r;
+
+    for (i = 0; i < N; i++) {
+        keys[i] = 0x10000000 + (StgWord)i * 24;
+    }
+
+    h = ops->alloc(false);
+    start();
+    for (i = 0; i < N; i++) {
+        ops->insert(h, keys[i], (void *)(i + 1));
+    }
+    stop(t, 0);
+    check(ops->count(h) == N, "word count", 0);
+
+    start();
+    for (r = 0; r < 5; r++) {
+        for (i = 0; i < N; i++) {
+            long j = (i * 7919) % N;
+            check(ops->lookup(h, keys[j]) == (void *)(j + 1),
+                  "word lookup", j);
+        }
+    }
+    stop(t, 1);
+
+    start();
+    for (r = 0; r < 5; r++) {
+        for (i = 0; i < N; i++) {
+            check(ops->lookup(h, keys[i] + 8) == NULL, "word miss", i);
+        }
+    }
+    stop(t, 2);
+
+    start();
+    for (r = 0; r < 5; r++) {
+        for (i = 0; i < N; i++) {
+            void *d = ops->remove(h, keys[i], NULL);
+            check(d == (void *)(i + 1), "word remove", i);
+            keys[i] += (StgWord)N * 24;
+            ops->insert(h, keys[i], d);
+        }
+    }
+    stop(t, 3);
+    check(ops->count(h) == N, "word churn count", 0);
+    for (i = 0; i < N; i++) {
+        check(ops->lookup(h, keys[i]) == (void *)(i + 1),
+              "word lookup after churn", i);
+    }
+    ops->free(h);
+
+    h = ops->alloc(true);
+    start();
+    for (i = 0; i < N; i++) {
+        ops->insert(h, (StgWord)strs[i], (void *)(i + 1));
+    }
+    stop(t, 4);
+
+    start();
+    for (r = 0; r < 3; r++) {
+        for (i = 0; i < N; i++) {
+            long j = (i * 7919) % N;
+            // look up a copy, so that the strings are really compared
+            char key[40];
+            strcpy(key, strs[j]);
+            check(ops->lookup(h, (StgWord)key) == (void *)(j + 1),
+                  "str lookup", j);
+        }
+    }
+    stop(t, 5);
+
+    start();
+    for (i = 0; i < N; i += 2) {
+        ops->remove(h, (StgWord)strs[i], NULL);
+    }
+    stop(t, 6);
+    for (i = 0; i < N; i++) {
+        check(ops->lookup(h, (StgWord)strs[i]) ==
+                  ((i & 1) ? (void *)(i + 1) : NULL),
+              "str lookup after remove", i);
+    }
+    check(ops->count(h) == N / 2, "str count", 0);
+    ops->free(h);
+
+    // many small, short-lived tables, as made by e.g. the heap census
+    start();
+    for (r = 0; r < 10000; r++) {
+        h = ops->alloc(false);
+        for (i = 0; i < 50; i++) {
+            ops->insert(h, 0x10000000 + i * 8, (void *)(i + 1));
+        }
+        for (i = 0; i < 50; i++) {
+            check(ops->lookup(h, 0x10000000 + i * 8) == (void *)(i + 1),
+                  "small lookup", i);
+        }
+        ops->free(h);
+    }
+    stop(t, 7);
+}
+
+int main(int argc, char *argv[])
+{
+    HashTable *h;
+    uint32_t t, p;
+    long i;
+
+    hs_init(&argc, &argv);
+    timing = argc > 1;
+
+    for (i = 0; i < N; i++) {
+        sprintf(strs[i], "base_GHCziBase_sym%ld_closure", (i * 7919) % N);
+    }
+
+    for (t = 0; t < N_TABLES; t++) {
+        run(t);
+    }
+
+    // keysHashTable
+    h = allocStrHashTable();
+    for (i = 0; i < N; i++) {
+        insertStrHashTable(h, strs[i], (void *)(i + 1));
+    }
+    check(keysHashTable(h, keys, N) == N, "str keys", 0);
+    freeHashTable(h, NULL);
+
+    // duplicate keys: removal with data removes that entry only
+    h = allocHashTable();
+    insertHashTable(h, 8, (void *)1);
+    insertHashTable(h, 8, (void *)2);
+    check(keyCountHashTable(h) == 2, "dup count", 0);
+    check(removeHashTable(h, 8, (void *)1) == (void *)1, "dup remove", 0);
+    check(lookupHashTable(h, 8) == (void *)2, "dup lookup", 0);
+    freeHashTable(h, NULL);
+
+    if (timing) {
+        printf("%-14s", "");
+        for (t = 0; t < N_TABLES; t++) {
+            printf(" %9s", tables[t].name);
+        }
+        printf("\n");
+        for (p = 0; p < N_PHASES; p++) {
+            printf("%-14s", phases[p]);
+            for (t = 0; t < N_TABLES; t++) {
+                printf(" %8.3fs", times[t][p]);
+            }
+            printf("\n");
+        }
+    }
+
+    printf("ok\n");
+    hs_exit();
+    return 0;
+}
@@ -0,0 +1,289 @@
+#include "Rts.h"
+#include "Hash.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The linearly-hashed table of chained buckets that rts/Hash.c used
+// before it became an open-addressing table, kept as the baseline that
+// testhashtable measures the RTS table against.  Only the operations the
+// benchmark uses are here.  Strings are hashed with the RTS's hashStr,
+// which the old table used too, so only the table structure differs.
+
+typedef struct chainedtable ChainedTable;
+
+ChainedTable *allocChainedTable (bool str);
+void insertChainedTable (ChainedTable *table, StgWord key, const void *data);
+void *lookupChainedTable (ChainedTable *table, StgWord key);
+void *removeChainedTable (ChainedTable *table, StgWord key, const void *data);
+int keyCountChainedTable (ChainedTable *table);
+void freeChainedTable (ChainedTable *table);
+
+#define HSEGSIZE    1024    /* Size of a single hash table segment */
+                            /* Also the minimum size of a hash table */
+#define HDIRSIZE    1024    /* Size of the segment directory */
+                            /* Maximum hash table size is HSEGSIZE * HDIRSIZE */
+#define HLOAD       5       /* Maximum average load of a single hash bucket */
+
+#define HCHUNK      (1024 * sizeof(W_) / sizeof(HashList))
+                            /* Number of HashList cells to allocate in one go */
+
+/* Linked list of (key, data) pairs for separate chaining */
+typedef struct hashlist {
+    StgWord key;
+    const void *data;
+    struct hashlist *next;  /* Next cell in bucket chain (same hash value) */
+} HashList;
+
+typedef struct chunklist {
+  HashList *chunk;
+  struct chunklist *next;
+} HashListChunk;
+
+struct chainedtable {
+    int split;              /* Next bucket to split when expanding */
+    int max;                /* Max bucket of smaller table */
+    int mask1;              /* Mask for doing the mod of h_1 (smaller table) */
+    int mask2;              /* Mask for doing the mod of h_2 (larger table) */
+    int kcount;             /* Number of keys */
+    int bcount;             /* Number of buckets */
+    HashList **dir[HDIRSIZE];   /* Directory of segments */
+    HashList *freeList;         /* free list of HashLists */
+    HashListChunk *chunks;
+    bool str;                   /* string keys? */
+};
+
+/* -----------------------------------------------------------------------------
+ * Hash first using the smaller table.  If the bucket is less than the
+ * next bucket to be split, re-hash using the larger table.
+ * -------------------------------------------------------------------------- */
+
+static int
+hash(const ChainedTable *table, StgWord key)
+{
+    StgWord h;
+    int bucket;
+
+    if (table->str) {
+        h = hashStr(NULL, key);
+    } else {
+        /* Strip the boring zero bits */
+        h = key / sizeof(StgWord);
+    }
+
+    /* Mod the size of the hash table (a power of 2) */
+    bucket = h & table->mask1;
+
+    if (bucket < table->split) {
+        /* Mod the size of the expanded hash table (also a power of 2) */
+        bucket = h & table->mask2;
+    }
+    return bucket;
+}
+
+static int
+compare(const ChainedTable *table, StgWord key1, StgWord key2)
+{
+    if (table->str) {
+        return (strcmp((char *)key1, (char *)key2) == 0);
+    }
+    return (key1 == key2);
+}
+
+/* -----------------------------------------------------------------------------
+ * Expand the larger hash table by one bucket, and split one bucket
+ * from the smaller table into two parts.  Only the bucket referenced
+ * by @table->split@ is affected by the expansion.
+ * -------------------------------------------------------------------------- */
+
+static void
+expand(ChainedTable *table)
+{
+    int oldsegment;
+    int oldindex;
+    int newbucket;
+    int newsegment;
+    int newindex;
+    HashList *hl;
+    HashList *next;
+    HashList *old, *new;
+
+    if (table->split + table->max >= HDIRSIZE * HSEGSIZE)
+        /* Wow!  That's big.  Too big, so don't expand. */
+        return;
+
+    /* Calculate indices of bucket to split */
+    oldsegment = table->split / HSEGSIZE;
+    oldindex = table->split % HSEGSIZE;
+
+    newbucket = table->max + table->split;
+
+    /* And the indices of the new bucket */
+    newsegment = newbucket / HSEGSIZE;
+    newindex = newbucket % HSEGSIZE;
+
+    if (newindex == 0)
+        table->dir[newsegment] = malloc(HSEGSIZE * sizeof(HashList *));
+
+    if (++table->split == table->max) {
+        table->split = 0;
+        table->max *= 2;
+        table->mask1 = table->mask2;
+        table->mask2 = table->mask2 << 1 | 1;
+    }
+    table->bcount++;
+
+    /* Split the bucket, paying no attention to the original order */
+
+    old = new = NULL;
+    for (hl = table->dir[oldsegment][oldindex]; hl != NULL; hl = next) {
+        next = hl->next;
+        if (hash(table, hl->key) == newbucket) {
+            hl->next = new;
+            new = hl;
+        } else {
+            hl->next = old;
+            old = hl;
+        }
+    }
+    table->dir[oldsegment][oldindex] = old;
+    table->dir[newsegment][newindex] = new;
+}
+
+void *
+lookupChainedTable(ChainedTable *table, StgWord key)
+{
+    int bucket;
+    HashList *hl;
+
+    bucket = hash(table, key);
+    for (hl = table->dir[bucket / HSEGSIZE][bucket % HSEGSIZE];
+         hl != NULL; hl = hl->next) {
+        if (compare(table, hl->key, key))
+            return (void *) hl->data;
+    }
+
+    /* It's not there */
+    return NULL;
+}
+
+/* -----------------------------------------------------------------------------
+ * We allocate the hashlist cells in large chunks to cut down on malloc
+ * overhead.
+ * -------------------------------------------------------------------------- */
+
+static HashList *
+allocHashList (ChainedTable *table)
+{
+    HashList *hl, *p;
+    HashListChunk *cl;
+
+    if ((hl = table->freeList) != NULL) {
+        table->freeList = hl->next;
+    } else {
+        hl = malloc(HCHUNK * sizeof(HashList));
+        cl = malloc(sizeof (*cl));
+        cl->chunk = hl;
+        cl->next = table->chunks;
+        table->chunks = cl;
+
+        table->freeList = hl + 1;
+        for (p = table->freeList; p < hl + HCHUNK - 1; p++)
+            p->next = p + 1;
+        p->next = NULL;
+    }
+    return hl;
+}
+
+void
+insertChainedTable(ChainedTable *table, StgWord key, const void *data)
+{
+    int bucket;
+    HashList *hl;
+
+    /* When the average load gets too high, we expand the table */
+    if (++table->kcount >= HLOAD * table->bcount)
+        expand(table);
+
+    bucket = hash(table, key);
+
+    hl = allocHashList(table);
+
+    hl->key = key;
+    hl->data = data;
+    hl->next = table->dir[bucket / HSEGSIZE][bucket % HSEGSIZE];
+    table->dir[bucket / HSEGSIZE][bucket % HSEGSIZE] = hl;
+}
+
+void *
+removeChainedTable(ChainedTable *table, StgWord key, const void *data)
+{
+    int bucket;
+    HashList **prev;
+    HashList *hl;
+
+    bucket = hash(table, key);
+    prev = &table->dir[bucket / HSEGSIZE][bucket % HSEGSIZE];
+
+    for (hl = *prev; hl != NULL; prev = &hl->next, hl = hl->next) {
+        if (compare(table, hl->key, key) && (data == NULL || hl->data == data)) {
+            *prev = hl->next;
+            hl->next = table->freeList;
+            table->freeList = hl;
+            table->kcount--;
+            return (void *) hl->data;
+        }
+    }
+
+    /* It's not there */
+    return NULL;
+}
+
+void
+freeChainedTable(ChainedTable *table)
+{
+    long segment;
+    HashListChunk *cl, *cl_next;
+
+    /* The last bucket with something in it is table->max + table->split - 1 */
+    for (segment = (table->max + table->split - 1) / HSEGSIZE;
+         segment >= 0; segment--) {
+        free(table->dir[segment]);
+    }
+    for (cl = table->chunks; cl != NULL; cl = cl_next) {
+        cl_next = cl->next;
+        free(cl->chunk);
+        free(cl);
+    }
+    free(table);
+}
+
+ChainedTable *
+allocChainedTable(bool str)
+{
+    ChainedTable *table;
+    HashList **hb;
+
+    table = malloc(sizeof(ChainedTable));
+    table->dir[0] = malloc(HSEGSIZE * sizeof(HashList *));
+
+    for (hb = table->dir[0]; hb < table->dir[0] + HSEGSIZE; hb++)
+        *hb = NULL;
+
+    table->split = 0;
+    table->max = HSEGSIZE;
+    table->mask1 = HSEGSIZE - 1;
+    table->mask2 = 2 * HSEGSIZE - 1;
+    table->kcount = 0;
+    table->bcount = HSEGSIZE;
+    table->freeList = NULL;
+    table->chunks = NULL;
+    table->str = str;
+
+    return table;
+}
+
+int
+keyCountChainedTable (ChainedTable *table)
+{
+    return table->kcount;
+}
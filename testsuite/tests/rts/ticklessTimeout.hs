@@ -0,0 +1,15 @@
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import System.Timeout
+
+-- A thread that never blocks keeps the only Capability busy, so that the
+-- timer manager, returning from its safe foreign call, has to wait for
+-- it to be preempted before it can fire the timeout.  With +RTS
+-- --tickless the ticker must keep running while it waits.
+main :: IO ()
+main = do
+  ref <- newIORef (0 :: Int)
+  _ <- forkIO $ forever $ modifyIORef' ref (+1)
+  r <- timeout 100000 (threadDelay 10000000)
+  print r
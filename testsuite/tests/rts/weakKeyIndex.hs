@@ -0,0 +1,93 @@
+{-# LANGUAGE MagicHash, UnboxedTuples #-}
+
+-- Weak pointers whose keys are only kept alive by other weak pointers,
+-- and weak pointers with dead, large and static keys, across GCs.
+-- See Note [Weak key index] in rts/sm/MarkWeak.c.
+
+import Control.Monad
+import Data.Array.Base (unsafeRead)
+import Data.Array.IO
+import Data.Maybe
+import GHC.Arr (STArray(..))
+import GHC.Base
+import GHC.IOArray (IOArray(..))
+import GHC.IORef (IORef(..))
+import GHC.STRef (STRef(..))
+import GHC.Weak
+import System.Mem
+
+-- A key is either a small mutable variable or an array big enough to be
+-- a large object; the weak pointer is on the underlying MutVar# or
+-- MutableArray#, so that it does not depend on the box.
+data Key = Small (IORef Int) | Big (IOArray Int Int)
+
+newKey :: Int -> IO Key
+newKey i
+  | i `mod` 8 == 0 = Big <$> newArray (0, 2000) i
+  | otherwise      = Small <$> newIORef i
+
+keyValue :: Key -> IO Int
+keyValue (Small r) = readIORef r
+keyValue (Big a)   = unsafeRead a 2000
+
+mkWeakKey :: Key -> v -> IO (Weak v)
+mkWeakKey (Small (IORef (STRef r#))) v = IO $ \s ->
+  case mkWeakNoFinalizer# r# v s of (# s1, w #) -> (# s1, Weak w #)
+mkWeakKey (Big (IOArray (STArray _ _ _ a#))) v = IO $ \s ->
+  case mkWeakNoFinalizer# a# v s of (# s1, w #) -> (# s1, Weak w #)
+
+staticKey :: Int
+staticKey = 42
+{-# NOINLINE staticKey #-}
+
+chainLength :: Int
+chainLength = 20000
+
+-- The weak pointers in the chain are made in a scrambled order, so that
+-- consecutive keys of the chain are not next to each other in the heap.
+scramble :: Int -> Int
+scramble i = (i * 7919) `mod` chainLength
+
+-- The key of link i is only reachable as the value of the weak pointer
+-- on the key of link i-1; the first key is returned to keep the chain
+-- alive.
+mkChain :: IO (Key, [Weak Key])
+mkChain = do
+  keys <- mapM (newKey . scramble) [0 .. chainLength - 1]
+  ws <- forM (zip keys (tail keys)) $ \(k, next) -> mkWeakKey k next
+  return (head keys, ws)
+
+checkChain :: [Weak Key] -> IO ()
+checkChain ws = forM_ (zip [1 ..] ws) $ \(i, w) -> do
+  mk <- deRefWeak w
+  case mk of
+    Nothing -> error ("chain broken at " ++ show (i :: Int))
+    Just k -> do
+      v <- keyValue k
+      when (v /= scramble i) $ error ("wrong key at " ++ show i)
+
+main :: IO ()
+main = do
+  (root, chain) <- mkChain
+  dead <- forM [1 .. 5000] $ \i -> do
+    k <- newKey i
+    mkWeakKey k i
+  live <- forM [1 .. 500] $ \i -> do
+    k <- newKey (i * 8)
+    w <- mkWeakKey k i
+    return (k, w)
+  staticWeak <- mkWeak staticKey "static" Nothing
+
+  forM_ [1 .. 3 :: Int] $ \_ -> do
+    performMinorGC
+    performMajorGC
+    checkChain chain
+
+  deadLeft <- length . filter isJust <$> mapM deRefWeak dead
+  print deadLeft
+  liveLeft <- length . filter isJust <$> mapM (deRefWeak . snd) live
+  print liveLeft
+  print =<< deRefWeak staticWeak
+
+  mapM_ (keyValue . fst) live
+  print =<< keyValue root